@@ -0,0 +1,672 @@
+/*
+ * bb_rx.c
+ *
+ *  Baseband uplink receiver and recorder
+ *
+ *  Messages are received once, without copying, into the buffers of a lock-free
+ *  broadcast ring that every consumer thread reads at its own pace: the writer,
+ *  any number of forwarders and the spectrum monitor. The writer drains its
+ *  ring into an aligned staging buffer and writes it out in large chunks with
+ *  O_DIRECT (buffered I/O where the file system does not support it).
+ *  Forwarders republish the
+ *  messages to local subscribers, e.g. a demodulator, handing the received
+ *  buffer to ZMQ instead of copying it. A consumer that can not keep up loses
+ *  whole messages of its own stream, counted, while the receiver and the other
+ *  consumers carry on. The optional cf32 conversion and decimation stage runs
+ *  in the writer thread, the spectrum monitor in a thread of its own.
+ */
+
+#define _GNU_SOURCE
+
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "log.h"
+#include "ctrl.h"
+#include "bcast_ring.h"
+#include "dsp.h"
+#include "spectrum.h"
+#include "bb_rx.h"
+#include "metrics.h"
+
+#define BB_ALIGN        4096            //O_DIRECT buffer, offset and length alignment
+#define BB_CHUNK        (4<<20)         //bytes per write
+#define BB_RCVBUF       (8<<20)
+#define BB_FWD_HOLD     256             //messages a forwarder leaves with ZMQ before it copies instead
+
+struct writer_t
+{
+    pthread_t thread;
+    struct bcast_consumer_t* ring;
+    int fd;                     //-1 - discard
+    uint8_t direct;
+    uint8_t* buf;               //staging buffer, BB_ALIGN aligned
+    size_t fill;
+    atomic_int done;            //set by the receiver, drain and exit
+    uint64_t written;
+    int err;
+    struct dsp_chain_t* dsp;    //NULL - raw samples
+    float* out;                 //conversion output
+    size_t out_cap;             //complex samples
+};
+
+//a received buffer handed to ZMQ for sending
+struct fwd_hold_t
+{
+    struct bcast_buf_t* buf;
+    atomic_int busy;            //cleared once ZMQ let go of it
+};
+
+struct forwarder_t
+{
+    pthread_t thread;
+    struct bcast_consumer_t* ring;
+    char endpoint[136];
+    void* sock;
+    atomic_int done;
+    struct fwd_hold_t hold[BB_FWD_HOLD];
+    uint32_t next;              //hold entry to try first
+    uint64_t copied;            //sent as a copy, all hold entries being in use
+};
+
+struct monitor_t
+{
+    pthread_t thread;
+    struct bcast_consumer_t* ring;
+    struct spectrum_t spec;
+    double interval;            //ms between reports
+    double t0;                  //ms, start of the run
+    atomic_int done;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static int write_all(struct writer_t* w, const uint8_t* data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t ret = write(w->fd, data, len);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            //O_DIRECT accepted at open time but not by the file system
+            if(errno == EINVAL && w->direct)
+            {
+                fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+                w->direct = 0;
+                continue;
+            }
+
+            w->err = errno;
+            return -1;
+        }
+
+        data += ret;
+        len -= ret;
+        w->written += ret;
+    }
+
+    return 0;
+}
+
+//write out the staging buffer, a partial one only at the very end
+static int flush_staging(struct writer_t* w, uint8_t last)
+{
+    size_t aligned = w->fill & ~(size_t)(BB_ALIGN-1);
+
+    if(w->fd < 0 || w->err)
+    {
+        w->fill = 0;
+        return -1;
+    }
+
+    if(!last || aligned == w->fill)
+    {
+        int ret = write_all(w, w->buf, w->fill);
+        w->fill = 0;
+        return ret;
+    }
+
+    //unaligned tail, finish the file with buffered I/O
+    if(aligned > 0 && write_all(w, w->buf, aligned) < 0)
+        return -1;
+    if(w->direct)
+    {
+        fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+        w->direct = 0;
+    }
+
+    int ret = write_all(w, w->buf + aligned, w->fill - aligned);
+    w->fill = 0;
+    return ret;
+}
+
+//copy into the staging buffer, writing it out whenever it fills up
+static void stage(struct writer_t* w, const void* src, size_t len)
+{
+    const uint8_t* data = src;
+
+    if(w->fd < 0)
+        return;
+
+    while(len > 0)
+    {
+        size_t n = (len < BB_CHUNK - w->fill) ? len : BB_CHUNK - w->fill;
+
+        memcpy(w->buf + w->fill, data, n);
+        w->fill += n;
+        data += n;
+        len -= n;
+        if(w->fill == BB_CHUNK)
+            flush_staging(w, 0);
+    }
+}
+
+static void* writer(void* arg)
+{
+    struct writer_t* w = arg;
+    const struct timespec idle = {0, 100000};
+
+    for(;;)
+    {
+        zmq_msg_t* msg = bcast_peek(w->ring);
+
+        if(msg == NULL)
+        {
+            if(atomic_load(&w->done) && bcast_peek(w->ring) == NULL)
+                break;
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        if(w->dsp != NULL)
+        {
+            size_t n = zmq_msg_size(msg) / BB_SAMPLE_SIZE; //a partial trailing sample is dropped
+
+            if(n/w->dsp->decim + 1 > w->out_cap)
+            {
+                float* out = realloc(w->out, 2*(n/w->dsp->decim + 1)*sizeof(float));
+                if(out != NULL)
+                {
+                    w->out = out;
+                    w->out_cap = n/w->dsp->decim + 1;
+                }
+            }
+
+            if(n/w->dsp->decim + 1 <= w->out_cap)
+                stage(w, w->out, 2*sizeof(float)*dsp_process(w->dsp, zmq_msg_data(msg), n, w->out));
+        }
+        else
+            stage(w, zmq_msg_data(msg), zmq_msg_size(msg));
+
+        bcast_release(w->ring);
+    }
+
+    flush_staging(w, 1);
+    return NULL;
+}
+
+//ZMQ is done sending a held buffer, called from its I/O thread
+static void forward_sent(void* data, void* hint)
+{
+    struct fwd_hold_t* h = hint;
+
+    (void)data;
+    bcast_put(h->buf);
+    atomic_store_explicit(&h->busy, 0, memory_order_release);
+}
+
+static struct fwd_hold_t* get_hold(struct forwarder_t* f)
+{
+    for(uint32_t i=0; i<BB_FWD_HOLD; i++)
+    {
+        struct fwd_hold_t* h = &f->hold[f->next];
+
+        f->next = (f->next + 1) % BB_FWD_HOLD;
+        if(!atomic_load_explicit(&h->busy, memory_order_acquire))
+            return h;
+    }
+
+    return NULL;
+}
+
+static void* forwarder(void* arg)
+{
+    struct forwarder_t* f = arg;
+    const struct timespec idle = {0, 100000};
+
+    for(;;)
+    {
+        zmq_msg_t* msg = bcast_peek(f->ring);
+
+        if(msg == NULL)
+        {
+            if(atomic_load(&f->done) && bcast_peek(f->ring) == NULL)
+                break;
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        //pass the received buffer on as it is, copy only when too many are still queued in ZMQ
+        zmq_msg_t out;
+        struct fwd_hold_t* h = get_hold(f);
+
+        if(h != NULL)
+        {
+            h->buf = bcast_hold(f->ring);
+            atomic_store_explicit(&h->busy, 1, memory_order_relaxed);
+            zmq_msg_init_data(&out, zmq_msg_data(msg), zmq_msg_size(msg), forward_sent, h);
+        }
+        else
+        {
+            zmq_msg_init_size(&out, zmq_msg_size(msg));
+            memcpy(zmq_msg_data(&out), zmq_msg_data(msg), zmq_msg_size(msg));
+            f->copied++;
+        }
+
+        //PUB never blocks, subscribers that are behind lose messages inside ZMQ
+        if(zmq_msg_send(&out, f->sock, ZMQ_DONTWAIT) < 0)
+            zmq_msg_close(&out);
+
+        bcast_release(f->ring);
+    }
+
+    return NULL;
+}
+
+static void* monitor(void* arg)
+{
+    struct monitor_t* m = arg;
+    const struct timespec idle = {0, 100000};
+    double t_report = m->t0 + m->interval;
+
+    for(;;)
+    {
+        zmq_msg_t* msg = bcast_peek(m->ring);
+        double now = now_ms();
+
+        if(now >= t_report)
+        {
+            spectrum_report(&m->spec, (now - m->t0)/1e3);
+            t_report += m->interval;
+        }
+
+        if(msg == NULL)
+        {
+            if(atomic_load(&m->done) && bcast_peek(m->ring) == NULL)
+                break;
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        spectrum_feed(&m->spec, zmq_msg_data(msg), zmq_msg_size(msg) / BB_SAMPLE_SIZE);
+        bcast_release(m->ring);
+    }
+
+    if(m->spec.frames > 0)
+        spectrum_report(&m->spec, (now_ms() - m->t0)/1e3);
+
+    return NULL;
+}
+
+static int open_recording(struct writer_t* w, const char* path)
+{
+    w->fd = -1;
+    if(path == NULL)
+        return 0;
+
+    if(posix_memalign((void**)&w->buf, BB_ALIGN, BB_CHUNK) != 0)
+        return -1;
+
+    w->direct = 1;
+    w->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_DIRECT, 0644);
+    if(w->fd < 0 && errno == EINVAL) //e.g. tmpfs
+    {
+        w->direct = 0;
+        w->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    }
+
+    return (w->fd < 0) ? -1 : 0;
+}
+
+//SigMF metadata next to the data file
+static int write_sigmf_meta(const char* path, const struct bb_rx_opts_t* opts, const char* endpoint)
+{
+    FILE* fp = fopen(path, "w");
+    char datetime[32];
+    time_t now = time(NULL);
+
+    if(fp == NULL)
+        return -1;
+
+    strftime(datetime, sizeof(datetime), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(fp, "{\n    \"global\": {\n");
+    fprintf(fp, "        \"core:datatype\": \"%s\",\n", opts->decim ? "cf32_le" : "ci16_le");
+    if(opts->rate > 0)
+        fprintf(fp, "        \"core:sample_rate\": %.17g,\n", opts->rate / (opts->decim ? opts->decim : 1));
+    fprintf(fp, "        \"core:version\": \"1.0.0\",\n");
+    fprintf(fp, "        \"core:recorder\": \"cari-ctrl\",\n");
+    fprintf(fp, "        \"core:description\": \"CARI RX baseband from %s\"\n", endpoint);
+    fprintf(fp, "    },\n    \"captures\": [\n        {\n");
+    fprintf(fp, "            \"core:sample_start\": 0,\n");
+    if(opts->freq > 0)
+        fprintf(fp, "            \"core:frequency\": %lu,\n", opts->freq);
+    fprintf(fp, "            \"core:datetime\": \"%s\"\n", datetime);
+    fprintf(fp, "        }\n    ],\n    \"annotations\": []\n}\n");
+
+    return fclose(fp);
+}
+
+//messages lost by all consumers so far
+static uint64_t bcast_dropped(const struct bcast_t* b)
+{
+    uint64_t n = 0;
+
+    for(uint8_t i=0; i<b->n; i++)
+        n += b->cons[i]->dropped;
+    return n;
+}
+
+//rate is the last interval's in MS/s, negative for the final summary
+//the stream is not a device, the records carry none; endpoints can be longer than LOG_STR
+static void print_stats(double secs, double rate, uint64_t bytes, uint64_t frames, const struct bcast_t* b, const struct forwarder_t* fwd, uint8_t nfwd)
+{
+    LOG(0, "%.1f s: ", secs);
+    if(rate >= 0)
+        LOG(0, "%.3f MS/s, ", rate);
+    LOG(0, "%.3f MS/s average, %lu message(s)", secs > 0 ? bytes/BB_SAMPLE_SIZE/secs/1e6 : 0, frames);
+
+    //ring high-water mark and losses of every consumer, the writer first
+    for(uint8_t i=0; i<b->n; i++)
+    {
+        const struct bcast_consumer_t* c = b->cons[i];
+
+        if(i == 0)
+            LOG(0, ", ring high-water ");
+        else if(i <= nfwd)
+            dbg_print(0, "; %s ", fwd[i-1].endpoint);
+        else
+            LOG(0, "; spectrum ");
+        LOG(0, "%u/%u, ", c->high, spsc_capacity(&c->ring));
+        if(c->dropped)
+            LOG(TERM_YELLOW, "%lu dropped", c->dropped);
+        else
+            LOG(TERM_GREEN, "%lu dropped", c->dropped);
+    }
+    dbg_print(0, "\n"); //not dropped, the next line must not run into this one
+}
+
+static void close_forwarders(struct forwarder_t* fwd, uint8_t n)
+{
+    for(uint8_t i=0; i<n; i++)
+        zmq_close(fwd[i].sock);
+
+    //ZMQ lets go of the buffers still queued asynchronously
+    for(uint8_t i=0; i<n; i++)
+    {
+        for(uint32_t j=0; j<BB_FWD_HOLD; j++)
+        {
+            for(int k=0; k<1000 && atomic_load(&fwd[i].hold[j].busy); k++)
+                usleep(1000);
+        }
+    }
+}
+
+int bb_rx_run(void* zmq_ctx, const struct bb_rx_opts_t* opts)
+{
+    struct bcast_t bcast;
+    struct writer_t w = {0};
+    struct forwarder_t* fwd = NULL;
+    struct monitor_t mon = {0};
+    uint8_t spec = (opts->spectrum.interval > 0);
+    struct dsp_chain_t dsp;
+    char endpoint[136];
+    char data_path[512], meta_path[512];
+    const char* path = opts->path;
+    int rcvbuf = BB_RCVBUF;
+    int hwm = opts->ring;
+    int linger = 0;
+    int ret = 1;
+
+    ctrl_make_addr(endpoint, sizeof(endpoint), opts->endpoint);
+
+    if(opts->decim > 0)
+    {
+        if(dsp_init(&dsp, opts->decim, opts->kernel) != 0)
+        {
+            dbg_print(TERM_RED, "The %s kernel is not supported by this CPU\n", dsp_kernel_name(opts->kernel));
+            return 1;
+        }
+        w.dsp = &dsp;
+    }
+
+    //base name, with or without the SigMF extensions
+    if(path != NULL && opts->sigmf)
+    {
+        int len = strlen(path);
+        const char* ext[] = {".sigmf-data", ".sigmf-meta", ".sigmf"};
+
+        for(uint8_t i=0; i<sizeof(ext)/sizeof(ext[0]); i++)
+        {
+            int elen = strlen(ext[i]);
+            if(len > elen && strcmp(path+len-elen, ext[i]) == 0)
+            {
+                len -= elen;
+                break;
+            }
+        }
+
+        snprintf(data_path, sizeof(data_path), "%.*s.sigmf-data", len, path);
+        snprintf(meta_path, sizeof(meta_path), "%.*s.sigmf-meta", len, path);
+        path = data_path;
+
+        if(write_sigmf_meta(meta_path, opts, endpoint) != 0)
+        {
+            dbg_print(TERM_RED, "Can not write %s: %s\n", meta_path, strerror(errno));
+            if(w.dsp != NULL)
+                dsp_free(w.dsp);
+            return 1;
+        }
+    }
+
+    if(spec && spectrum_init(&mon.spec, &opts->spectrum, opts->kernel) != 0)
+    {
+        dbg_print(TERM_RED, "Can not set up a %u point FFT\n", opts->spectrum.fft);
+        if(w.dsp != NULL)
+            dsp_free(w.dsp);
+        return 1;
+    }
+
+    //the writer, then the forwarders and the spectrum monitor
+    fwd = calloc(opts->nforward ? opts->nforward : 1, sizeof(struct forwarder_t));
+    if(fwd == NULL || bcast_init(&bcast, 1 + opts->nforward + spec, opts->ring, opts->nforward*BB_FWD_HOLD) != 0)
+    {
+        free(fwd);
+        if(spec)
+            spectrum_free(&mon.spec);
+        if(w.dsp != NULL)
+            dsp_free(w.dsp);
+        return 1;
+    }
+
+    uint8_t nfwd = 0;
+    for(; nfwd<opts->nforward; nfwd++)
+    {
+        struct forwarder_t* f = &fwd[nfwd];
+
+        ctrl_make_addr(f->endpoint, sizeof(f->endpoint), opts->forward[nfwd]);
+        f->sock = zmq_socket(zmq_ctx, ZMQ_PUB);
+        zmq_setsockopt(f->sock, ZMQ_LINGER, &linger, sizeof(linger));
+        if(zmq_bind(f->sock, f->endpoint) != 0)
+        {
+            dbg_print(TERM_RED, "Can not bind to %s: %s\n", f->endpoint, zmq_strerror(zmq_errno()));
+            zmq_close(f->sock);
+            goto out_fwd;
+        }
+        f->ring = bcast.cons[1 + nfwd];
+        atomic_init(&f->done, 0);
+        for(uint32_t i=0; i<BB_FWD_HOLD; i++)
+            atomic_init(&f->hold[i].busy, 0);
+    }
+
+    if(open_recording(&w, path) != 0)
+    {
+        dbg_print(TERM_RED, "Can not open %s: %s\n", path, strerror(errno));
+        goto out_fwd;
+    }
+
+    void* sock = zmq_socket(zmq_ctx, ZMQ_SUB);
+    zmq_setsockopt(sock, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(sock, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+    zmq_setsockopt(sock, ZMQ_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    zmq_setsockopt(sock, ZMQ_SUBSCRIBE, "", 0);
+    if(zmq_connect(sock, endpoint) != 0)
+    {
+        dbg_print(TERM_RED, "Can not connect to %s: %s\n", endpoint, zmq_strerror(zmq_errno()));
+        zmq_close(sock);
+        if(w.fd >= 0)
+            close(w.fd);
+        goto out_fwd;
+    }
+
+    dbg_print(0, "Baseband RX from %s", endpoint);
+    if(w.dsp != NULL)
+        dbg_print(0, ", cf32 decimated by %u (%s)", w.dsp->decim, dsp_kernel_name(w.dsp->kernel));
+    if(path != NULL)
+        dbg_print(0, " to %s%s", path, w.direct ? " (O_DIRECT)" : "");
+    for(uint8_t i=0; i<nfwd; i++)
+        dbg_print(0, "%s %s", i ? "," : ", forwarded to", fwd[i].endpoint);
+    if(spec)
+        dbg_print(0, ", %u point spectrum (%s)", opts->spectrum.fft, dsp_kernel_name(mon.spec.kernel));
+    dbg_print(0, ", ring of %u messages\n", spsc_capacity(&bcast.cons[0]->ring));
+
+    w.ring = bcast.cons[0];
+    atomic_init(&w.done, 0);
+    pthread_create(&w.thread, NULL, writer, &w);
+    for(uint8_t i=0; i<nfwd; i++)
+        pthread_create(&fwd[i].thread, NULL, forwarder, &fwd[i]);
+    if(spec)
+    {
+        mon.ring = bcast.cons[1 + nfwd];
+        mon.interval = opts->spectrum.interval*1e3;
+        mon.t0 = now_ms();
+        atomic_init(&mon.done, 0);
+        pthread_create(&mon.thread, NULL, monitor, &mon);
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    zmq_pollitem_t item = {sock, 0, ZMQ_POLLIN, 0};
+    uint64_t bytes = 0, frames = 0;
+    double t0 = 0;              //first message
+    double t_report = 0;
+    uint64_t bytes_report = 0;
+    uint64_t dropped_report = 0;
+
+    while(running)
+    {
+        double now = now_ms();
+
+        if(t0 > 0 && opts->duration > 0 && now - t0 >= opts->duration*1e3)
+            break;
+
+        if(t0 > 0 && now >= t_report)
+        {
+            print_stats((now-t0)/1e3, (bytes-bytes_report)/BB_SAMPLE_SIZE/(now-t_report+1000)/1e3,
+                bytes, frames, &bcast, fwd, nfwd);
+            t_report = now + 1000;
+            bytes_report = bytes;
+
+            metrics_stream_drop(METRICS_BB_RX, bcast_dropped(&bcast) - dropped_report);
+            dropped_report = bcast_dropped(&bcast);
+        }
+
+        if(zmq_poll(&item, 1, 100) <= 0)
+            continue;
+
+        //consumers that are behind lose the message, the socket is never stalled
+        while(zmq_msg_recv(bcast_reserve(&bcast), sock, ZMQ_DONTWAIT) >= 0)
+        {
+            if(t0 == 0)
+                t_report = (t0 = now_ms()) + 1000;
+
+            size_t size = zmq_msg_size(bcast_reserve(&bcast));
+            frames++;
+            bytes += size;
+            metrics_stream(METRICS_BB_RX, 1, size);
+            bcast_publish(&bcast);
+        }
+    }
+
+    double secs = t0 > 0 ? (now_ms()-t0)/1e3 : 0;
+    metrics_stream_drop(METRICS_BB_RX, bcast_dropped(&bcast) - dropped_report);
+
+    atomic_store(&w.done, 1);
+    pthread_join(w.thread, NULL);
+    for(uint8_t i=0; i<nfwd; i++)
+    {
+        atomic_store(&fwd[i].done, 1);
+        pthread_join(fwd[i].thread, NULL);
+    }
+    if(spec)
+    {
+        atomic_store(&mon.done, 1);
+        pthread_join(mon.thread, NULL);
+    }
+    zmq_close(sock);
+
+    print_stats(secs, -1, bytes, frames, &bcast, fwd, nfwd);
+    if(path != NULL)
+    {
+        dbg_print(0, "Wrote %lu bytes to %s", w.written, path);
+        if(w.err)
+            dbg_print(TERM_RED, " - %s", strerror(w.err));
+        dbg_print(0, "\n");
+        close(w.fd);
+    }
+    for(uint8_t i=0; i<nfwd; i++)
+    {
+        if(fwd[i].copied)
+            dbg_print(TERM_YELLOW, "%s: %lu message(s) copied, its subscribers are falling behind\n", fwd[i].endpoint, fwd[i].copied);
+    }
+
+    ret = (w.err != 0);
+    for(uint8_t i=0; i<bcast.n; i++)
+        ret |= (bcast.cons[i]->dropped != 0);
+
+out_fwd:
+    close_forwarders(fwd, nfwd);
+    if(spec)
+        spectrum_free(&mon.spec);
+    bcast_free(&bcast);
+    free(fwd);
+    free(w.buf);
+    free(w.out);
+    if(w.dsp != NULL)
+        dsp_free(w.dsp);
+
+    return ret;
+}
@@ -0,0 +1,32 @@
+/*
+ * bb_rx.h
+ *
+ *  Baseband uplink receiver and recorder
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "spectrum.h"
+
+#define BB_SAMPLE_SIZE  4       //interleaved int16 I/Q
+#define BB_MAX_FORWARD  4       //republished streams
+
+struct bb_rx_opts_t
+{
+    const char* endpoint;       //baseband publisher
+    const char* path;           //recording, NULL - receive and measure only
+    uint32_t ring;              //messages buffered between the receiver and the writer
+    double duration;            //s, 0 - until interrupted
+    uint32_t decim;             //0 - keep raw int16, else convert to cf32 and decimate
+    int kernel;                 //dsp_kernel_t
+    uint8_t sigmf;              //write a SigMF recording (path is the base name)
+    double rate;                //input sample rate in S/s for the metadata, 0 - unknown
+    uint64_t freq;              //center frequency in Hz for the metadata, 0 - unknown
+    const char* forward[BB_MAX_FORWARD];    //endpoints to republish the stream at
+    uint8_t nforward;
+    struct spectrum_opts_t spectrum;        //monitor, off if the interval is 0
+};
+
+int bb_rx_run(void* zmq_ctx, const struct bb_rx_opts_t* opts);
@@ -0,0 +1,270 @@
+/*
+ * bb_tx.c
+ *
+ *  BBU side baseband publisher
+ *
+ *  The sample file is memory mapped and every message points straight into
+ *  the mapping (zmq_msg_init_data), nothing is copied. The mapping is only
+ *  released after ZMQ has let go of the last message.
+ *  Messages are paced with a token bucket refilled at the sample rate, jitter
+ *  is the deviation of the interval between two sends from the nominal one.
+ */
+
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "log.h"
+#include "ctrl.h"
+#include "histogram.h"
+#include "bb_rx.h"
+#include "bb_tx.h"
+#include "metrics.h"
+
+#ifndef ZMQ_XPUB_NODROP
+#define ZMQ_XPUB_NODROP 69
+#endif
+
+#define BB_TX_BURST     4       //token bucket depth in messages
+
+static volatile sig_atomic_t running = 1;
+static atomic_uint_fast64_t in_flight;  //messages ZMQ still holds
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static void msg_released(void* data, void* hint)
+{
+    (void)data;
+    (void)hint;
+    atomic_fetch_sub(&in_flight, 1);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000ULL + t.tv_nsec;
+}
+
+static void sleep_until(uint64_t t)
+{
+    struct timespec ts = {t / 1000000000ULL, t % 1000000000ULL};
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && running);
+}
+
+int bb_tx_open(struct bb_tx_t* tx, void* zmq_ctx, const struct bb_tx_opts_t* opts)
+{
+    struct stat st;
+    char endpoint[136];
+    int linger = 1000;
+    int nodrop = 1;
+    int fd;
+
+    memset(tx, 0, sizeof(struct bb_tx_t));
+    tx->opts = *opts;
+
+    if((fd = open(opts->path, O_RDONLY)) < 0 || fstat(fd, &st) != 0)
+    {
+        dbg_print(TERM_RED, "Can not open %s: %s\n", opts->path, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    tx->size = st.st_size - st.st_size % BB_SAMPLE_SIZE;
+    if(tx->size == 0)
+    {
+        dbg_print(TERM_RED, "%s holds no samples\n", opts->path);
+        close(fd);
+        return -1;
+    }
+
+    tx->map = mmap(NULL, tx->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(tx->map == MAP_FAILED)
+    {
+        dbg_print(TERM_RED, "Can not map %s: %s\n", opts->path, strerror(errno));
+        tx->map = NULL;
+        return -1;
+    }
+    madvise(tx->map, tx->size, MADV_SEQUENTIAL);
+
+    //XPUB, so playback can wait for the first subscriber, NODROP turns the HWM into backpressure
+    ctrl_make_addr(endpoint, sizeof(endpoint), opts->endpoint);
+    tx->sock = zmq_socket(zmq_ctx, ZMQ_XPUB);
+    zmq_setsockopt(tx->sock, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(tx->sock, ZMQ_SNDHWM, &opts->hwm, sizeof(opts->hwm));
+    zmq_setsockopt(tx->sock, ZMQ_XPUB_NODROP, &nodrop, sizeof(nodrop));
+    if(zmq_bind(tx->sock, endpoint) != 0)
+    {
+        dbg_print(TERM_RED, "Can not bind to %s: %s\n", endpoint, zmq_strerror(zmq_errno()));
+        bb_tx_close(tx);
+        return -1;
+    }
+
+    dbg_print(0, "Baseband TX: %s (%lu samples) at %s, ", opts->path, tx->size/BB_SAMPLE_SIZE, endpoint);
+    if(opts->rate > 0)
+        dbg_print(0, "%.3f MS/s", opts->rate/1e6);
+    else
+        dbg_print(0, "flat out");
+    dbg_print(0, ", %u samples per message, HWM %d\n", opts->batch, opts->hwm);
+
+    return 0;
+}
+
+static void print_stats(double secs, double rate, uint64_t samples, uint64_t msgs, const struct hist_t* jitter, uint64_t stalls)
+{
+    dbg_print(0, "%.1f s: ", secs);
+    if(rate >= 0)
+        dbg_print(0, "%.3f MS/s, ", rate);
+    dbg_print(0, "%.3f MS/s average, %lu message(s)", secs > 0 ? samples/secs/1e6 : 0, msgs);
+    if(jitter->n > 0)
+        dbg_print(0, ", jitter [us] p50 %.1f p99 %.1f p99.9 %.1f max %.1f", hist_quantile(jitter, 0.5)/1e3,
+            hist_quantile(jitter, 0.99)/1e3, hist_quantile(jitter, 0.999)/1e3, jitter->max/1e3);
+    if(stalls)
+        dbg_print(TERM_YELLOW, ", %lu HWM stall(s)", stalls);
+    dbg_print(0, "\n");
+}
+
+int bb_tx_stream(struct bb_tx_t* tx)
+{
+    const struct bb_tx_opts_t* opts = &tx->opts;
+    size_t msg_len = (size_t)opts->batch * BB_SAMPLE_SIZE;
+    struct hist_t* jitter = malloc(sizeof(struct hist_t));
+    zmq_pollitem_t item = {tx->sock, 0, ZMQ_POLLIN, 0};
+    uint8_t sub[64];
+
+    if(jitter == NULL)
+        return 1;
+    hist_init(jitter);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    //messages published before anyone subscribes are lost, wait for the RRU
+    dbg_print(0, "Waiting for a subscriber...\n");
+    log_flush();
+    while(running && zmq_poll(&item, 1, 100) <= 0);
+    if(!running)
+    {
+        free(jitter);
+        return 1;
+    }
+
+    uint64_t period = (opts->rate > 0) ? (uint64_t)(1e9*opts->batch/opts->rate) : 0;
+    uint64_t depth = BB_TX_BURST * period;  //bucket depth in ns worth of tokens
+    uint64_t samples = 0, msgs = 0, stalls = 0;
+    uint64_t t0 = now_ns();
+    uint64_t bucket = t0 - period;          //time up to which tokens have been spent, one message ready
+    uint64_t t_prev = 0;
+    uint64_t t_report = t0 + 1000000000ULL;
+    uint64_t samples_report = 0;
+    size_t off = 0;
+
+    while(running)
+    {
+        uint64_t now = now_ns();
+
+        if(opts->duration > 0 && now - t0 >= opts->duration*1e9)
+            break;
+
+        //drain subscription messages
+        while(zmq_recv(tx->sock, sub, sizeof(sub), ZMQ_DONTWAIT) >= 0);
+
+        if(now >= t_report)
+        {
+            print_stats((now-t0)/1e9, (samples-samples_report)/((now-t_report)/1e9 + 1)/1e6, samples, msgs, jitter, stalls);
+            t_report = now + 1000000000ULL;
+            samples_report = samples;
+        }
+
+        //token bucket: the bucket refills at the sample rate, up to BB_TX_BURST messages
+        if(period)
+        {
+            if(now > bucket + depth)
+                bucket = now - depth;
+            if(bucket + period > now)
+            {
+                sleep_until(bucket + period);
+                now = now_ns();
+            }
+            bucket += period;
+        }
+
+        if(off == tx->size)
+        {
+            if(opts->duration == 0)
+                break;
+            off = 0;
+        }
+
+        size_t len = (tx->size - off < msg_len) ? tx->size - off : msg_len;
+        zmq_msg_t msg;
+
+        atomic_fetch_add(&in_flight, 1);
+        zmq_msg_init_data(&msg, tx->map + off, len, msg_released, NULL);
+        if(zmq_msg_send(&msg, tx->sock, ZMQ_DONTWAIT) < 0)
+        {
+            zmq_msg_close(&msg);
+            if(zmq_errno() != EAGAIN)
+                break;
+
+            //subscriber HWM reached, retry with the same tokens
+            stalls++;
+            bucket -= period;
+            zmq_poll(&(zmq_pollitem_t){tx->sock, 0, ZMQ_POLLOUT, 0}, 1, 10);
+            continue;
+        }
+
+        now = now_ns();
+        if(t_prev && period)
+            hist_add(jitter, (now - t_prev > period) ? now - t_prev - period : period - (now - t_prev));
+        t_prev = now;
+
+        off += len;
+        samples += len / BB_SAMPLE_SIZE;
+        msgs++;
+        metrics_stream(METRICS_BB_TX, 1, len);
+    }
+
+    print_stats((now_ns()-t0)/1e9, -1, samples, msgs, jitter, stalls);
+    if(opts->rate > 0)
+        dbg_print(0, "Target %.3f MS/s\n", opts->rate/1e6);
+
+    free(jitter);
+    return 0;
+}
+
+void bb_tx_close(struct bb_tx_t* tx)
+{
+    if(tx->sock != NULL)
+        zmq_close(tx->sock);
+    tx->sock = NULL;
+
+    if(tx->map == NULL)
+        return;
+
+    //the messages point into the mapping, wait until ZMQ is done with them
+    for(int i=0; i<200 && atomic_load(&in_flight) > 0; i++)
+        usleep(10000);
+
+    if(atomic_load(&in_flight) == 0)
+        munmap(tx->map, tx->size);
+    tx->map = NULL;
+}
@@ -0,0 +1,32 @@
+/*
+ * bb_tx.h
+ *
+ *  BBU side baseband publisher, plays a sample file back at a fixed rate
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct bb_tx_opts_t
+{
+    const char* path;           //raw interleaved int16 I/Q
+    const char* endpoint;       //where to publish, "IP:port" or a full endpoint
+    double rate;                //S/s, 0 - as fast as possible
+    uint32_t batch;             //samples per message
+    int hwm;                    //ZMQ_SNDHWM in messages
+    double duration;            //s, 0 - play the file once, else loop it for this long
+};
+
+struct bb_tx_t
+{
+    struct bb_tx_opts_t opts;
+    void* sock;
+    uint8_t* map;
+    size_t size;
+};
+
+int bb_tx_open(struct bb_tx_t* tx, void* zmq_ctx, const struct bb_tx_opts_t* opts);
+int bb_tx_stream(struct bb_tx_t* tx);
+void bb_tx_close(struct bb_tx_t* tx);
@@ -0,0 +1,212 @@
+/*
+ * bcast_ring.h
+ *
+ *  Lock-free single producer, multiple consumer broadcast of ZMQ messages
+ *
+ *  Every message is received once into a reference counted buffer from a
+ *  preallocated pool and its pointer is pushed to one SPSC ring per consumer,
+ *  so every consumer has a cursor of its own. A consumer whose ring is full
+ *  misses that message and counts it, the others are not affected. The last
+ *  consumer to release a buffer closes the message and hands the buffer back
+ *  to the pool. The pool holds one buffer more than all rings together, so
+ *  the producer always finds a free one without waiting. A consumer can keep
+ *  a buffer past its ring slot with bcast_hold(), e.g. to send it on without
+ *  copying, as long as the consumers together never hold more than the extra
+ *  buffers given to bcast_init().
+ */
+
+#pragma once
+
+#include <zmq.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "spsc_ring.h"
+
+#define BCAST_MAX_CONSUMERS 8
+
+struct bcast_buf_t
+{
+    zmq_msg_t msg;
+    atomic_uint refs;                   //consumers still holding it
+    atomic_uint busy;                   //0 - back in the pool
+};
+
+struct bcast_consumer_t
+{
+    struct spsc_ring_t ring;            //struct bcast_buf_t* slots
+    _Alignas(SPSC_CACHE_LINE) uint64_t dropped;   //written by the producer only
+    uint64_t received;
+    uint32_t high;                      //ring high-water mark
+};
+
+struct bcast_t
+{
+    struct bcast_buf_t* bufs;
+    uint32_t nbufs;
+    uint32_t next;                      //where the producer looks for a free buffer first
+    struct bcast_buf_t* filling;
+    struct bcast_consumer_t* cons[BCAST_MAX_CONSUMERS];
+    uint8_t n;
+};
+
+static inline void bcast_free(struct bcast_t* b)
+{
+    if(b->filling != NULL)
+        zmq_msg_close(&b->filling->msg);
+    b->filling = NULL;
+
+    for(uint8_t i=0; i<b->n; i++)
+    {
+        spsc_free(&b->cons[i]->ring);
+        free(b->cons[i]);
+    }
+    free(b->bufs);
+    b->bufs = NULL;
+    b->n = 0;
+}
+
+//n consumers with size messages queued each at most and extra buffers for holding, returns 0 on success
+static inline int bcast_init(struct bcast_t* b, uint8_t n, uint32_t size, uint32_t extra)
+{
+    b->n = 0;
+    b->bufs = NULL;
+    b->next = 0;
+    b->filling = NULL;
+
+    if(n == 0 || n > BCAST_MAX_CONSUMERS)
+        return -1;
+
+    uint32_t total = 1 + extra;
+    for(uint8_t i=0; i<n; i++)
+    {
+        struct bcast_consumer_t* c;
+
+        if(posix_memalign((void**)&c, SPSC_CACHE_LINE, sizeof(*c)) != 0)
+        {
+            bcast_free(b);
+            return -1;
+        }
+        if(spsc_init(&c->ring, size, sizeof(struct bcast_buf_t*)) != 0)
+        {
+            free(c);
+            bcast_free(b);
+            return -1;
+        }
+        c->dropped = 0;
+        c->received = 0;
+        c->high = 0;
+        b->cons[b->n++] = c;
+        total += spsc_capacity(&c->ring);
+    }
+
+    if(posix_memalign((void**)&b->bufs, SPSC_CACHE_LINE, (size_t)total*sizeof(struct bcast_buf_t)) != 0)
+    {
+        bcast_free(b);
+        return -1;
+    }
+    for(uint32_t i=0; i<total; i++)
+    {
+        atomic_init(&b->bufs[i].refs, 0);
+        atomic_init(&b->bufs[i].busy, 0);
+    }
+    b->nbufs = total;
+
+    return 0;
+}
+
+//producer: message to receive into, initialized, always available
+static inline zmq_msg_t* bcast_reserve(struct bcast_t* b)
+{
+    if(b->filling == NULL)
+    {
+        while(atomic_load_explicit(&b->bufs[b->next].busy, memory_order_acquire))
+            b->next = (b->next + 1 == b->nbufs) ? 0 : b->next + 1;
+
+        b->filling = &b->bufs[b->next];
+        zmq_msg_init(&b->filling->msg);
+    }
+
+    return &b->filling->msg;
+}
+
+//producer: hand the received message to every consumer with room for it
+static inline void bcast_publish(struct bcast_t* b)
+{
+    struct bcast_buf_t* buf = b->filling;
+    struct bcast_buf_t** slot[BCAST_MAX_CONSUMERS];
+    uint32_t refs = 0;
+
+    b->filling = NULL;
+
+    for(uint8_t i=0; i<b->n; i++)
+    {
+        slot[i] = spsc_reserve(&b->cons[i]->ring);
+        if(slot[i] == NULL)
+            b->cons[i]->dropped++;
+        else
+            refs++;
+    }
+
+    if(refs == 0)
+    {
+        zmq_msg_close(&buf->msg);
+        return;
+    }
+
+    //all references exist before the first consumer can drop one
+    atomic_store_explicit(&buf->refs, refs, memory_order_relaxed);
+    atomic_store_explicit(&buf->busy, 1, memory_order_relaxed);
+
+    for(uint8_t i=0; i<b->n; i++)
+    {
+        if(slot[i] == NULL)
+            continue;
+
+        struct bcast_consumer_t* c = b->cons[i];
+        *slot[i] = buf;
+        spsc_commit(&c->ring);
+
+        uint32_t count = spsc_count(&c->ring);
+        if(count > c->high)
+            c->high = count;
+    }
+}
+
+//consumer: oldest message or NULL if there is none
+static inline zmq_msg_t* bcast_peek(struct bcast_consumer_t* c)
+{
+    struct bcast_buf_t** slot = spsc_peek(&c->ring);
+
+    return (slot != NULL) ? &(*slot)->msg : NULL;
+}
+
+//drop a reference, from any thread
+static inline void bcast_put(struct bcast_buf_t* buf)
+{
+    if(atomic_fetch_sub_explicit(&buf->refs, 1, memory_order_acq_rel) == 1)
+    {
+        zmq_msg_close(&buf->msg);
+        atomic_store_explicit(&buf->busy, 0, memory_order_release);
+    }
+}
+
+//consumer: keep the peeked message beyond bcast_release(), until bcast_put()
+static inline struct bcast_buf_t* bcast_hold(struct bcast_consumer_t* c)
+{
+    struct bcast_buf_t* buf = *(struct bcast_buf_t**)spsc_peek(&c->ring);
+
+    atomic_fetch_add_explicit(&buf->refs, 1, memory_order_relaxed);
+    return buf;
+}
+
+//consumer: done with the peeked message
+static inline void bcast_release(struct bcast_consumer_t* c)
+{
+    struct bcast_buf_t* buf = *(struct bcast_buf_t**)spsc_peek(&c->ring);
+
+    spsc_release(&c->ring);
+    c->received++;
+    bcast_put(buf);
+}
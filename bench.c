@@ -0,0 +1,328 @@
+/*
+ * bench.c
+ *
+ *  Control channel round trip benchmark
+ *
+ *  Every probe carries its slot and sequence number in an envelope frame ahead
+ *  of the empty delimiter, REP and ROUTER peers echo it back with the reply, so
+ *  replies are matched exactly and a lost probe only holds up its own slot.
+ *  At a fixed rate the RTT is taken from the scheduled send time, so a
+ *  stalled device shows up in the tail instead of silently slowing the probes.
+ */
+
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "interface_cmds.h"
+#include "cari_codec.h"
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "ctrl.h"
+#include "histogram.h"
+#include "bench.h"
+
+#define TAG_LEN     12      //[slot u32][seq u64]
+
+struct probe_t
+{
+    uint64_t seq;
+    uint64_t t_sent;        //ns
+    uint8_t busy;
+};
+
+//in-process device for inproc:// endpoints, answers without any processing
+struct responder_t
+{
+    pthread_t thread;
+    void* sock;
+    volatile int running;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000ULL + t.tv_nsec;
+}
+
+static void* responder(void* arg)
+{
+    struct responder_t* r = arg;
+    zmq_pollitem_t item = {r->sock, 0, ZMQ_POLLIN, 0};
+
+    while(r->running)
+    {
+        if(zmq_poll(&item, 1, 100) <= 0)
+            continue;
+
+        zmq_msg_t part;
+        zmq_msg_init(&part);
+
+        //echo the routing ID and the envelope, answer the last frame
+        while(zmq_msg_recv(&part, r->sock, ZMQ_DONTWAIT) >= 0)
+        {
+            if(zmq_msg_more(&part))
+            {
+                zmq_msg_send(&part, r->sock, ZMQ_SNDMORE);
+                continue;
+            }
+
+            struct cari_frame_t f;
+            uint8_t rep[16];
+            size_t len;
+
+            if(cari_decode_request(zmq_msg_data(&part), zmq_msg_size(&part), &f) != CARI_DEC_OK)
+                len = cari_enc_u8(rep, sizeof(rep), zmq_msg_size(&part) ? *(uint8_t*)zmq_msg_data(&part) : 0, ERR_MALFORMED);
+            else if(f.cid == CMD_SUB_GET_PARAM && cari_param_size(f.payload[0]) > 0)
+            {
+                uint8_t pld[9] = {f.payload[0]};
+                len = cari_encode(rep, sizeof(rep), f.cid, pld, 1+cari_param_size(f.payload[0]));
+            }
+            else
+                len = cari_enc_u8(rep, sizeof(rep), f.cid, ERR_OK);
+
+            zmq_send(r->sock, rep, len, 0);
+        }
+
+        zmq_msg_close(&part);
+    }
+
+    return NULL;
+}
+
+//receive a reply, slot is -1 for replies without a valid envelope
+//returns -1 if nothing is waiting, msg holds the CARI frame otherwise
+static int bench_recv(struct link_t* link, zmq_msg_t* msg, int64_t* slot, uint64_t* seq)
+{
+    uint8_t tag[TAG_LEN];
+    int ret = link_recv_tagged(link, msg, tag, sizeof(tag));
+
+    if(ret < 0)
+        return -1;
+
+    *slot = -1;
+    if(ret == 1)
+    {
+        *slot = cari_get_u32(tag);
+        *seq = cari_get_u64(&tag[4]);
+    }
+
+    return 0;
+}
+
+static int bench_send(struct link_t* link, uint32_t slot, uint64_t seq, const uint8_t* frame, uint16_t len)
+{
+    uint8_t tag[TAG_LEN];
+
+    cari_put_u32(tag, slot);
+    cari_put_u64(&tag[4], seq);
+    return link_send_tagged(link, tag, sizeof(tag), frame, len);
+}
+
+static void print_report(const struct hist_t* h, uint64_t sent, uint64_t recvd, uint64_t lost, uint64_t errors, uint64_t bad, double elapsed)
+{
+    dbg_print(0, "Sent %lu, received %lu, ", sent, recvd);
+    dbg_print(lost ? TERM_YELLOW : TERM_GREEN, "lost %lu (%.3f%%)", lost, sent ? 100.0*lost/sent : 0);
+    if(errors || bad)
+        dbg_print(TERM_YELLOW, ", %lu error repl(ies), %lu malformed", errors, bad);
+    dbg_print(0, "\n");
+
+    dbg_print(0, "Throughput %.1f req/s over %.3f s\n", elapsed > 0 ? recvd/elapsed : 0, elapsed);
+
+    if(h->n == 0)
+        return;
+
+    dbg_print(0, "RTT [us]: min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  mean %.1f\n",
+        h->min/1e3, hist_quantile(h, 0.5)/1e3, hist_quantile(h, 0.9)/1e3, hist_quantile(h, 0.99)/1e3,
+        hist_quantile(h, 0.999)/1e3, h->max/1e3, hist_mean(h)/1e3);
+}
+
+static int start_responder(struct responder_t* resp, void* zmq_ctx, const char* addr)
+{
+    int linger = 0;
+
+    resp->sock = zmq_socket(zmq_ctx, ZMQ_ROUTER);
+    zmq_setsockopt(resp->sock, ZMQ_LINGER, &linger, sizeof(linger));
+    if(zmq_bind(resp->sock, addr) != 0)
+    {
+        dbg_print(TERM_RED, "Can not bind the in-process device to %s: %s\n", addr, zmq_strerror(zmq_errno()));
+        zmq_close(resp->sock);
+        resp->sock = NULL;
+        return -1;
+    }
+
+    resp->running = 1;
+    pthread_create(&resp->thread, NULL, responder, resp);
+    return 0;
+}
+
+static void stop_responder(struct responder_t* resp)
+{
+    if(resp->sock == NULL)
+        return;
+
+    resp->running = 0;
+    pthread_join(resp->thread, NULL);
+    zmq_close(resp->sock);
+}
+
+int bench_run(void* zmq_ctx, const char* addr, const struct bench_opts_t* opts)
+{
+    struct link_t link;
+    struct responder_t resp = {0};
+    uint8_t frame[16];
+    uint16_t len;
+    uint8_t cid;
+    int ret = 1;
+
+    if(opts->get_param)
+        len = cari_enc_u8(frame, sizeof(frame), cid = CMD_SUB_GET_PARAM, PARAM_RX_FREQ);
+    else
+        len = cari_encode(frame, sizeof(frame), cid = CMD_PING, NULL, 0);
+
+    //at a fixed rate a lost probe must not hold up the schedule, so allow some probes in flight
+    uint32_t window = opts->window ? opts->window : (opts->rate > 0 ? 256 : 1);
+
+    struct hist_t* hist = malloc(sizeof(struct hist_t));
+    struct probe_t* probes = calloc(window, sizeof(struct probe_t));
+    uint32_t* free_slots = malloc(window*sizeof(uint32_t));
+    uint32_t nfree = window;
+
+    if(hist == NULL || probes == NULL || free_slots == NULL)
+        goto out;
+
+    hist_init(hist);
+    for(uint32_t i=0; i<window; i++)
+        free_slots[i] = window-1-i;
+
+    link_direct_only("Benchmark");
+
+    if(strncmp(addr, "inproc://", 9) == 0 && start_responder(&resp, zmq_ctx, addr) != 0)
+        goto out;
+
+    if(link_open(&link, zmq_ctx, addr) != 0)
+    {
+        dbg_print(TERM_RED, "Can not connect to %s\n", addr);
+        goto out;
+    }
+
+    dbg_print(0, "Benchmarking %s: %lu x %s, window %u, ", link.endpoint, opts->count, cari_cmd_name(cid), window);
+    if(opts->rate > 0)
+        dbg_print(0, "%.1f req/s\n", opts->rate);
+    else
+        dbg_print(0, "flat out\n");
+
+    uint64_t timeout = link.timeout * 1000000ULL;
+    uint64_t period = (opts->rate > 0) ? (uint64_t)(1e9/opts->rate) : 0;
+    uint64_t sent = 0, recvd = 0, lost = 0, errors = 0, bad = 0;
+    uint64_t t0 = now_ns();
+    uint64_t next = t0;             //scheduled time of the next probe
+    uint64_t t_last = t0;
+    uint64_t expiry = UINT64_MAX;   //no probe in flight expires before this
+
+    zmq_pollitem_t item = {link.sock, 0, ZMQ_POLLIN, 0};
+
+    while(sent < opts->count || nfree < window)
+    {
+        uint64_t now = now_ns();
+
+        while(sent < opts->count && nfree > 0 && (period == 0 || now >= next))
+        {
+            uint32_t slot = free_slots[nfree-1];
+            struct probe_t* p = &probes[slot];
+
+            if(bench_send(&link, slot, sent, frame, len) < 0)
+                break;
+
+            nfree--;
+            p->seq = sent;
+            p->t_sent = period ? next : now; //scheduled time, a late send counts against the device
+            p->busy = 1;
+            if(p->t_sent + timeout < expiry)
+                expiry = p->t_sent + timeout;
+            sent++;
+            next += period;
+        }
+
+        //whatever has been out for longer than the deadline is lost
+        if(now >= expiry)
+        {
+            expiry = UINT64_MAX;
+            for(uint32_t i=0; i<window; i++)
+            {
+                if(!probes[i].busy)
+                    continue;
+
+                if(now - probes[i].t_sent >= timeout)
+                {
+                    probes[i].busy = 0;
+                    free_slots[nfree++] = i;
+                    lost++;
+                }
+                else if(probes[i].t_sent + timeout < expiry)
+                    expiry = probes[i].t_sent + timeout;
+            }
+        }
+
+        if(sent == opts->count && nfree == window)
+            break;
+
+        //sleep until the next probe is due or the oldest one expires
+        uint64_t wake = expiry;
+        if(sent < opts->count && nfree > 0 && next < wake)
+            wake = next;
+
+        //sub-millisecond gaps are busy-polled, zmq_poll only has ms resolution
+        long wait = (wake > now) ? (long)((wake - now)/1000000) : 0;
+        if(zmq_poll(&item, 1, wait) < 0)
+            break;
+
+        zmq_msg_t msg;
+        int64_t slot;
+        uint64_t seq = 0;
+
+        while(bench_recv(&link, &msg, &slot, &seq) == 0)
+        {
+            struct probe_t* p = (slot >= 0 && slot < window) ? &probes[slot] : NULL;
+            struct cari_frame_t f;
+
+            //untagged or already written off
+            if(p == NULL || !p->busy || p->seq != seq)
+            {
+                zmq_msg_close(&msg);
+                continue;
+            }
+
+            now = now_ns();
+            p->busy = 0;
+            free_slots[nfree++] = slot;
+            recvd++;
+            t_last = now;
+
+            if(cari_decode_reply_msg(cid, &msg, &f) != CARI_DEC_OK)
+                bad++;
+            else if(f.err != ERR_OK)
+                errors++;
+            else
+                hist_add(hist, now - p->t_sent);
+
+            zmq_msg_close(&msg);
+        }
+    }
+
+    print_report(hist, sent, recvd, lost, errors, bad, (t_last - t0)/1e9);
+    link_close(&link);
+    ret = (recvd == 0);
+
+out:
+    stop_responder(&resp);
+    free(hist);
+    free(probes);
+    free(free_slots);
+    return ret;
+}
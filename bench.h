@@ -0,0 +1,19 @@
+/*
+ * bench.h
+ *
+ *  Control channel round trip benchmark
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct bench_opts_t
+{
+    uint64_t count;         //probes to send
+    double rate;            //probes per second, 0 - as fast as the window allows
+    uint32_t window;        //probes in flight at most
+    uint8_t get_param;      //SUB_GET_PARAM instead of PING
+};
+
+int bench_run(void* zmq_ctx, const char* addr, const struct bench_opts_t* opts);
@@ -0,0 +1,97 @@
+/*
+ * bench_codec.c
+ *
+ *  CARI codec throughput benchmark
+ */
+
+#include <zmq.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cari_codec.h"
+#include "interface_cmds.h"
+
+#define N_FRAMES    20000000UL
+#define N_MSGS      2000000UL
+
+static volatile uint64_t sink;
+
+static double now_s(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec/1e9;
+}
+
+static void report(const char* name, uint64_t n, double t)
+{
+    printf("%-28s %8.2f Mframes/s %8.2f ns/frame\n", name, n/t/1e6, t/n*1e9);
+}
+
+int main(void)
+{
+    uint8_t buf[64];
+    uint8_t rep_status[4];
+    uint8_t rep_param[12];
+    struct cari_frame_t f;
+    uint64_t acc = 0;
+    double t0;
+
+    //encode into a plain buffer
+    t0 = now_s();
+    for(uint64_t i=0; i<N_FRAMES; i++)
+    {
+        acc += cari_enc_param_u64(buf, sizeof(buf), PARAM_RX_FREQ, 420000000UL + i);
+        acc += buf[5];
+    }
+    report("encode SET_PARAM u64", N_FRAMES, now_s()-t0);
+
+    t0 = now_s();
+    for(uint64_t i=0; i<N_FRAMES; i++)
+    {
+        acc += cari_enc_param_f32(buf, sizeof(buf), PARAM_RX_FREQ_CORR, (float)i);
+        acc += buf[5];
+    }
+    report("encode SET_PARAM f32", N_FRAMES, now_s()-t0);
+
+    //encode straight into ZMQ messages
+    t0 = now_s();
+    for(uint64_t i=0; i<N_MSGS; i++)
+    {
+        zmq_msg_t msg;
+        uint8_t pld[9] = {PARAM_RX_FREQ};
+        cari_put_u64(&pld[1], 420000000UL + i);
+        cari_encode_msg(&msg, CMD_SUB_SET_PARAM, pld, sizeof(pld));
+        acc += ((uint8_t*)zmq_msg_data(&msg))[5];
+        zmq_msg_close(&msg);
+    }
+    report("encode into zmq_msg_t", N_MSGS, now_s()-t0);
+
+    //decode status replies in place
+    cari_encode(rep_status, sizeof(rep_status), CMD_SUB_SET_PARAM, &(uint8_t){ERR_OK}, 1);
+    t0 = now_s();
+    for(uint64_t i=0; i<N_FRAMES; i++)
+    {
+        rep_status[3] = i & 1;
+        if(cari_decode_reply(CMD_SUB_SET_PARAM, rep_status, sizeof(rep_status), &f) == CARI_DEC_OK)
+            acc += f.err;
+    }
+    report("decode status reply", N_FRAMES, now_s()-t0);
+
+    //decode data replies in place
+    uint8_t pld[9] = {PARAM_RX_FREQ};
+    cari_encode(rep_param, sizeof(rep_param), CMD_SUB_GET_PARAM, pld, sizeof(pld));
+    t0 = now_s();
+    for(uint64_t i=0; i<N_FRAMES; i++)
+    {
+        rep_param[4] = i;
+        if(cari_decode_reply(CMD_SUB_GET_PARAM, rep_param, sizeof(rep_param), &f) == CARI_DEC_OK)
+            acc += cari_get_u64(&f.payload[1]);
+    }
+    report("decode GET_PARAM u64 reply", N_FRAMES, now_s()-t0);
+
+    sink = acc;
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * bench_dsp.c
+ *
+ *  Baseband conversion kernel benchmark, every kernel the CPU supports
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "dsp.h"
+
+#define N_SAMPLES   (1<<16)     //complex samples per block
+#define N_BLOCKS    1000
+
+static volatile float sink;
+
+static double now_s(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec/1e9;
+}
+
+static void report(const char* name, const char* kernel, uint64_t n, double t, double err)
+{
+    printf("%-20s %-7s %9.2f MS/s %8.3f ns/sample  max err %.2e\n", name, kernel, n/t/1e6, t/n*1e9, err);
+}
+
+int main(void)
+{
+    int16_t* in = malloc(2*N_SAMPLES*sizeof(int16_t));
+    float* out = malloc(2*(N_SAMPLES+1)*sizeof(float));
+    float* ref = malloc(2*(N_SAMPLES+1)*sizeof(float));
+    const uint32_t decims[] = {1, 4, 16};
+    int best = dsp_detect();
+    uint64_t rng = 1;
+
+    if(in == NULL || out == NULL || ref == NULL)
+        return 1;
+
+    //tone plus noise plus a DC offset
+    for(int i=0; i<N_SAMPLES; i++)
+    {
+        rng = rng*6364136223846793005ULL + 1442695040888963407ULL;
+        in[2*i] = 8000*cos(0.01*i) + (int16_t)(rng >> 52) + 300;
+        in[2*i+1] = 8000*sin(0.01*i) + (int16_t)(rng >> 40 & 0xFFF) - 200;
+    }
+
+    printf("best kernel: %s\n", dsp_kernel_name(best));
+
+    for(uint32_t d=0; d<sizeof(decims)/sizeof(decims[0]); d++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), decims[d] == 1 ? "convert+dc" : "convert+dc+fir /%u", decims[d]);
+
+        //scalar output as the reference
+        struct dsp_chain_t c;
+        dsp_init(&c, decims[d], DSP_SCALAR);
+        size_t nref = dsp_process(&c, in, N_SAMPLES, ref);
+        nref = dsp_process(&c, in, N_SAMPLES, ref);
+        dsp_free(&c);
+
+        for(int k=0; k<=best; k++)
+        {
+            double err = 0;
+
+            dsp_init(&c, decims[d], k);
+            dsp_process(&c, in, N_SAMPLES, out);
+            size_t m = dsp_process(&c, in, N_SAMPLES, out);
+            for(size_t i=0; i<2*m && m==nref; i++)
+                err = fmax(err, fabs(out[i]-ref[i]));
+
+            double t0 = now_s();
+            for(int b=0; b<N_BLOCKS; b++)
+                sink = out[dsp_process(&c, in, N_SAMPLES, out)/2];
+            report(name, dsp_kernel_name(k), (uint64_t)N_SAMPLES*N_BLOCKS, now_s()-t0, m == nref ? err : INFINITY);
+
+            dsp_free(&c);
+        }
+    }
+
+    free(in);
+    free(out);
+    free(ref);
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * bench_fft.c
+ *
+ *  FFT benchmark, every kernel the CPU supports
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "dsp.h"
+#include "fft.h"
+
+#define N_POINTS    (1<<24)     //complex points transformed per size and kernel
+
+static volatile float sink;
+
+static double now_s(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec/1e9;
+}
+
+//the spectrum monitor overlaps blocks by half, so it needs twice the FFTs of the sample rate
+static void report(uint32_t n, const char* kernel, uint64_t ffts, double t, double err)
+{
+    printf("fft %-6u %-7s %9.2f us %9.2f MS/s (%8.2f MS/s overlapped) %6.2f GFLOPS  max err %.2e\n",
+        n, kernel, t/ffts*1e6, ffts*n/t/1e6, ffts*n/2/t/1e6, 5.0*n*log2(n)*ffts/t/1e9, err);
+}
+
+int main(void)
+{
+    const uint32_t sizes[] = {256, 1024, 4096, 16384, 65536};
+    float* in = malloc(2*FFT_MAX_SIZE*sizeof(float));
+    float* x = malloc(2*FFT_MAX_SIZE*sizeof(float));
+    float* ref = malloc(2*FFT_MAX_SIZE*sizeof(float));
+    int best = dsp_detect();
+    uint64_t rng = 1;
+
+    if(in == NULL || x == NULL || ref == NULL)
+        return 1;
+
+    //tone plus noise
+    for(int i=0; i<FFT_MAX_SIZE; i++)
+    {
+        rng = rng*6364136223846793005ULL + 1442695040888963407ULL;
+        in[2*i] = 0.25*cos(0.01*i) + (int32_t)(rng >> 40 & 0xFFFF)/65536.0 - 0.5;
+        in[2*i+1] = 0.25*sin(0.01*i) + (int32_t)(rng >> 16 & 0xFFFF)/65536.0 - 0.5;
+    }
+
+    printf("best kernel: %s\n", dsp_kernel_name(best));
+
+    for(uint32_t s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++)
+    {
+        uint32_t n = sizes[s];
+        struct fft_plan_t p;
+
+        //scalar output as the reference
+        fft_init(&p, n, DSP_SCALAR);
+        memcpy(x, in, 2*n*sizeof(float));
+        memcpy(ref, fft_run(&p, x), 2*n*sizeof(float));
+        fft_free(&p);
+
+        double scale = 0;
+        for(uint32_t i=0; i<2*n; i++)
+            scale = fmax(scale, fabs(ref[i]));
+
+        for(int k=0; k<=best; k++)
+        {
+            uint64_t ffts = N_POINTS/n;
+            double err = 0;
+
+            if(fft_init(&p, n, k) != 0)
+                continue;
+
+            memcpy(x, in, 2*n*sizeof(float));
+            const float* y = fft_run(&p, x);
+            for(uint32_t i=0; i<2*n; i++)
+                err = fmax(err, fabs(y[i]-ref[i])/scale);
+
+            //the input is overwritten, so it is copied in first as the spectrum monitor does with its window
+            double t0 = now_s();
+            for(uint64_t b=0; b<ffts; b++)
+            {
+                memcpy(x, in, 2*n*sizeof(float));
+                sink = fft_run(&p, x)[b & (2*n-1)];
+            }
+            report(n, dsp_kernel_name(k), ffts, now_s()-t0, err);
+
+            fft_free(&p);
+        }
+    }
+
+    free(in);
+    free(x);
+    free(ref);
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * bench_log.c
+ *
+ *  Logging cost on the producing thread, records formatted by the logger
+ *  thread into /dev/null
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "term.h"
+#include "dbg.h"
+#include "log.h"
+
+#define N_EVENTS    2000000UL
+#define BURST       (LOG_RING/2)    //the logger is let to catch up between bursts, nothing is dropped
+
+static double now_s(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec/1e9;
+}
+
+static void report(const char* fmt, const char* name, uint64_t n, double t)
+{
+    printf("%-6s %-22s %8.2f Mevents/s %8.2f ns/event\n", fmt, name, n/t/1e6, t/n*1e9);
+}
+
+static void run(enum log_fmt_t fmt, const char* name)
+{
+    double t, t0;
+
+    if(log_start(fmt, "/dev/null") != 0)
+    {
+        printf("Can not start the logger\n");
+        exit(1);
+    }
+
+    t = 0;
+    for(uint64_t i=0; i<N_EVENTS; i+=BURST)
+    {
+        t0 = now_s();
+        for(uint64_t k=i; k<i+BURST; k++)
+            LOG(0, "hop\n");
+        t += now_s()-t0;
+        log_flush();
+    }
+    report(name, "LOG no args", N_EVENTS, t);
+
+    t = 0;
+    for(uint64_t i=0; i<N_EVENTS; i+=BURST)
+    {
+        t0 = now_s();
+        for(uint64_t k=i; k<i+BURST; k++)
+            LOG_DEV(k & 63, TERM_YELLOW, "Hop %lu: ERR %d, %.2f ms\n", k, -3, k*0.001);
+        t += now_s()-t0;
+        log_flush();
+    }
+    report(name, "LOG_DEV 3 args", N_EVENTS, t);
+
+    t = 0;
+    for(uint64_t i=0; i<N_EVENTS; i+=BURST)
+    {
+        t0 = now_s();
+        for(uint64_t k=i; k<i+BURST; k++)
+            LOG(0, "%s %s\n", "192.168.1.200:17002", "down");
+        t += now_s()-t0;
+        log_flush();
+    }
+    report(name, "LOG 2 strings", N_EVENTS, t);
+
+    t = 0;
+    for(uint64_t i=0; i<N_EVENTS/10; i+=BURST)
+    {
+        t0 = now_s();
+        for(uint64_t k=i; k<i+BURST; k++)
+            dbg_print(TERM_YELLOW, "Hop %lu: ERR %d, %.2f ms\n", k, -3, k*0.001);
+        t += now_s()-t0;
+        log_flush();
+    }
+    report(name, "dbg_print 3 args", N_EVENTS/10, t);
+
+    log_stop();
+}
+
+int main(void)
+{
+    run(LOG_TERM, "term");
+    run(LOG_JSON, "json");
+    run(LOG_BIN, "bin");
+
+    if(log_dropped() > 0)
+        printf("%lu record(s) dropped\n", log_dropped());
+
+    return 0;
+}
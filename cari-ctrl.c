@@ -1,513 +1,983 @@
-#include <zmq.h>
-#include <stdio.h>
-#include <unistd.h>
-#include <string.h>
-#include <stdint.h>
-#include <stdarg.h>
-#include <stdlib.h>
-#include <math.h>
-#include <getopt.h>
-
-#include "interface_cmds.h"
-#include "term.h" //colored terminal font
-
-uint8_t rep_buff[1024];
-
-//config
-struct re_config_t
-{
-    uint64_t rx_freq;
-    uint64_t tx_freq;
-    float tx_freq_corr;
-    float rx_freq_corr;
-    float tx_pwr;
-    int8_t afc;
-    int8_t rx_ena;
-    char my_addr[128];
-    char re_addr[128];
-} config;
-
-//debug printf
-void dbg_print(const char* color_code, const char* fmt, ...)
-{
-    char str[200];
-    va_list ap;
-
-    va_start(ap, fmt);
-    vsprintf(str, fmt, ap);
-    va_end(ap);
-
-    if(color_code!=NULL)
-    {
-        printf(color_code);
-        printf(str);
-        printf(TERM_DEFAULT);
-    }
-    else
-    {
-        printf(str);
-    }
-}
-
-void print_help(const char *program_name) {
-    printf("Usage: %s [OPTIONS]\n\n", program_name);
-    printf("CARI Ctrl\n\n");
-    printf("Required options:\n");
-	printf("  -d, --dest=ADDR       Destination (RRU) IP and port (for the control channel)\n");
-	printf("                        This is the address of the Remote Radio Unit (RRU), with port set with `--ctrl` argument.\n");
-    printf("  -s, --source=ADDR     Source (BBU) IP and port (for baseband uplink)\n");
-	printf("                        This is the address of the ZMQ baseband publisher, running at the Baseband Unit (BBU).\n");
-	printf("\n");
-    printf("Optional options:\n");
-    printf("  -r, --reset           Reset remote device\n");
-    printf("  -i, --ident           Get device's IDENT string\n");
-    printf("  -p, --power=DBM       RF power setpoint in dBm (where ALC is available) as a decimal number\n");
-    printf("  -f, --rf=FREQ         RX frequency in Hertz as an integer (420000000-450000000)\n");
-    printf("  -F, --tf=FREQ         TX frequency in Hertz as an integer (420000000-450000000)\n");
-    printf("  -c, --rc=PPM          RX frequency correction in ppm as a decimal number (-100.0 to 100.0)\n");
-    printf("  -C, --tc=PPM          TX frequency correction in ppm as a decimal number (-100.0 to 100.0)\n");
-    printf("  -a, --afc=ENABLE      Automatic Frequency Control (where available), 1-on, 0-off\n");
-    printf("  -R, --rx=ENABLE       Activate RX baseband downstream, 1-on, 0-off\n");
-    printf("  -h, --help            Display this help message and exit\n");
-    printf("\n");
-    printf("Example:\n");
-    printf("  %s -d 192.168.1.200:17002 -s 192.168.1.100:17004 -p 20.5 --rf 433000000\n", program_name);
-}
-
-int main(int argc, char *argv[])
-{
-    uint8_t dev_reset = 0;
-    uint8_t get_ident = 0;
-
-    // Initialize default values
-    config.tx_pwr = -10.0f;
-    config.rx_freq_corr = -10000.0; // normal range is about -50..+50
-    config.tx_freq_corr = -10000.0;
-    config.rx_ena = -1;
-    config.afc = -1;
-    config.rx_freq = 0;
-    config.tx_freq = 0;
-    memset(config.my_addr, 0, sizeof(config.my_addr));
-    memset(config.re_addr, 0, sizeof(config.re_addr));
-
-    // Define the long options
-    static struct option long_options[] =
-    {
-        {"reset",   no_argument,       0, 'r'},
-        {"ident",   no_argument,       0, 'i'},
-        {"source",  required_argument, 0, 's'},
-        {"dest",    required_argument, 0, 'd'},
-        {"power",   required_argument, 0, 'p'},
-        {"rfreq",   required_argument, 0, 'f'},
-        {"tfreq",   required_argument, 0, 'F'},
-        {"rcorr",   required_argument, 0, 'c'},
-        {"tcorr",   required_argument, 0, 'C'},
-        {"afc",     required_argument, 0, 'a'},
-        {"rx",      required_argument, 0, 'R'},
-        {"help",    no_argument,       0, 'h'},
-        {0, 0, 0, 0}
-    };
-
-    //autogenerate the arg list
-    char arglist[64] = {0};
-    for(uint8_t i=0; i<sizeof(long_options)/sizeof(struct option)-1; i++)
-    {
-        arglist[strlen(arglist)] = long_options[i].val;
-        if(long_options[i].has_arg != no_argument)
-            arglist[strlen(arglist)] = ':';
-    }
-
-    int opt;
-    int option_index = 0;
-
-    // Parse command line arguments
-    while ((opt = getopt_long(argc, argv, arglist, long_options, &option_index)) != -1) 
-    {
-        switch (opt) 
-        {
-            case 'r': // reset
-                dev_reset = 1;
-                break;
-
-            case 'i': // reset
-                get_ident = 1;
-                break;
-
-            case 's': // local PUB address
-                if (strlen(optarg) > 0 && strlen(optarg) < sizeof(config.my_addr)) {
-                    strcpy(config.my_addr, optarg);
-                    dbg_print(0, "Local PUB address: ");
-                    dbg_print(TERM_GREEN, "%s\n", config.my_addr);
-                } else {
-                    dbg_print(TERM_RED, "Invalid local address length.\nExiting.\n");
-                    return 1;
-                }
-                break;
-
-            case 'd': // remote device address
-                if (strlen(optarg) > 0 && strlen(optarg) < sizeof(config.re_addr)) {
-                    strcpy(config.re_addr, optarg);
-                    dbg_print(0, "Remote CTRL address: ");
-                    dbg_print(TERM_GREEN, "%s\n", config.re_addr);
-                } else {
-                    dbg_print(TERM_RED, "Invalid remote address length.\nExiting.\n");
-                    return 1;
-                }
-                break;
-
-            case 'p': // RF power
-                config.tx_pwr = atof(optarg);
-                if(config.tx_pwr < 0.0f || config.tx_pwr > 47.75f) {
-                    dbg_print(TERM_RED, "Invalid TX power\nExiting\n");
-                    return 1;
-                }
-                dbg_print(0, "TX power: ");
-                dbg_print(TERM_GREEN, "%2.2f dBm\n", config.tx_pwr);
-                break;
-
-            case 'f': // --rf (RX frequency)
-                config.rx_freq = atoi(optarg);
-                if(config.rx_freq < 420000000U || config.rx_freq > 450000000U) {
-                    dbg_print(TERM_RED, "Invalid RX frequency\nExiting\n");
-                    return 1;
-                }
-                dbg_print(0, "RX frequency: ");
-                dbg_print(TERM_GREEN, "%lu Hz\n", config.rx_freq);
-                break;
-
-            case 'F': // --tf (TX frequency)
-                config.tx_freq = atoi(optarg);
-                if(config.tx_freq < 420000000U || config.tx_freq > 450000000U) {
-                    dbg_print(TERM_RED, "Invalid TX frequency\nExiting\n");
-                    return 1;
-                }
-                dbg_print(0, "TX frequency: ");
-                dbg_print(TERM_GREEN, "%lu Hz\n", config.tx_freq);
-                break;
-
-            case 'c': // --rc (RX frequency correction)
-                config.rx_freq_corr = atof(optarg);
-                if(config.rx_freq_corr < -100.0f || config.rx_freq_corr > 100.0f) {
-                    dbg_print(TERM_YELLOW, "RX frequency correction of %3.1fppm seems large\n", config.rx_freq_corr);
-                }
-                dbg_print(0, "RX frequency correction: ");
-                dbg_print(TERM_GREEN, "%3.1f ppm\n", config.rx_freq_corr);
-                break;
-
-            case 'C': // --tc (TX frequency correction)
-                config.tx_freq_corr = atof(optarg);
-                if(config.tx_freq_corr < -100.0f || config.tx_freq_corr > 100.0f) {
-                    dbg_print(TERM_YELLOW, "TX frequency correction of %3.1fppm seems large\n", config.tx_freq_corr);
-                }
-                dbg_print(0, "TX frequency correction: ");
-                dbg_print(TERM_GREEN, "%3.1f ppm\n", config.tx_freq_corr);
-                break;
-
-            case 'a': // --afc
-                config.afc = (optarg[0] == '0') ? 0 : 1;
-                dbg_print(0, "AFC: ");
-                if(config.afc)
-                    dbg_print(TERM_GREEN, "enabled\n");
-                else
-                    dbg_print(TERM_GREEN, "disabled\n");
-                break;
-
-            case 'R': // --rx
-                config.rx_ena = (optarg[0] == '0') ? 0 : 1;
-                dbg_print(0, "RX: ");
-                if(config.rx_ena)
-                    dbg_print(TERM_GREEN, "enabled\n");
-                else
-                    dbg_print(TERM_GREEN, "disabled\n");
-                break;
-
-            case 'h': // Help
-                print_help(argv[0]);
-                return 0;
-
-            case '?': // Unknown option
-                dbg_print(TERM_RED, "Unknown option or missing argument.\n");
-                print_help(argv[0]);
-                return 1;
-
-            default:
-                dbg_print(TERM_RED, "Unknown error while parsing options.\n");
-                return 1;
-        }
-    }
-
-    // Check if we have enough parameters
-    if (argc < 2) {
-        dbg_print(TERM_RED, "Not enough params.\n");
-        print_help(argv[0]);
-        return 1;
-    }
-
-    void *zmq_ctx = zmq_ctx_new();
-    void *zmq_ctrl = zmq_socket(zmq_ctx, ZMQ_REQ);
-
-    char my_addr[128] = {'t', 'c', 'p', ':', '/', '/'}; //this device's address
-    char re_addr[128] = {'t', 'c', 'p', ':', '/', '/'}; //remote device's address
-
-    if(strlen(config.re_addr) > 0) { //lame validity check
-        memcpy(&re_addr[6], config.re_addr, strlen(config.re_addr));
-    } else {
-        dbg_print(TERM_YELLOW, "Too short remote device's address\nExiting.");
-        return 1;
-    }
-
-    dbg_print(0, "ZMQ CTRL ");
-    if(zmq_connect(zmq_ctrl, re_addr) == 0)
-        dbg_print(TERM_GREEN, "connected\n");
-    else {
-        dbg_print(TERM_YELLOW, "fail\nExiting.");
-        return 1;
-    }
-
-    if(get_ident) {
-        dbg_print(0, "Getting device's identifier string ");
-
-        uint8_t cmd = CMD_DEV_GET_IDENT;
-        uint8_t req[3] = {cmd, 0x03, 0x00};
-        zmq_send(zmq_ctrl, req, *((uint16_t*)&req[1]), ZMQ_DONTWAIT);
-        zmq_recv(zmq_ctrl, (char*)rep_buff, sizeof(rep_buff), 0); //get reply
-        if(rep_buff[0] == cmd) { //response OK?
-            dbg_print(TERM_GREEN, "OK");
-            dbg_print(TERM_DEFAULT, "\n\"%s\"\n", &rep_buff[3]);
-        } else {
-            dbg_print(TERM_RED, "- malformed response\n");
-        }
-
-        zmq_close(zmq_ctrl);
-        zmq_ctx_destroy(zmq_ctx);
-        return 0;
-    }
-
-    if(dev_reset) {
-        dbg_print(0, "Device reset ");
-
-        uint8_t cmd = CMD_DEV_SET_REG;
-        uint8_t req[5] = {cmd, 0x05, 0x00, 0x00, 0x00};
-        zmq_send(zmq_ctrl, req, *((uint16_t*)&req[1]), ZMQ_DONTWAIT);
-        zmq_recv(zmq_ctrl, (char*)rep_buff, sizeof(rep_buff), 0); //get reply
-        if(rep_buff[0] == cmd && *((uint16_t*)&rep_buff[1]) == 4) { //response OK?
-            if(rep_buff[3] == ERR_OK)
-                dbg_print(TERM_GREEN, "OK\n");
-            else
-                dbg_print(TERM_YELLOW, "ERR %d\n", rep_buff[3]);
-        } else {
-            dbg_print(TERM_RED, "- malformed response\n");
-        }
-
-        zmq_close(zmq_ctrl);
-        zmq_ctx_destroy(zmq_ctx);
-        return 0;
-    }
-
-    //"valid" PUBlisher's address?
-    if(strlen(config.my_addr) > 0) {
-        dbg_print(0, "Sending SUB command to device... ");
-        memcpy(&my_addr[6], config.my_addr, strlen(config.my_addr));
-        uint8_t req[128];
-        uint8_t cmd = CMD_SUB_CONN;
-        req[0] = cmd;
-        memcpy(&req[3], my_addr, strlen(my_addr));
-        *((uint16_t*)&req[1]) = strlen(my_addr) + 3;
-        zmq_send(zmq_ctrl, req, *((uint16_t*)&req[1]), ZMQ_DONTWAIT); //full address with "tcp://"
-        zmq_recv(zmq_ctrl, (char*)rep_buff, sizeof(rep_buff), 0); //get reply
-        if(rep_buff[0] == cmd && *((uint16_t*)&rep_buff[1]) == 4) { //response OK?
-            if(rep_buff[3] == ERR_OK)
-                dbg_print(TERM_GREEN, "OK\n");
-            else
-                dbg_print(TERM_YELLOW, "ERR %d\n", rep_buff[3]);
-        } else {
-            dbg_print(TERM_RED, "malformed response\n");
-        }
-    }
-
-    if(strlen(config.re_addr) > 0) {
-        //TODO: update this
-        //rx freq
-        /*if(config.rx_freq>0)
-        {
-            dbg_print(0, "Setting RX freq to %d Hz ", config.rx_freq);
-            uint8_t req[128];
-            uint8_t cmd=CMD_SUB_SET_PARAM;
-            req[0]=cmd;
-            memcpy(&req[3], (uint8_t*)&config.rx_freq, sizeof(config.rx_freq));
-            *((uint16_t*)&req[1])=sizeof(config.rx_freq)+3;
-            zmq_send(zmq_req, req, *((uint16_t*)&req[1]), ZMQ_DONTWAIT);
-            zmq_recv(zmq_req, (char*)rep_buff, sizeof(rep_buff), 0); //get reply
-            if(rep_buff[0]==cmd && *((uint16_t*)&rep_buff[1])==4) //response OK?
-            {
-                if(rep_buff[3]==ERR_OK)
-                    dbg_print(TERM_GREEN, "OK\n");
-                else
-                    dbg_print(TERM_YELLOW, "ERR %d\n", rep_buff[3]);
-            }
-            else
-            {
-                dbg_print(TERM_RED, "malformed response\n");
-            }
-        }*/
-
-        // tx freq
-        /*if(config.tx_freq>0)
-        {
-            dbg_print(0, "Setting TX freq to %d Hz ", config.tx_freq);
-            uint8_t req[128];
-            uint8_t cmd=CMD_SET_TX_FREQ;
-            req[0]=cmd;
-            memcpy(&req[3], (uint8_t*)&config.tx_freq, sizeof(config.tx_freq));
-            *((uint16_t*)&req[1])=sizeof(config.tx_freq)+3;
-            zmq_send(zmq_req, req, *((uint16_t*)&req[1]), ZMQ_DONTWAIT);
-            zmq_recv(zmq_req, (char*)rep_buff, sizeof(rep_buff), 0); //get reply
-            if(rep_buff[0]==cmd && *((uint16_t*)&rep_buff[1])==4) //response OK?
-            {
-                if(rep_buff[3]==ERR_OK)
-                    dbg_print(TERM_GREEN, "OK\n");
-                else
-                    dbg_print(TERM_YELLOW, "ERR %d\n", rep_buff[3]);
-            }
-            else
-            {
-                dbg_print(TERM_RED, "malformed response\n");
-            }
-        }*/
-
-        // rx freq correction
-        /*if(config.rx_freq_corr>-1000.0f)
-        {
-            dbg_print(0, "Setting RX freq correction to %3.1f ppm ", config.rx_freq_corr);
-            uint8_t req[128];
-            uint8_t cmd=CMD_SET_RX_FREQ_CORR;
-            req[0]=cmd;
-            memcpy(&req[3], (uint8_t*)&config.rx_freq_corr, sizeof(config.rx_freq_corr));
-            *((uint16_t*)&req[1])=sizeof(config.rx_freq_corr)+3;
-            zmq_send(zmq_req, req, *((uint16_t*)&req[1]), ZMQ_DONTWAIT);
-            zmq_recv(zmq_req, (char*)rep_buff, sizeof(rep_buff), 0); //get reply
-            if(rep_buff[0]==cmd && *((uint16_t*)&rep_buff[1])==4) //response OK?
-            {
-                if(rep_buff[3]==ERR_OK)
-                    dbg_print(TERM_GREEN, "OK\n");
-                else
-                    dbg_print(TERM_YELLOW, "ERR %d\n", rep_buff[3]);
-            }
-            else
-            {
-                dbg_print(TERM_RED, "malformed response\n");
-            }
-        }*/
-
-        // tx freq correction
-        /*if(config.tx_freq_corr>-1000.0f)
-        {
-            dbg_print(0, "Setting TX freq correction to %3.1f ppm ", config.tx_freq_corr);
-            uint8_t req[128];
-            uint8_t cmd=CMD_SET_TX_FREQ_CORR;
-            req[0]=cmd;
-            memcpy(&req[3], (uint8_t*)&config.tx_freq_corr, sizeof(config.tx_freq_corr));
-            *((uint16_t*)&req[1])=sizeof(config.tx_freq_corr)+3;
-            zmq_send(zmq_req, req, *((uint16_t*)&req[1]), ZMQ_DONTWAIT);
-            zmq_recv(zmq_req, (char*)rep_buff, sizeof(rep_buff), 0); //get reply
-            if(rep_buff[0]==cmd && *((uint16_t*)&rep_buff[1])==4) //response OK?
-            {
-                if(rep_buff[3]==ERR_OK)
-                    dbg_print(TERM_GREEN, "OK\n");
-                else
-                    dbg_print(TERM_YELLOW, "ERR %d\n", rep_buff[3]);
-            }
-            else
-            {
-                dbg_print(TERM_RED, "malformed response\n");
-            }
-        }*/
-
-        // afc
-        /*if(config.afc!=-1)
-        {
-            if(config.afc)
-                dbg_print(0, "Enabling AFC ");
-            else
-                dbg_print(0, "Disabling AFC ");
-
-            uint8_t req[128];
-            uint8_t cmd=CMD_SET_AFC;
-            req[0]=cmd;
-            req[3]=config.afc;
-            req[1]=4;
-            zmq_send(zmq_req, req, *((uint16_t*)&req[1]), ZMQ_DONTWAIT);
-            zmq_recv(zmq_req, (char*)rep_buff, sizeof(rep_buff), 0); //get reply
-            if(rep_buff[0]==cmd && *((uint16_t*)&rep_buff[1])==4) //response OK?
-            {
-                if(rep_buff[3]==ERR_OK)
-                    dbg_print(TERM_GREEN, "OK\n");
-                else
-                    dbg_print(TERM_YELLOW, "ERR %d\n", rep_buff[3]);
-            }
-            else
-            {
-                dbg_print(TERM_RED, "malformed response\n");
-            }
-        }*/
-
-        // tx power
-        /*if(config.tx_pwr>=0.0f)
-        {
-            uint8_t pwr_round=floor(config.tx_pwr/0.25f);
-            dbg_print(0, "Setting TX power to %2.2f dBm ", pwr_round*0.25f);
-            uint8_t req[128];
-            uint8_t cmd=CMD_SET_TX_POWER;
-            req[0]=cmd;
-            req[3]=pwr_round;
-            *((uint16_t*)&req[1])=4;
-            zmq_send(zmq_req, req, *((uint16_t*)&req[1]), ZMQ_DONTWAIT);
-            zmq_recv(zmq_req, (char*)rep_buff, sizeof(rep_buff), 0); //get reply
-            if(rep_buff[0]==cmd && *((uint16_t*)&rep_buff[1])==4) //response OK?
-            {
-                if(rep_buff[3]==ERR_OK)
-                    dbg_print(TERM_GREEN, "OK\n");
-                else
-                    dbg_print(TERM_YELLOW, "ERR %d\n", rep_buff[3]);
-            }
-            else
-            {
-                dbg_print(TERM_RED, "malformed response\n");
-            }
-        }*/
-
-        // rx enabled?
-        /*if(config.rx_ena!=-1)
-        {
-            dbg_print(0, "RX ");
-            if(config.rx_ena==1)
-                dbg_print(0, "enable ");
-            else
-                dbg_print(0, "disable ");
-            uint8_t req[128];
-            uint8_t cmd=CMD_SET_RX;
-            req[0]=cmd;
-            req[3]=config.rx_ena;
-            *((uint16_t*)&req[1])=4;
-            zmq_send(zmq_req, req, *((uint16_t*)&req[1]), ZMQ_DONTWAIT);
-            zmq_recv(zmq_req, (char*)rep_buff, sizeof(rep_buff), 0); //get reply
-            if(rep_buff[0]==cmd && *((uint16_t*)&rep_buff[1])==4) //response OK?
-            {
-                if(rep_buff[3]==ERR_OK)
-                    dbg_print(TERM_GREEN, "OK\n");
-                else
-                    dbg_print(TERM_YELLOW, "ERR %d\n", rep_buff[3]);
-            }
-            else
-            {
-                dbg_print(TERM_RED, "malformed response\n");
-            }
-        }*/
-    }
-
-    zmq_close(zmq_ctrl);
-    zmq_ctx_destroy(zmq_ctx);
-
-    dbg_print(0, "Done, exiting.\n");
-    return 0;
-}
\ No newline at end of file
+#include <zmq.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <math.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "interface_cmds.h"
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "ctrl.h"
+#include "cari.h"
+#include "fleet.h"
+#include "daemon.h"
+#include "bench.h"
+#include "bb_rx.h"
+#include "dsp.h"
+#include "bb_tx.h"
+#include "spvn.h"
+#include "devcache.h"
+#include "hop.h"
+#include "script.h"
+#include "regmap.h"
+#include "watch.h"
+#include "discover.h"
+#include "log.h"
+#include "metrics.h"
+
+//options without a short form
+#define OPT_METRICS         256
+#define OPT_METRICS_FILE    257
+#define OPT_METRICS_EVERY   258
+
+struct re_config_t config;
+
+void print_ident(struct pending_t* p, const struct cari_frame_t* f, void* arg)
+{
+    (void)arg;
+
+    dbg_print(0, "%s ", p->desc);
+    if(p->err == ERR_OK) { //response OK?
+        dbg_print(TERM_GREEN, "OK");
+        dbg_print(0, " (%.2f ms)", p->rtt);
+        dbg_print(TERM_DEFAULT, "\n\"%.*s\"\n", (int)strnlen((const char*)f->payload, f->payload_len), f->payload);
+    } else if(p->err > 0) {
+        dbg_print(TERM_YELLOW, "ERR %d (%s)\n", p->err, cari_err_name(p->err));
+    } else {
+        dbg_print(TERM_RED, "- %s\n", p->err == CARI_NO_REPLY ? "no response" : "malformed response");
+    }
+}
+
+void print_help(const char *program_name) {
+    printf("Usage: %s [OPTIONS]\n\n", program_name);
+    printf("CARI Ctrl\n\n");
+    printf("Required options:\n");
+	printf("  -d, --dest=ADDR       Destination (RRU) IP and port (for the control channel)\n");
+	printf("                        This is the address of the Remote Radio Unit (RRU), with port set with `--ctrl` argument.\n");
+    printf("  -s, --source=ADDR     Source (BBU) IP and port (for baseband uplink)\n");
+	printf("                        This is the address of the ZMQ baseband publisher, running at the Baseband Unit (BBU).\n");
+	printf("\n");
+    printf("Optional options:\n");
+    printf("  -r, --reset           Reset remote device\n");
+    printf("  -i, --ident           Get device's IDENT string\n");
+    printf("  -p, --power=DBM       RF power setpoint in dBm (where ALC is available) as a decimal number\n");
+    printf("  -f, --rf=FREQ         RX frequency in Hertz as an integer (420000000-450000000)\n");
+    printf("  -F, --tf=FREQ         TX frequency in Hertz as an integer (420000000-450000000)\n");
+    printf("  -c, --rc=PPM          RX frequency correction in ppm as a decimal number (-100.0 to 100.0)\n");
+    printf("  -C, --tc=PPM          TX frequency correction in ppm as a decimal number (-100.0 to 100.0)\n");
+    printf("  -a, --afc=ENABLE      Automatic Frequency Control (where available), 1-on, 0-off\n");
+    printf("  -R, --rx=ENABLE       Activate RX baseband downstream, 1-on, 0-off\n");
+    printf("  -l, --fleet=FILE      Configure every device listed in FILE concurrently (one \"ADDR [option=value ...]\" per line)\n");
+    printf("                        Passing more than one `-d` also runs in fleet mode, command line settings apply to all devices.\n");
+    printf("  -D, --daemon=ENDPOINT Run as a daemon keeping warm connections to the devices, serving requests at ENDPOINT\n");
+    printf("  -V, --via=ENDPOINT    Send all requests through the daemon at ENDPOINT (default: $CARI_CTRL_VIA)\n");
+    printf("  -t, --timeout=MS      Reply deadline for the first attempt in ms, doubled on every retry (default 2000)\n");
+    printf("  -n, --retries=N       Resend unanswered requests N times over a fresh connection (default 2)\n");
+    printf("  -B, --bench=COUNT     Measure control channel round trips with COUNT probes and print the latency distribution\n");
+    printf("                        `-d` also takes ipc:// and inproc:// endpoints, inproc:// runs an in-process device.\n");
+    printf("  -H, --rate=HZ         Probes per second in benchmark mode (default 0 - as fast as possible)\n");
+    printf("  -w, --window=N        Probes in flight in benchmark mode (default 1, 256 with `--rate`), requests in register modes, probes in discovery\n");
+    printf("  -P, --bench-param     Probe with SUB_GET_PARAM instead of PING\n");
+    printf("  -b, --bb=ENDPOINT     Receive the baseband uplink published at ENDPOINT, after applying any settings to `-d`\n");
+    printf("  -o, --record=FILE     Record the received baseband to FILE (raw interleaved int16 I/Q)\n");
+    printf("  -O, --bb-forward=EP   Republish the received baseband at EP for local consumers, e.g. a demodulator (up to 4)\n");
+    printf("  -Q, --spectrum=SEC    Monitor the received baseband spectrum: channel power, noise floor and peak offset every SEC seconds\n");
+    printf("                        Needs `--bb-rate` for Hz and `--rfreq` for ppm.\n");
+    printf("  -L, --fft=N           FFT size of the spectrum monitor, a power of 2 (default 4096)\n");
+    printf("  -N, --chan-bw=HZ      Channel bandwidth the spectrum monitor integrates the power over (default 12500)\n");
+    printf("  -z, --ring=N          Baseband messages buffered between the receiver and each consumer (default 4096)\n");
+    printf("  -T, --duration=SEC    Stop receiving baseband or telemetry, or watching, after SEC seconds (default 0 - until interrupted)\n");
+    printf("  -x, --decim=N         Convert the baseband to complex float32, remove DC and decimate by N (1 - convert only)\n");
+    printf("  -k, --kernel=NAME     Conversion kernel: auto, avx2, sse or scalar (default auto - best the CPU supports)\n");
+    printf("  -M, --sigmf           Record as SigMF (FILE.sigmf-data and FILE.sigmf-meta)\n");
+    printf("  -S, --bb-rate=SPS     Baseband sample rate: before decimation for the SigMF metadata, playback rate for `--publish`\n");
+    printf("  -u, --publish=FILE    Publish FILE (raw interleaved int16 I/Q) as the BBU baseband at the `--source` address\n");
+    printf("                        Paced at `--bb-rate` (0 - as fast as possible), looped for `--duration` if given.\n");
+    printf("  -q, --batch=N         Samples per published message (default 4096)\n");
+    printf("  -W, --hwm=N           Published messages queued per subscriber before backpressure (default 1000)\n");
+    printf("  -v, --spvn=SEC        Stream supervision telemetry from every `-d` (or `-l`) device, printing a summary every SEC seconds\n");
+    printf("  -E, --cache=FILE      Device ident and capability cache (default $XDG_CACHE_HOME or ~/.cache/cari-ctrl.cache)\n");
+    printf("  -e, --cache-ttl=SEC   Trust cached device info for SEC seconds before checking the ident again (default 3600, 0 - no cache)\n");
+    printf("  -y, --converge        Only send the settings that differ from the last known device state\n");
+    printf("  -Y, --readback        Converge against the state read back from the device (one SUB_GET_PARAM batch)\n");
+    printf("  -j, --hop=FILE        Retune `-d` on the schedule of the hop table FILE (one \"T_MS RX_FREQ [TX_FREQ [PPM]]\" per line)\n");
+    printf("  -J, --hop-repeat=N    Play the hop table N times (default 1)\n");
+    printf("  -g, --script=FILE     Run the operations in FILE (- for stdin) over one connection per device, a JSON result per line\n");
+    printf("                        Lines hold long options: [dest=ADDR] [rfreq=FREQ ...] [ping] [ident] [reset] [get=rfreq]\n");
+    printf("                        [getreg=REG] [setreg=REG:VAL]; `dest` (initially `-d`) applies to the following lines.\n");
+    printf("  -m, --reg-dump=FILE   Read the registers of `-d` into the dump FILE, `--window` requests in flight (default 32)\n");
+    printf("  -A, --reg-load=FILE   Write the registers in the dump FILE to `-d` (register 0, the reset, is skipped)\n");
+    printf("                        With `--converge` the device is read first and only differing registers are written.\n");
+    printf("  -G, --reg-diff=FILE   Compare two dumps (give it twice) or a dump with `-d`, a single dump is printed\n");
+    printf("  -I, --reg-range=F-L   Registers to dump or load (default 0-255)\n");
+    printf("  -K, --watch=MS        Supervise every `-d` (or `-l`) device with a PING heartbeat every MS ms, applying the settings\n");
+    printf("                        (SUB_CONN included) when it is first seen and after every outage, a JSON line per event\n");
+    printf("  -X, --missed=N        Consecutive missed heartbeats before a device is down (default 3)\n");
+    printf("  -U, --discover=RANGE  Find the devices at A.B.C.D[/PREFIX]:PORT[,PORT|FIRST-LAST...] with PING and DEV_GET_IDENT\n");
+    printf("                        `--window` probes in flight (default 256), `--timeout` 250 ms, `--retries` 0; prints a device list\n");
+    printf("  -Z, --log=FORMAT      Status output: term (colored, default), json (a JSON object per line) or bin:FILE (binary)\n");
+    printf("                        read:FILE writes the binary log FILE as term or json (the `--log` given before) and exits.\n");
+    printf("      --metrics=PORT    Serve Prometheus metrics over HTTP at 127.0.0.1:PORT (IP:PORT to listen elsewhere): requests\n");
+    printf("                        by command, result and device, their latency histograms, stream frames, bytes and drops\n");
+    printf("      --metrics-file=F  Write the same metrics to the file F on start, every `--metrics-every` seconds and on exit\n");
+    printf("      --metrics-every=S Metrics file period in seconds (default 10)\n");
+    printf("  -h, --help            Display this help message and exit\n");
+    printf("\n");
+    printf("Example:\n");
+    printf("  %s -d 192.168.1.200:17002 -s 192.168.1.100:17004 -p 20.5 --rf 433000000\n", program_name);
+    printf("  %s -l rrus.txt -p 20.5\n", program_name);
+    printf("  %s -D ipc:///tmp/cari-ctrl.sock\n", program_name);
+    printf("  %s -V ipc:///tmp/cari-ctrl.sock -d 192.168.1.200:17002 --rf 433000000\n", program_name);
+    printf("  %s -d 192.168.1.200:17002 -B 10000 -H 1000\n", program_name);
+    printf("  %s -d 192.168.1.200:17002 -R 1 -b 192.168.1.200:17003 -o capture.iq -T 60\n", program_name);
+    printf("  %s -b 192.168.1.200:17003 -S 1000000 -x 8 -M -o capture\n", program_name);
+    printf("  %s -b 192.168.1.200:17003 -o capture.iq -O ipc:///tmp/bb-demod\n", program_name);
+    printf("  %s -d 192.168.1.200:17002 -f 433475000 -c 1.5 -R 1 -b 192.168.1.200:17003 -S 1000000 -Q 1\n", program_name);
+    printf("  %s -d 192.168.1.200:17002 -s 192.168.1.100:17004 -u tx.iq -S 1000000 -T 60\n", program_name);
+    printf("  %s -l rrus.txt -v 10\n", program_name);
+    printf("  %s -l rrus.txt -s 192.168.1.100:17004 -R 1 -K 500 > outages.jsonl\n", program_name);
+    printf("  %s -U 192.168.0.0/22:17002,17012 > rrus.txt\n", program_name);
+    printf("  %s -d 192.168.1.200:17002 -j hops.txt -J 100\n", program_name);
+    printf("  generate-ops | %s -d 192.168.1.200:17002 -g - > results.jsonl\n", program_name);
+    printf("  %s -d 192.168.1.200:17002 -m golden.regs\n", program_name);
+    printf("  %s -d 192.168.1.201:17002 -G golden.regs\n", program_name);
+    printf("  %s -l rrus.txt -K 500 -Z bin:watch.log > outages.jsonl\n", program_name);
+    printf("  %s -Z json -Z read:watch.log\n", program_name);
+    printf("  %s -D ipc:///tmp/cari-ctrl.sock --metrics 9464\n", program_name);
+}
+
+int main(int argc, char *argv[])
+{
+    uint8_t dev_reset = 0;
+    uint8_t get_ident = 0;
+
+    const char* fleet_file = NULL;
+    const char* daemon_ep = NULL;
+    int timeout = 2000;
+    int retries = 2;
+    uint8_t timing = 0;         //`-t` and `-n` given, bit 0 and 1
+    struct fleet_t fleet = {0};
+    int ndests = 0;
+    struct bench_opts_t bench = {0};
+    struct bb_rx_opts_t bb_rx = {.ring = 4096, .kernel = DSP_AUTO, .spectrum = {.fft = SPECTRUM_FFT, .chan_bw = SPECTRUM_CHAN_BW}};
+    struct bb_tx_opts_t bb_tx = {.batch = 4096, .hwm = 1000};
+    struct spvn_opts_t spvn = {0};
+    const char* cache_path = NULL;
+    int cache_ttl = DEVCACHE_TTL;
+    uint8_t converge = 0;
+    struct hop_opts_t hop = {.repeat = 1};
+    const char* script_path = NULL;
+    struct regmap_opts_t regmap = {.last = REGMAP_SIZE-1};
+    struct watch_opts_t watch = {.missed = WATCH_MISSED};
+    struct discover_opts_t discover = {0};
+    enum log_fmt_t log_fmt = LOG_TERM;
+    const char* log_path = NULL;
+    const char* log_read = NULL;
+    const char* metrics_addr = NULL;
+    const char* metrics_file = NULL;
+    int metrics_every = METRICS_INTERVAL;
+
+    // Initialize default values
+    config_init(&config);
+    if(getenv("CARI_CTRL_VIA") != NULL)
+        link_set_via(getenv("CARI_CTRL_VIA"));
+
+    // Define the long options
+    static struct option long_options[] =
+    {
+        {"reset",   no_argument,       0, 'r'},
+        {"ident",   no_argument,       0, 'i'},
+        {"source",  required_argument, 0, 's'},
+        {"dest",    required_argument, 0, 'd'},
+        {"power",   required_argument, 0, 'p'},
+        {"rfreq",   required_argument, 0, 'f'},
+        {"tfreq",   required_argument, 0, 'F'},
+        {"rcorr",   required_argument, 0, 'c'},
+        {"tcorr",   required_argument, 0, 'C'},
+        {"afc",     required_argument, 0, 'a'},
+        {"rx",      required_argument, 0, 'R'},
+        {"fleet",   required_argument, 0, 'l'},
+        {"daemon",  required_argument, 0, 'D'},
+        {"via",     required_argument, 0, 'V'},
+        {"timeout", required_argument, 0, 't'},
+        {"retries", required_argument, 0, 'n'},
+        {"bench",   required_argument, 0, 'B'},
+        {"rate",    required_argument, 0, 'H'},
+        {"window",  required_argument, 0, 'w'},
+        {"bench-param", no_argument,   0, 'P'},
+        {"bb",      required_argument, 0, 'b'},
+        {"record",  required_argument, 0, 'o'},
+        {"ring",    required_argument, 0, 'z'},
+        {"duration", required_argument, 0, 'T'},
+        {"decim",   required_argument, 0, 'x'},
+        {"kernel",  required_argument, 0, 'k'},
+        {"sigmf",   no_argument,       0, 'M'},
+        {"bb-rate", required_argument, 0, 'S'},
+        {"publish", required_argument, 0, 'u'},
+        {"batch",   required_argument, 0, 'q'},
+        {"hwm",     required_argument, 0, 'W'},
+        {"spvn",    required_argument, 0, 'v'},
+        {"cache",   required_argument, 0, 'E'},
+        {"cache-ttl", required_argument, 0, 'e'},
+        {"converge", no_argument,      0, 'y'},
+        {"readback", no_argument,      0, 'Y'},
+        {"hop",     required_argument, 0, 'j'},
+        {"hop-repeat", required_argument, 0, 'J'},
+        {"script",  required_argument, 0, 'g'},
+        {"reg-dump", required_argument, 0, 'm'},
+        {"reg-load", required_argument, 0, 'A'},
+        {"reg-diff", required_argument, 0, 'G'},
+        {"reg-range", required_argument, 0, 'I'},
+        {"bb-forward", required_argument, 0, 'O'},
+        {"spectrum", required_argument, 0, 'Q'},
+        {"fft",     required_argument, 0, 'L'},
+        {"chan-bw", required_argument, 0, 'N'},
+        {"watch",   required_argument, 0, 'K'},
+        {"missed",  required_argument, 0, 'X'},
+        {"discover", required_argument, 0, 'U'},
+        {"log",     required_argument, 0, 'Z'},
+        {"metrics", required_argument, 0, OPT_METRICS},
+        {"metrics-file", required_argument, 0, OPT_METRICS_FILE},
+        {"metrics-every", required_argument, 0, OPT_METRICS_EVERY},
+        {"help",    no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    //autogenerate the arg list
+    char arglist[2*sizeof(long_options)/sizeof(struct option)] = {0};
+    for(uint8_t i=0; i<sizeof(long_options)/sizeof(struct option)-1; i++)
+    {
+        if(long_options[i].val > 0xFF)
+            continue;
+        arglist[strlen(arglist)] = long_options[i].val;
+        if(long_options[i].has_arg != no_argument)
+            arglist[strlen(arglist)] = ':';
+    }
+
+    int opt;
+    int option_index = 0;
+
+    // Parse command line arguments
+    while ((opt = getopt_long(argc, argv, arglist, long_options, &option_index)) != -1) 
+    {
+        switch (opt) 
+        {
+            case 'r': // reset
+                dev_reset = 1;
+                break;
+
+            case 'i': // reset
+                get_ident = 1;
+                break;
+
+            case 'l': // device list file
+                fleet_file = optarg;
+                break;
+
+            case 'D': // run as daemon
+                daemon_ep = optarg;
+                break;
+
+            case 'V': // go through a running daemon
+                link_set_via(optarg);
+                break;
+
+            case 't': // request deadline
+                timeout = atoi(optarg);
+                if(timeout <= 0) {
+                    dbg_print(TERM_RED, "Invalid timeout\nExiting.\n");
+                    return 1;
+                }
+                link_set_timeout(timeout, retries);
+                timing |= 1;
+                break;
+
+            case 'n': // retries
+                retries = atoi(optarg);
+                if(retries < 0 || retries > 8) {
+                    dbg_print(TERM_RED, "Invalid number of retries (0-8)\nExiting.\n");
+                    return 1;
+                }
+                link_set_timeout(timeout, retries);
+                timing |= 2;
+                break;
+
+            case 'B': // benchmark
+                bench.count = strtoull(optarg, NULL, 10);
+                if(bench.count == 0) {
+                    dbg_print(TERM_RED, "Invalid number of probes\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'H': // probe rate
+                bench.rate = atof(optarg);
+                if(bench.rate < 0) {
+                    dbg_print(TERM_RED, "Invalid probe rate\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'w': // probes in flight
+                bench.window = atoi(optarg);
+                if(bench.window < 1 || bench.window > 65536) {
+                    dbg_print(TERM_RED, "Invalid window (1-65536)\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'P': // probe with GET_PARAM
+                bench.get_param = 1;
+                break;
+
+            case 'b': // baseband publisher
+                bb_rx.endpoint = optarg;
+                break;
+
+            case 'o': // baseband recording
+                bb_rx.path = optarg;
+                break;
+
+            case 'O': // baseband republishing
+                if(bb_rx.nforward == BB_MAX_FORWARD) {
+                    dbg_print(TERM_RED, "At most %d forwarding endpoints\nExiting.\n", BB_MAX_FORWARD);
+                    return 1;
+                }
+                bb_rx.forward[bb_rx.nforward++] = optarg;
+                break;
+
+            case 'Q': // spectrum monitor
+                bb_rx.spectrum.interval = atof(optarg);
+                if(bb_rx.spectrum.interval <= 0) {
+                    dbg_print(TERM_RED, "Invalid spectrum report interval\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'L': // FFT size
+                bb_rx.spectrum.fft = atoi(optarg);
+                if(bb_rx.spectrum.fft < FFT_MIN_SIZE || bb_rx.spectrum.fft > FFT_MAX_SIZE || (bb_rx.spectrum.fft & (bb_rx.spectrum.fft-1))) {
+                    dbg_print(TERM_RED, "Invalid FFT size (power of 2, %d-%d)\nExiting.\n", FFT_MIN_SIZE, FFT_MAX_SIZE);
+                    return 1;
+                }
+                break;
+
+            case 'N': // channel bandwidth
+                bb_rx.spectrum.chan_bw = atof(optarg);
+                if(bb_rx.spectrum.chan_bw <= 0) {
+                    dbg_print(TERM_RED, "Invalid channel bandwidth\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'z': // baseband ring size
+                bb_rx.ring = atoi(optarg);
+                if(bb_rx.ring < 16 || bb_rx.ring > (1<<20)) {
+                    dbg_print(TERM_RED, "Invalid ring size (16-1048576)\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'T': // receive duration
+                bb_rx.duration = atof(optarg);
+                if(bb_rx.duration < 0) {
+                    dbg_print(TERM_RED, "Invalid duration\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'x': // cf32 conversion and decimation
+                bb_rx.decim = atoi(optarg);
+                if(bb_rx.decim < 1 || bb_rx.decim > 1024) {
+                    dbg_print(TERM_RED, "Invalid decimation (1-1024)\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'k': // conversion kernel
+                bb_rx.kernel = dsp_kernel_parse(optarg);
+                if(bb_rx.kernel < DSP_AUTO) {
+                    dbg_print(TERM_RED, "Unknown kernel (auto, avx2, sse, scalar)\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'M': // SigMF recording
+                bb_rx.sigmf = 1;
+                break;
+
+            case 'S': // baseband sample rate
+                bb_rx.rate = atof(optarg);
+                if(bb_rx.rate < 0) {
+                    dbg_print(TERM_RED, "Invalid sample rate\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'u': // baseband playback
+                bb_tx.path = optarg;
+                break;
+
+            case 'q': // samples per message
+                bb_tx.batch = atoi(optarg);
+                if(bb_tx.batch < 1 || bb_tx.batch > (1<<24)) {
+                    dbg_print(TERM_RED, "Invalid batch size\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'W': // publisher HWM
+                bb_tx.hwm = atoi(optarg);
+                if(bb_tx.hwm < 1) {
+                    dbg_print(TERM_RED, "Invalid HWM\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'v': // supervision telemetry
+                spvn.interval = atof(optarg);
+                if(spvn.interval <= 0) {
+                    dbg_print(TERM_RED, "Invalid summary interval\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'E': // device cache file
+                cache_path = optarg;
+                break;
+
+            case 'e': // device cache TTL
+                cache_ttl = atoi(optarg);
+                if(cache_ttl < 0) {
+                    dbg_print(TERM_RED, "Invalid cache TTL\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'y': // send only what differs
+                converge |= 1;
+                break;
+
+            case 'Y': // converge against the device readback
+                converge |= 2;
+                break;
+
+            case 'j': // hop table
+                hop.path = optarg;
+                break;
+
+            case 'J': // hop table repetitions
+                hop.repeat = atoi(optarg);
+                if(hop.repeat < 1) {
+                    dbg_print(TERM_RED, "Invalid repeat count\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'g': // streaming script
+                script_path = optarg;
+                break;
+
+            case 'm': // register dump
+                regmap.dump = optarg;
+                break;
+
+            case 'A': // register load
+                regmap.load = optarg;
+                break;
+
+            case 'G': // register dump comparison
+                if(regmap.diff[1] != NULL) {
+                    dbg_print(TERM_RED, "At most two dumps can be compared\nExiting.\n");
+                    return 1;
+                }
+                regmap.diff[regmap.diff[0] != NULL] = optarg;
+                break;
+
+            case 'I': // register range
+            {
+                unsigned first, last;
+                char c;
+                if(sscanf(optarg, "%i-%i%c", &first, &last, &c) != 2 || first > last || last >= REGMAP_SIZE) {
+                    dbg_print(TERM_RED, "Invalid register range (FIRST-LAST, 0-255)\nExiting.\n");
+                    return 1;
+                }
+                regmap.first = first;
+                regmap.last = last;
+                break;
+            }
+
+            case 'K': // heartbeat watchdog
+                watch.interval = atoi(optarg);
+                if(watch.interval < WATCH_MIN_RTO) {
+                    dbg_print(TERM_RED, "Invalid heartbeat interval (at least %d ms)\nExiting.\n", WATCH_MIN_RTO);
+                    return 1;
+                }
+                break;
+
+            case 'X': // missed beats
+                watch.missed = atoi(optarg);
+                if(watch.missed < 1 || watch.missed > 100) {
+                    dbg_print(TERM_RED, "Invalid number of missed beats (1-100)\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'U': // address range sweep
+                if(discover_parse(&discover, optarg) != 0) {
+                    dbg_print(TERM_RED, "Invalid range (A.B.C.D[/PREFIX]:PORT[,PORT|FIRST-LAST...], up to %d ports and %d addresses)\nExiting.\n",
+                        DISCOVER_MAX_PORTS, DISCOVER_MAX_ADDRS);
+                    return 1;
+                }
+                break;
+
+            case 'Z': // status output format
+                if(strcmp(optarg, "term") == 0)
+                    log_fmt = LOG_TERM;
+                else if(strcmp(optarg, "json") == 0)
+                    log_fmt = LOG_JSON;
+                else if(strncmp(optarg, "bin:", 4) == 0 && optarg[4] != 0) {
+                    log_fmt = LOG_BIN;
+                    log_path = optarg+4;
+                }
+                else if(strncmp(optarg, "read:", 5) == 0 && optarg[5] != 0)
+                    log_read = optarg+5;
+                else {
+                    dbg_print(TERM_RED, "Invalid log format (term, json, bin:FILE or read:FILE)\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case OPT_METRICS: // Prometheus endpoint
+                metrics_addr = optarg;
+                break;
+
+            case OPT_METRICS_FILE: // metrics snapshot
+                metrics_file = optarg;
+                break;
+
+            case OPT_METRICS_EVERY: // snapshot period
+                metrics_every = atoi(optarg);
+                if(metrics_every < 1) {
+                    dbg_print(TERM_RED, "Invalid metrics file period (at least 1 s)\nExiting.\n");
+                    return 1;
+                }
+                break;
+
+            case 'h': // Help
+                print_help(argv[0]);
+                return 0;
+
+            case '?': // Unknown option
+                dbg_print(TERM_RED, "Unknown option or missing argument.\n");
+                print_help(argv[0]);
+                return 1;
+
+            default:
+                switch (config_parse_opt(&config, opt, optarg, 1))
+                {
+                    case 0:
+                        break;
+
+                    case -1:
+                        dbg_print(TERM_RED, "Exiting.\n");
+                        return 1;
+
+                    default:
+                        dbg_print(TERM_RED, "Unknown error while parsing options.\n");
+                        return 1;
+                }
+
+                if(opt == 'd') { //every destination is kept for fleet mode
+                    fleet_add(&fleet, &config);
+                    ndests++;
+                }
+                break;
+        }
+    }
+
+    // Check if we have enough parameters
+    if (argc < 2) {
+        dbg_print(TERM_RED, "Not enough params.\n");
+        print_help(argv[0]);
+        return 1;
+    }
+
+    if(log_read != NULL) {
+        if(log_replay(log_read, log_fmt == LOG_JSON ? LOG_JSON : LOG_TERM) != 0) {
+            dbg_print(TERM_RED, "Can not read the binary log %s\n", log_read);
+            return 1;
+        }
+        return 0;
+    }
+
+    //from here on status output is written by the logger thread
+    if(log_start(log_fmt, log_path) != 0) {
+        dbg_print(TERM_RED, "Can not open the log %s\n", log_path);
+        return 1;
+    }
+    atexit(log_stop);
+
+    if(metrics_addr != NULL && metrics_serve(metrics_addr) != 0) {
+        dbg_print(TERM_RED, "Can not serve metrics at %s\n", metrics_addr);
+        return 1;
+    }
+    if(metrics_file != NULL && metrics_snapshot(metrics_file, metrics_every) != 0) {
+        dbg_print(TERM_RED, "Can not write metrics to %s\n", metrics_file);
+        return 1;
+    }
+    atexit(metrics_stop);
+
+    void *zmq_ctx = zmq_ctx_new();
+
+    if(daemon_ep != NULL) {
+        int ret = daemon_run(zmq_ctx, daemon_ep);
+        zmq_ctx_destroy(zmq_ctx);
+        return ret;
+    }
+
+    if(discover.nports > 0) {
+        discover.timeout = (timing & 1) ? timeout : DISCOVER_TIMEOUT;
+        discover.retries = (timing & 2) ? retries : 0;
+        discover.window = bench.window ? bench.window : DISCOVER_WINDOW;
+
+        int ret = discover_run(zmq_ctx, &discover);
+        fleet_free(&fleet);
+        zmq_ctx_destroy(zmq_ctx);
+        return ret;
+    }
+
+    if(bench.count > 0) {
+        if(strlen(config.re_addr) == 0) {
+            dbg_print(TERM_YELLOW, "No device to benchmark, set one with `-d`\nExiting.\n");
+            return 1;
+        }
+
+        int ret = bench_run(zmq_ctx, config.re_addr, &bench);
+        fleet_free(&fleet);
+        zmq_ctx_destroy(zmq_ctx);
+        return ret;
+    }
+
+    if(hop.path != NULL) {
+        if(strlen(config.re_addr) == 0) {
+            dbg_print(TERM_YELLOW, "No device to retune, set one with `-d`\nExiting.\n");
+            return 1;
+        }
+
+        int ret = hop_run(zmq_ctx, config.re_addr, &hop);
+        fleet_free(&fleet);
+        zmq_ctx_destroy(zmq_ctx);
+        return ret;
+    }
+
+    if(script_path != NULL) {
+        int ret = script_run(zmq_ctx, script_path, strlen(config.re_addr) ? config.re_addr : NULL, long_options);
+        fleet_free(&fleet);
+        zmq_ctx_destroy(zmq_ctx);
+        return ret;
+    }
+
+    if(regmap.dump != NULL || regmap.load != NULL || regmap.diff[0] != NULL) {
+        if(strlen(config.re_addr) == 0 && regmap.diff[0] == NULL) {
+            dbg_print(TERM_YELLOW, "No device to read or write, set one with `-d`\nExiting.\n");
+            return 1;
+        }
+
+        regmap.window = bench.window ? bench.window : REGMAP_WINDOW;
+        regmap.converge = converge;
+        int ret = regmap_run(zmq_ctx, strlen(config.re_addr) ? config.re_addr : NULL, &regmap);
+        fleet_free(&fleet);
+        zmq_ctx_destroy(zmq_ctx);
+        return ret;
+    }
+
+    if(spvn.interval > 0) {
+        if(fleet_file != NULL && fleet_load(&fleet, fleet_file, &config, long_options) < 0) {
+            dbg_print(TERM_RED, "Exiting.\n");
+            return 1;
+        }
+        if(fleet.n == 0) {
+            dbg_print(TERM_YELLOW, "No device to supervise, set one with `-d` or `-l`\nExiting.\n");
+            return 1;
+        }
+
+        spvn.duration = bb_rx.duration;
+        int failed = spvn_run(&fleet, zmq_ctx, &spvn);
+        fleet_free(&fleet);
+        zmq_ctx_destroy(zmq_ctx);
+        return failed ? 1 : 0;
+    }
+
+    if(watch.interval > 0) {
+        //settings given after the last -d still apply to every device
+        for(int i=0; i<fleet.n; i++) {
+            char re_addr[sizeof(config.re_addr)];
+            strcpy(re_addr, fleet.dev[i].cfg.re_addr);
+            fleet.dev[i].cfg = config;
+            strcpy(fleet.dev[i].cfg.re_addr, re_addr);
+        }
+
+        if(fleet_file != NULL && fleet_load(&fleet, fleet_file, &config, long_options) < 0) {
+            dbg_print(TERM_RED, "Exiting.\n");
+            return 1;
+        }
+        if(fleet.n == 0) {
+            dbg_print(TERM_YELLOW, "No device to watch, set one with `-d` or `-l`\nExiting.\n");
+            return 1;
+        }
+
+        //restored devices have their state recorded, for converging later
+        struct devcache_t cache;
+        if(cache_ttl > 0 && devcache_open(&cache, cache_path ? cache_path : devcache_default_path(), cache_ttl) == 0)
+            fleet.cache = &cache;
+
+        watch.duration = bb_rx.duration;
+        int down = watch_run(&fleet, zmq_ctx, &watch);
+
+        if(fleet.cache != NULL)
+            devcache_close(&cache);
+
+        fleet_free(&fleet);
+        zmq_ctx_destroy(zmq_ctx);
+        return down ? 1 : 0;
+    }
+
+    bb_rx.freq = config.rx_freq;
+    bb_rx.spectrum.rate = bb_rx.rate;
+    bb_rx.spectrum.freq = config.rx_freq;
+    bb_tx.endpoint = config.my_addr;
+    bb_tx.rate = bb_rx.rate;
+    bb_tx.duration = bb_rx.duration;
+
+    if(bb_tx.path != NULL && strlen(config.my_addr) == 0) {
+        dbg_print(TERM_YELLOW, "No address to publish at, set one with `-s`\nExiting.\n");
+        return 1;
+    }
+
+    //playback only, nothing to configure
+    if(bb_tx.path != NULL && strlen(config.re_addr) == 0) {
+        struct bb_tx_t tx;
+        int ret = 1;
+
+        if(bb_tx_open(&tx, zmq_ctx, &bb_tx) == 0)
+            ret = bb_tx_stream(&tx);
+        bb_tx_close(&tx);
+        fleet_free(&fleet);
+        zmq_ctx_destroy(zmq_ctx);
+        return ret;
+    }
+
+    //baseband only, nothing to configure
+    if(bb_rx.endpoint != NULL && strlen(config.re_addr) == 0) {
+        int ret = bb_rx_run(zmq_ctx, &bb_rx);
+        fleet_free(&fleet);
+        zmq_ctx_destroy(zmq_ctx);
+        return ret;
+    }
+
+    //many devices at once?
+    if(fleet_file != NULL || ndests > 1) {
+        //settings given after the last -d still apply to every device
+        for(int i=0; i<fleet.n; i++) {
+            char re_addr[sizeof(config.re_addr)];
+            strcpy(re_addr, fleet.dev[i].cfg.re_addr);
+            fleet.dev[i].cfg = config;
+            strcpy(fleet.dev[i].cfg.re_addr, re_addr);
+        }
+
+        if(fleet_file != NULL && fleet_load(&fleet, fleet_file, &config, long_options) < 0) {
+            dbg_print(TERM_RED, "Exiting.\n");
+            return 1;
+        }
+
+        //known device states, for converging and to keep them up to date
+        struct devcache_t cache;
+        if(cache_ttl > 0 && devcache_open(&cache, cache_path ? cache_path : devcache_default_path(), cache_ttl) == 0)
+            fleet.cache = &cache;
+        fleet.converge = converge;
+
+        int failed = fleet_run(&fleet, zmq_ctx, dev_reset, get_ident);
+
+        if(fleet.cache != NULL)
+            devcache_close(&cache);
+
+        fleet_free(&fleet);
+        zmq_ctx_destroy(zmq_ctx);
+        return failed ? 1 : 0;
+    }
+    fleet_free(&fleet);
+
+    if(strlen(config.re_addr) == 0) { //lame validity check
+        dbg_print(TERM_YELLOW, "Too short remote device's address\nExiting.");
+        return 1;
+    }
+
+    //a single device goes through libcari too, one request batch at a time
+    struct cari_t* cari = cari_new(zmq_ctx);
+    struct cari_dev_t* ctrl = NULL;
+
+    dbg_print(0, "ZMQ CTRL ");
+    if(cari != NULL) {
+        int timeout, retries;
+        link_get_timeout(&timeout, &retries);
+        cari_set_timeout(cari, timeout, retries);
+        cari_set_window(cari, MAX_BATCH);
+        if(link_get_via() == NULL || cari_set_via(cari, link_get_via()) == 0)
+            ctrl = cari_dev_open(cari, config.re_addr);
+    }
+    if(ctrl != NULL) {
+        dbg_print(TERM_GREEN, "connected");
+        if(link_get_via() != NULL)
+            dbg_print(0, " via %s", link_get_via());
+        dbg_print(0, "\n");
+    } else {
+        dbg_print(TERM_YELLOW, "fail\nExiting.");
+        cari_free(cari);
+        return 1;
+    }
+
+    //collect all settings into one batch
+    struct pending_t batch[MAX_BATCH];
+    uint8_t n = config_to_batch(&config, batch);
+
+    //device info for the ident and local validation, from the cache if it is still fresh
+    struct devcache_t cache;
+    struct devcache_ent_t dev;
+    int cached = -1;
+    if(cache_ttl > 0 && (get_ident || n > 0)) {
+        if(devcache_open(&cache, cache_path ? cache_path : devcache_default_path(), cache_ttl) == 0)
+            cached = devcache_get(&cache, ctrl, config.re_addr, &dev);
+        devcache_close(&cache);
+    }
+
+    if(get_ident && cached >= 0) {
+        dbg_print(0, "Getting device's identifier string ");
+        dbg_print(TERM_GREEN, "OK");
+        dbg_print(0, cached ? " (cached)" : "");
+        dbg_print(TERM_DEFAULT, "\n\"%s\"\n", dev.ident);
+
+        cari_free(cari);
+        zmq_ctx_destroy(zmq_ctx);
+        return 0;
+    }
+
+    if(get_ident) {
+        struct pending_t req;
+        batch_add(&req, cari_encode(req.req, sizeof(req.req), CMD_DEV_GET_IDENT, NULL, 0), "Getting device's identifier string");
+        batch_exchange(ctrl, &req, 1, print_ident, NULL);
+
+        cari_free(cari);
+        zmq_ctx_destroy(zmq_ctx);
+        return req.done && req.err == ERR_OK ? 0 : 1;
+    }
+
+    if(dev_reset) {
+        struct pending_t req;
+        batch_add(&req, cari_enc_set_reg(req.req, sizeof(req.req), 0, 0), "Device reset");
+        uint8_t failed = apply_batch(ctrl, &req, 1);
+
+        //nothing is known about the settings after a reset
+        if(!failed && cache_ttl > 0 && devcache_open(&cache, cache_path ? cache_path : devcache_default_path(), cache_ttl) == 0) {
+            struct re_config_t unknown;
+            config_init(&unknown);
+            devcache_set_state(&cache, config.re_addr, &unknown);
+            devcache_close(&cache);
+        }
+
+        cari_free(cari);
+        zmq_ctx_destroy(zmq_ctx);
+        return failed ? 1 : 0;
+    }
+
+    //the publisher has to be up before SUB_CONN points the device at it
+    struct bb_tx_t tx = {0};
+    if(bb_tx.path != NULL && bb_tx_open(&tx, zmq_ctx, &bb_tx) != 0) {
+        bb_tx_close(&tx);
+        cari_free(cari);
+        zmq_ctx_destroy(zmq_ctx);
+        return 1;
+    }
+
+    //settings the device can not take are refused before anything is sent
+    if(cached >= 0 && devcache_check(&dev, &config) > 0) {
+        dbg_print(TERM_YELLOW, "Settings not applied\nExiting.\n");
+        bb_tx_close(&tx);
+        cari_free(cari);
+        zmq_ctx_destroy(zmq_ctx);
+        return 1;
+    }
+
+    //last known state, trusted for as long as the device info
+    struct re_config_t have;
+    config_init(&have);
+    if(cached >= 0 && time(NULL) - dev.t_state < cache_ttl)
+        have = dev.state;
+
+    if(converge && n > 0) {
+        struct re_config_t delta;
+        uint8_t same;
+
+        if(converge & 2) {
+            double t0 = now_ms();
+            uint8_t lost = config_readback(ctrl, &config, &have);
+            dbg_print(0, "Read back device state in %.2f ms", now_ms()-t0);
+            if(lost)
+                dbg_print(TERM_YELLOW, ", %d setting(s) unreadable\n", lost);
+            else
+                dbg_print(0, "\n");
+        }
+
+        same = config_diff(&config, &have, &delta);
+        n = config_to_batch(&delta, batch);
+        dbg_print(0, "%d setting(s) already in place, %d to change\n", same, n);
+    }
+
+    uint8_t failed = 0;
+    if(n > 0) {
+        double t0 = now_ms();
+        failed = apply_batch(ctrl, batch, n);
+
+        dbg_print(0, "Applied %d setting(s) in %.2f ms", n, now_ms()-t0);
+        if(failed)
+            dbg_print(TERM_YELLOW, ", %d failed\n", failed);
+        else
+            dbg_print(0, "\n");
+
+        for(uint8_t i=0; i<n; i++)
+            config_note_request(&have, &batch[i]);
+    }
+
+    //receive the stream the settings above (usually `--rx 1`) started
+    if(bb_rx.endpoint != NULL && !failed) {
+        failed = bb_rx_run(zmq_ctx, &bb_rx);
+
+        if(config.rx_ena == 1) {
+            struct pending_t req;
+            batch_add(&req, cari_enc_u8(req.req, sizeof(req.req), CMD_SUB_START_BB_STREAM, 0), "RX disable");
+            failed |= apply_batch(ctrl, &req, 1);
+            config_note_request(&have, &req);
+        }
+    }
+
+    //remember what the device now has
+    if(cached >= 0 && devcache_open(&cache, cache_path ? cache_path : devcache_default_path(), cache_ttl) == 0) {
+        devcache_set_state(&cache, config.re_addr, &have);
+        devcache_close(&cache);
+    }
+
+    if(tx.sock != NULL && !failed)
+        failed = bb_tx_stream(&tx);
+    bb_tx_close(&tx);
+
+    cari_free(cari);
+    zmq_ctx_destroy(zmq_ctx);
+
+    dbg_print(0, "Done, exiting.\n");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,636 @@
+/*
+ * cari-mock-rru.c
+ *
+ *  Mock Remote Radio Unit - the device side of the CARI control protocol,
+ *  for load testing the control plane on localhost
+ */
+
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "interface_cmds.h"
+#include "cari_codec.h"
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "ctrl.h"
+
+#define MAX_REPLY   96
+#define MAX_ENV     4       //envelope frames kept between the routing ID and the frame
+#define MAX_ENV_LEN 16
+
+//mock settings
+struct mock_config_t
+{
+    char bind_addr[64];
+    uint16_t port;          //first port
+    uint32_t devices;       //virtual devices, one port each
+    uint16_t threads;
+    double latency;         //ms
+    double jitter;          //ms, uniform +/-
+    double err_prob;        //probability of an error reply
+    double drop_prob;       //probability of no reply at all
+    double spvn_rate;       //supervision frames per second and device
+} mcfg;
+
+//supervision variables of every virtual device
+static const struct cari_spvn_info_t spvn_vars[] =
+{
+    {0, SPVN_F32, "temp_c"},
+    {1, SPVN_F32, "pa_current_a"},
+    {2, SPVN_F32, "vswr"},
+    {3, SPVN_U16, "supply_mv"}
+};
+#define SPVN_VARS   (sizeof(spvn_vars)/sizeof(spvn_vars[0]))
+
+//reply waiting for its artificial latency to pass
+struct delayed_t
+{
+    double due;             //ms
+    void* sock;
+    uint8_t id[255];
+    uint8_t id_len;
+    uint8_t env[MAX_ENV][MAX_ENV_LEN]; //envelope, echoed back like a REP socket does
+    uint8_t env_len[MAX_ENV];
+    uint8_t nenv;
+    uint8_t len;
+    uint8_t frame[MAX_REPLY];
+};
+
+//state of a single virtual device
+struct vdev_t
+{
+    void* sock;
+    uint16_t port;
+    uint8_t regs[256];
+    uint64_t rx_freq, tx_freq;
+    float rx_corr, tx_corr;
+    uint8_t afc, tx_pwr;
+    char sub_addr[128];
+    uint8_t bb_on;          //baseband stream state, nothing is streamed
+    uint8_t spvn_on;
+    struct delayed_t spvn_peer; //who started the supervision stream
+    float spvn[SPVN_VARS];  //current values, random walk
+};
+
+struct worker_t
+{
+    pthread_t thread;
+    void* zmq_ctx;
+    struct vdev_t* devs;
+    uint32_t ndev;
+    uint64_t rng;
+    struct delayed_t* heap; //min-heap on the due time
+    uint32_t nheap, cap;
+    uint64_t requests, replies, errors, dropped;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+//xorshift64*, per thread
+static double rnd(struct worker_t* w)
+{
+    w->rng ^= w->rng >> 12;
+    w->rng ^= w->rng << 25;
+    w->rng ^= w->rng >> 27;
+    return ((w->rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0/9007199254740992.0);
+}
+
+static int heap_push(struct worker_t* w, const struct delayed_t* d)
+{
+    if(w->nheap == w->cap)
+    {
+        uint32_t cap = w->cap ? w->cap*2 : 256;
+        struct delayed_t* heap = realloc(w->heap, cap*sizeof(struct delayed_t));
+        if(heap == NULL)
+            return -1;
+        w->heap = heap;
+        w->cap = cap;
+    }
+
+    uint32_t i = w->nheap++;
+    while(i > 0 && w->heap[(i-1)/2].due > d->due)
+    {
+        w->heap[i] = w->heap[(i-1)/2];
+        i = (i-1)/2;
+    }
+    w->heap[i] = *d;
+
+    return 0;
+}
+
+static void heap_pop(struct worker_t* w)
+{
+    struct delayed_t last = w->heap[--w->nheap];
+    uint32_t i = 0;
+
+    while(2*i+1 < w->nheap)
+    {
+        uint32_t c = 2*i+1;
+        if(c+1 < w->nheap && w->heap[c+1].due < w->heap[c].due)
+            c++;
+        if(last.due <= w->heap[c].due)
+            break;
+        w->heap[i] = w->heap[c];
+        i = c;
+    }
+    w->heap[i] = last;
+}
+
+static void send_delayed(const struct delayed_t* d)
+{
+    zmq_send(d->sock, d->id, d->id_len, ZMQ_SNDMORE|ZMQ_DONTWAIT);
+    for(uint8_t i=0; i<d->nenv; i++)
+        zmq_send(d->sock, d->env[i], d->env_len[i], ZMQ_SNDMORE|ZMQ_DONTWAIT);
+    zmq_send(d->sock, d->frame, d->len, ZMQ_DONTWAIT);
+}
+
+//execute a request (at least the CID) against the device state, returns the reply length
+static size_t handle_request(struct vdev_t* dev, const uint8_t* req, size_t len, uint8_t* rep)
+{
+    struct cari_frame_t f;
+    uint8_t pld[64];
+    uint8_t err = ERR_OK;
+    int ret = cari_decode_request(req, len, &f);
+
+    if(ret == CARI_DEC_CID)
+        return cari_enc_u8(rep, MAX_REPLY, req[0], ERR_CMD_UNSUP);
+    if(ret != CARI_DEC_OK)
+        return cari_enc_u8(rep, MAX_REPLY, req[0], ERR_MALFORMED);
+
+    switch(f.cid)
+    {
+        case CMD_PING:
+            break;
+
+        case CMD_DEV_GET_IDENT:
+            ret = snprintf((char*)pld, sizeof(pld), "CARI mock RRU port %u", dev->port);
+            return cari_encode(rep, MAX_REPLY, f.cid, pld, ret+1);
+
+        case CMD_DEV_SET_REG:
+            dev->regs[f.payload[0]] = f.payload[1];
+            if(f.payload[0] == 0) //reset
+            {
+                dev->rx_freq = dev->tx_freq = 0;
+                dev->afc = dev->tx_pwr = 0;
+                dev->sub_addr[0] = 0;
+                dev->bb_on = 0;
+                dev->spvn_on = 0;
+            }
+            break;
+
+        case CMD_DEV_GET_REG:
+            return cari_encode(rep, MAX_REPLY, f.cid, &dev->regs[f.payload[0]], 1);
+
+        case CMD_SUB_SET_PARAM:
+            if(cari_param_size(f.payload[0]) != f.payload_len-1)
+            {
+                err = (cari_param_size(f.payload[0]) < 0) ? ERR_RANGE : ERR_MALFORMED;
+                break;
+            }
+            switch(f.payload[0])
+            {
+                case PARAM_RX_FREQ:
+                case PARAM_TX_FREQ:
+                {
+                    uint64_t freq = cari_get_u64(&f.payload[1]);
+                    if(freq < 420000000U || freq > 450000000U)
+                        err = ERR_RANGE;
+                    else if(f.payload[0] == PARAM_RX_FREQ)
+                        dev->rx_freq = freq;
+                    else
+                        dev->tx_freq = freq;
+                    break;
+                }
+                case PARAM_RX_FREQ_CORR: dev->rx_corr = cari_get_f32(&f.payload[1]); break;
+                case PARAM_TX_FREQ_CORR: dev->tx_corr = cari_get_f32(&f.payload[1]); break;
+                case PARAM_AFC:          dev->afc = f.payload[1]; break;
+                case PARAM_TX_PWR:
+                    if(f.payload[1] > 47.75f/0.25f)
+                        err = ERR_RANGE;
+                    else
+                        dev->tx_pwr = f.payload[1];
+                    break;
+            }
+            break;
+
+        case CMD_SUB_GET_PARAM:
+        {
+            int size = cari_param_size(f.payload[0]);
+            if(size < 0)
+            {
+                err = ERR_RANGE;
+                return cari_encode(rep, MAX_REPLY, f.cid, &err, 1);
+            }
+            pld[0] = f.payload[0];
+            switch(f.payload[0])
+            {
+                case PARAM_RX_FREQ:      cari_put_u64(&pld[1], dev->rx_freq); break;
+                case PARAM_TX_FREQ:      cari_put_u64(&pld[1], dev->tx_freq); break;
+                case PARAM_RX_FREQ_CORR: cari_put_f32(&pld[1], dev->rx_corr); break;
+                case PARAM_TX_FREQ_CORR: cari_put_f32(&pld[1], dev->tx_corr); break;
+                case PARAM_AFC:          pld[1] = dev->afc; break;
+                case PARAM_TX_PWR:       pld[1] = dev->tx_pwr; break;
+            }
+            return cari_encode(rep, MAX_REPLY, f.cid, pld, 1+size);
+        }
+
+        case CMD_SUB_GET_CAPS:
+        {
+            struct cari_caps_t caps = {(1<<CAP_FM)|(1<<CAP_IQ)|(1<<CAP_DUPLEX), 420000000U, 450000000U, 420000000U, 450000000U, 47.75f};
+            return cari_enc_caps(rep, MAX_REPLY, &caps);
+        }
+
+        case CMD_SUB_CONN:
+            snprintf(dev->sub_addr, sizeof(dev->sub_addr), "%.*s", f.payload_len, f.payload);
+            break;
+
+        case CMD_DEV_GET_SPVN_LIST:
+            return cari_enc_spvn_list(rep, MAX_REPLY, spvn_vars, SPVN_VARS);
+
+        case CMD_SUB_START_BB_STREAM:
+            dev->bb_on = f.payload[0];
+            break;
+
+        case CMD_DEV_START_SPVN_STREAM:
+            dev->spvn_on = f.payload[0];
+            break;
+
+        default:
+            err = ERR_CMD_UNSUP;
+            break;
+    }
+
+    return cari_enc_u8(rep, MAX_REPLY, f.cid, err);
+}
+
+//take all pending requests off one device socket
+static void serve_device(struct worker_t* w, struct vdev_t* dev, double now)
+{
+    struct delayed_t d;
+    uint8_t req[1024];
+    int len;
+
+    while((len = zmq_recv(dev->sock, d.id, sizeof(d.id), ZMQ_DONTWAIT)) >= 0)
+    {
+        int more;
+        size_t more_size = sizeof(more);
+
+        d.id_len = len;
+        d.nenv = 0;
+        len = 0;
+
+        //[id][envelope...][empty][frame] from REQ/DEALER peers, [id][frame] from raw DEALERs
+        do
+        {
+            len = zmq_recv(dev->sock, req, sizeof(req), 0);
+            zmq_getsockopt(dev->sock, ZMQ_RCVMORE, &more, &more_size);
+            if(more && len >= 0 && d.nenv < MAX_ENV)
+            {
+                d.env_len[d.nenv] = (len < MAX_ENV_LEN) ? len : MAX_ENV_LEN;
+                memcpy(d.env[d.nenv], req, d.env_len[d.nenv]);
+                d.nenv++;
+            }
+        } while(more);
+
+        //an empty frame has no CID to answer with
+        if(len <= 0)
+            continue;
+        if(len > (int)sizeof(req))
+            len = sizeof(req);
+
+        w->requests++;
+        if(mcfg.drop_prob > 0 && rnd(w) < mcfg.drop_prob)
+        {
+            w->dropped++;
+            continue;
+        }
+
+        d.sock = dev->sock;
+        if(mcfg.err_prob > 0 && rnd(w) < mcfg.err_prob)
+        {
+            d.len = cari_enc_u8(d.frame, sizeof(d.frame), req[0], ERR_RANGE);
+            w->errors++;
+        }
+        else
+            d.len = handle_request(dev, req, len, d.frame);
+
+        //supervision samples go to whoever started the stream
+        if(req[0] == CMD_DEV_START_SPVN_STREAM && dev->spvn_on)
+            dev->spvn_peer = d;
+
+        double delay = mcfg.latency + (2.0*rnd(w) - 1.0)*mcfg.jitter;
+        if(delay <= 0)
+        {
+            send_delayed(&d);
+            w->replies++;
+        }
+        else
+        {
+            d.due = now + delay;
+            heap_push(w, &d);
+        }
+    }
+}
+
+//push one supervision frame to every device's stream subscriber
+static void push_spvn(struct worker_t* w, double now)
+{
+    for(uint32_t i=0; i<w->ndev; i++)
+    {
+        struct vdev_t* dev = &w->devs[i];
+        struct delayed_t* d = &dev->spvn_peer;
+        uint8_t pld[4 + SPVN_VARS*5];
+        uint16_t n = 4;
+
+        if(!dev->spvn_on)
+            continue;
+
+        if(dev->spvn[0] == 0) //first frame
+        {
+            dev->spvn[0] = 40.0f;
+            dev->spvn[1] = 2.0f;
+            dev->spvn[2] = 1.2f;
+            dev->spvn[3] = 28000.0f;
+        }
+        dev->spvn[0] += 0.05f * (2*rnd(w) - 1);
+        dev->spvn[1] = 2.0f + 0.2f*rnd(w) + dev->tx_pwr*0.01f;
+        dev->spvn[2] = 1.2f + 0.1f*rnd(w);
+        dev->spvn[3] = 28000.0f + 100.0f*(2*rnd(w) - 1);
+
+        cari_put_u32(pld, (uint32_t)(now*1e3));
+        for(uint8_t v=0; v<SPVN_VARS; v++)
+        {
+            pld[n++] = spvn_vars[v].id;
+            n += cari_spvn_put(&pld[n], spvn_vars[v].type, dev->spvn[v]);
+        }
+
+        d->len = cari_encode(d->frame, sizeof(d->frame), CMD_DEV_START_SPVN_STREAM, pld, n);
+        send_delayed(d);
+    }
+}
+
+static void* worker(void* arg)
+{
+    struct worker_t* w = arg;
+    zmq_pollitem_t* items = calloc(w->ndev, sizeof(zmq_pollitem_t));
+
+    for(uint32_t i=0; i<w->ndev; i++)
+    {
+        items[i].socket = w->devs[i].sock;
+        items[i].events = ZMQ_POLLIN;
+    }
+
+    double spvn_period = (mcfg.spvn_rate > 0) ? 1e3/mcfg.spvn_rate : 0;
+    double spvn_next = now_ms();
+
+    while(running)
+    {
+        double now = now_ms();
+        long wait = 100;
+
+        if(w->nheap > 0)
+            wait = (w->heap[0].due > now) ? (long)ceil(w->heap[0].due - now) : 0;
+        if(spvn_period > 0 && (long)ceil(spvn_next - now) < wait)
+            wait = (spvn_next > now) ? (long)ceil(spvn_next - now) : 0;
+
+        if(zmq_poll(items, w->ndev, wait) < 0)
+        {
+            if(zmq_errno() == EINTR)
+                continue;
+            break;
+        }
+
+        now = now_ms();
+        for(uint32_t i=0; i<w->ndev; i++)
+        {
+            if(items[i].revents & ZMQ_POLLIN)
+                serve_device(w, &w->devs[i], now);
+        }
+
+        //release replies whose time has come
+        while(w->nheap > 0 && w->heap[0].due <= now)
+        {
+            send_delayed(&w->heap[0]);
+            heap_pop(w);
+            w->replies++;
+        }
+
+        if(spvn_period > 0 && now >= spvn_next)
+        {
+            push_spvn(w, now);
+            spvn_next += spvn_period;
+            if(spvn_next < now) //fell behind, do not burst
+                spvn_next = now + spvn_period;
+        }
+    }
+
+    free(items);
+    return NULL;
+}
+
+void print_help(const char *program_name) {
+    printf("Usage: %s [OPTIONS]\n\n", program_name);
+    printf("CARI mock RRU\n\n");
+    printf("Options:\n");
+    printf("  -b, --bind=ADDR       Address to bind to (default 127.0.0.1), full endpoints like ipc:///tmp/rru get \":PORT\" appended\n");
+    printf("  -p, --port=PORT       Control port of the first virtual device (default 17002)\n");
+    printf("  -n, --devices=N       Number of virtual devices, one port each (default 1)\n");
+    printf("  -T, --threads=N       Worker threads (default 1)\n");
+    printf("  -l, --latency=MS      Artificial reply latency in ms (default 0)\n");
+    printf("  -j, --jitter=MS       Latency jitter in ms, uniform +/- (default 0)\n");
+    printf("  -e, --errors=P        Probability of an injected ERR_RANGE reply (0.0-1.0)\n");
+    printf("  -x, --drop=P          Probability of dropping a request without a reply (0.0-1.0)\n");
+    printf("  -s, --spvn-rate=HZ    Supervision frames per second and device once the stream is started (default 10)\n");
+    printf("  -h, --help            Display this help message and exit\n");
+    printf("\n");
+    printf("Example:\n");
+    printf("  %s -p 20000 -n 1000 -T 4 -l 5 -j 2 -e 0.01\n", program_name);
+}
+
+int main(int argc, char *argv[])
+{
+    // Initialize default values
+    strcpy(mcfg.bind_addr, "127.0.0.1");
+    mcfg.port = 17002;
+    mcfg.devices = 1;
+    mcfg.threads = 1;
+    mcfg.spvn_rate = 10;
+
+    // Define the long options
+    static struct option long_options[] =
+    {
+        {"bind",    required_argument, 0, 'b'},
+        {"port",    required_argument, 0, 'p'},
+        {"devices", required_argument, 0, 'n'},
+        {"threads", required_argument, 0, 'T'},
+        {"latency", required_argument, 0, 'l'},
+        {"jitter",  required_argument, 0, 'j'},
+        {"errors",  required_argument, 0, 'e'},
+        {"drop",    required_argument, 0, 'x'},
+        {"spvn-rate", required_argument, 0, 's'},
+        {"help",    no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    //autogenerate the arg list
+    char arglist[64] = {0};
+    for(uint8_t i=0; i<sizeof(long_options)/sizeof(struct option)-1; i++)
+    {
+        arglist[strlen(arglist)] = long_options[i].val;
+        if(long_options[i].has_arg != no_argument)
+            arglist[strlen(arglist)] = ':';
+    }
+
+    int opt;
+    int option_index = 0;
+
+    // Parse command line arguments
+    while ((opt = getopt_long(argc, argv, arglist, long_options, &option_index)) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                snprintf(mcfg.bind_addr, sizeof(mcfg.bind_addr), "%s", optarg);
+                break;
+
+            case 'p':
+            {
+                char* end;
+                unsigned long port = strtoul(optarg, &end, 10);
+                if(end == optarg || *end != 0 || port == 0 || port > 65535)
+                {
+                    dbg_print(TERM_RED, "Invalid port (1-65535)\nExiting.\n");
+                    return 1;
+                }
+                mcfg.port = port;
+                break;
+            }
+
+            case 'n':
+                mcfg.devices = atoi(optarg);
+                break;
+
+            case 'T':
+                mcfg.threads = atoi(optarg);
+                break;
+
+            case 'l':
+                mcfg.latency = atof(optarg);
+                break;
+
+            case 'j':
+                mcfg.jitter = atof(optarg);
+                break;
+
+            case 'e':
+                mcfg.err_prob = atof(optarg);
+                break;
+
+            case 'x':
+                mcfg.drop_prob = atof(optarg);
+                break;
+
+            case 's':
+                mcfg.spvn_rate = atof(optarg);
+                break;
+
+            case 'h': // Help
+                print_help(argv[0]);
+                return 0;
+
+            default:
+                print_help(argv[0]);
+                return 1;
+        }
+    }
+
+    if(mcfg.devices == 0 || mcfg.threads == 0 || mcfg.port + mcfg.devices - 1 > 65535) {
+        dbg_print(TERM_RED, "Invalid device/thread count or port range.\nExiting.\n");
+        return 1;
+    }
+    if(mcfg.threads > mcfg.devices)
+        mcfg.threads = mcfg.devices;
+
+    void *zmq_ctx = zmq_ctx_new();
+    zmq_ctx_set(zmq_ctx, ZMQ_IO_THREADS, mcfg.threads);
+    zmq_ctx_set(zmq_ctx, ZMQ_MAX_SOCKETS, mcfg.devices + 64);
+
+    struct vdev_t* devs = calloc(mcfg.devices, sizeof(struct vdev_t));
+    struct worker_t* workers = calloc(mcfg.threads, sizeof(struct worker_t));
+
+    //contiguous block of devices per thread
+    for(uint32_t i=0; i<mcfg.devices; i++)
+    {
+        char addr[96];
+        int linger = 0;
+
+        devs[i].port = mcfg.port + i;
+        devs[i].sock = zmq_socket(zmq_ctx, ZMQ_ROUTER);
+        zmq_setsockopt(devs[i].sock, ZMQ_LINGER, &linger, sizeof(linger));
+        if(strstr(mcfg.bind_addr, "://") != NULL) //ipc:// or other transports, the port is just a suffix
+            snprintf(addr, sizeof(addr), "%s:%u", mcfg.bind_addr, devs[i].port);
+        else
+            snprintf(addr, sizeof(addr), "tcp://%s:%u", mcfg.bind_addr, devs[i].port);
+        if(zmq_bind(devs[i].sock, addr) != 0) {
+            dbg_print(TERM_RED, "Can not bind to %s: %s\nExiting.\n", addr, zmq_strerror(zmq_errno()));
+            return 1;
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    uint32_t per = mcfg.devices / mcfg.threads;
+    uint32_t first = 0;
+    for(uint16_t t=0; t<mcfg.threads; t++)
+    {
+        struct worker_t* w = &workers[t];
+        w->zmq_ctx = zmq_ctx;
+        w->devs = &devs[first];
+        w->ndev = (t == mcfg.threads-1) ? mcfg.devices - first : per;
+        w->rng = 0x9E3779B97F4A7C15ULL * (t+1);
+        first += w->ndev;
+        pthread_create(&w->thread, NULL, worker, w);
+    }
+
+    dbg_print(0, "Mock RRU: ");
+    dbg_print(TERM_GREEN, "%u device(s) at %s:%u-%u", mcfg.devices, mcfg.bind_addr, mcfg.port, mcfg.port+mcfg.devices-1);
+    dbg_print(0, ", %u thread(s), latency %.2f+/-%.2f ms, errors %.3f, drops %.3f\n",
+        mcfg.threads, mcfg.latency, mcfg.jitter, mcfg.err_prob, mcfg.drop_prob);
+    fflush(stdout);
+
+    uint64_t requests = 0, replies = 0, errors = 0, dropped = 0;
+    for(uint16_t t=0; t<mcfg.threads; t++)
+    {
+        pthread_join(workers[t].thread, NULL);
+        requests += workers[t].requests;
+        replies += workers[t].replies;
+        errors += workers[t].errors;
+        dropped += workers[t].dropped;
+        free(workers[t].heap);
+    }
+
+    dbg_print(0, "%lu request(s), %lu repl(ies), %lu injected error(s), %lu dropped\n", requests, replies, errors, dropped);
+
+    for(uint32_t i=0; i<mcfg.devices; i++)
+        zmq_close(devs[i].sock);
+    free(devs);
+    free(workers);
+    zmq_ctx_destroy(zmq_ctx);
+
+    return 0;
+}
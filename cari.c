@@ -0,0 +1,828 @@
+/*
+ * cari.c
+ *
+ *  libcari - non-blocking CARI control of any number of devices
+ *
+ *  All devices share one ROUTER socket. Each device is a connection of its
+ *  own, addressed by the routing ID set with ZMQ_CONNECT_ROUTING_ID: its slot
+ *  in the device table and a generation, bumped whenever the connection is
+ *  replaced, so late replies to a dropped connection are recognized and
+ *  ignored. Through the daemon every device shares the daemon's connection
+ *  and replies are told apart by the device address the daemon puts in front
+ *  of the frame.
+ *
+ *  Requests come from a pool that grows in chunks and is never shrunk. Every
+ *  device keeps its requests in flight in send order, plus a backlog of the
+ *  ones waiting for room in its window. Only the oldest request of a device
+ *  is watched for its deadline; when it passes, the connection is replaced
+ *  and everything still in flight is sent again.
+ */
+
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "cari.h"
+#include "ctrl.h"
+#include "cari_codec.h"
+#include "metrics.h"
+
+#define CARI_CHUNK      256     //requests allocated at once
+#define CARI_RID_LEN    8       //[slot u32][generation u32]
+#define CARI_VIA_SLOT   0xFFFFFFFF
+
+struct cari_op_t
+{
+    struct cari_result_t res;
+    struct cari_op_t* next;
+    cari_cb_t cb;
+    zmq_msg_t reply;            //holds the payload until the result is released
+    uint8_t has_reply;
+    int mdev;                   //metrics series of the device
+    double t_sent;              //ms
+    double deadline;            //ms
+    uint16_t len;
+    uint8_t req[CARI_REQ_MAX];
+};
+
+struct cari_chunk_t
+{
+    struct cari_chunk_t* next;
+    struct cari_op_t ops[CARI_CHUNK];
+};
+
+struct cari_dev_t
+{
+    struct cari_t* c;
+    char addr[128];
+    char endpoint[136];
+    uint32_t slot;
+    uint32_t gen;
+    uint8_t via;
+    int mdev;
+    int timeout;
+    int retries;
+    uint32_t window;
+    struct cari_op_t* head;     //in flight, oldest first
+    struct cari_op_t* tail;
+    uint32_t inflight;
+    struct cari_op_t* qhead;    //waiting for room in the window
+    struct cari_op_t* qtail;
+    uint32_t queued;
+    int32_t busy;               //index in cari_t.busy, -1 - nothing in flight
+    uint8_t dirty;              //in cari_t.dirty
+};
+
+struct cari_t
+{
+    void* zmq_ctx;
+    uint8_t own_ctx;
+    void* sock;
+    char via[136];              //daemon endpoint, empty - direct
+
+    int timeout;
+    int retries;
+    uint32_t window;
+
+    struct cari_dev_t** dev;    //by slot, NULL once closed
+    uint32_t ndev, cap;
+    int32_t* hash;              //slots by address, open addressing, -1 - empty
+    uint32_t hcap;
+
+    struct cari_dev_t** busy;   //devices with requests in flight
+    uint32_t nbusy;
+    struct cari_dev_t** dirty;  //devices with a backlog to send
+    uint32_t ndirty;
+
+    struct cari_op_t* free;
+    struct cari_chunk_t* chunks;
+    struct cari_op_t* done_head;    //completed without a callback
+    struct cari_op_t* done_tail;
+    struct cari_op_t* current;      //last one returned by cari_next()
+
+    uint64_t next_id;
+    uint64_t pending;
+    struct cari_stats_t stats;
+};
+
+static uint32_t hash_addr(const char* s)
+{
+    uint32_t h = 2166136261u;   //FNV-1a
+
+    while(*s)
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+static struct cari_dev_t* find_dev(const struct cari_t* c, const char* addr)
+{
+    if(c->hcap == 0)
+        return NULL;
+
+    for(uint32_t i = hash_addr(addr) & (c->hcap-1); c->hash[i] >= 0; i = (i+1) & (c->hcap-1))
+    {
+        struct cari_dev_t* d = c->dev[c->hash[i]];
+        if(d != NULL && strcmp(d->addr, addr) == 0) //closed devices are left in as tombstones
+            return d;
+    }
+
+    return NULL;
+}
+
+static void hash_insert(struct cari_t* c, uint32_t slot)
+{
+    uint32_t i = hash_addr(c->dev[slot]->addr) & (c->hcap-1);
+
+    while(c->hash[i] >= 0)
+        i = (i+1) & (c->hcap-1);
+    c->hash[i] = slot;
+}
+
+//room for one more device in the tables
+static int reserve_dev(struct cari_t* c)
+{
+    if(c->ndev == c->cap)
+    {
+        uint32_t cap = c->cap ? c->cap*2 : 64;
+        struct cari_dev_t** dev = realloc(c->dev, cap*sizeof(struct cari_dev_t*));
+        if(dev == NULL)
+            return -1;
+        c->dev = dev;
+
+        struct cari_dev_t** busy = realloc(c->busy, cap*sizeof(struct cari_dev_t*));
+        if(busy == NULL)
+            return -1;
+        c->busy = busy;
+
+        struct cari_dev_t** dirty = realloc(c->dirty, cap*sizeof(struct cari_dev_t*));
+        if(dirty == NULL)
+            return -1;
+        c->dirty = dirty;
+
+        c->cap = cap;
+    }
+
+    //rehash at half load, dropping the tombstones
+    if(2*(c->ndev+1) > c->hcap)
+    {
+        uint32_t hcap = c->hcap ? c->hcap*2 : 128;
+        int32_t* hash = malloc(hcap*sizeof(int32_t));
+        if(hash == NULL)
+            return -1;
+
+        memset(hash, 0xFF, hcap*sizeof(int32_t));
+        free(c->hash);
+        c->hash = hash;
+        c->hcap = hcap;
+        for(uint32_t i=0; i<c->ndev; i++)
+            if(c->dev[i] != NULL)
+                hash_insert(c, i);
+    }
+
+    return 0;
+}
+
+static struct cari_op_t* op_alloc(struct cari_t* c)
+{
+    if(c->free == NULL)
+    {
+        struct cari_chunk_t* chunk = malloc(sizeof(struct cari_chunk_t));
+        if(chunk == NULL)
+            return NULL;
+
+        chunk->next = c->chunks;
+        c->chunks = chunk;
+        for(int i=CARI_CHUNK-1; i>=0; i--)
+        {
+            chunk->ops[i].next = c->free;
+            c->free = &chunk->ops[i];
+        }
+    }
+
+    struct cari_op_t* op = c->free;
+    c->free = op->next;
+    op->next = NULL;
+    return op;
+}
+
+static void op_release(struct cari_t* c, struct cari_op_t* op)
+{
+    if(op->has_reply)
+        zmq_msg_close(&op->reply);
+    op->has_reply = 0;
+    op->next = c->free;
+    c->free = op;
+}
+
+static void set_busy(struct cari_t* c, struct cari_dev_t* d)
+{
+    if(d->inflight > 0 && d->busy < 0)
+    {
+        d->busy = c->nbusy;
+        c->busy[c->nbusy++] = d;
+    }
+    else if(d->inflight == 0 && d->busy >= 0)
+    {
+        struct cari_dev_t* last = c->busy[--c->nbusy];
+        c->busy[d->busy] = last;
+        last->busy = d->busy;
+        d->busy = -1;
+    }
+}
+
+static void set_dirty(struct cari_t* c, struct cari_dev_t* d)
+{
+    if(!d->dirty && d->queued > 0 && d->inflight < d->window)
+    {
+        d->dirty = 1;
+        c->dirty[c->ndirty++] = d;
+    }
+}
+
+static int attempt_timeout(const struct cari_dev_t* d, uint8_t attempt)
+{
+    return d->timeout << (attempt > 8 ? 8 : attempt);
+}
+
+static int send_op(struct cari_dev_t* d, struct cari_op_t* op, double now)
+{
+    struct cari_t* c = d->c;
+    uint8_t rid[CARI_RID_LEN];
+
+    cari_put_u32(rid, d->via ? CARI_VIA_SLOT : d->slot);
+    cari_put_u32(rid+4, d->via ? 0 : d->gen);
+
+    op->t_sent = now;
+    op->deadline = now + attempt_timeout(d, op->res.attempts-1);
+    c->stats.sent++;
+
+    //ROUTER sends never block, a full or missing connection drops the request and the deadline takes care of it
+    if(zmq_send(c->sock, rid, sizeof(rid), ZMQ_SNDMORE|ZMQ_DONTWAIT) < 0
+        || zmq_send(c->sock, NULL, 0, ZMQ_SNDMORE|ZMQ_DONTWAIT) < 0)
+        return -1;
+    if(d->via && zmq_send(c->sock, d->addr, strlen(d->addr), ZMQ_SNDMORE|ZMQ_DONTWAIT) < 0)
+        return -1;
+
+    return zmq_send(c->sock, op->req, op->len, ZMQ_DONTWAIT);
+}
+
+static int connect_dev(struct cari_dev_t* d)
+{
+    uint8_t rid[CARI_RID_LEN];
+
+    cari_put_u32(rid, d->slot);
+    cari_put_u32(rid+4, d->gen);
+
+    if(zmq_setsockopt(d->c->sock, ZMQ_CONNECT_ROUTING_ID, rid, sizeof(rid)) != 0)
+        return -1;
+    return zmq_connect(d->c->sock, d->endpoint);
+}
+
+//move requests from the backlog into the window
+static void flush(struct cari_t* c, struct cari_dev_t* d, double now)
+{
+    while(d->qhead != NULL && d->inflight < d->window)
+    {
+        struct cari_op_t* op = d->qhead;
+
+        d->qhead = op->next;
+        if(d->qhead == NULL)
+            d->qtail = NULL;
+        d->queued--;
+
+        op->next = NULL;
+        if(d->tail != NULL)
+            d->tail->next = op;
+        else
+            d->head = op;
+        d->tail = op;
+        d->inflight++;
+
+        op->res.attempts = 1;
+        send_op(d, op, now);
+    }
+
+    set_busy(c, d);
+}
+
+static void complete(struct cari_t* c, struct cari_op_t* op)
+{
+    c->stats.completed++;
+    c->stats.failed += (op->res.err < ERR_OK);
+    metrics_req(op->mdev, op->res.cid, op->res.err, op->res.attempts, op->res.rtt);
+
+    if(op->cb != NULL)
+    {
+        op->cb(&op->res);
+        c->pending--;
+        op_release(c, op);
+        return;
+    }
+
+    op->next = NULL;
+    if(c->done_tail != NULL)
+        c->done_tail->next = op;
+    else
+        c->done_head = op;
+    c->done_tail = op;
+}
+
+//the oldest request in flight for the same command takes the reply
+static struct cari_op_t* match(struct cari_dev_t* d, zmq_msg_t* frame, double now)
+{
+    const uint8_t* rep = zmq_msg_data(frame);
+    struct cari_op_t* prev = NULL;
+    struct cari_frame_t f;
+
+    if(zmq_msg_size(frame) < 1)
+        return NULL;
+
+    for(struct cari_op_t* op = d->head; op != NULL; prev = op, op = op->next)
+    {
+        if(op->res.cid != rep[0])
+            continue;
+
+        if(prev != NULL)
+            prev->next = op->next;
+        else
+            d->head = op->next;
+        if(d->tail == op)
+            d->tail = prev;
+        d->inflight--;
+        set_busy(d->c, d);
+        set_dirty(d->c, d);
+
+        op->res.rtt = now - op->t_sent;
+        zmq_msg_init(&op->reply);
+        zmq_msg_move(&op->reply, frame);
+        op->has_reply = 1;
+        if(cari_decode_reply_msg(op->res.cid, &op->reply, &f) == CARI_DEC_OK)
+        {
+            op->res.err = f.err;
+            op->res.payload = f.payload;
+            op->res.payload_len = f.payload_len;
+        }
+        else
+            op->res.err = CARI_MALFORMED;
+
+        return op;
+    }
+
+    return NULL;
+}
+
+//a complete multipart message from the socket, returns 0 if there was none
+static int recv_one(struct cari_t* c, double now, int* completed)
+{
+    zmq_msg_t rid, part, dest;
+    struct cari_dev_t* d = NULL;
+
+    zmq_msg_init(&rid);
+    if(zmq_msg_recv(&rid, c->sock, ZMQ_DONTWAIT) < 0)
+    {
+        zmq_msg_close(&rid);
+        return 0;
+    }
+
+    //[rid]([empty])[dest when via][frame], the frame is the last part
+    zmq_msg_init(&part);
+    zmq_msg_init(&dest);
+    uint8_t more = zmq_msg_more(&rid);
+    while(more)
+    {
+        zmq_msg_move(&dest, &part);
+        zmq_msg_init(&part);
+        if(zmq_msg_recv(&part, c->sock, 0) < 0)
+            break;
+        more = zmq_msg_more(&part);
+    }
+
+    if(zmq_msg_size(&rid) == CARI_RID_LEN)
+    {
+        uint32_t slot = cari_get_u32(zmq_msg_data(&rid));
+        uint32_t gen = cari_get_u32((uint8_t*)zmq_msg_data(&rid) + 4);
+
+        if(slot == CARI_VIA_SLOT)
+        {
+            char addr[128];
+            size_t len = zmq_msg_size(&dest);
+            if(len < sizeof(addr))
+            {
+                memcpy(addr, zmq_msg_data(&dest), len);
+                addr[len] = 0;
+                d = find_dev(c, addr);
+            }
+        }
+        else if(slot < c->ndev && c->dev[slot] != NULL && c->dev[slot]->gen == gen)
+            d = c->dev[slot];
+    }
+
+    struct cari_op_t* op = (d != NULL) ? match(d, &part, now) : NULL;
+    if(op != NULL)
+    {
+        complete(c, op);
+        (*completed)++;
+    }
+    else
+        c->stats.stray++;
+
+    zmq_msg_close(&rid);
+    zmq_msg_close(&part);
+    zmq_msg_close(&dest);
+    return 1;
+}
+
+//deadline of the oldest request passed, send everything in flight again over a fresh connection
+//requests out of retries are moved to the finished list instead
+static void expire(struct cari_t* c, struct cari_dev_t* d, double now, struct cari_op_t** finished)
+{
+    struct cari_op_t* prev = NULL;
+    struct cari_op_t* op = d->head;
+
+    if(!d->via)
+    {
+        zmq_disconnect(c->sock, d->endpoint);
+        d->gen++;
+        connect_dev(d);
+        c->stats.reconnects++;
+    }
+
+    while(op != NULL)
+    {
+        struct cari_op_t* next = op->next;
+
+        if(now >= op->deadline && op->res.attempts > d->retries)
+        {
+            if(prev != NULL)
+                prev->next = next;
+            else
+                d->head = next;
+            if(d->tail == op)
+                d->tail = prev;
+            d->inflight--;
+
+            op->res.err = CARI_NO_REPLY;
+            op->next = *finished;
+            *finished = op;
+        }
+        else
+        {
+            //only requests past their deadline use up an attempt
+            if(now >= op->deadline)
+                op->res.attempts++;
+            send_op(d, op, now);
+            prev = op;
+        }
+        op = next;
+    }
+
+    set_busy(c, d);
+    set_dirty(c, d);
+}
+
+struct cari_t* cari_new(void* zmq_ctx)
+{
+    struct cari_t* c = calloc(1, sizeof(struct cari_t));
+    int linger = 0, hwm = 0;
+
+    if(c == NULL)
+        return NULL;
+
+    c->own_ctx = (zmq_ctx == NULL);
+    c->zmq_ctx = c->own_ctx ? zmq_ctx_new() : zmq_ctx;
+    c->timeout = CARI_TIMEOUT;
+    c->retries = CARI_RETRIES;
+    c->window = CARI_WINDOW;
+    c->sock = (c->zmq_ctx != NULL) ? zmq_socket(c->zmq_ctx, ZMQ_ROUTER) : NULL;
+    if(c->sock == NULL)
+    {
+        cari_free(c);
+        return NULL;
+    }
+
+    //outstanding requests are bounded by the windows, the daemon connection carries all of them
+    zmq_setsockopt(c->sock, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(c->sock, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+    zmq_setsockopt(c->sock, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+
+    return c;
+}
+
+void cari_free(struct cari_t* c)
+{
+    if(c == NULL)
+        return;
+
+    for(uint32_t i=0; i<c->ndev; i++)
+    {
+        struct cari_dev_t* d = c->dev[i];
+        if(d == NULL)
+            continue;
+        for(struct cari_op_t* op = d->head; op != NULL; op = op->next)
+            if(op->has_reply)
+                zmq_msg_close(&op->reply);
+        free(d);
+    }
+    for(struct cari_op_t* op = c->done_head; op != NULL; op = op->next)
+        if(op->has_reply)
+            zmq_msg_close(&op->reply);
+    if(c->current != NULL && c->current->has_reply)
+        zmq_msg_close(&c->current->reply);
+
+    while(c->chunks != NULL)
+    {
+        struct cari_chunk_t* next = c->chunks->next;
+        free(c->chunks);
+        c->chunks = next;
+    }
+
+    if(c->sock != NULL)
+        zmq_close(c->sock);
+    if(c->own_ctx && c->zmq_ctx != NULL)
+        zmq_ctx_destroy(c->zmq_ctx);
+
+    free(c->dev);
+    free(c->hash);
+    free(c->busy);
+    free(c->dirty);
+    free(c);
+}
+
+void cari_set_timeout(struct cari_t* c, int timeout, int retries)
+{
+    c->timeout = timeout;
+    c->retries = retries;
+}
+
+void cari_set_window(struct cari_t* c, uint32_t window)
+{
+    c->window = window ? window : 1;
+}
+
+int cari_set_via(struct cari_t* c, const char* endpoint)
+{
+    uint8_t rid[CARI_RID_LEN];
+
+    if(endpoint == NULL)
+    {
+        c->via[0] = 0;
+        return 0;
+    }
+    if(c->via[0] != 0) //already connected, one daemon per context
+        return strcmp(c->via, endpoint) == 0 ? 0 : -1;
+
+    cari_put_u32(rid, CARI_VIA_SLOT);
+    cari_put_u32(rid+4, 0);
+    if(zmq_setsockopt(c->sock, ZMQ_CONNECT_ROUTING_ID, rid, sizeof(rid)) != 0 || zmq_connect(c->sock, endpoint) != 0)
+        return -1;
+
+    snprintf(c->via, sizeof(c->via), "%s", endpoint);
+    return 0;
+}
+
+struct cari_dev_t* cari_dev_open(struct cari_t* c, const char* addr)
+{
+    struct cari_dev_t* d = find_dev(c, addr);
+
+    if(d != NULL)
+        return d;
+    if(strlen(addr) == 0 || strlen(addr) >= sizeof(d->addr) || reserve_dev(c) != 0)
+        return NULL;
+
+    d = calloc(1, sizeof(struct cari_dev_t));
+    if(d == NULL)
+        return NULL;
+
+    d->c = c;
+    snprintf(d->addr, sizeof(d->addr), "%s", addr);
+    d->slot = c->ndev;
+    d->via = (c->via[0] != 0);
+    d->timeout = c->timeout;
+    d->retries = c->retries;
+    d->window = c->window;
+    d->busy = -1;
+    d->mdev = metrics_dev(addr);
+
+    if(!d->via)
+    {
+        ctrl_make_addr(d->endpoint, sizeof(d->endpoint), addr);
+        if(connect_dev(d) != 0)
+        {
+            free(d);
+            return NULL;
+        }
+    }
+    else
+        snprintf(d->endpoint, sizeof(d->endpoint), "%s", c->via);
+
+    c->dev[c->ndev++] = d;
+    hash_insert(c, d->slot);
+    return d;
+}
+
+void cari_dev_close(struct cari_dev_t* d)
+{
+    struct cari_t* c = d->c;
+
+    if(!d->via)
+        zmq_disconnect(c->sock, d->endpoint);
+    c->dev[d->slot] = NULL;
+
+    d->inflight = 0;
+    set_busy(c, d);
+    for(uint32_t i=0; i<c->ndirty; i++)
+    {
+        if(c->dirty[i] == d)
+        {
+            c->dirty[i] = c->dirty[--c->ndirty];
+            break;
+        }
+    }
+
+    //in flight, then the backlog
+    if(d->tail != NULL)
+        d->tail->next = d->qhead;
+    else
+        d->head = d->qhead;
+
+    struct cari_op_t* op = d->head;
+    free(d);
+
+    while(op != NULL)
+    {
+        struct cari_op_t* next = op->next;
+        op->res.dev = NULL;
+        op->res.err = CARI_CANCELLED;
+        complete(c, op);
+        op = next;
+    }
+}
+
+const char* cari_dev_addr(const struct cari_dev_t* d)
+{
+    return d->addr;
+}
+
+int cari_dev_mdev(const struct cari_dev_t* d)
+{
+    return d->mdev;
+}
+
+struct cari_t* cari_dev_ctx(const struct cari_dev_t* d)
+{
+    return d->c;
+}
+
+uint32_t cari_dev_pending(const struct cari_dev_t* d)
+{
+    return d->inflight + d->queued;
+}
+
+void cari_dev_set_timeout(struct cari_dev_t* d, int timeout, int retries)
+{
+    d->timeout = timeout;
+    d->retries = retries;
+}
+
+uint64_t cari_submit(struct cari_dev_t* d, const uint8_t* frame, uint16_t len, cari_cb_t cb, void* arg)
+{
+    struct cari_t* c = d->c;
+    struct cari_op_t* op;
+
+    if(len < 1 || len > CARI_REQ_MAX || (op = op_alloc(c)) == NULL)
+        return 0;
+
+    memcpy(op->req, frame, len);
+    op->len = len;
+    op->cb = cb;
+    op->has_reply = 0;
+    op->mdev = d->mdev;
+    op->res = (struct cari_result_t){.dev = d, .arg = arg, .id = ++c->next_id, .cid = frame[0], .err = CARI_NO_REPLY};
+
+    if(d->qtail != NULL)
+        d->qtail->next = op;
+    else
+        d->qhead = op;
+    d->qtail = op;
+    d->queued++;
+
+    c->pending++;
+    c->stats.submitted++;
+    set_dirty(c, d);
+
+    return op->res.id;
+}
+
+int cari_process(struct cari_t* c)
+{
+    struct cari_op_t* finished = NULL;
+    double now = now_ms();
+    int completed = 0;
+
+    //devices may be removed from the busy list while walking it
+    for(uint32_t i=0; i<c->nbusy; )
+    {
+        struct cari_dev_t* d = c->busy[i];
+
+        if(now >= d->head->deadline)
+            expire(c, d, now, &finished);
+        if(i < c->nbusy && c->busy[i] == d)
+            i++;
+    }
+
+    //callbacks run once the device tables are consistent again
+    while(finished != NULL)
+    {
+        struct cari_op_t* next = finished->next;
+        complete(c, finished);
+        completed++;
+        finished = next;
+    }
+
+    for(;;)
+    {
+        //callbacks may submit more, send it in the same round
+        while(c->ndirty > 0)
+        {
+            struct cari_dev_t* d = c->dirty[--c->ndirty];
+            d->dirty = 0;
+            flush(c, d, now);
+        }
+
+        while(recv_one(c, now_ms(), &completed))
+            ;
+
+        //ZMQ_FD is edge triggered, it only fires again once everything has been read
+        int events = 0;
+        size_t size = sizeof(events);
+        zmq_getsockopt(c->sock, ZMQ_EVENTS, &events, &size);
+        if(!(events & ZMQ_POLLIN) && c->ndirty == 0)
+            break;
+        now = now_ms();
+    }
+
+    return completed;
+}
+
+int cari_fd(struct cari_t* c)
+{
+    int fd = -1;
+    size_t size = sizeof(fd);
+
+    zmq_getsockopt(c->sock, ZMQ_FD, &fd, &size);
+    return fd;
+}
+
+long cari_timeout(const struct cari_t* c)
+{
+    double now = now_ms();
+    double next = -1;
+
+    if(c->ndirty > 0)
+        return 0;
+
+    for(uint32_t i=0; i<c->nbusy; i++)
+    {
+        double t = c->busy[i]->head->deadline;
+        if(next < 0 || t < next)
+            next = t;
+    }
+
+    if(next < 0)
+        return -1;
+    return (next > now) ? (long)(next - now) + 1 : 0;
+}
+
+const struct cari_result_t* cari_next(struct cari_t* c)
+{
+    if(c->current != NULL)
+    {
+        op_release(c, c->current);
+        c->current = NULL;
+    }
+
+    struct cari_op_t* op = c->done_head;
+    if(op == NULL)
+        return NULL;
+
+    c->done_head = op->next;
+    if(c->done_head == NULL)
+        c->done_tail = NULL;
+    c->current = op;
+    c->pending--;
+
+    return &op->res;
+}
+
+uint64_t cari_pending(const struct cari_t* c)
+{
+    return c->pending;
+}
+
+void cari_stats(const struct cari_t* c, struct cari_stats_t* s)
+{
+    *s = c->stats;
+}
@@ -0,0 +1,106 @@
+/*
+ * cari.h
+ *
+ *  libcari - non-blocking CARI control of any number of devices
+ *
+ *  A context drives every device over a single ROUTER socket, one connection
+ *  per device, so a single thread can keep thousands of requests outstanding
+ *  across thousands of devices with one file descriptor to wait on.
+ *
+ *  cari_submit() only queues a request. cari_process() does all the socket
+ *  work: it sends what fits into each device's window, matches the replies
+ *  (the oldest outstanding request of the same command, as the devices answer
+ *  in order), resends unanswered requests over a fresh connection and gives
+ *  up on them after the configured retries. Every finished request is either
+ *  handed to its callback, from within cari_process(), or queued for
+ *  cari_next() when submitted without one.
+ *
+ *  Event loop integration: wait for cari_fd() to become readable or for
+ *  cari_timeout() ms, whichever comes first, then call cari_process(). Call
+ *  it as well after submitting. The descriptor is ZMQ_FD, edge triggered:
+ *  cari_process() always leaves the socket drained, so it is safe to use with
+ *  epoll/libuv in either mode. Not thread safe, use one context per thread.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cari_codec.h"
+
+#define CARI_WINDOW         64      //default requests in flight per device
+#define CARI_REQ_MAX        144     //longest request frame, as struct pending_t
+#define CARI_TIMEOUT        2000    //default first attempt deadline in ms, doubled on every retry
+#define CARI_RETRIES        2
+
+//cari_result_t.err below ERR_OK
+#define CARI_MALFORMED      -1      //the reply did not decode
+#define CARI_NO_REPLY       -2      //no reply after all retries
+#define CARI_CANCELLED      -3      //the device was closed first
+
+struct cari_t;
+struct cari_dev_t;
+
+struct cari_result_t
+{
+    struct cari_dev_t* dev;     //NULL if cancelled, not to be used once the device is closed
+    void* arg;                  //as given to cari_submit()
+    uint64_t id;                //as returned by cari_submit()
+    uint8_t cid;                //command of the request
+    int8_t err;                 //cari_err_t of the reply or one of the above
+    uint8_t attempts;           //attempt that got the reply (or the last one), 1 - first
+    double rtt;                 //ms, of the attempt that got the reply
+    const uint8_t* payload;     //decoded reply, valid until the callback returns or the next cari_next()
+    uint16_t payload_len;
+};
+
+typedef void (*cari_cb_t)(const struct cari_result_t* r);
+
+struct cari_stats_t
+{
+    uint64_t submitted;
+    uint64_t sent;              //including resends
+    uint64_t completed;
+    uint64_t failed;            //completed with a CARI_* error
+    uint64_t stray;             //replies matching no request
+    uint64_t reconnects;
+};
+
+//zmq_ctx is borrowed, NULL - the context creates its own
+struct cari_t* cari_new(void* zmq_ctx);
+//outstanding requests are dropped without completing
+void cari_free(struct cari_t* c);
+
+//defaults for devices opened from now on
+void cari_set_timeout(struct cari_t* c, int timeout, int retries);
+void cari_set_window(struct cari_t* c, uint32_t window);
+//route devices opened from now on through the daemon at endpoint, NULL - direct
+int cari_set_via(struct cari_t* c, const char* endpoint);
+
+//addr as for `-d`, opening the same address again returns the same device
+struct cari_dev_t* cari_dev_open(struct cari_t* c, const char* addr);
+//outstanding requests complete with CARI_CANCELLED
+void cari_dev_close(struct cari_dev_t* d);
+const char* cari_dev_addr(const struct cari_dev_t* d);
+//metrics series of the device, METRICS_NO_DEV if the table was full
+int cari_dev_mdev(const struct cari_dev_t* d);
+struct cari_t* cari_dev_ctx(const struct cari_dev_t* d);
+uint32_t cari_dev_pending(const struct cari_dev_t* d);
+//for requests sent from now on, e.g. deadlines following the measured round trip time
+void cari_dev_set_timeout(struct cari_dev_t* d, int timeout, int retries);
+
+//queue an encoded request frame, cb NULL - completes to cari_next()
+//returns a request ID, counting up from 1 per context, 0 if the frame is too long or out of memory
+uint64_t cari_submit(struct cari_dev_t* d, const uint8_t* frame, uint16_t len, cari_cb_t cb, void* arg);
+
+//do all pending socket work without blocking, returns the number of requests completed
+int cari_process(struct cari_t* c);
+int cari_fd(struct cari_t* c);
+//ms until cari_process() has deadlines to handle, -1 - nothing outstanding
+long cari_timeout(const struct cari_t* c);
+//next completed request without a callback or NULL, valid until the next call
+const struct cari_result_t* cari_next(struct cari_t* c);
+//requests submitted and not yet completed or collected
+uint64_t cari_pending(const struct cari_t* c);
+void cari_stats(const struct cari_t* c, struct cari_stats_t* s);
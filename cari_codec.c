@@ -0,0 +1,383 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cari_codec.h"
+#include "interface_cmds.h"
+
+//command table lookup, generated from CARI_CMD_TABLE
+const struct cari_cmd_info_t* cari_cmd_info(uint8_t cid)
+{
+    #define X(id, name, req_min, req_max, rep_kind, rep_min, rep_max) \
+        case id: { static const struct cari_cmd_info_t info = {id, name, req_min, req_max, rep_kind, rep_min, rep_max}; return &info; }
+
+    switch(cid)
+    {
+        CARI_CMD_TABLE(X)
+        default:
+            return NULL;
+    }
+
+    #undef X
+}
+
+const char* cari_cmd_name(uint8_t cid)
+{
+    const struct cari_cmd_info_t* info = cari_cmd_info(cid);
+    return info ? info->name : "UNKNOWN";
+}
+
+const char* cari_err_name(int err)
+{
+    #define X(id, name) case id: return name;
+
+    switch(err)
+    {
+        CARI_ERR_TABLE(X)
+        default:
+            return "unknown error";
+    }
+
+    #undef X
+}
+
+//write a frame header followed by the payload
+size_t cari_encode(uint8_t* buf, size_t size, uint8_t cid, const void* payload, size_t payload_len)
+{
+    size_t len = CARI_HDR_LEN + payload_len;
+
+    if(payload_len > CARI_MAX_PAYLOAD || len > size)
+        return 0;
+
+    buf[0] = cid;
+    cari_put_u16(&buf[1], len);
+    if(payload_len > 0)
+        memcpy(&buf[CARI_HDR_LEN], payload, payload_len);
+
+    return len;
+}
+
+size_t cari_enc_param_u8(uint8_t* buf, size_t size, uint8_t param, uint8_t val)
+{
+    uint8_t pld[2] = {param, val};
+    return cari_encode(buf, size, CMD_SUB_SET_PARAM, pld, sizeof(pld));
+}
+
+size_t cari_enc_param_u64(uint8_t* buf, size_t size, uint8_t param, uint64_t val)
+{
+    uint8_t pld[9] = {param};
+    cari_put_u64(&pld[1], val);
+    return cari_encode(buf, size, CMD_SUB_SET_PARAM, pld, sizeof(pld));
+}
+
+size_t cari_enc_param_f32(uint8_t* buf, size_t size, uint8_t param, float val)
+{
+    uint8_t pld[5] = {param};
+    cari_put_f32(&pld[1], val);
+    return cari_encode(buf, size, CMD_SUB_SET_PARAM, pld, sizeof(pld));
+}
+
+size_t cari_enc_set_reg(uint8_t* buf, size_t size, uint8_t reg, uint8_t val)
+{
+    uint8_t pld[2] = {reg, val};
+    return cari_encode(buf, size, CMD_DEV_SET_REG, pld, sizeof(pld));
+}
+
+size_t cari_enc_u8(uint8_t* buf, size_t size, uint8_t cid, uint8_t val)
+{
+    return cari_encode(buf, size, cid, &val, 1);
+}
+
+size_t cari_enc_caps(uint8_t* buf, size_t size, const struct cari_caps_t* caps)
+{
+    uint8_t pld[CARI_CAPS_LEN];
+    float steps = caps->pwr_max/0.25f;
+
+    pld[0] = caps->flags;
+    cari_put_u64(&pld[1], caps->rx_min);
+    cari_put_u64(&pld[9], caps->rx_max);
+    cari_put_u64(&pld[17], caps->tx_min);
+    cari_put_u64(&pld[25], caps->tx_max);
+    pld[33] = !(steps > 0.0f) ? 0 : (steps >= 255.0f) ? 255 : (uint8_t)steps; //NaN and below 0 too
+
+    return cari_encode(buf, size, CMD_SUB_GET_CAPS, pld, sizeof(pld));
+}
+
+//SUB_GET_SPVN_LIST reply, names longer than CARI_SPVN_NAME_LEN-1 are cut
+size_t cari_enc_spvn_list(uint8_t* buf, size_t size, const struct cari_spvn_info_t* vars, uint8_t n)
+{
+    size_t len = CARI_HDR_LEN;
+
+    for(uint8_t i=0; i<n; i++)
+    {
+        size_t name_len = strnlen(vars[i].name, CARI_SPVN_NAME_LEN-1);
+
+        if(len + 3 + name_len > size || len + 3 + name_len > CARI_MAX_FRAME)
+            return 0;
+
+        buf[len++] = vars[i].id;
+        buf[len++] = vars[i].type;
+        memcpy(&buf[len], vars[i].name, name_len);
+        len += name_len;
+        buf[len++] = 0;
+    }
+
+    if(len > size)
+        return 0;
+
+    buf[0] = CMD_DEV_GET_SPVN_LIST;
+    cari_put_u16(&buf[1], len);
+    return len;
+}
+
+//write a supervision value, returns its size or 0 for unknown types
+size_t cari_spvn_put(uint8_t* p, uint8_t type, float val)
+{
+    switch(type)
+    {
+        case SPVN_U8:
+            p[0] = val;
+            return 1;
+
+        case SPVN_U16:
+            cari_put_u16(p, val);
+            return 2;
+
+        case SPVN_I16:
+            cari_put_u16(p, (int16_t)val);
+            return 2;
+
+        case SPVN_U32:
+            cari_put_u32(p, val);
+            return 4;
+
+        case SPVN_F32:
+            cari_put_f32(p, val);
+            return 4;
+
+        default:
+            return 0;
+    }
+}
+
+//size of a supervision value on the wire, -1 for unknown types
+int cari_spvn_type_size(uint8_t type)
+{
+    switch(type)
+    {
+        case SPVN_U8:
+            return 1;
+
+        case SPVN_U16:
+        case SPVN_I16:
+            return 2;
+
+        case SPVN_U32:
+        case SPVN_F32:
+            return 4;
+
+        default:
+            return -1;
+    }
+}
+
+//size of a parameter value on the wire, -1 for unknown parameters
+int cari_param_size(uint8_t param)
+{
+    switch(param)
+    {
+        case PARAM_RX_FREQ:
+        case PARAM_TX_FREQ:
+            return 8;
+
+        case PARAM_RX_FREQ_CORR:
+        case PARAM_TX_FREQ_CORR:
+            return 4;
+
+        case PARAM_AFC:
+        case PARAM_TX_PWR:
+            return 1;
+
+        default:
+            return -1;
+    }
+}
+
+//split a frame into header and payload, checking the length field
+int cari_decode(const uint8_t* buf, size_t len, struct cari_frame_t* f)
+{
+    if(len < CARI_HDR_LEN)
+        return CARI_DEC_SHORT;
+
+    f->cid = buf[0];
+    f->len = cari_get_u16(&buf[1]);
+    if(f->len != len)
+        return CARI_DEC_LEN;
+
+    f->payload = &buf[CARI_HDR_LEN];
+    f->payload_len = len - CARI_HDR_LEN;
+    f->err = ERR_OK;
+
+    return CARI_DEC_OK;
+}
+
+//decode a request, checking the payload length against the command table
+int cari_decode_request(const uint8_t* buf, size_t len, struct cari_frame_t* f)
+{
+    int ret = cari_decode(buf, len, f);
+    const struct cari_cmd_info_t* info;
+
+    if(ret != CARI_DEC_OK)
+        return ret;
+    if((info = cari_cmd_info(f->cid)) == NULL)
+        return CARI_DEC_CID;
+    if(f->payload_len < info->req_min || f->payload_len > info->req_max)
+        return CARI_DEC_PAYLOAD;
+
+    return CARI_DEC_OK;
+}
+
+//decode a reply to the given command and map its status
+int cari_decode_reply(uint8_t cid, const uint8_t* buf, size_t len, struct cari_frame_t* f)
+{
+    const struct cari_cmd_info_t* info = cari_cmd_info(cid);
+    int ret = cari_decode(buf, len, f);
+
+    if(ret != CARI_DEC_OK)
+        return ret;
+    if(info == NULL || f->cid != cid)
+        return CARI_DEC_CID;
+
+    if(info->rep_kind == CARI_REP_STATUS)
+    {
+        if(f->payload_len != 1)
+            return CARI_DEC_PAYLOAD;
+        f->err = f->payload[0];
+        return CARI_DEC_OK;
+    }
+
+    //data reply, a lone byte that can not be the data carries an error code
+    if(f->payload_len == 1 && (info->rep_kind == CARI_REP_DATA
+        || (info->rep_kind == CARI_REP_STRING && f->payload[0] != 0)))
+    {
+        f->err = f->payload[0];
+        return CARI_DEC_OK;
+    }
+
+    if(f->payload_len < info->rep_min || f->payload_len > info->rep_max)
+        return CARI_DEC_PAYLOAD;
+
+    return CARI_DEC_OK;
+}
+
+//a decoded single byte reply whose value a device error would have sent as well
+int cari_reply_ambiguous(const struct cari_frame_t* f)
+{
+    const struct cari_cmd_info_t* info = cari_cmd_info(f->cid);
+
+    if(info == NULL || info->rep_kind != CARI_REP_BYTE || f->err != ERR_OK || f->payload_len != 1)
+        return 0;
+
+    #define X(id, name) || f->payload[0] == id
+
+    return f->payload[0] != ERR_OK && (0 CARI_ERR_TABLE(X));
+
+    #undef X
+}
+
+//unpack a SUB_GET_CAPS reply
+int cari_dec_caps(const struct cari_frame_t* f, struct cari_caps_t* caps)
+{
+    if(f->cid != CMD_SUB_GET_CAPS || f->payload_len < CARI_CAPS_LEN)
+        return CARI_DEC_PAYLOAD;
+
+    caps->flags = f->payload[0];
+    caps->rx_min = cari_get_u64(&f->payload[1]);
+    caps->rx_max = cari_get_u64(&f->payload[9]);
+    caps->tx_min = cari_get_u64(&f->payload[17]);
+    caps->tx_max = cari_get_u64(&f->payload[25]);
+    caps->pwr_max = f->payload[33]*0.25f;
+
+    return CARI_DEC_OK;
+}
+
+//unpack a DEV_GET_SPVN_LIST reply, returns the number of variables or a cari_dec_t error
+int cari_dec_spvn_list(const struct cari_frame_t* f, struct cari_spvn_info_t* vars, int max)
+{
+    const uint8_t* p = f->payload;
+    const uint8_t* end = f->payload + f->payload_len;
+    int n = 0;
+
+    if(f->cid != CMD_DEV_GET_SPVN_LIST)
+        return CARI_DEC_CID;
+
+    while(p < end)
+    {
+        const uint8_t* name = p + 2;
+        const uint8_t* nul;
+
+        if(end - p < 3 || (nul = memchr(name, 0, end - name)) == NULL)
+            return CARI_DEC_PAYLOAD;
+        if(cari_spvn_type_size(p[1]) < 0)
+            return CARI_DEC_PAYLOAD;
+
+        if(n < max)
+        {
+            size_t len = nul - name;
+            if(len > CARI_SPVN_NAME_LEN-1)
+                len = CARI_SPVN_NAME_LEN-1;
+
+            vars[n].id = p[0];
+            vars[n].type = p[1];
+            memcpy(vars[n].name, name, len);
+            vars[n].name[len] = 0;
+            n++;
+        }
+
+        p = nul + 1;
+    }
+
+    return n;
+}
+
+//start walking a supervision stream frame
+int cari_spvn_begin(const struct cari_frame_t* f, struct cari_spvn_iter_t* it)
+{
+    if(f->cid != CMD_DEV_START_SPVN_STREAM || f->payload_len < 4)
+        return CARI_DEC_PAYLOAD;
+
+    it->t_us = cari_get_u32(f->payload);
+    it->p = f->payload + 4;
+    it->left = f->payload_len - 4;
+
+    return CARI_DEC_OK;
+}
+
+//next sample, types maps a variable id to its type (CARI_SPVN_NONE if unknown)
+//returns 1 for a sample, 0 at the end of the frame, CARI_DEC_PAYLOAD if the frame can not be walked further
+int cari_spvn_next(struct cari_spvn_iter_t* it, const uint8_t* types, uint8_t* id, float* val)
+{
+    if(it->left == 0)
+        return 0;
+
+    int size = cari_spvn_type_size(types[it->p[0]]);
+    if(size < 0 || it->left < 1 + size)
+        return CARI_DEC_PAYLOAD;
+
+    const uint8_t* v = it->p + 1;
+    *id = it->p[0];
+
+    switch(types[*id])
+    {
+        case SPVN_U8:  *val = v[0]; break;
+        case SPVN_U16: *val = cari_get_u16(v); break;
+        case SPVN_I16: *val = (int16_t)cari_get_u16(v); break;
+        case SPVN_U32: *val = cari_get_u32(v); break;
+        default:       *val = cari_get_f32(v); break;
+    }
+
+    it->p += 1 + size;
+    it->left -= 1 + size;
+
+    return 1;
+}
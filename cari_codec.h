@@ -0,0 +1,204 @@
+/*
+ * cari_codec.h
+ *
+ *  CARI frame encoder/decoder
+ *
+ *  Frame: [cid][len_lo][len_hi][payload...], len is the full frame length.
+ *  Nothing here allocates, all multi-byte fields are read and written byte
+ *  by byte (little endian), so buffers need no particular alignment.
+ *  Decoded frames point into the receive buffer, no payload is copied.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "interface_cmds.h"
+
+#define CARI_HDR_LEN        3
+#define CARI_MAX_FRAME      0xFFFF
+#define CARI_MAX_PAYLOAD    (CARI_MAX_FRAME-CARI_HDR_LEN)
+
+//reply kinds
+//a device reports an error to any command with a lone cari_err_t byte, which only
+//tells apart from the data where the data is never a single byte of the same value
+#define CARI_REP_STATUS     0   //single cari_err_t byte
+#define CARI_REP_DATA       1   //command specific data, never a single byte, so a lone byte is an error code
+#define CARI_REP_STRING     2   //NUL terminated string, a lone byte other than NUL is an error code
+#define CARI_REP_BYTE       3   //a single data byte: an error looks exactly like a value, it decodes as data
+                                //and cari_reply_ambiguous() flags the values that are error codes as well
+
+//command table
+//X(cid, name, request payload min, request payload max, reply kind, reply payload min, reply payload max)
+#define CARI_CMD_TABLE(X) \
+    X(CMD_PING,                  "PING",             0, 0,                CARI_REP_STATUS, 1, 1)                \
+    X(CMD_DEV_SET_REG,           "DEV_SET_REG",      2, 2,                CARI_REP_STATUS, 1, 1)                \
+    X(CMD_SUB_SET_PARAM,         "SUB_SET_PARAM",    2, CARI_MAX_PAYLOAD, CARI_REP_STATUS, 1, 1)                \
+    X(CMD_SUB_EXEC,              "SUB_EXEC",         0, CARI_MAX_PAYLOAD, CARI_REP_STATUS, 1, 1)                \
+    X(CMD_SUB_CONN,              "SUB_CONN",         1, CARI_MAX_PAYLOAD, CARI_REP_STATUS, 1, 1)                \
+    X(CMD_SUB_START_BB_STREAM,   "SUB_START_BB",     1, 1,                CARI_REP_STATUS, 1, 1)                \
+    X(CMD_DEV_START_SPVN_STREAM, "DEV_START_SPVN",   1, 1,                CARI_REP_STATUS, 1, 1)                \
+    X(CMD_DEV_GET_IDENT,         "DEV_GET_IDENT",    0, 0,                CARI_REP_STRING, 0, CARI_MAX_PAYLOAD) \
+    X(CMD_DEV_GET_REG,           "DEV_GET_REG",      1, 1,                CARI_REP_BYTE,   1, 1)                \
+    X(CMD_SUB_GET_CAPS,          "SUB_GET_CAPS",     0, 0,                CARI_REP_DATA,   0, CARI_MAX_PAYLOAD) \
+    X(CMD_SUB_GET_PARAM,         "SUB_GET_PARAM",    1, 1,                CARI_REP_DATA,   2, CARI_MAX_PAYLOAD) \
+    X(CMD_DEV_GET_SPVN_LIST,     "DEV_GET_SPVN_LIST",0, 0,                CARI_REP_DATA,   0, CARI_MAX_PAYLOAD)
+
+#define CARI_ERR_TABLE(X) \
+    X(ERR_OK,           "OK")             \
+    X(ERR_MALFORMED,    "malformed")      \
+    X(ERR_CMD_UNSUP,    "unsupported")    \
+    X(ERR_ZMQ_BIND,     "bind failed")    \
+    X(ERR_ZMQ_CONN,     "connect failed") \
+    X(ERR_RANGE,        "out of range")
+
+//decoder results
+enum cari_dec_t
+{
+    CARI_DEC_OK = 0,
+    CARI_DEC_SHORT = -1,        //shorter than the header
+    CARI_DEC_LEN = -2,          //length field does not match the frame
+    CARI_DEC_CID = -3,          //unknown or unexpected command ID
+    CARI_DEC_PAYLOAD = -4       //payload length out of range for the command
+};
+
+//SUB_SET_PARAM/SUB_GET_PARAM parameters
+//CARI 1.3 leaves the parameter payload open, this is a project extension that the
+//mock and the tool agree on, not something a device is known to accept:
+//request [param][value, little endian], SUB_GET_PARAM takes [param] and answers the same pair
+enum cari_param_t
+{
+    PARAM_RX_FREQ,              //RX frequency in Hz, uint64
+    PARAM_TX_FREQ,              //TX frequency in Hz, uint64
+    PARAM_RX_FREQ_CORR,         //RX frequency correction in ppm, float
+    PARAM_TX_FREQ_CORR,         //TX frequency correction in ppm, float
+    PARAM_AFC,                  //AFC enable, uint8
+    PARAM_TX_PWR                //TX power in 0.25dBm steps, uint8
+};
+
+//SUB_GET_CAPS reply payload
+//CARI 1.3 names the command but not its reply, this is a project extension that the
+//mock and the tool agree on, not something a device is known to send:
+//[flags u8, bit n set for cari_cpbl_t n][rx_min u64][rx_max u64][tx_min u64][tx_max u64][max power u8, 0.25dBm steps]
+#define CARI_CAPS_LEN       34
+
+struct cari_caps_t
+{
+    uint8_t flags;
+    uint64_t rx_min, rx_max;
+    uint64_t tx_min, tx_max;
+    float pwr_max;              //dBm
+};
+
+//supervision telemetry payloads
+//CARI 1.3 has the commands but does not lay out their data, this is a project extension
+//that the mock and the supervision consumer agree on, not something a device is known to send:
+//DEV_GET_SPVN_LIST reply: [id][type][name, NUL terminated] for every variable
+//while the stream is on, samples are pushed on the control connection as DEV_START_SPVN_STREAM
+//frames (never a single byte, unlike the status reply): [timestamp in us, uint32][id][value]...
+//with every value little endian according to the variable type
+enum cari_spvn_type_t
+{
+    SPVN_U8,
+    SPVN_U16,
+    SPVN_I16,
+    SPVN_U32,
+    SPVN_F32
+};
+
+//supervision variable, one entry of a DEV_GET_SPVN_LIST reply
+#define CARI_SPVN_NAME_LEN  24
+#define CARI_SPVN_NONE      0xFF    //type of an id not on the list
+
+struct cari_spvn_info_t
+{
+    uint8_t id;
+    uint8_t type;               //cari_spvn_type_t
+    char name[CARI_SPVN_NAME_LEN];
+};
+
+//cursor over the samples of a supervision stream frame
+struct cari_spvn_iter_t
+{
+    const uint8_t* p;
+    uint16_t left;
+    uint32_t t_us;              //device timestamp of the frame
+};
+
+struct cari_cmd_info_t
+{
+    uint8_t cid;
+    const char* name;
+    uint16_t req_min, req_max;
+    uint8_t rep_kind;
+    uint16_t rep_min, rep_max;
+};
+
+//decoded frame, payload points into the original buffer
+struct cari_frame_t
+{
+    uint8_t cid;
+    uint16_t len;
+    const uint8_t* payload;
+    uint16_t payload_len;
+    int8_t err;                 //replies only: cari_err_t, ERR_OK for data replies
+};
+
+//little endian accessors, alignment agnostic
+static inline void cari_put_u16(uint8_t* p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static inline void cari_put_u32(uint8_t* p, uint32_t v) { cari_put_u16(p, v); cari_put_u16(p+2, v >> 16); }
+static inline void cari_put_u64(uint8_t* p, uint64_t v) { cari_put_u32(p, v); cari_put_u32(p+4, v >> 32); }
+static inline void cari_put_f32(uint8_t* p, float v)    { uint32_t u; memcpy(&u, &v, 4); cari_put_u32(p, u); }
+
+static inline uint16_t cari_get_u16(const uint8_t* p) { return p[0] | (uint16_t)p[1] << 8; }
+static inline uint32_t cari_get_u32(const uint8_t* p) { return cari_get_u16(p) | (uint32_t)cari_get_u16(p+2) << 16; }
+static inline uint64_t cari_get_u64(const uint8_t* p) { return cari_get_u32(p) | (uint64_t)cari_get_u32(p+4) << 32; }
+static inline float cari_get_f32(const uint8_t* p)    { uint32_t u = cari_get_u32(p); float v; memcpy(&v, &u, 4); return v; }
+
+const struct cari_cmd_info_t* cari_cmd_info(uint8_t cid);
+const char* cari_cmd_name(uint8_t cid);
+const char* cari_err_name(int err);
+
+//encoders, all return the frame length or 0 if it does not fit
+size_t cari_encode(uint8_t* buf, size_t size, uint8_t cid, const void* payload, size_t payload_len);
+size_t cari_enc_param_u8(uint8_t* buf, size_t size, uint8_t param, uint8_t val);
+size_t cari_enc_param_u64(uint8_t* buf, size_t size, uint8_t param, uint64_t val);
+size_t cari_enc_param_f32(uint8_t* buf, size_t size, uint8_t param, float val);
+size_t cari_enc_set_reg(uint8_t* buf, size_t size, uint8_t reg, uint8_t val);
+size_t cari_enc_u8(uint8_t* buf, size_t size, uint8_t cid, uint8_t val);
+
+size_t cari_enc_caps(uint8_t* buf, size_t size, const struct cari_caps_t* caps);
+size_t cari_enc_spvn_list(uint8_t* buf, size_t size, const struct cari_spvn_info_t* vars, uint8_t n);
+size_t cari_spvn_put(uint8_t* p, uint8_t type, float val);
+int cari_param_size(uint8_t param);
+int cari_spvn_type_size(uint8_t type);
+
+//decoders
+int cari_decode(const uint8_t* buf, size_t len, struct cari_frame_t* f);
+int cari_decode_request(const uint8_t* buf, size_t len, struct cari_frame_t* f);
+int cari_decode_reply(uint8_t cid, const uint8_t* buf, size_t len, struct cari_frame_t* f);
+int cari_reply_ambiguous(const struct cari_frame_t* f);
+int cari_dec_caps(const struct cari_frame_t* f, struct cari_caps_t* caps);
+int cari_dec_spvn_list(const struct cari_frame_t* f, struct cari_spvn_info_t* vars, int max);
+int cari_spvn_begin(const struct cari_frame_t* f, struct cari_spvn_iter_t* it);
+int cari_spvn_next(struct cari_spvn_iter_t* it, const uint8_t* types, uint8_t* id, float* val);
+
+#ifdef ZMQ_VERSION
+//encode straight into a new message, returns 0 on success
+static inline int cari_encode_msg(zmq_msg_t* msg, uint8_t cid, const void* payload, size_t payload_len)
+{
+    if(payload_len > CARI_MAX_PAYLOAD || zmq_msg_init_size(msg, CARI_HDR_LEN+payload_len) != 0)
+        return -1;
+
+    cari_encode(zmq_msg_data(msg), zmq_msg_size(msg), cid, payload, payload_len);
+    return 0;
+}
+
+//decode a reply in place, the frame stays valid until the message is closed
+static inline int cari_decode_reply_msg(uint8_t cid, zmq_msg_t* msg, struct cari_frame_t* f)
+{
+    return cari_decode_reply(cid, zmq_msg_data(msg), zmq_msg_size(msg), f);
+}
+#endif
@@ -0,0 +1,714 @@
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "ctrl.h"
+#include "dbg.h"
+#include "log.h"
+#include "interface_cmds.h"
+#include "cari_codec.h"
+#include "term.h" //colored terminal font
+#include "cari.h"
+#include "metrics.h"
+
+static const char* via_endpoint = NULL; //daemon front-end, if any
+static int link_timeout = 2000;         //first attempt deadline, ms
+static int link_retries = 2;
+
+//default values - nothing to be set
+void config_init(struct re_config_t* cfg)
+{
+    cfg->tx_pwr = -10.0f;
+    cfg->rx_freq_corr = -10000.0; // normal range is about -50..+50
+    cfg->tx_freq_corr = -10000.0;
+    cfg->rx_ena = -1;
+    cfg->afc = -1;
+    cfg->rx_freq = 0;
+    cfg->tx_freq = 0;
+    memset(cfg->my_addr, 0, sizeof(cfg->my_addr));
+    memset(cfg->re_addr, 0, sizeof(cfg->re_addr));
+}
+
+//parse a single device setting option
+//returns 0 on success, -1 if the value is invalid, 1 if the option is not a device setting
+int config_parse_opt(struct re_config_t* cfg, int opt, const char* arg, uint8_t verbose)
+{
+    switch (opt)
+    {
+        case 's': // local PUB address
+            if (strlen(arg) > 0 && strlen(arg) < sizeof(cfg->my_addr)) {
+                strcpy(cfg->my_addr, arg);
+                if(verbose) {
+                    dbg_print(0, "Local PUB address: ");
+                    dbg_print(TERM_GREEN, "%s\n", cfg->my_addr);
+                }
+            } else {
+                dbg_print(TERM_RED, "Invalid local address length.\n");
+                return -1;
+            }
+            break;
+
+        case 'd': // remote device address
+            if (strlen(arg) > 0 && strlen(arg) < sizeof(cfg->re_addr)) {
+                strcpy(cfg->re_addr, arg);
+                if(verbose) {
+                    dbg_print(0, "Remote CTRL address: ");
+                    dbg_print(TERM_GREEN, "%s\n", cfg->re_addr);
+                }
+            } else {
+                dbg_print(TERM_RED, "Invalid remote address length.\n");
+                return -1;
+            }
+            break;
+
+        case 'p': // RF power
+            cfg->tx_pwr = atof(arg);
+            if(cfg->tx_pwr < 0.0f || cfg->tx_pwr > 47.75f) {
+                dbg_print(TERM_RED, "Invalid TX power\n");
+                return -1;
+            }
+            if(verbose) {
+                dbg_print(0, "TX power: ");
+                dbg_print(TERM_GREEN, "%2.2f dBm\n", cfg->tx_pwr);
+            }
+            break;
+
+        case 'f': // --rf (RX frequency)
+            cfg->rx_freq = atoi(arg);
+            if(cfg->rx_freq < 420000000U || cfg->rx_freq > 450000000U) {
+                dbg_print(TERM_RED, "Invalid RX frequency\n");
+                return -1;
+            }
+            if(verbose) {
+                dbg_print(0, "RX frequency: ");
+                dbg_print(TERM_GREEN, "%lu Hz\n", cfg->rx_freq);
+            }
+            break;
+
+        case 'F': // --tf (TX frequency)
+            cfg->tx_freq = atoi(arg);
+            if(cfg->tx_freq < 420000000U || cfg->tx_freq > 450000000U) {
+                dbg_print(TERM_RED, "Invalid TX frequency\n");
+                return -1;
+            }
+            if(verbose) {
+                dbg_print(0, "TX frequency: ");
+                dbg_print(TERM_GREEN, "%lu Hz\n", cfg->tx_freq);
+            }
+            break;
+
+        case 'c': // --rc (RX frequency correction)
+            cfg->rx_freq_corr = atof(arg);
+            if(cfg->rx_freq_corr < -100.0f || cfg->rx_freq_corr > 100.0f) {
+                dbg_print(TERM_YELLOW, "RX frequency correction of %3.1fppm seems large\n", cfg->rx_freq_corr);
+            }
+            if(verbose) {
+                dbg_print(0, "RX frequency correction: ");
+                dbg_print(TERM_GREEN, "%3.1f ppm\n", cfg->rx_freq_corr);
+            }
+            break;
+
+        case 'C': // --tc (TX frequency correction)
+            cfg->tx_freq_corr = atof(arg);
+            if(cfg->tx_freq_corr < -100.0f || cfg->tx_freq_corr > 100.0f) {
+                dbg_print(TERM_YELLOW, "TX frequency correction of %3.1fppm seems large\n", cfg->tx_freq_corr);
+            }
+            if(verbose) {
+                dbg_print(0, "TX frequency correction: ");
+                dbg_print(TERM_GREEN, "%3.1f ppm\n", cfg->tx_freq_corr);
+            }
+            break;
+
+        case 'a': // --afc
+            cfg->afc = (arg[0] == '0') ? 0 : 1;
+            if(verbose) {
+                dbg_print(0, "AFC: ");
+                if(cfg->afc)
+                    dbg_print(TERM_GREEN, "enabled\n");
+                else
+                    dbg_print(TERM_GREEN, "disabled\n");
+            }
+            break;
+
+        case 'R': // --rx
+            cfg->rx_ena = (arg[0] == '0') ? 0 : 1;
+            if(verbose) {
+                dbg_print(0, "RX: ");
+                if(cfg->rx_ena)
+                    dbg_print(TERM_GREEN, "enabled\n");
+                else
+                    dbg_print(TERM_GREEN, "disabled\n");
+            }
+            break;
+
+        default:
+            return 1;
+    }
+
+    return 0;
+}
+
+//monotonic time in ms
+double now_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+//full ZMQ endpoint for a device address, "IP:port" defaults to tcp://
+//addresses already carrying a transport (ipc://, inproc://, ...) are kept as they are
+void ctrl_make_addr(char* out, size_t size, const char* addr)
+{
+    if(strstr(addr, "://") != NULL)
+        snprintf(out, size, "%s", addr);
+    else
+        snprintf(out, size, "tcp://%s", addr);
+}
+
+//send a CARI frame over the DEALER control socket
+//the empty delimiter frame keeps the envelope compatible with REP/ROUTER peers
+int ctrl_send(void* sock, const uint8_t* frame, uint16_t len)
+{
+    if(zmq_send(sock, NULL, 0, ZMQ_SNDMORE|ZMQ_DONTWAIT) < 0)
+        return -1;
+
+    return zmq_send(sock, frame, len, ZMQ_DONTWAIT);
+}
+
+//receive a CARI frame from the DEALER control socket into msg, without copying
+//the frame is the last part of the message, the delimiter and routing frames are skipped
+//flags apply to the first frame only, the rest of a multipart message is always there
+//returns the frame length, msg has to be closed by the caller on success
+int ctrl_recv_msg(void* sock, zmq_msg_t* msg, int flags)
+{
+    zmq_msg_init(msg);
+
+    do
+    {
+        if(zmq_msg_recv(msg, sock, flags) < 0)
+        {
+            zmq_msg_close(msg);
+            return -1;
+        }
+        flags = 0;
+    } while(zmq_msg_more(msg) || zmq_msg_size(msg) == 0);
+
+    return zmq_msg_size(msg);
+}
+
+//for modes whose results are read by programs: the original stdout is returned for the results
+//and fd 1 is pointed at stderr, so the status output (the log included) goes there
+//returns NULL if that failed, nothing is redirected then
+FILE* ctrl_take_stdout(void)
+{
+    FILE* out = NULL;
+    int fd;
+
+    log_flush();
+    fd = dup(STDOUT_FILENO);
+    if(fd >= 0 && (out = fdopen(fd, "w")) != NULL && dup2(STDERR_FILENO, STDOUT_FILENO) >= 0)
+        return out;
+
+    dbg_print(TERM_RED, "Can not separate the results from the status output: %s\n", strerror(errno));
+    if(out != NULL)
+        fclose(out);
+    else if(fd >= 0)
+        close(fd);
+    return NULL;
+}
+
+//route all links opened from now on through the daemon at the given endpoint
+void link_set_via(const char* endpoint)
+{
+    via_endpoint = endpoint;
+}
+
+//per-request deadline and number of retries for links opened from now on
+void link_set_timeout(int timeout, int retries)
+{
+    link_timeout = timeout;
+    link_retries = retries;
+}
+
+//current defaults, e.g. for a libcari context driven next to links
+const char* link_get_via(void)
+{
+    return via_endpoint;
+}
+
+void link_get_timeout(int* timeout, int* retries)
+{
+    *timeout = link_timeout;
+    *retries = link_retries;
+}
+
+static int link_connect(struct link_t* link)
+{
+    int linger = 0;
+
+    link->sock = zmq_socket(link->zmq_ctx, ZMQ_DEALER);
+    if(link->sock == NULL)
+        return -1;
+
+    zmq_setsockopt(link->sock, ZMQ_LINGER, &linger, sizeof(linger));
+    if(zmq_connect(link->sock, link->endpoint) != 0)
+    {
+        link_close(link);
+        return -1;
+    }
+
+    return 0;
+}
+
+//open a control link to the device at addr
+int link_open(struct link_t* link, void* zmq_ctx, const char* addr)
+{
+    snprintf(link->dest, sizeof(link->dest), "%s", addr);
+    link->via = (via_endpoint != NULL);
+    if(link->via)
+        snprintf(link->endpoint, sizeof(link->endpoint), "%s", via_endpoint);
+    else
+        ctrl_make_addr(link->endpoint, sizeof(link->endpoint), addr);
+
+    link->zmq_ctx = zmq_ctx;
+    link->timeout = link_timeout;
+    link->retries = link_retries;
+    link->mdev = metrics_dev(addr);
+
+    return link_connect(link);
+}
+
+//throw the socket away together with anything still queued in it and connect a fresh one
+int link_reopen(struct link_t* link)
+{
+    link_close(link);
+    return link_connect(link);
+}
+
+//deadline for the given attempt (0 - first one), exponential backoff
+int link_attempt_timeout(const struct link_t* link, uint8_t attempt)
+{
+    if(attempt > 8)
+        attempt = 8;
+    return link->timeout << attempt;
+}
+
+void link_close(struct link_t* link)
+{
+    if(link->sock != NULL)
+        zmq_close(link->sock);
+    link->sock = NULL;
+}
+
+//send a CARI frame, prefixed with the device address when going through the daemon
+int link_send(struct link_t* link, const uint8_t* frame, uint16_t len)
+{
+    if(!link->via)
+        return ctrl_send(link->sock, frame, len);
+
+    if(zmq_send(link->sock, NULL, 0, ZMQ_SNDMORE|ZMQ_DONTWAIT) < 0
+        || zmq_send(link->sock, link->dest, strlen(link->dest), ZMQ_SNDMORE|ZMQ_DONTWAIT) < 0)
+        return -1;
+
+    return zmq_send(link->sock, frame, len, ZMQ_DONTWAIT);
+}
+
+//send a CARI frame held in a message, ZMQ takes ownership of it on success
+int link_send_msg(struct link_t* link, zmq_msg_t* frame)
+{
+    if(zmq_send(link->sock, NULL, 0, ZMQ_SNDMORE|ZMQ_DONTWAIT) < 0)
+        return -1;
+
+    if(link->via && zmq_send(link->sock, link->dest, strlen(link->dest), ZMQ_SNDMORE|ZMQ_DONTWAIT) < 0)
+        return -1;
+
+    return zmq_msg_send(frame, link->sock, ZMQ_DONTWAIT);
+}
+
+int link_recv_msg(struct link_t* link, zmq_msg_t* msg, int flags)
+{
+    return ctrl_recv_msg(link->sock, msg, flags);
+}
+
+//modes that tag their requests: the envelope does not survive the daemon, so a daemon
+//given with --via (or CARI_CTRL_VIA) is left out of links opened from now on, with a warning
+void link_direct_only(const char* mode)
+{
+    if(via_endpoint == NULL)
+        return;
+
+    dbg_print(TERM_YELLOW, "%s mode goes to the device directly, --via %s is ignored\n", mode, via_endpoint);
+    via_endpoint = NULL;
+}
+
+//send a CARI frame behind an envelope frame carrying tag, REP and ROUTER peers echo it back
+int link_send_tagged(struct link_t* link, const uint8_t* tag, size_t tag_len, const uint8_t* frame, uint16_t len)
+{
+    if(zmq_send(link->sock, tag, tag_len, ZMQ_SNDMORE|ZMQ_DONTWAIT) < 0)
+        return -1;
+
+    return ctrl_send(link->sock, frame, len);
+}
+
+//receive the reply to a tagged request, msg holds its CARI frame and is closed by the caller
+//returns -1 if nothing is waiting, 1 if the envelope was tag_len bytes (copied to tag), 0 if not
+int link_recv_tagged(struct link_t* link, zmq_msg_t* msg, uint8_t* tag, size_t tag_len)
+{
+    int ret = 0;
+
+    zmq_msg_init(msg);
+    if(zmq_msg_recv(msg, link->sock, ZMQ_DONTWAIT) < 0)
+    {
+        zmq_msg_close(msg);
+        return -1;
+    }
+
+    if(zmq_msg_size(msg) == tag_len)
+    {
+        memcpy(tag, zmq_msg_data(msg), tag_len);
+        ret = 1;
+    }
+
+    while(zmq_msg_more(msg))
+        zmq_msg_recv(msg, link->sock, 0);
+
+    return ret;
+}
+
+//finish a batch entry whose request was encoded into p->req
+//returns the number of entries added, 0 if the request did not fit
+uint8_t batch_add(struct pending_t* p, size_t len, const char* fmt, ...)
+{
+    va_list ap;
+
+    if(len == 0)
+        return 0;
+
+    p->cid = p->req[0];
+    p->len = len;
+    p->done = 0;
+    p->err = -1;
+    p->attempts = 0;
+    p->rtt = 0;
+
+    va_start(ap, fmt);
+    vsnprintf(p->desc, sizeof(p->desc), fmt, ap);
+    va_end(ap);
+
+    return 1;
+}
+
+//collect all settings of a device into one batch, returns the number of entries
+uint8_t config_to_batch(const struct re_config_t* cfg, struct pending_t* batch)
+{
+    uint8_t n = 0;
+
+    #define REQ batch[n].req, sizeof(batch[n].req)
+
+    //"valid" PUBlisher's address?
+    if(strlen(cfg->my_addr) > 0) {
+        char my_addr[128+8];
+        ctrl_make_addr(my_addr, sizeof(my_addr), cfg->my_addr); //full address with "tcp://"
+        n += batch_add(&batch[n], cari_encode(REQ, CMD_SUB_CONN, my_addr, strlen(my_addr)), "SUB connection to %s", my_addr);
+    }
+
+    if(cfg->rx_freq > 0)
+        n += batch_add(&batch[n], cari_enc_param_u64(REQ, PARAM_RX_FREQ, cfg->rx_freq), "RX frequency %lu Hz", cfg->rx_freq);
+
+    if(cfg->tx_freq > 0)
+        n += batch_add(&batch[n], cari_enc_param_u64(REQ, PARAM_TX_FREQ, cfg->tx_freq), "TX frequency %lu Hz", cfg->tx_freq);
+
+    if(cfg->rx_freq_corr > -1000.0f)
+        n += batch_add(&batch[n], cari_enc_param_f32(REQ, PARAM_RX_FREQ_CORR, cfg->rx_freq_corr), "RX frequency correction %3.1f ppm", cfg->rx_freq_corr);
+
+    if(cfg->tx_freq_corr > -1000.0f)
+        n += batch_add(&batch[n], cari_enc_param_f32(REQ, PARAM_TX_FREQ_CORR, cfg->tx_freq_corr), "TX frequency correction %3.1f ppm", cfg->tx_freq_corr);
+
+    if(cfg->afc != -1)
+        n += batch_add(&batch[n], cari_enc_param_u8(REQ, PARAM_AFC, cfg->afc), "AFC %s", cfg->afc ? "enable" : "disable");
+
+    if(cfg->tx_pwr >= 0.0f) {
+        uint8_t pwr_round = floor(cfg->tx_pwr/0.25f);
+        n += batch_add(&batch[n], cari_enc_param_u8(REQ, PARAM_TX_PWR, pwr_round), "TX power %2.2f dBm", pwr_round*0.25f);
+    }
+
+    if(cfg->rx_ena != -1)
+        n += batch_add(&batch[n], cari_enc_u8(REQ, CMD_SUB_START_BB_STREAM, cfg->rx_ena), "RX %s", cfg->rx_ena ? "enable" : "disable");
+
+    #undef REQ
+
+    return n;
+}
+
+//GET_PARAM requests for every readable setting of cfg, for confirming the device state
+uint8_t config_to_readback(const struct re_config_t* cfg, struct pending_t* batch)
+{
+    uint8_t n = 0;
+
+    #define REQ batch[n].req, sizeof(batch[n].req)
+
+    if(cfg->rx_freq > 0)
+        n += batch_add(&batch[n], cari_enc_u8(REQ, CMD_SUB_GET_PARAM, PARAM_RX_FREQ), "RX frequency readback");
+    if(cfg->tx_freq > 0)
+        n += batch_add(&batch[n], cari_enc_u8(REQ, CMD_SUB_GET_PARAM, PARAM_TX_FREQ), "TX frequency readback");
+    if(cfg->rx_freq_corr > -1000.0f)
+        n += batch_add(&batch[n], cari_enc_u8(REQ, CMD_SUB_GET_PARAM, PARAM_RX_FREQ_CORR), "RX frequency correction readback");
+    if(cfg->tx_freq_corr > -1000.0f)
+        n += batch_add(&batch[n], cari_enc_u8(REQ, CMD_SUB_GET_PARAM, PARAM_TX_FREQ_CORR), "TX frequency correction readback");
+    if(cfg->afc != -1)
+        n += batch_add(&batch[n], cari_enc_u8(REQ, CMD_SUB_GET_PARAM, PARAM_AFC), "AFC readback");
+    if(cfg->tx_pwr >= 0.0f)
+        n += batch_add(&batch[n], cari_enc_u8(REQ, CMD_SUB_GET_PARAM, PARAM_TX_PWR), "TX power readback");
+
+    #undef REQ
+
+    return n;
+}
+
+//forget the readable settings of cfg, before they are read back
+void config_forget_readable(struct re_config_t* have, const struct re_config_t* cfg)
+{
+    struct re_config_t unset;
+    config_init(&unset);
+
+    if(cfg->rx_freq > 0)
+        have->rx_freq = unset.rx_freq;
+    if(cfg->tx_freq > 0)
+        have->tx_freq = unset.tx_freq;
+    if(cfg->rx_freq_corr > -1000.0f)
+        have->rx_freq_corr = unset.rx_freq_corr;
+    if(cfg->tx_freq_corr > -1000.0f)
+        have->tx_freq_corr = unset.tx_freq_corr;
+    if(cfg->afc != -1)
+        have->afc = unset.afc;
+    if(cfg->tx_pwr >= 0.0f)
+        have->tx_pwr = unset.tx_pwr;
+}
+
+//record a [param][value] pair (SUB_SET_PARAM request or SUB_GET_PARAM reply) in the known state
+void config_note_param(struct re_config_t* have, const uint8_t* pld, uint16_t len)
+{
+    if(len < 1 || cari_param_size(pld[0]) < 0 || len < 1 + cari_param_size(pld[0]))
+        return;
+
+    switch(pld[0])
+    {
+        case PARAM_RX_FREQ:      have->rx_freq = cari_get_u64(&pld[1]); break;
+        case PARAM_TX_FREQ:      have->tx_freq = cari_get_u64(&pld[1]); break;
+        case PARAM_RX_FREQ_CORR: have->rx_freq_corr = cari_get_f32(&pld[1]); break;
+        case PARAM_TX_FREQ_CORR: have->tx_freq_corr = cari_get_f32(&pld[1]); break;
+        case PARAM_AFC:          have->afc = pld[1]; break;
+        case PARAM_TX_PWR:       have->tx_pwr = pld[1]*0.25f; break;
+    }
+}
+
+//record a request the device accepted in the known state
+void config_note_request(struct re_config_t* have, const struct pending_t* p)
+{
+    struct cari_frame_t f;
+
+    if(!p->done || p->err != ERR_OK || cari_decode(p->req, p->len, &f) != CARI_DEC_OK)
+        return;
+
+    switch(f.cid)
+    {
+        case CMD_SUB_SET_PARAM:
+            config_note_param(have, f.payload, f.payload_len);
+            break;
+
+        case CMD_SUB_CONN: //kept as sent, with "tcp://"
+            snprintf(have->my_addr, sizeof(have->my_addr), "%.*s", (int)f.payload_len, f.payload);
+            break;
+
+        case CMD_SUB_START_BB_STREAM:
+            have->rx_ena = f.payload[0];
+            break;
+    }
+}
+
+//want without the settings the known state already has
+//returns the number of settings dropped
+uint8_t config_diff(const struct re_config_t* want, const struct re_config_t* have, struct re_config_t* delta)
+{
+    struct re_config_t unset;
+    uint8_t same = 0;
+
+    config_init(&unset);
+    *delta = *want;
+
+    if(strlen(want->my_addr) > 0)
+    {
+        char my_addr[128+8];
+        ctrl_make_addr(my_addr, sizeof(my_addr), want->my_addr);
+        if(strcmp(my_addr, have->my_addr) == 0)
+        {
+            memset(delta->my_addr, 0, sizeof(delta->my_addr));
+            same++;
+        }
+    }
+
+    #define SAME(field, set) \
+        if(set && want->field == have->field) { delta->field = unset.field; same++; }
+
+    SAME(rx_freq, want->rx_freq > 0);
+    SAME(tx_freq, want->tx_freq > 0);
+    SAME(rx_freq_corr, want->rx_freq_corr > -1000.0f);
+    SAME(tx_freq_corr, want->tx_freq_corr > -1000.0f);
+    SAME(afc, want->afc != -1);
+    SAME(rx_ena, want->rx_ena != -1);
+
+    #undef SAME
+
+    //power goes out in 0.25dBm steps
+    if(want->tx_pwr >= 0.0f && have->tx_pwr >= 0.0f && floor(want->tx_pwr/0.25f) == floor(have->tx_pwr/0.25f))
+    {
+        delta->tx_pwr = unset.tx_pwr;
+        same++;
+    }
+
+    return same;
+}
+
+//a request of a blocking exchange, handed to libcari as the callback argument
+struct xchg_req_t
+{
+    struct pending_t* p;
+    uint8_t* waiting;
+    reply_cb_t cb;
+    void* arg;
+};
+
+static void on_exchange(const struct cari_result_t* r)
+{
+    struct xchg_req_t* x = r->arg;
+    struct pending_t* p = x->p;
+
+    (*x->waiting)--;
+    p->attempts = r->attempts;
+    if(r->err == CARI_NO_REPLY || r->err == CARI_CANCELLED) //left not done
+        return;
+
+    p->done = 1;
+    p->rtt = r->rtt;
+    p->err = (r->err >= 0) ? r->err : -1;
+
+    if(x->cb != NULL)
+    {
+        struct cari_frame_t f = {.cid = r->cid, .len = CARI_HDR_LEN + r->payload_len,
+            .payload = r->payload, .payload_len = r->payload_len, .err = p->err};
+        x->cb(p, &f, x->arg);
+    }
+}
+
+//put the whole batch in the device's queue and run its context until every request is done
+//libcari resends unanswered requests over a fresh connection, as set with cari_set_timeout()
+//returns the number of requests that never got a reply
+uint8_t batch_exchange(struct cari_dev_t* d, struct pending_t* batch, uint8_t n, reply_cb_t cb, void* arg)
+{
+    struct cari_t* c = cari_dev_ctx(d);
+    struct xchg_req_t reqs[MAX_BATCH];
+    uint8_t waiting = 0;
+    uint8_t lost = 0;
+    double t0 = now_ms();
+
+    if(n > MAX_BATCH)
+        n = MAX_BATCH;
+
+    for(uint8_t i=0; i<n; i++)
+    {
+        reqs[i] = (struct xchg_req_t){&batch[i], &waiting, cb, arg};
+        batch[i].done = 0;
+        batch[i].attempts = 0;
+        if(cari_submit(d, batch[i].req, batch[i].len, on_exchange, &reqs[i]) != 0)
+            waiting++;
+    }
+
+    //every request ends by its deadline at the latest, a failed poll only means another round
+    cari_process(c);
+    while(waiting > 0)
+    {
+        struct pollfd pfd = {cari_fd(c), POLLIN, 0};
+        poll(&pfd, 1, cari_timeout(c));
+        cari_process(c);
+    }
+
+    for(uint8_t i=0; i<n; i++)
+        lost += !batch[i].done;
+    if(lost)
+        dbg_print(TERM_YELLOW, "No reply from %s for %d request(s) in %.2f ms\n", cari_dev_addr(d), lost, now_ms()-t0);
+
+    return lost;
+}
+
+//print the status of every reply
+static void print_reply(struct pending_t* p, const struct cari_frame_t* f, void* arg)
+{
+    uint8_t* failed = arg;
+
+    (void)f;
+    dbg_print(0, "%s ", p->desc);
+    if(p->err == ERR_OK) {
+        dbg_print(TERM_GREEN, "OK");
+    } else if(p->err > 0) {
+        dbg_print(TERM_YELLOW, "ERR %d (%s)", p->err, cari_err_name(p->err));
+        (*failed)++;
+    } else {
+        dbg_print(TERM_RED, "malformed response");
+        (*failed)++;
+    }
+
+    if(p->attempts > 1)
+        dbg_print(0, " (%.2f ms, attempt %d)\n", p->rtt, p->attempts);
+    else
+        dbg_print(0, " (%.2f ms)\n", p->rtt);
+}
+
+//apply a batch of settings, returns the number of failed entries
+uint8_t apply_batch(struct cari_dev_t* d, struct pending_t* batch, uint8_t n)
+{
+    uint8_t failed = 0;
+    uint8_t lost = batch_exchange(d, batch, n, print_reply, &failed);
+
+    for(uint8_t i=0; i<n; i++)
+    {
+        if(!batch[i].done)
+            dbg_print(TERM_RED, "%s - no response\n", batch[i].desc);
+    }
+
+    return failed + lost;
+}
+
+static void note_readback(struct pending_t* p, const struct cari_frame_t* f, void* arg)
+{
+    if(p != NULL && p->err == ERR_OK)
+        config_note_param(arg, f->payload, f->payload_len);
+}
+
+//read the readable settings of want back into have with a single pipelined exchange
+//returns the number of settings that could not be read
+uint8_t config_readback(struct cari_dev_t* d, const struct re_config_t* want, struct re_config_t* have)
+{
+    struct pending_t batch[MAX_BATCH];
+    uint8_t n = config_to_readback(want, batch);
+    uint8_t lost;
+
+    config_forget_readable(have, want);
+    lost = batch_exchange(d, batch, n, note_readback, have);
+
+    for(uint8_t i=0; i<n; i++)
+    {
+        if(batch[i].done && batch[i].err != ERR_OK)
+            lost++;
+    }
+
+    return lost;
+}
@@ -0,0 +1,98 @@
+/*
+ * ctrl.h
+ *
+ *  CARI control channel helpers
+ */
+
+#pragma once
+
+#include <zmq.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cari_codec.h"
+
+struct cari_dev_t;
+
+//config
+struct re_config_t
+{
+    uint64_t rx_freq;
+    uint64_t tx_freq;
+    float tx_freq_corr;
+    float rx_freq_corr;
+    float tx_pwr;
+    int8_t afc;
+    int8_t rx_ena;
+    char my_addr[128];
+    char re_addr[128];
+};
+
+//a single request of a pipelined batch
+#define MAX_BATCH   16
+
+struct pending_t
+{
+    uint8_t cid;
+    uint8_t req[144];
+    uint16_t len;
+    uint8_t done;
+    int8_t err;             //CARI error code, -1 if malformed
+    uint8_t attempts;       //times sent
+    double t_sent;          //last attempt, ms
+    double rtt;             //latency of the attempt that got the reply, ms
+    char desc[64];
+};
+
+//control channel to a single device, either direct or routed through the daemon
+struct link_t
+{
+    void* sock;
+    char endpoint[136];     //what the socket is connected to
+    char dest[128];         //device address, sent as a routing frame when going through the daemon
+    uint8_t via;
+    void* zmq_ctx;
+    int timeout;            //first attempt deadline in ms, doubled on every retry
+    int retries;
+    int mdev;               //metrics series of the device
+};
+
+//reply handler of batch_exchange()
+//the frame points into the received reply and is only valid during the call
+typedef void (*reply_cb_t)(struct pending_t* p, const struct cari_frame_t* f, void* arg);
+
+void config_init(struct re_config_t* cfg);
+int config_parse_opt(struct re_config_t* cfg, int opt, const char* arg, uint8_t verbose);
+
+double now_ms(void);
+void ctrl_make_addr(char* out, size_t size, const char* addr);
+int ctrl_send(void* sock, const uint8_t* frame, uint16_t len);
+int ctrl_recv_msg(void* sock, zmq_msg_t* msg, int flags);
+FILE* ctrl_take_stdout(void);
+
+void link_set_via(const char* endpoint);
+void link_set_timeout(int timeout, int retries);
+const char* link_get_via(void);
+void link_get_timeout(int* timeout, int* retries);
+int link_open(struct link_t* link, void* zmq_ctx, const char* addr);
+int link_reopen(struct link_t* link);
+void link_close(struct link_t* link);
+int link_attempt_timeout(const struct link_t* link, uint8_t attempt);
+int link_send(struct link_t* link, const uint8_t* frame, uint16_t len);
+int link_send_msg(struct link_t* link, zmq_msg_t* frame);
+int link_recv_msg(struct link_t* link, zmq_msg_t* msg, int flags);
+void link_direct_only(const char* mode);
+int link_send_tagged(struct link_t* link, const uint8_t* tag, size_t tag_len, const uint8_t* frame, uint16_t len);
+int link_recv_tagged(struct link_t* link, zmq_msg_t* msg, uint8_t* tag, size_t tag_len);
+
+uint8_t batch_add(struct pending_t* p, size_t len, const char* fmt, ...);
+uint8_t config_to_batch(const struct re_config_t* cfg, struct pending_t* batch);
+uint8_t config_to_readback(const struct re_config_t* cfg, struct pending_t* batch);
+void config_forget_readable(struct re_config_t* have, const struct re_config_t* cfg);
+void config_note_param(struct re_config_t* have, const uint8_t* pld, uint16_t len);
+void config_note_request(struct re_config_t* have, const struct pending_t* p);
+uint8_t config_diff(const struct re_config_t* want, const struct re_config_t* have, struct re_config_t* delta);
+uint8_t batch_exchange(struct cari_dev_t* d, struct pending_t* batch, uint8_t n, reply_cb_t cb, void* arg);
+uint8_t apply_batch(struct cari_dev_t* d, struct pending_t* batch, uint8_t n);
+uint8_t config_readback(struct cari_dev_t* d, const struct re_config_t* want, struct re_config_t* have);
@@ -0,0 +1,393 @@
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+
+#include "daemon.h"
+#include "ctrl.h"
+#include "cari.h"
+#include "metrics.h"
+#include "dbg.h"
+#include "log.h"
+#include "interface_cmds.h"
+#include "cari_codec.h"
+#include "term.h" //colored terminal font
+
+//client waiting for a reply from a device
+struct waiter_t
+{
+    uint8_t id[255];        //ROUTER routing ID
+    uint8_t id_len;
+    uint8_t cid;            //of the request
+    double t_enq;           //ms
+};
+
+//device known to the daemon
+//the device answers in order, so replies are handed to the waiters first in, first out
+struct dmn_dev_t
+{
+    struct link_t link;
+    struct waiter_t* fifo;
+    int head;
+    int count;
+    int cap;
+    double t_retry;             //next reconnect attempt while the link has no socket
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static int fifo_push(struct dmn_dev_t* dev, const uint8_t* id, uint8_t id_len, uint8_t cid)
+{
+    if(dev->count == dev->cap)
+    {
+        int cap = dev->cap ? dev->cap*2 : 8;
+        struct waiter_t* fifo = malloc(cap*sizeof(struct waiter_t));
+        if(fifo == NULL)
+            return -1;
+        for(int i=0; i<dev->count; i++) //unwrap
+            fifo[i] = dev->fifo[(dev->head+i) % dev->cap];
+        free(dev->fifo);
+        dev->fifo = fifo;
+        dev->head = 0;
+        dev->cap = cap;
+    }
+
+    struct waiter_t* w = &dev->fifo[(dev->head+dev->count) % dev->cap];
+    memcpy(w->id, id, id_len);
+    w->id_len = id_len;
+    w->cid = cid;
+    w->t_enq = now_ms();
+    dev->count++;
+
+    return 0;
+}
+
+static struct waiter_t* fifo_pop(struct dmn_dev_t* dev)
+{
+    if(dev->count == 0)
+        return NULL;
+
+    struct waiter_t* w = &dev->fifo[dev->head];
+    dev->head = (dev->head+1) % dev->cap;
+    dev->count--;
+
+    return w;
+}
+
+//fresh socket for a device, a closed one must not be left in the poll set
+static void reconnect(struct dmn_dev_t* dev, zmq_pollitem_t* item, double now)
+{
+    if(link_reopen(&dev->link) == 0)
+    {
+        item->socket = dev->link.sock;
+        item->events = ZMQ_POLLIN;
+        return;
+    }
+
+    dbg_print_dev(dev->link.mdev, TERM_RED, "Can not reconnect to %s, retrying in %d ms\n", dev->link.dest, dev->link.timeout);
+    item->socket = NULL;
+    item->fd = -1;
+    item->events = 0;
+    dev->t_retry = now + dev->link.timeout;
+}
+
+//the waiter a reply with this CID belongs to, NULL if none is waiting for one
+//a request the device never answered holds the head of the queue, so the waiters
+//before the match are dropped, their clients resend on their own deadlines
+static struct waiter_t* fifo_match(struct dmn_dev_t* dev, uint8_t cid)
+{
+    int k = 0;
+
+    while(k < dev->count && dev->fifo[(dev->head+k) % dev->cap].cid != cid)
+        k++;
+    if(k == dev->count)
+        return NULL;
+
+    for(; k > 0; k--)
+    {
+        struct waiter_t* w = fifo_pop(dev);
+        metrics_req(dev->link.mdev, w->cid, CARI_NO_REPLY, 1, 0);
+    }
+
+    return fifo_pop(dev);
+}
+
+//reply to a client: [id][empty][device address][CARI frame]
+//the frame message is handed over to ZMQ without copying
+static void send_reply(void* front, const uint8_t* id, uint8_t id_len, const char* dest, zmq_msg_t* frame)
+{
+    zmq_send(front, id, id_len, ZMQ_SNDMORE);
+    zmq_send(front, NULL, 0, ZMQ_SNDMORE);
+    zmq_send(front, dest, strlen(dest), ZMQ_SNDMORE);
+    if(zmq_msg_send(frame, front, 0) < 0)
+        zmq_msg_close(frame);
+}
+
+//status-only reply generated by the daemon itself
+static void send_status(void* front, const uint8_t* id, uint8_t id_len, const char* dest, uint8_t cid, uint8_t err)
+{
+    zmq_msg_t msg;
+
+    if(cari_encode_msg(&msg, cid, &err, 1) == 0)
+        send_reply(front, id, id_len, dest, &msg);
+}
+
+//receive the rest of a multipart message, keeping up to max parts
+//returns the number of parts, the kept ones have to be closed by the caller
+static int recv_parts(void* sock, zmq_msg_t* parts, int max)
+{
+    int n = 0;
+    int more;
+    zmq_msg_t extra;
+
+    do
+    {
+        zmq_msg_t* m = (n < max) ? &parts[n] : &extra;
+
+        zmq_msg_init(m);
+        if(zmq_msg_recv(m, sock, 0) < 0)
+        {
+            zmq_msg_close(m);
+            for(int i=0; i<n && i<max; i++)
+                zmq_msg_close(&parts[i]);
+            return -1;
+        }
+        more = zmq_msg_more(m);
+        if(m == &extra)
+            zmq_msg_close(&extra);
+        n++;
+    } while(more);
+
+    return n;
+}
+
+//run the daemon: a ROUTER front-end at the endpoint, one warm DEALER link per device
+//clients send [empty][device address][CARI frame] and get the reply in the same envelope
+int daemon_run(void* zmq_ctx, const char* endpoint)
+{
+    zmq_msg_t parts[3];
+    uint8_t id[255];
+    char dest[128];
+
+    struct dmn_dev_t* devs = NULL;
+    int ndev = 0;
+    int cap = 0;
+    zmq_pollitem_t* items = NULL;
+    uint64_t forwarded = 0;
+    uint64_t recycled = 0;
+
+    //a libcari client carries all of its devices over one connection, a ROUTER
+    //drops replies past the high-water mark instead of waiting (set before the
+    //bind, connections accepted later keep the options of the bind)
+    int hwm = 0;
+    void* front = zmq_socket(zmq_ctx, ZMQ_ROUTER);
+    if(front != NULL)
+    {
+        zmq_setsockopt(front, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+        zmq_setsockopt(front, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+    }
+    if(front == NULL || zmq_bind(front, endpoint) != 0)
+    {
+        dbg_print(TERM_RED, "Can not bind to %s: %s\n", endpoint, zmq_strerror(zmq_errno()));
+        if(front != NULL)
+            zmq_close(front);
+        return 1;
+    }
+
+    link_set_via(NULL); //the daemon always talks to the devices directly
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    dbg_print(0, "Daemon listening at ");
+    dbg_print(TERM_GREEN, "%s\n", endpoint);
+
+    items = calloc(1, sizeof(zmq_pollitem_t));
+    items[0].socket = front;
+    items[0].events = ZMQ_POLLIN;
+
+    while(running)
+    {
+        //tick faster while something is outstanding, to notice dead devices
+        long wait = 1000;
+        for(int i=0; i<ndev; i++)
+        {
+            if(devs[i].count > 0)
+                wait = 50;
+        }
+
+        if(zmq_poll(items, 1+ndev, wait) < 0)
+        {
+            if(zmq_errno() == EINTR)
+                continue;
+            dbg_print(TERM_RED, "Poll error: %s\n", zmq_strerror(zmq_errno()));
+            break;
+        }
+
+        //requests from clients
+        if(items[0].revents & ZMQ_POLLIN)
+        {
+            int id_len;
+
+            while((id_len = zmq_recv(front, id, sizeof(id), ZMQ_DONTWAIT)) >= 0)
+            {
+                int n = recv_parts(front, parts, 3);
+                if(n < 0)
+                    break;
+
+                if(n != 3 || zmq_msg_size(&parts[0]) != 0 || zmq_msg_size(&parts[1]) == 0
+                    || zmq_msg_size(&parts[1]) >= sizeof(dest) || zmq_msg_size(&parts[2]) < CARI_HDR_LEN)
+                {
+                    LOG(TERM_YELLOW, "Malformed request dropped\n");
+                    for(int i=0; i<n && i<3; i++)
+                        zmq_msg_close(&parts[i]);
+                    continue;
+                }
+
+                memcpy(dest, zmq_msg_data(&parts[1]), zmq_msg_size(&parts[1]));
+                dest[zmq_msg_size(&parts[1])] = 0;
+                uint8_t cid = *(uint8_t*)zmq_msg_data(&parts[2]);
+                zmq_msg_close(&parts[0]);
+                zmq_msg_close(&parts[1]);
+
+                struct dmn_dev_t* dev = NULL;
+                for(int i=0; i<ndev; i++)
+                {
+                    if(strcmp(devs[i].link.dest, dest) == 0)
+                    {
+                        dev = &devs[i];
+                        break;
+                    }
+                }
+
+                if(dev == NULL)
+                {
+                    if(ndev == cap)
+                    {
+                        int new_cap = cap ? cap*2 : 16;
+                        struct dmn_dev_t* new_devs = realloc(devs, new_cap*sizeof(struct dmn_dev_t));
+                        if(new_devs != NULL)
+                            devs = new_devs;
+                        zmq_pollitem_t* new_items = new_devs ? realloc(items, (1+new_cap)*sizeof(zmq_pollitem_t)) : NULL;
+                        if(new_items != NULL)
+                            items = new_items;
+
+                        if(new_devs == NULL || new_items == NULL)
+                        {
+                            dbg_print(TERM_RED, "Out of memory for %s\n", dest);
+                            send_status(front, id, id_len, dest, cid, ERR_ZMQ_CONN);
+                            zmq_msg_close(&parts[2]);
+                            continue;
+                        }
+                        cap = new_cap;
+                    }
+
+                    dev = &devs[ndev];
+                    memset(dev, 0, sizeof(struct dmn_dev_t));
+                    if(link_open(&dev->link, zmq_ctx, dest) != 0)
+                    {
+                        dbg_print(TERM_RED, "Can not connect to %s\n", dest);
+                        send_status(front, id, id_len, dest, cid, ERR_ZMQ_CONN);
+                        zmq_msg_close(&parts[2]);
+                        continue;
+                    }
+
+                    items[1+ndev].socket = dev->link.sock;
+                    items[1+ndev].events = ZMQ_POLLIN;
+                    ndev++;
+
+                    dbg_print_dev(dev->link.mdev, 0, "Device ");
+                    dbg_print_dev(dev->link.mdev, TERM_GREEN, "%s", dest);
+                    dbg_print_dev(dev->link.mdev, 0, " connected\n");
+                }
+
+                if(fifo_push(dev, id, id_len, cid) != 0)
+                {
+                    send_status(front, id, id_len, dest, cid, ERR_ZMQ_CONN);
+                    zmq_msg_close(&parts[2]);
+                    continue;
+                }
+
+                if(dev->link.sock == NULL || link_send_msg(&dev->link, &parts[2]) < 0)
+                {
+                    dev->count--; //drop the waiter just pushed
+                    send_status(front, id, id_len, dest, cid, ERR_ZMQ_CONN);
+                    zmq_msg_close(&parts[2]);
+                    continue;
+                }
+                forwarded++;
+            }
+        }
+
+        //replies from devices
+        for(int i=0; i<ndev; i++)
+        {
+            if(!(items[1+i].revents & ZMQ_POLLIN))
+                continue;
+
+            zmq_msg_t msg;
+            while(link_recv_msg(&devs[i].link, &msg, ZMQ_DONTWAIT) >= 0)
+            {
+                struct waiter_t* w = zmq_msg_size(&msg) > 0 ? fifo_match(&devs[i], *(uint8_t*)zmq_msg_data(&msg)) : NULL;
+                if(w != NULL)
+                {
+                    struct cari_frame_t f;
+                    int err = (cari_decode_reply_msg(w->cid, &msg, &f) == CARI_DEC_OK) ? f.err : CARI_MALFORMED;
+
+                    metrics_req(devs[i].link.mdev, w->cid, err, 1, now_ms() - w->t_enq);
+                    send_reply(front, w->id, w->id_len, devs[i].link.dest, &msg);
+                }
+                else
+                    zmq_msg_close(&msg);
+            }
+        }
+
+        //a device that stopped answering gets a fresh socket, the clients waiting
+        //for it run into their own deadlines and resend
+        double now = now_ms();
+        for(int i=0; i<ndev; i++)
+        {
+            struct dmn_dev_t* dev = &devs[i];
+
+            //the socket could not be recreated, try again every timeout
+            if(dev->link.sock == NULL)
+            {
+                if(now >= dev->t_retry)
+                    reconnect(dev, &items[1+i], now);
+                continue;
+            }
+
+            if(dev->count == 0 || now - dev->fifo[dev->head].t_enq < dev->link.timeout)
+                continue;
+
+            dbg_print_dev(dev->link.mdev, TERM_YELLOW, "Device %s not responding, %d request(s) dropped, reconnecting\n", dev->link.dest, dev->count);
+            for(struct waiter_t* w; (w = fifo_pop(dev)) != NULL; )
+                metrics_req(dev->link.mdev, w->cid, CARI_NO_REPLY, 1, 0);
+            dev->count = 0;
+            dev->head = 0;
+            reconnect(dev, &items[1+i], now);
+            recycled++;
+        }
+    }
+
+    dbg_print(0, "Daemon exiting, %lu request(s) forwarded to %d device(s), %lu reconnect(s)\n", forwarded, ndev, recycled);
+
+    for(int i=0; i<ndev; i++)
+    {
+        link_close(&devs[i].link);
+        free(devs[i].fifo);
+    }
+    free(devs);
+    free(items);
+    zmq_close(front);
+
+    return 0;
+}
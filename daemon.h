@@ -0,0 +1,9 @@
+/*
+ * daemon.h
+ *
+ *  Persistent control daemon keeping warm connections to the devices
+ */
+
+#pragma once
+
+int daemon_run(void* zmq_ctx, const char* endpoint);
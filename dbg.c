@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "dbg.h"
+#include "log.h"
+
+static void print(uint32_t dev, const char* color_code, const char* fmt, va_list ap)
+{
+    char str[1024];
+    int len = vsnprintf(str, sizeof(str), fmt, ap);
+
+    if(len < 0)
+        return;
+    if((size_t)len >= sizeof(str))
+        len = sizeof(str)-1; //cut off
+
+    log_text(color_code, dev, str, len);
+}
+
+//debug printf, formatted here and handed to the logger
+void dbg_print(const char* color_code, const char* fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    print(LOG_NO_DEV, color_code, fmt, ap);
+    va_end(ap);
+}
+
+void dbg_print_dev(uint32_t dev, const char* color_code, const char* fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    print(dev, color_code, fmt, ap);
+    va_end(ap);
+}
@@ -0,0 +1,13 @@
+/*
+ * dbg.h
+ *
+ *  Debug/status output helpers
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+void dbg_print(const char* color_code, const char* fmt, ...);
+//the same for text about one device, dev is its metrics series like for LOG_DEV()
+void dbg_print_dev(uint32_t dev, const char* color_code, const char* fmt, ...);
@@ -0,0 +1,358 @@
+/*
+ * devcache.c
+ *
+ *  On-disk cache of device identity and capabilities
+ *
+ *  The file is a small header followed by fixed size records, one per device
+ *  address, and is memory mapped while in use. An entry is trusted without
+ *  any round trip until its TTL runs out, then the ident is fetched again:
+ *  the cached capabilities are kept if it did not change. The last settings
+ *  the device accepted are kept alongside, for sending only what differs.
+ *  Processes sharing the file serialize through flock().
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "interface_cmds.h"
+#include "cari_codec.h"
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "ctrl.h"
+#include "devcache.h"
+
+#define DEVCACHE_MAGIC      0x48434143u //"CACH"
+#define DEVCACHE_VERSION    2
+#define DEVCACHE_GROW       64          //records added when the file is full
+
+struct devcache_hdr_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t rec_size;                  //sizeof(struct devcache_ent_t) of the writer
+};
+
+#define HDR(c)      ((struct devcache_hdr_t*)(c)->map)
+#define ENT(c, i)   ((struct devcache_ent_t*)((c)->map + sizeof(struct devcache_hdr_t)) + (i))
+
+//map the whole file, re-mapping if another process grew it
+static int remap(struct devcache_t* c)
+{
+    struct stat st;
+
+    if(fstat(c->fd, &st) != 0)
+        return -1;
+    if(c->map != NULL && (size_t)st.st_size == c->size)
+        return 0;
+
+    if(c->map != NULL)
+        munmap(c->map, c->size);
+    c->map = NULL;
+    c->size = st.st_size;
+
+    if(c->size < sizeof(struct devcache_hdr_t))
+        return -1;
+
+    c->map = mmap(NULL, c->size, PROT_READ|PROT_WRITE, MAP_SHARED, c->fd, 0);
+    if(c->map == MAP_FAILED)
+    {
+        c->map = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+//room for count records, under the exclusive lock
+static int reserve(struct devcache_t* c, uint32_t count)
+{
+    size_t need = sizeof(struct devcache_hdr_t) + (size_t)count*sizeof(struct devcache_ent_t);
+
+    if(need <= c->size)
+        return 0;
+    if(ftruncate(c->fd, need + DEVCACHE_GROW*sizeof(struct devcache_ent_t)) != 0)
+        return -1;
+
+    return remap(c);
+}
+
+static int find(const struct devcache_t* c, const char* addr)
+{
+    uint32_t count = HDR(c)->count;
+    uint32_t max = (c->size - sizeof(struct devcache_hdr_t)) / sizeof(struct devcache_ent_t);
+
+    if(count > max)
+        count = max;
+
+    for(uint32_t i=0; i<count; i++)
+    {
+        if(strncmp(ENT(c, i)->addr, addr, sizeof(ENT(c, i)->addr)) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+const char* devcache_default_path(void)
+{
+    static char path[256];
+    const char* dir = getenv("XDG_CACHE_HOME");
+
+    if(dir != NULL && dir[0])
+        snprintf(path, sizeof(path), "%s/cari-ctrl.cache", dir);
+    else if((dir = getenv("HOME")) != NULL && dir[0])
+    {
+        snprintf(path, sizeof(path), "%s/.cache", dir);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/.cache/cari-ctrl.cache", dir);
+    }
+    else
+        return NULL;
+
+    return path;
+}
+
+//open (or create) the cache file, returns 0 on success
+int devcache_open(struct devcache_t* c, const char* path, uint32_t ttl)
+{
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+    c->ttl = ttl;
+
+    if(path == NULL || (c->fd = open(path, O_RDWR|O_CREAT, 0644)) < 0)
+        return -1;
+
+    flock(c->fd, LOCK_EX);
+
+    struct stat st;
+    int ret = -1;
+
+    if(fstat(c->fd, &st) == 0)
+    {
+        if(st.st_size == 0 && ftruncate(c->fd, sizeof(struct devcache_hdr_t)) != 0)
+            goto out;
+        if(remap(c) != 0)
+            goto out;
+
+        struct devcache_hdr_t* h = HDR(c);
+
+        //fresh or incompatible file, start over
+        if(h->magic != DEVCACHE_MAGIC || h->version != DEVCACHE_VERSION || h->rec_size != sizeof(struct devcache_ent_t))
+        {
+            h->magic = DEVCACHE_MAGIC;
+            h->version = DEVCACHE_VERSION;
+            h->rec_size = sizeof(struct devcache_ent_t);
+            h->count = 0;
+        }
+        ret = 0;
+    }
+
+out:
+    flock(c->fd, LOCK_UN);
+    if(ret != 0)
+        devcache_close(c);
+
+    return ret;
+}
+
+void devcache_close(struct devcache_t* c)
+{
+    if(c->map != NULL)
+        munmap(c->map, c->size);
+    if(c->fd >= 0)
+        close(c->fd);
+
+    c->map = NULL;
+    c->fd = -1;
+}
+
+//copy the entry of addr, returns 1 if it is still fresh, 0 if stale, -1 if there is none
+int devcache_lookup(struct devcache_t* c, const char* addr, struct devcache_ent_t* out)
+{
+    int ret = -1;
+
+    if(c->map == NULL)
+        return -1;
+
+    flock(c->fd, LOCK_SH);
+    if(remap(c) == 0)
+    {
+        int i = find(c, addr);
+        if(i >= 0)
+        {
+            *out = *ENT(c, i);
+            out->addr[sizeof(out->addr)-1] = 0;
+            out->ident[sizeof(out->ident)-1] = 0;
+            ret = (time(NULL) - out->t_check < c->ttl) ? 1 : 0;
+        }
+    }
+    flock(c->fd, LOCK_UN);
+
+    return ret;
+}
+
+//insert or replace the entry of ent->addr
+int devcache_store(struct devcache_t* c, const struct devcache_ent_t* ent)
+{
+    int ret = -1;
+
+    if(c->map == NULL)
+        return -1;
+
+    flock(c->fd, LOCK_EX);
+    if(remap(c) == 0)
+    {
+        int i = find(c, ent->addr);
+
+        if(i < 0 && reserve(c, HDR(c)->count + 1) == 0)
+            i = HDR(c)->count++;
+        if(i >= 0)
+        {
+            *ENT(c, i) = *ent;
+            ret = 0;
+        }
+    }
+    flock(c->fd, LOCK_UN);
+
+    return ret;
+}
+
+//replace the known settings of addr, keeping the rest of its entry
+int devcache_set_state(struct devcache_t* c, const char* addr, const struct re_config_t* state)
+{
+    struct devcache_ent_t ent;
+
+    if(devcache_lookup(c, addr, &ent) < 0)
+    {
+        memset(&ent, 0, sizeof(ent));
+        snprintf(ent.addr, sizeof(ent.addr), "%s", addr);
+    }
+
+    ent.state = *state;
+    ent.t_state = time(NULL);
+
+    return devcache_store(c, &ent);
+}
+
+static void on_reply(struct pending_t* p, const struct cari_frame_t* f, void* arg)
+{
+    struct devcache_ent_t* ent = arg;
+
+    if(p->cid == CMD_DEV_GET_IDENT && p->err == ERR_OK)
+    {
+        snprintf(ent->ident, sizeof(ent->ident), "%.*s", (int)strnlen((const char*)f->payload, f->payload_len), f->payload);
+    }
+    else if(p->cid == CMD_SUB_GET_CAPS)
+    {
+        struct cari_caps_t caps;
+
+        if(p->err == ERR_OK && cari_dec_caps(f, &caps) == CARI_DEC_OK)
+        {
+            memcpy(ent->caps, f->payload, CARI_CAPS_LEN);
+            ent->caps_state = DEVCACHE_CAPS_OK;
+        }
+        else if(p->err >= 0)
+            ent->caps_state = DEVCACHE_CAPS_UNSUP;
+    }
+}
+
+//device info from the cache, going to the device only for what is missing or stale
+//returns 1 if served from the cache, 0 if (partly) fetched, -1 if the device did not answer
+int devcache_get(struct devcache_t* c, struct cari_dev_t* d, const char* addr, struct devcache_ent_t* out)
+{
+    struct devcache_ent_t old;
+    int state = devcache_lookup(c, addr, &old);
+
+    if(state == 1 && old.caps_state != DEVCACHE_CAPS_NONE)
+    {
+        *out = old;
+        return 1;
+    }
+
+    struct pending_t batch[2];
+    uint8_t n = 0;
+
+    memset(out, 0, sizeof(*out));
+    snprintf(out->addr, sizeof(out->addr), "%s", addr);
+    config_init(&out->state);
+
+    //stale entry: confirm the ident first, the caps only follow if it changed
+    n += batch_add(&batch[n], cari_encode(batch[n].req, sizeof(batch[n].req), CMD_DEV_GET_IDENT, NULL, 0), "Device ident");
+    if(state < 0 || old.caps_state == DEVCACHE_CAPS_NONE)
+        n += batch_add(&batch[n], cari_encode(batch[n].req, sizeof(batch[n].req), CMD_SUB_GET_CAPS, NULL, 0), "Device capabilities");
+
+    if(batch_exchange(d, batch, n, on_reply, out) != 0 || batch[0].err != ERR_OK)
+        return -1;
+
+    //the known settings survive as long as it is the same device (no ident yet if only the state was stored)
+    if(state >= 0 && (old.ident[0] == 0 || strcmp(out->ident, old.ident) == 0))
+    {
+        out->state = old.state;
+        out->t_state = old.t_state;
+    }
+
+    if(n == 1)
+    {
+        if(strcmp(out->ident, old.ident) == 0)
+        {
+            memcpy(out->caps, old.caps, CARI_CAPS_LEN);
+            out->caps_state = old.caps_state;
+        }
+        else
+        {
+            n = batch_add(&batch[0], cari_encode(batch[0].req, sizeof(batch[0].req), CMD_SUB_GET_CAPS, NULL, 0), "Device capabilities");
+            batch_exchange(d, batch, n, on_reply, out);
+        }
+    }
+
+    out->t_check = time(NULL);
+    devcache_store(c, out);
+
+    return 0;
+}
+
+//check the settings against the cached capabilities, returns the number of violations
+int devcache_check(const struct devcache_ent_t* ent, const struct re_config_t* cfg)
+{
+    struct cari_caps_t caps;
+    struct cari_frame_t f = {.cid = CMD_SUB_GET_CAPS, .payload = ent->caps, .payload_len = CARI_CAPS_LEN};
+    int bad = 0;
+
+    if(ent->caps_state != DEVCACHE_CAPS_OK || cari_dec_caps(&f, &caps) != CARI_DEC_OK)
+        return 0;
+
+    if(cfg->rx_freq > 0 && (cfg->rx_freq < caps.rx_min || cfg->rx_freq > caps.rx_max))
+    {
+        dbg_print(TERM_RED, "RX frequency %lu Hz outside of the device range (%lu-%lu)\n", cfg->rx_freq, caps.rx_min, caps.rx_max);
+        bad++;
+    }
+
+    if(cfg->tx_freq > 0 && (cfg->tx_freq < caps.tx_min || cfg->tx_freq > caps.tx_max))
+    {
+        dbg_print(TERM_RED, "TX frequency %lu Hz outside of the device range (%lu-%lu)\n", cfg->tx_freq, caps.tx_min, caps.tx_max);
+        bad++;
+    }
+
+    if(cfg->tx_pwr >= 0.0f && cfg->tx_pwr > caps.pwr_max)
+    {
+        dbg_print(TERM_RED, "TX power %2.2f dBm above the device maximum (%2.2f dBm)\n", cfg->tx_pwr, caps.pwr_max);
+        bad++;
+    }
+
+    if(cfg->rx_ena == 1 && !(caps.flags & (1<<CAP_IQ)))
+    {
+        dbg_print(TERM_RED, "Device has no I/Q baseband capability\n");
+        bad++;
+    }
+
+    return bad;
+}
@@ -0,0 +1,49 @@
+/*
+ * devcache.h
+ *
+ *  On-disk cache of device identity and capabilities
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cari_codec.h"
+#include "ctrl.h"
+
+#define DEVCACHE_TTL    3600    //default s before the ident is checked again
+
+//caps_state
+#define DEVCACHE_CAPS_NONE      0   //not fetched yet
+#define DEVCACHE_CAPS_OK        1
+#define DEVCACHE_CAPS_UNSUP     2   //device does not answer SUB_GET_CAPS
+
+//a single device, fixed size record in the file
+struct devcache_ent_t
+{
+    char addr[128];
+    char ident[64];
+    int64_t t_check;                //unix time the ident was last confirmed
+    uint8_t caps[CARI_CAPS_LEN];    //SUB_GET_CAPS payload as received
+    uint8_t caps_state;
+    struct re_config_t state;       //last known settings, unset fields are unknown
+    int64_t t_state;                //unix time the state was last confirmed
+};
+
+struct devcache_t
+{
+    int fd;
+    uint8_t* map;
+    size_t size;
+    uint32_t ttl;
+};
+
+int devcache_open(struct devcache_t* c, const char* path, uint32_t ttl);
+void devcache_close(struct devcache_t* c);
+int devcache_lookup(struct devcache_t* c, const char* addr, struct devcache_ent_t* out);
+int devcache_store(struct devcache_t* c, const struct devcache_ent_t* ent);
+int devcache_set_state(struct devcache_t* c, const char* addr, const struct re_config_t* state);
+int devcache_get(struct devcache_t* c, struct cari_dev_t* d, const char* addr, struct devcache_ent_t* out);
+int devcache_check(const struct devcache_ent_t* ent, const struct re_config_t* cfg);
+const char* devcache_default_path(void);
@@ -0,0 +1,376 @@
+/*
+ * discover.c
+ *
+ *  Parallel address/port sweep for CARI devices
+ *
+ *  Every address of the range is probed on every port with a PING and, once
+ *  that is answered, a DEV_GET_IDENT. Probes run through one libcari context
+ *  with a connection each, up to the window at a time; a finished probe's
+ *  connection is closed right away and the next address takes its place.
+ *  Anything that does not answer a PING within the deadline (closed ports,
+ *  hosts that are down, services speaking something else) is dropped, so the
+ *  sweep takes about addresses/window deadlines. The devices found are
+ *  written to stdout sorted by address, as a device list for `--fleet`,
+ *  with the ident as a comment.
+ */
+
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <arpa/inet.h>
+
+#include "interface_cmds.h"
+#include "cari_codec.h"
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "ctrl.h"
+#include "cari.h"
+#include "discover.h"
+
+struct disc_t;
+
+struct probe_t
+{
+    struct probe_t* next;       //free or finished list
+    struct disc_t* d;
+    struct cari_dev_t* cd;
+    uint32_t ip;
+    uint16_t port;
+    uint8_t alive;
+    uint8_t ident_ok;
+    double rtt;                 //ms, of the PING
+    char ident[64];
+};
+
+struct disc_hit_t
+{
+    uint32_t ip;
+    uint16_t port;
+    uint8_t ident_ok;
+    double rtt;
+    char ident[64];
+};
+
+struct disc_t
+{
+    struct probe_t* free;
+    struct probe_t* finished;
+    struct disc_hit_t* hits;
+    uint32_t nhits, cap;
+    uint8_t ident[8];
+    uint16_t ident_len;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+int discover_parse(struct discover_opts_t* opts, const char* spec)
+{
+    char buf[256];
+    struct in_addr in;
+    unsigned prefix = 32;
+
+    if(strlen(spec) >= sizeof(buf))
+        return -1;
+    strcpy(buf, spec);
+
+    char* ports = strchr(buf, ':');
+    if(ports == NULL)
+        return -1;
+    *ports++ = 0;
+
+    char* slash = strchr(buf, '/');
+    if(slash != NULL)
+    {
+        char* end;
+        *slash++ = 0;
+        prefix = strtoul(slash, &end, 10);
+        if(*slash == 0 || *end != 0 || prefix > 32)
+            return -1;
+    }
+    if(inet_pton(AF_INET, buf, &in) != 1)
+        return -1;
+
+    uint32_t mask = prefix ? 0xFFFFFFFFu << (32 - prefix) : 0;
+    opts->net = ntohl(in.s_addr) & mask;
+    opts->prefix = prefix;
+    opts->nports = 0;
+
+    for(char* tok = strtok(ports, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        unsigned first, last;
+        char c;
+
+        if(sscanf(tok, "%u-%u%c", &first, &last, &c) != 2)
+        {
+            if(sscanf(tok, "%u%c", &first, &c) != 1)
+                return -1;
+            last = first;
+        }
+        if(first == 0 || first > last || last > 65535)
+            return -1;
+
+        for(unsigned p=first; p<=last; p++)
+        {
+            if(opts->nports == DISCOVER_MAX_PORTS)
+                return -1;
+            opts->ports[opts->nports++] = p;
+        }
+    }
+    if(opts->nports == 0)
+        return -1;
+
+    //network and broadcast addresses are left out, but for /31 and /32
+    uint64_t hosts = (prefix >= 31) ? 1ull << (32 - prefix) : (1ull << (32 - prefix)) - 2;
+    if(hosts*opts->nports > DISCOVER_MAX_ADDRS)
+        return -1;
+
+    return 0;
+}
+
+static void finish(struct probe_t* p)
+{
+    p->next = p->d->finished;
+    p->d->finished = p;
+}
+
+static void on_ident(const struct cari_result_t* r)
+{
+    struct probe_t* p = r->arg;
+
+    if(r->err == ERR_OK)
+    {
+        size_t len = strnlen((const char*)r->payload, r->payload_len);
+        if(len >= sizeof(p->ident))
+            len = sizeof(p->ident)-1;
+
+        //it ends up in a comment of a line based file
+        for(size_t i=0; i<len; i++)
+            p->ident[i] = isprint(r->payload[i]) ? r->payload[i] : '?';
+        p->ident[len] = 0;
+        p->ident_ok = 1;
+    }
+    finish(p);
+}
+
+static void on_ping(const struct cari_result_t* r)
+{
+    struct probe_t* p = r->arg;
+
+    //a malformed reply is some other service on the port
+    if(r->err < ERR_OK)
+    {
+        finish(p);
+        return;
+    }
+
+    p->alive = 1;
+    p->rtt = r->rtt;
+    if(cari_submit(p->cd, p->d->ident, p->d->ident_len, on_ident, p) == 0)
+        finish(p);
+}
+
+static int cmp_hit(const void* a, const void* b)
+{
+    const struct disc_hit_t* x = a;
+    const struct disc_hit_t* y = b;
+
+    if(x->ip != y->ip)
+        return (x->ip > y->ip) - (x->ip < y->ip);
+    return (int)x->port - (int)y->port;
+}
+
+static void fmt_addr(char* out, size_t size, uint32_t ip, uint16_t port)
+{
+    snprintf(out, size, "%u.%u.%u.%u:%u", ip >> 24, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF, port);
+}
+
+//probes whose result is in, their connections are closed and they go back to the pool
+static void collect(struct disc_t* d, uint32_t* inflight)
+{
+    while(d->finished != NULL)
+    {
+        struct probe_t* p = d->finished;
+        d->finished = p->next;
+
+        if(p->alive && d->nhits == d->cap)
+        {
+            uint32_t cap = d->cap ? d->cap*2 : 64;
+            struct disc_hit_t* hits = realloc(d->hits, cap*sizeof(struct disc_hit_t));
+            if(hits != NULL)
+            {
+                d->hits = hits;
+                d->cap = cap;
+            }
+        }
+
+        if(p->alive && d->nhits < d->cap)
+        {
+            struct disc_hit_t* h = &d->hits[d->nhits++];
+            char addr[32];
+
+            h->ip = p->ip;
+            h->port = p->port;
+            h->rtt = p->rtt;
+            h->ident_ok = p->ident_ok;
+            strcpy(h->ident, p->ident);
+
+            fmt_addr(addr, sizeof(addr), p->ip, p->port);
+            dbg_print(0, "%s ", addr);
+            dbg_print(TERM_GREEN, "found");
+            dbg_print(0, " (%.2f ms)", p->rtt);
+            if(p->ident_ok)
+                dbg_print(0, " \"%s\"\n", p->ident);
+            else
+                dbg_print(TERM_YELLOW, ", no ident\n");
+        }
+
+        cari_dev_close(p->cd);
+        p->next = d->free;
+        d->free = p;
+        (*inflight)--;
+    }
+}
+
+//returns 0 if the whole range was swept
+int discover_run(void* zmq_ctx, const struct discover_opts_t* opts)
+{
+    struct disc_t d = {0};
+    uint8_t ping[8];
+    uint16_t ping_len = cari_encode(ping, sizeof(ping), CMD_PING, NULL, 0);
+    uint32_t first = opts->net, nhosts;
+    uint64_t total, next = 0;
+    uint32_t inflight = 0;
+    int ret = 0;
+
+    if(opts->prefix >= 31)
+        nhosts = 1u << (32 - opts->prefix);
+    else
+    {
+        first++;
+        nhosts = (1u << (32 - opts->prefix)) - 2;
+    }
+    total = (uint64_t)nhosts * opts->nports;
+    d.ident_len = cari_encode(d.ident, sizeof(d.ident), CMD_DEV_GET_IDENT, NULL, 0);
+
+    //always direct, a daemon would keep a connection to every address tried
+    struct cari_t* c = cari_new(zmq_ctx);
+    struct probe_t* pool = calloc(opts->window, sizeof(struct probe_t));
+    if(c == NULL || pool == NULL)
+    {
+        cari_free(c);
+        free(pool);
+        return 1;
+    }
+    cari_set_timeout(c, opts->timeout, opts->retries);
+    for(uint32_t i=0; i<opts->window; i++)
+    {
+        pool[i].d = &d;
+        pool[i].next = d.free;
+        d.free = &pool[i];
+    }
+
+    //stdout carries the device list only, everything else goes to stderr
+    FILE* out = ctrl_take_stdout();
+    if(out == NULL)
+    {
+        cari_free(c);
+        free(pool);
+        return 1;
+    }
+
+    dbg_print(0, "Probing %lu address(es), %u in flight, %d ms deadline\n", total, opts->window, opts->timeout);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    double t0 = now_ms();
+    while(running && (next < total || inflight > 0))
+    {
+        //fill the window, hosts first so one device is not hit on all ports at once
+        while(running && next < total && d.free != NULL)
+        {
+            struct probe_t* p = d.free;
+            char addr[32];
+
+            p->ip = first + next % nhosts;
+            p->port = opts->ports[next / nhosts];
+            p->alive = p->ident_ok = 0;
+            p->ident[0] = 0;
+            next++;
+
+            fmt_addr(addr, sizeof(addr), p->ip, p->port);
+            p->cd = cari_dev_open(c, addr);
+            if(p->cd == NULL)
+            {
+                dbg_print(TERM_RED, "%s connection failed: %s\n", addr, zmq_strerror(zmq_errno()));
+                continue;
+            }
+            if(cari_submit(p->cd, ping, ping_len, on_ping, p) == 0)
+            {
+                cari_dev_close(p->cd);
+                continue;
+            }
+
+            d.free = p->next;
+            inflight++;
+        }
+
+        cari_process(c);
+        collect(&d, &inflight);
+
+        if(next < total && d.free != NULL)
+            continue;
+
+        struct pollfd pfd = {cari_fd(c), POLLIN, 0};
+        if(poll(&pfd, 1, cari_timeout(c)) < 0 && errno != EINTR)
+        {
+            dbg_print(TERM_RED, "Poll error: %s\n", strerror(errno));
+            break;
+        }
+    }
+    double secs = (now_ms() - t0)/1e3;
+
+    if(next < total || inflight > 0)
+    {
+        dbg_print(TERM_YELLOW, "Interrupted, %lu of %lu address(es) probed\n", next - inflight, total);
+        ret = 1;
+    }
+
+    qsort(d.hits, d.nhits, sizeof(struct disc_hit_t), cmp_hit);
+
+    fprintf(out, "# %u.%u.%u.%u/%u, %u port(s): %u device(s)\n", opts->net >> 24, (opts->net >> 16) & 0xFF,
+        (opts->net >> 8) & 0xFF, opts->net & 0xFF, opts->prefix, opts->nports, d.nhits);
+    for(uint32_t i=0; i<d.nhits; i++)
+    {
+        char addr[32];
+
+        fmt_addr(addr, sizeof(addr), d.hits[i].ip, d.hits[i].port);
+        if(d.hits[i].ident_ok)
+            fprintf(out, "%-21s  # %s\n", addr, d.hits[i].ident);
+        else
+            fprintf(out, "%-21s  # no ident\n", addr);
+    }
+    fclose(out);
+
+    dbg_print(0, "Discovery: %lu address(es) probed in %.2f s (%.0f/s), ", next - inflight, secs,
+        secs > 0 ? (next - inflight)/secs : 0);
+    dbg_print(d.nhits ? TERM_GREEN : TERM_YELLOW, "%u device(s) found\n", d.nhits);
+
+    cari_free(c);
+    free(pool);
+    free(d.hits);
+
+    return ret;
+}
@@ -0,0 +1,29 @@
+/*
+ * discover.h
+ *
+ *  Parallel address/port sweep for CARI devices
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define DISCOVER_TIMEOUT    250     //default probe deadline in ms
+#define DISCOVER_WINDOW     256     //default probes in flight
+#define DISCOVER_MAX_PORTS  64
+#define DISCOVER_MAX_ADDRS  (1 << 20)
+
+struct discover_opts_t
+{
+    uint32_t net;               //first address, host order
+    uint8_t prefix;
+    uint16_t ports[DISCOVER_MAX_PORTS];
+    uint8_t nports;
+    int timeout;                //ms per attempt
+    int retries;
+    uint32_t window;            //probes in flight
+};
+
+//"A.B.C.D[/PREFIX]:PORT[,PORT|FIRST-LAST ...]"
+int discover_parse(struct discover_opts_t* opts, const char* spec);
+int discover_run(void* zmq_ctx, const struct discover_opts_t* opts);
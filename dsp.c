@@ -0,0 +1,335 @@
+/*
+ * dsp.c
+ *
+ *  Baseband conversion stage
+ *
+ *  DC removal is done per block: every block is corrected with the offset
+ *  tracked so far, while the conversion kernel sums the block up to update
+ *  the estimate, so it costs no extra pass over the data.
+ *  The SIMD kernels are compiled with function level target attributes and
+ *  only called after the CPU has been checked, no global -m flags needed.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DSP_X86
+#include <immintrin.h>
+#endif
+
+#include "dsp.h"
+
+static const char* kernel_names[DSP_KERNELS] = {"scalar", "sse", "avx2"};
+
+static void convert_scalar(const int16_t* in, float* out, size_t n, float scale, const float dc[2], float sum[2])
+{
+    float si = 0, sq = 0;
+
+    for(size_t i=0; i<n; i++)
+    {
+        float vi = in[2*i] * scale;
+        float vq = in[2*i+1] * scale;
+
+        out[2*i] = vi - dc[0];
+        out[2*i+1] = vq - dc[1];
+        si += vi;
+        sq += vq;
+    }
+
+    sum[0] = si;
+    sum[1] = sq;
+}
+
+//x: ntaps interleaved complex samples, taps: reversed and doubled
+static void fir_scalar(const float* x, const float* taps, uint32_t ntaps, float* y)
+{
+    float re = 0, im = 0;
+
+    for(uint32_t j=0; j<2*ntaps; j+=2)
+    {
+        re += taps[j] * x[j];
+        im += taps[j] * x[j+1];
+    }
+
+    y[0] = re;
+    y[1] = im;
+}
+
+#ifdef DSP_X86
+__attribute__((target("sse4.1")))
+static void convert_sse(const int16_t* in, float* out, size_t n, float scale, const float dc[2], float sum[2])
+{
+    __m128 vs = _mm_set1_ps(scale);
+    __m128 vdc = _mm_setr_ps(dc[0], dc[1], dc[0], dc[1]);
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    size_t i = 0;
+
+    //4 complex samples per round
+    for(; i+4<=n; i+=4)
+    {
+        __m128i raw = _mm_loadu_si128((const __m128i*)&in[2*i]);
+        __m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(raw)), vs);
+        __m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(raw, 8))), vs);
+
+        acc0 = _mm_add_ps(acc0, lo);
+        acc1 = _mm_add_ps(acc1, hi);
+        _mm_storeu_ps(&out[2*i], _mm_sub_ps(lo, vdc));
+        _mm_storeu_ps(&out[2*i+4], _mm_sub_ps(hi, vdc));
+    }
+
+    float a[4];
+    _mm_storeu_ps(a, _mm_add_ps(acc0, acc1));
+
+    convert_scalar(&in[2*i], &out[2*i], n-i, scale, dc, sum);
+    sum[0] += a[0] + a[2];
+    sum[1] += a[1] + a[3];
+}
+
+__attribute__((target("sse4.1")))
+static void fir_sse(const float* x, const float* taps, uint32_t ntaps, float* y)
+{
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+
+    for(uint32_t j=0; j<2*ntaps; j+=8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(&x[j]), _mm_loadu_ps(&taps[j])));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(&x[j+4]), _mm_loadu_ps(&taps[j+4])));
+    }
+
+    //[re0 im0 re1 im1] -> [re0+re1 im0+im1]
+    __m128 acc = _mm_add_ps(acc0, acc1);
+    _mm_storel_pi((__m64*)y, _mm_add_ps(acc, _mm_movehl_ps(acc, acc)));
+}
+
+__attribute__((target("avx2,fma")))
+static void convert_avx2(const int16_t* in, float* out, size_t n, float scale, const float dc[2], float sum[2])
+{
+    __m256 vs = _mm256_set1_ps(scale);
+    __m256 vdc = _mm256_setr_ps(dc[0], dc[1], dc[0], dc[1], dc[0], dc[1], dc[0], dc[1]);
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+
+    //8 complex samples per round
+    for(; i+8<=n; i+=8)
+    {
+        __m128i raw0 = _mm_loadu_si128((const __m128i*)&in[2*i]);
+        __m128i raw1 = _mm_loadu_si128((const __m128i*)&in[2*i+8]);
+        __m256 lo = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(raw0)), vs);
+        __m256 hi = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(raw1)), vs);
+
+        acc0 = _mm256_add_ps(acc0, lo);
+        acc1 = _mm256_add_ps(acc1, hi);
+        _mm256_storeu_ps(&out[2*i], _mm256_sub_ps(lo, vdc));
+        _mm256_storeu_ps(&out[2*i+8], _mm256_sub_ps(hi, vdc));
+    }
+
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    float a[4];
+    _mm_storeu_ps(a, s);
+
+    convert_scalar(&in[2*i], &out[2*i], n-i, scale, dc, sum);
+    sum[0] += a[0] + a[2];
+    sum[1] += a[1] + a[3];
+}
+
+__attribute__((target("avx2,fma")))
+static void fir_avx2(const float* x, const float* taps, uint32_t ntaps, float* y)
+{
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+
+    for(uint32_t j=0; j<2*ntaps; j+=16)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(&x[j]), _mm256_loadu_ps(&taps[j]), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(&x[j+8]), _mm256_loadu_ps(&taps[j+8]), acc1);
+    }
+
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    _mm_storel_pi((__m64*)y, _mm_add_ps(s, _mm_movehl_ps(s, s)));
+}
+#endif
+
+//best kernel the CPU supports
+int dsp_detect(void)
+{
+#ifdef DSP_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return DSP_AVX2;
+    if(__builtin_cpu_supports("sse4.1"))
+        return DSP_SSE;
+#endif
+    return DSP_SCALAR;
+}
+
+const char* dsp_kernel_name(int kernel)
+{
+    return (kernel >= 0 && kernel < DSP_KERNELS) ? kernel_names[kernel] : "auto";
+}
+
+//kernel by name, DSP_AUTO for "auto", -2 if unknown
+int dsp_kernel_parse(const char* name)
+{
+    if(strcmp(name, "auto") == 0)
+        return DSP_AUTO;
+
+    for(int i=0; i<DSP_KERNELS; i++)
+    {
+        if(strcmp(name, kernel_names[i]) == 0)
+            return i;
+    }
+
+    return -2;
+}
+
+dsp_convert_fn dsp_convert_kernel(int kernel)
+{
+#ifdef DSP_X86
+    if(kernel == DSP_AVX2)
+        return convert_avx2;
+    if(kernel == DSP_SSE)
+        return convert_sse;
+#endif
+    (void)kernel;
+    return convert_scalar;
+}
+
+dsp_fir_fn dsp_fir_kernel(int kernel)
+{
+#ifdef DSP_X86
+    if(kernel == DSP_AVX2)
+        return fir_avx2;
+    if(kernel == DSP_SSE)
+        return fir_sse;
+#endif
+    (void)kernel;
+    return fir_scalar;
+}
+
+//Blackman windowed sinc lowpass, passband up to 90% of the output Nyquist frequency
+static void design_lowpass(float* taps, uint32_t ntaps, uint32_t decim)
+{
+    double fc = 0.45 / decim;
+    double mid = (ntaps-1) / 2.0;
+    double sum = 0;
+
+    for(uint32_t k=0; k<ntaps; k++)
+    {
+        double t = k - mid;
+        double sinc = (t == 0) ? 2*fc : sin(2*M_PI*fc*t) / (M_PI*t);
+        double w = 0.42 - 0.5*cos(2*M_PI*k/(ntaps-1)) + 0.08*cos(4*M_PI*k/(ntaps-1));
+
+        taps[k] = sinc * w;
+        sum += taps[k];
+    }
+
+    for(uint32_t k=0; k<ntaps; k++)
+        taps[k] /= sum;
+}
+
+//returns 0 on success, -1 if the kernel is not supported by this CPU
+int dsp_init(struct dsp_chain_t* c, uint32_t decim, int kernel)
+{
+    int best = dsp_detect();
+
+    memset(c, 0, sizeof(struct dsp_chain_t));
+    if(kernel == DSP_AUTO)
+        kernel = best;
+    if(kernel < 0 || kernel > best || decim == 0)
+        return -1;
+
+    c->kernel = kernel;
+    c->scale = 1.0f/32768.0f;
+    c->decim = decim;
+
+    if(decim == 1)
+        return 0;
+
+    c->ntaps = DSP_TAPS_PER_DECIM * decim; //always a multiple of 8
+    c->cap = 4096;
+    c->taps = malloc(2*c->ntaps*sizeof(float));
+    c->buf = calloc(2*(c->ntaps-1 + c->cap), sizeof(float));
+    if(c->taps == NULL || c->buf == NULL)
+    {
+        dsp_free(c);
+        return -1;
+    }
+
+    float* h = malloc(c->ntaps*sizeof(float));
+    if(h == NULL)
+    {
+        dsp_free(c);
+        return -1;
+    }
+
+    design_lowpass(h, c->ntaps, decim);
+    for(uint32_t j=0; j<c->ntaps; j++)
+        c->taps[2*j] = c->taps[2*j+1] = h[c->ntaps-1-j];
+    free(h);
+
+    c->next = c->ntaps-1; //the buffer starts with a zeroed history
+    return 0;
+}
+
+void dsp_free(struct dsp_chain_t* c)
+{
+    free(c->taps);
+    free(c->buf);
+    c->taps = NULL;
+    c->buf = NULL;
+}
+
+static void track_dc(struct dsp_chain_t* c, const float sum[2], size_t n)
+{
+    float alpha = (n < DSP_DC_SAMPLES) ? n/DSP_DC_SAMPLES : 1.0f;
+
+    c->dc[0] += alpha * (sum[0]/n - c->dc[0]);
+    c->dc[1] += alpha * (sum[1]/n - c->dc[1]);
+}
+
+size_t dsp_process(struct dsp_chain_t* c, const int16_t* in, size_t n, float* out)
+{
+    dsp_convert_fn convert = dsp_convert_kernel(c->kernel);
+    float sum[2];
+
+    if(n == 0)
+        return 0;
+
+    if(c->decim == 1)
+    {
+        convert(in, out, n, c->scale, c->dc, sum);
+        track_dc(c, sum, n);
+        return n;
+    }
+
+    uint32_t hist = c->ntaps-1;
+    if(n > c->cap)
+    {
+        float* buf = realloc(c->buf, 2*(hist + n)*sizeof(float));
+        if(buf == NULL)
+            return 0;
+        c->buf = buf;
+        c->cap = n;
+    }
+
+    convert(in, &c->buf[2*hist], n, c->scale, c->dc, sum);
+    track_dc(c, sum, n);
+
+    dsp_fir_fn fir = dsp_fir_kernel(c->kernel);
+    size_t len = hist + n;
+    size_t m = 0;
+
+    for(; c->next < len; c->next += c->decim)
+        fir(&c->buf[2*(c->next-hist)], c->taps, c->ntaps, &out[2*m++]);
+
+    //keep the newest samples as the history of the next block
+    memmove(c->buf, &c->buf[2*n], 2*hist*sizeof(float));
+    c->next -= n;
+
+    return m;
+}
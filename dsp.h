@@ -0,0 +1,54 @@
+/*
+ * dsp.h
+ *
+ *  Baseband conversion stage: int16 I/Q to complex float32, DC removal and
+ *  integer factor FIR decimation, with AVX2/SSE kernels picked at runtime
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum dsp_kernel_t
+{
+    DSP_AUTO = -1,
+    DSP_SCALAR,
+    DSP_SSE,                    //SSE4.1
+    DSP_AVX2,                   //AVX2 + FMA
+    DSP_KERNELS
+};
+
+#define DSP_TAPS_PER_DECIM  16  //filter length per unit of decimation
+#define DSP_DC_SAMPLES      65536.0f //DC tracking time constant in samples
+
+struct dsp_chain_t
+{
+    int kernel;
+    float scale;                //int16 full scale to +/-1.0
+    float dc[2];                //I/Q offset estimate, scaled
+    uint32_t decim;
+    uint32_t ntaps;             //multiple of 8
+    float* taps;                //reversed, every tap twice (I and Q lanes)
+    float* buf;                 //[history][converted block], interleaved complex
+    size_t cap;                 //complex samples
+    size_t next;                //buffer index of the next output's newest sample
+};
+
+int dsp_detect(void);
+const char* dsp_kernel_name(int kernel);
+int dsp_kernel_parse(const char* name);
+
+int dsp_init(struct dsp_chain_t* c, uint32_t decim, int kernel);
+void dsp_free(struct dsp_chain_t* c);
+
+//n complex int16 samples in, returns the number of complex float samples written to out
+//out has to hold n/decim+1 samples
+size_t dsp_process(struct dsp_chain_t* c, const int16_t* in, size_t n, float* out);
+
+//the individual kernels, for benchmarking
+typedef void (*dsp_convert_fn)(const int16_t* in, float* out, size_t n, float scale, const float dc[2], float sum[2]);
+typedef void (*dsp_fir_fn)(const float* x, const float* taps, uint32_t ntaps, float* y);
+
+dsp_convert_fn dsp_convert_kernel(int kernel);
+dsp_fir_fn dsp_fir_kernel(int kernel);
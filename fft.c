@@ -0,0 +1,348 @@
+/*
+ * fft.c
+ *
+ *  Complex FFT
+ *
+ *  Stockham formulation: every pass reads one buffer and writes the other, so
+ *  the output comes out in natural order without a bit reversal pass. log4(n)
+ *  radix-4 passes run first, followed by a radix-2 pass if n is an odd power
+ *  of 2. Twiddles are computed in double precision when the plan is made.
+ *  The SIMD kernels vectorize over the stride of a pass, except for the first
+ *  one (stride 1), where they take several butterflies at once and transpose
+ *  the results. As in dsp.c, they are compiled with function level target
+ *  attributes and only called after the CPU has been checked.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FFT_X86
+#include <immintrin.h>
+#endif
+
+#include "dsp.h"
+#include "fft.h"
+
+//a radix-4 pass over sub-transforms of length n, s of them interleaved
+typedef void (*fft_pass_fn)(const float* x, float* y, uint32_t n, uint32_t s, const float* tw);
+
+static void radix4_scalar(const float* x, float* y, uint32_t n, uint32_t s, const float* tw)
+{
+    uint32_t m = n/4;
+
+    for(uint32_t p=0; p<m; p++)
+    {
+        const float* w1 = &tw[2*p];
+        const float* w2 = &tw[2*(m+p)];
+        const float* w3 = &tw[2*(2*m+p)];
+
+        for(uint32_t q=0; q<s; q++)
+        {
+            const float* a = &x[2*(q + s*p)];
+            const float* b = &x[2*(q + s*(p+m))];
+            const float* c = &x[2*(q + s*(p+2*m))];
+            const float* d = &x[2*(q + s*(p+3*m))];
+            float* o = &y[2*(q + s*4*p)];
+
+            float apc_r = a[0]+c[0], apc_i = a[1]+c[1];
+            float amc_r = a[0]-c[0], amc_i = a[1]-c[1];
+            float bpd_r = b[0]+d[0], bpd_i = b[1]+d[1];
+            float jbmd_r = -(b[1]-d[1]), jbmd_i = b[0]-d[0]; //j*(b-d)
+
+            float t1_r = amc_r - jbmd_r, t1_i = amc_i - jbmd_i;
+            float t2_r = apc_r - bpd_r, t2_i = apc_i - bpd_i;
+            float t3_r = amc_r + jbmd_r, t3_i = amc_i + jbmd_i;
+
+            o[0] = apc_r + bpd_r;
+            o[1] = apc_i + bpd_i;
+            o[2*s] = t1_r*w1[0] - t1_i*w1[1];
+            o[2*s+1] = t1_r*w1[1] + t1_i*w1[0];
+            o[4*s] = t2_r*w2[0] - t2_i*w2[1];
+            o[4*s+1] = t2_r*w2[1] + t2_i*w2[0];
+            o[6*s] = t3_r*w3[0] - t3_i*w3[1];
+            o[6*s+1] = t3_r*w3[1] + t3_i*w3[0];
+        }
+    }
+}
+
+//the last pass of an odd power of 2, length 2 sub-transforms, no twiddles
+static void radix2_scalar(const float* x, float* y, uint32_t s)
+{
+    for(uint32_t q=0; q<s; q++)
+    {
+        const float* a = &x[2*q];
+        const float* b = &x[2*(q+s)];
+
+        y[2*q] = a[0] + b[0];
+        y[2*q+1] = a[1] + b[1];
+        y[2*(q+s)] = a[0] - b[0];
+        y[2*(q+s)+1] = a[1] - b[1];
+    }
+}
+
+#ifdef FFT_X86
+__attribute__((target("sse4.1")))
+static inline __m128 cmul_sse(__m128 a, __m128 w)
+{
+    __m128 sw = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_addsub_ps(_mm_mul_ps(a, _mm_moveldup_ps(w)), _mm_mul_ps(sw, _mm_movehdup_ps(w)));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 mulj_sse(__m128 a)
+{
+    __m128 sw = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_xor_ps(sw, _mm_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f));
+}
+
+//2 complex values per vector
+__attribute__((target("sse4.1")))
+static void radix4_sse(const float* x, float* y, uint32_t n, uint32_t s, const float* tw)
+{
+    uint32_t m = n/4;
+
+    if(s == 1)
+    {
+        if(m % 2)
+        {
+            radix4_scalar(x, y, n, s, tw);
+            return;
+        }
+
+        //2 butterflies at once, outputs transposed back to [y0 y1 y2 y3] per butterfly
+        for(uint32_t p=0; p<m; p+=2)
+        {
+            __m128 a = _mm_loadu_ps(&x[2*p]);
+            __m128 b = _mm_loadu_ps(&x[2*(p+m)]);
+            __m128 c = _mm_loadu_ps(&x[2*(p+2*m)]);
+            __m128 d = _mm_loadu_ps(&x[2*(p+3*m)]);
+
+            __m128 apc = _mm_add_ps(a, c), amc = _mm_sub_ps(a, c);
+            __m128 bpd = _mm_add_ps(b, d), jbmd = mulj_sse(_mm_sub_ps(b, d));
+
+            __m128 y0 = _mm_add_ps(apc, bpd);
+            __m128 y1 = cmul_sse(_mm_sub_ps(amc, jbmd), _mm_loadu_ps(&tw[2*p]));
+            __m128 y2 = cmul_sse(_mm_sub_ps(apc, bpd), _mm_loadu_ps(&tw[2*(m+p)]));
+            __m128 y3 = cmul_sse(_mm_add_ps(amc, jbmd), _mm_loadu_ps(&tw[2*(2*m+p)]));
+
+            _mm_storeu_ps(&y[8*p], _mm_movelh_ps(y0, y1));
+            _mm_storeu_ps(&y[8*p+4], _mm_movelh_ps(y2, y3));
+            _mm_storeu_ps(&y[8*p+8], _mm_movehl_ps(y1, y0));
+            _mm_storeu_ps(&y[8*p+12], _mm_movehl_ps(y3, y2));
+        }
+        return;
+    }
+
+    for(uint32_t p=0; p<m; p++)
+    {
+        __m128 w1 = _mm_castpd_ps(_mm_load1_pd((const double*)&tw[2*p]));
+        __m128 w2 = _mm_castpd_ps(_mm_load1_pd((const double*)&tw[2*(m+p)]));
+        __m128 w3 = _mm_castpd_ps(_mm_load1_pd((const double*)&tw[2*(2*m+p)]));
+
+        for(uint32_t q=0; q<s; q+=2)
+        {
+            __m128 a = _mm_loadu_ps(&x[2*(q + s*p)]);
+            __m128 b = _mm_loadu_ps(&x[2*(q + s*(p+m))]);
+            __m128 c = _mm_loadu_ps(&x[2*(q + s*(p+2*m))]);
+            __m128 d = _mm_loadu_ps(&x[2*(q + s*(p+3*m))]);
+            float* o = &y[2*(q + s*4*p)];
+
+            __m128 apc = _mm_add_ps(a, c), amc = _mm_sub_ps(a, c);
+            __m128 bpd = _mm_add_ps(b, d), jbmd = mulj_sse(_mm_sub_ps(b, d));
+
+            _mm_storeu_ps(o, _mm_add_ps(apc, bpd));
+            _mm_storeu_ps(o + 2*s, cmul_sse(_mm_sub_ps(amc, jbmd), w1));
+            _mm_storeu_ps(o + 4*s, cmul_sse(_mm_sub_ps(apc, bpd), w2));
+            _mm_storeu_ps(o + 6*s, cmul_sse(_mm_add_ps(amc, jbmd), w3));
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 cmul_avx2(__m256 a, __m256 w)
+{
+    __m256 sw = _mm256_permute_ps(a, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm256_fmaddsub_ps(a, _mm256_moveldup_ps(w), _mm256_mul_ps(sw, _mm256_movehdup_ps(w)));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 mulj_avx2(__m256 a)
+{
+    __m256 sw = _mm256_permute_ps(a, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm256_xor_ps(sw, _mm256_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f));
+}
+
+//4 complex values per vector
+__attribute__((target("avx2,fma")))
+static void radix4_avx2(const float* x, float* y, uint32_t n, uint32_t s, const float* tw)
+{
+    uint32_t m = n/4;
+
+    if(s < 4)
+    {
+        if(m % 4)
+        {
+            radix4_sse(x, y, n, s, tw);
+            return;
+        }
+
+        //4 butterflies at once, a 4x4 complex transpose puts the outputs back in order
+        for(uint32_t p=0; p<m; p+=4)
+        {
+            __m256 a = _mm256_loadu_ps(&x[2*p]);
+            __m256 b = _mm256_loadu_ps(&x[2*(p+m)]);
+            __m256 c = _mm256_loadu_ps(&x[2*(p+2*m)]);
+            __m256 d = _mm256_loadu_ps(&x[2*(p+3*m)]);
+
+            __m256 apc = _mm256_add_ps(a, c), amc = _mm256_sub_ps(a, c);
+            __m256 bpd = _mm256_add_ps(b, d), jbmd = mulj_avx2(_mm256_sub_ps(b, d));
+
+            __m256d y0 = _mm256_castps_pd(_mm256_add_ps(apc, bpd));
+            __m256d y1 = _mm256_castps_pd(cmul_avx2(_mm256_sub_ps(amc, jbmd), _mm256_loadu_ps(&tw[2*p])));
+            __m256d y2 = _mm256_castps_pd(cmul_avx2(_mm256_sub_ps(apc, bpd), _mm256_loadu_ps(&tw[2*(m+p)])));
+            __m256d y3 = _mm256_castps_pd(cmul_avx2(_mm256_add_ps(amc, jbmd), _mm256_loadu_ps(&tw[2*(2*m+p)])));
+
+            __m256d t0 = _mm256_unpacklo_pd(y0, y1), t1 = _mm256_unpackhi_pd(y0, y1);
+            __m256d t2 = _mm256_unpacklo_pd(y2, y3), t3 = _mm256_unpackhi_pd(y2, y3);
+
+            _mm256_storeu_ps(&y[8*p], _mm256_castpd_ps(_mm256_permute2f128_pd(t0, t2, 0x20)));
+            _mm256_storeu_ps(&y[8*p+8], _mm256_castpd_ps(_mm256_permute2f128_pd(t1, t3, 0x20)));
+            _mm256_storeu_ps(&y[8*p+16], _mm256_castpd_ps(_mm256_permute2f128_pd(t0, t2, 0x31)));
+            _mm256_storeu_ps(&y[8*p+24], _mm256_castpd_ps(_mm256_permute2f128_pd(t1, t3, 0x31)));
+        }
+        return;
+    }
+
+    for(uint32_t p=0; p<m; p++)
+    {
+        __m256 w1 = _mm256_castpd_ps(_mm256_broadcast_sd((const double*)&tw[2*p]));
+        __m256 w2 = _mm256_castpd_ps(_mm256_broadcast_sd((const double*)&tw[2*(m+p)]));
+        __m256 w3 = _mm256_castpd_ps(_mm256_broadcast_sd((const double*)&tw[2*(2*m+p)]));
+
+        for(uint32_t q=0; q<s; q+=4)
+        {
+            __m256 a = _mm256_loadu_ps(&x[2*(q + s*p)]);
+            __m256 b = _mm256_loadu_ps(&x[2*(q + s*(p+m))]);
+            __m256 c = _mm256_loadu_ps(&x[2*(q + s*(p+2*m))]);
+            __m256 d = _mm256_loadu_ps(&x[2*(q + s*(p+3*m))]);
+            float* o = &y[2*(q + s*4*p)];
+
+            __m256 apc = _mm256_add_ps(a, c), amc = _mm256_sub_ps(a, c);
+            __m256 bpd = _mm256_add_ps(b, d), jbmd = mulj_avx2(_mm256_sub_ps(b, d));
+
+            _mm256_storeu_ps(o, _mm256_add_ps(apc, bpd));
+            _mm256_storeu_ps(o + 2*s, cmul_avx2(_mm256_sub_ps(amc, jbmd), w1));
+            _mm256_storeu_ps(o + 4*s, cmul_avx2(_mm256_sub_ps(apc, bpd), w2));
+            _mm256_storeu_ps(o + 6*s, cmul_avx2(_mm256_add_ps(amc, jbmd), w3));
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void radix2_avx2(const float* x, float* y, uint32_t s)
+{
+    for(uint32_t q=0; q<s; q+=4)
+    {
+        __m256 a = _mm256_loadu_ps(&x[2*q]);
+        __m256 b = _mm256_loadu_ps(&x[2*(q+s)]);
+
+        _mm256_storeu_ps(&y[2*q], _mm256_add_ps(a, b));
+        _mm256_storeu_ps(&y[2*(q+s)], _mm256_sub_ps(a, b));
+    }
+}
+#endif
+
+static fft_pass_fn radix4_kernel(int kernel)
+{
+#ifdef FFT_X86
+    if(kernel == DSP_AVX2)
+        return radix4_avx2;
+    if(kernel == DSP_SSE)
+        return radix4_sse;
+#endif
+    (void)kernel;
+    return radix4_scalar;
+}
+
+int fft_init(struct fft_plan_t* p, uint32_t n, int kernel)
+{
+    int best = dsp_detect();
+
+    memset(p, 0, sizeof(struct fft_plan_t));
+    if(kernel == DSP_AUTO)
+        kernel = best;
+    if(kernel < 0 || kernel > best || n < FFT_MIN_SIZE || n > FFT_MAX_SIZE || (n & (n-1)))
+        return -1;
+
+    p->n = n;
+    p->kernel = kernel;
+    p->tw = malloc(2*n*sizeof(float)); //3/4 n + 3/16 n + ... < n twiddles
+    p->work = malloc(2*n*sizeof(float));
+    if(p->tw == NULL || p->work == NULL)
+    {
+        fft_free(p);
+        return -1;
+    }
+
+    float* tw = p->tw;
+    for(uint32_t len=n; len>=4; len/=4)
+    {
+        uint32_t m = len/4;
+
+        for(uint32_t k=1; k<=3; k++)
+        {
+            for(uint32_t i=0; i<m; i++)
+            {
+                double a = -2*M_PI*k*i/len;
+                *tw++ = cos(a);
+                *tw++ = sin(a);
+            }
+        }
+    }
+
+    return 0;
+}
+
+void fft_free(struct fft_plan_t* p)
+{
+    free(p->tw);
+    free(p->work);
+    p->tw = NULL;
+    p->work = NULL;
+}
+
+const float* fft_run(const struct fft_plan_t* p, float* x)
+{
+    fft_pass_fn pass = radix4_kernel(p->kernel);
+    const float* tw = p->tw;
+    float* in = x;
+    float* out = p->work;
+    uint32_t len = p->n, s = 1;
+
+    for(; len>=4; len/=4, s*=4)
+    {
+        pass(in, out, len, s, tw);
+        tw += 6*(len/4);
+
+        float* t = in;
+        in = out;
+        out = t;
+    }
+
+    if(len == 2)
+    {
+#ifdef FFT_X86
+        if(p->kernel == DSP_AVX2)
+            radix2_avx2(in, out, s);
+        else
+#endif
+        radix2_scalar(in, out, s);
+        in = out;
+    }
+
+    return in;
+}
@@ -0,0 +1,30 @@
+/*
+ * fft.h
+ *
+ *  Radix-4 (plus a final radix-2 pass) complex FFT with AVX2/SSE kernels
+ *  picked at runtime, see dsp.h for the kernel IDs
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FFT_MIN_SIZE    16
+#define FFT_MAX_SIZE    65536
+
+struct fft_plan_t
+{
+    uint32_t n;                 //complex points, a power of 2
+    int kernel;
+    float* tw;                  //twiddles of every radix-4 pass: [w^p][w^2p][w^3p], p < n/4 of that pass
+    float* work;                //second buffer, the passes alternate between it and the input
+};
+
+//returns 0 on success, -1 if the size is not a power of 2 in range or the kernel is not supported
+int fft_init(struct fft_plan_t* p, uint32_t n, int kernel);
+void fft_free(struct fft_plan_t* p);
+
+//forward transform of n interleaved complex floats, x is overwritten
+//returns the result, either x or the plan's work buffer, in natural order
+const float* fft_run(const struct fft_plan_t* p, float* x);
@@ -0,0 +1,352 @@
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <poll.h>
+
+#include "fleet.h"
+#include "ctrl.h"
+#include "dbg.h"
+#include "log.h"
+#include "interface_cmds.h"
+#include "term.h" //colored terminal font
+
+//append a device, returns its index or -1
+int fleet_add(struct fleet_t* fleet, const struct re_config_t* cfg)
+{
+    if(fleet->n == fleet->cap)
+    {
+        int cap = fleet->cap ? fleet->cap*2 : 16;
+        struct fleet_dev_t* dev = realloc(fleet->dev, cap*sizeof(struct fleet_dev_t));
+        if(dev == NULL)
+            return -1;
+        fleet->dev = dev;
+        fleet->cap = cap;
+    }
+
+    memset(&fleet->dev[fleet->n], 0, sizeof(struct fleet_dev_t));
+    fleet->dev[fleet->n].cfg = *cfg;
+
+    return fleet->n++;
+}
+
+//load a device list, one device per line:
+//  ADDR [option=value ...]
+//options use the long option names, e.g. "192.168.1.200:17002 rfreq=433000000 power=20"
+//settings not given on the line are taken from the defaults
+int fleet_load(struct fleet_t* fleet, const char* path, const struct re_config_t* defaults, const struct option* opts)
+{
+    FILE* fp = fopen(path, "r");
+    char line[1024];
+    int line_num = 0;
+
+    if(fp == NULL)
+    {
+        dbg_print(TERM_RED, "Can not open device list %s\n", path);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), fp) != NULL)
+    {
+        line_num++;
+
+        char* hash = strchr(line, '#'); //strip comments
+        if(hash != NULL)
+            *hash = 0;
+
+        char* tok = strtok(line, " \t\r\n");
+        if(tok == NULL)
+            continue;
+
+        struct re_config_t cfg = *defaults;
+        if(config_parse_opt(&cfg, 'd', tok, 0) != 0)
+        {
+            dbg_print(TERM_RED, "%s:%d: bad device address\n", path, line_num);
+            fclose(fp);
+            return -1;
+        }
+
+        while((tok = strtok(NULL, " \t\r\n")) != NULL)
+        {
+            char* val = strchr(tok, '=');
+            const struct option* o = NULL;
+
+            if(val != NULL)
+            {
+                *val++ = 0;
+                for(o = opts; o->name != NULL; o++)
+                    if(strcmp(o->name, tok) == 0 && o->has_arg != no_argument)
+                        break;
+            }
+
+            if(o == NULL || o->name == NULL || config_parse_opt(&cfg, o->val, val, 0) != 0)
+            {
+                dbg_print(TERM_RED, "%s:%d: bad setting \"%s\"\n", path, line_num, tok);
+                fclose(fp);
+                return -1;
+            }
+        }
+
+        if(fleet_add(fleet, &cfg) < 0)
+        {
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+    return fleet->n;
+}
+
+//settings batch of a device, without what it already has when converging
+static void build_apply(const struct fleet_t* fleet, struct fleet_dev_t* dev)
+{
+    struct re_config_t delta = dev->cfg;
+
+    if(fleet->converge)
+        dev->same = config_diff(&dev->cfg, &dev->have, &delta);
+
+    dev->phase = FLEET_APPLY;
+    dev->n = config_to_batch(&delta, dev->batch);
+}
+
+//the address, ident and request descriptions can be longer than LOG_STR, they go as text
+static void report_dev(const struct fleet_t* fleet, struct fleet_dev_t* dev)
+{
+    uint32_t ldev = (dev->cd != NULL) ? (uint32_t)cari_dev_mdev(dev->cd) : LOG_NO_DEV; //none when already converged
+
+    dbg_print_dev(ldev, 0, "%s ", dev->cfg.re_addr);
+
+    if(dev->failed == 0)
+        LOG_DEV(ldev, TERM_GREEN, "OK");
+    else
+        LOG_DEV(ldev, TERM_YELLOW, "FAIL");
+    LOG_DEV(ldev, 0, " %d/%d in %.2f ms", dev->n-dev->failed, dev->n, now_ms()-dev->t_start);
+    if(dev->attempt > 0)
+        LOG_DEV(ldev, 0, " after %d attempts", dev->attempt+1);
+    if(dev->same)
+        LOG_DEV(ldev, 0, ", %d unchanged", dev->same);
+    if(dev->ident[0])
+        dbg_print_dev(ldev, 0, " \"%s\"", dev->ident);
+    dbg_print_dev(ldev, 0, "\n"); //not dropped, the next line must not run into this one
+
+    for(uint8_t i=0; i<dev->n; i++)
+    {
+        struct pending_t* p = &dev->batch[i];
+
+        if(!p->done)
+            dbg_print_dev(ldev, TERM_RED, "  %s - no response\n", p->desc);
+        else if(p->err == ERR_OK && fleet->converge)
+            dbg_print_dev(ldev, 0, "  %s\n", p->desc);
+        else if(p->err > 0)
+            dbg_print_dev(ldev, TERM_YELLOW, "  %s - ERR %d (%s)\n", p->desc, p->err, cari_err_name(p->err));
+        else if(p->err < 0)
+            dbg_print_dev(ldev, TERM_RED, "  %s - malformed response\n", p->desc);
+    }
+}
+
+//put the whole batch of a device in the queue, returns the number of requests queued
+//one that could not be queued counts as unanswered right away
+static uint8_t submit_batch(struct fleet_dev_t* dev)
+{
+    uint8_t queued = 0;
+
+    for(uint8_t i=0; i<dev->n; i++)
+    {
+        dev->ids[i] = cari_submit(dev->cd, dev->batch[i].req, dev->batch[i].len, NULL, dev);
+        if(dev->ids[i] != 0)
+            queued++;
+        else
+        {
+            dev->replies++;
+            dev->failed += (dev->phase == FLEET_APPLY);
+        }
+    }
+
+    return queued;
+}
+
+//drive all devices at once through one libcari context, waiting on its descriptor
+//returns the number of devices that did not complete successfully
+int fleet_run(struct fleet_t* fleet, void* zmq_ctx, uint8_t dev_reset, uint8_t get_ident)
+{
+    int remaining = 0;
+    int failed = 0;
+    int changed = 0, same = 0;      //settings, when converging
+    double t0 = now_ms();
+    int timeout, retries;
+
+    struct cari_t* c = cari_new(zmq_ctx);
+    if(c == NULL)
+        return fleet->n;
+
+    link_get_timeout(&timeout, &retries);
+    cari_set_timeout(c, timeout, retries);
+    cari_set_window(c, MAX_BATCH);
+    if(link_get_via() != NULL && cari_set_via(c, link_get_via()) != 0)
+    {
+        dbg_print(TERM_RED, "Can not connect to %s\n", link_get_via());
+        cari_free(c);
+        return fleet->n;
+    }
+
+    for(int i=0; i<fleet->n; i++)
+    {
+        struct fleet_dev_t* dev = &fleet->dev[i];
+
+        if(get_ident)
+            dev->n = batch_add(&dev->batch[0], cari_encode(dev->batch[0].req, sizeof(dev->batch[0].req), CMD_DEV_GET_IDENT, NULL, 0), "Device ident");
+        else if(dev_reset)
+            dev->n = batch_add(&dev->batch[0], cari_enc_set_reg(dev->batch[0].req, sizeof(dev->batch[0].req), 0, 0), "Device reset");
+        else
+        {
+            struct devcache_ent_t ent;
+
+            config_init(&dev->have);
+            if(fleet->cache != NULL && devcache_lookup(fleet->cache, dev->cfg.re_addr, &ent) >= 0
+                && time(NULL) - ent.t_state < fleet->cache->ttl)
+                dev->have = ent.state;
+
+            if(fleet->converge & 2)
+            {
+                dev->phase = FLEET_READBACK;
+                dev->n = config_to_readback(&dev->cfg, dev->batch);
+                config_forget_readable(&dev->have, &dev->cfg);
+            }
+            if(dev->n == 0)
+                build_apply(fleet, dev);
+        }
+
+        dev->t_start = now_ms();
+        if(dev->n == 0)
+        {
+            if(dev->same) //already converged, nothing to send
+                report_dev(fleet, dev);
+            same += dev->same;
+            continue;
+        }
+
+        dev->cd = cari_dev_open(c, dev->cfg.re_addr);
+        if(dev->cd == NULL)
+        {
+            dbg_print(TERM_RED, "%s connection failed: %s\n", dev->cfg.re_addr, zmq_strerror(zmq_errno()));
+            dev->failed = dev->n;
+            failed++;
+            continue;
+        }
+
+        if(submit_batch(dev) == 0)
+        {
+            dbg_print(TERM_RED, "%s: requests could not be queued\n", dev->cfg.re_addr);
+            dev->failed = dev->n;
+            failed++;
+            continue;
+        }
+        remaining++;
+    }
+
+    while(remaining > 0)
+    {
+        const struct cari_result_t* r;
+
+        cari_process(c);
+
+        while((r = cari_next(c)) != NULL)
+        {
+            struct fleet_dev_t* dev = r->arg;
+            uint8_t k = 0;
+
+            while(k < dev->n && dev->ids[k] != r->id)
+                k++;
+            if(k == dev->n)
+                continue;
+
+            struct pending_t* p = &dev->batch[k];
+
+            p->attempts = r->attempts;
+            if(r->attempts > dev->attempt + 1)
+                dev->attempt = r->attempts - 1;
+            dev->replies++;
+
+            if(r->err == CARI_NO_REPLY) //left not done, reported as such
+                dev->failed += (dev->phase == FLEET_APPLY);
+            else
+            {
+                p->done = 1;
+                p->rtt = r->rtt;
+                p->err = (r->err >= 0) ? r->err : -1;
+                if(p->err != ERR_OK)
+                    dev->failed += (dev->phase == FLEET_APPLY); //unreadable settings are just sent
+                else if(p->cid == CMD_SUB_GET_PARAM)
+                    config_note_param(&dev->have, r->payload, r->payload_len);
+                else if(p->cid == CMD_DEV_GET_IDENT)
+                    snprintf(dev->ident, sizeof(dev->ident), "%.*s", (int)strnlen((const char*)r->payload, r->payload_len), r->payload);
+            }
+
+            if(dev->replies < dev->n)
+                continue;
+
+            //state read back, send what differs over the same connection
+            if(dev->phase == FLEET_READBACK)
+            {
+                build_apply(fleet, dev);
+                dev->replies = 0;
+                dev->attempt = 0;
+                if(dev->n > 0 && submit_batch(dev) > 0)
+                    continue;
+            }
+
+            for(uint8_t i=0; i<dev->n; i++)
+            {
+                config_note_request(&dev->have, &dev->batch[i]);
+                changed += (dev->batch[i].done && dev->batch[i].err == ERR_OK);
+            }
+            same += dev->same;
+            if(dev_reset && !dev->failed)
+                config_init(&dev->have);
+            if(fleet->cache != NULL && !get_ident)
+                devcache_set_state(fleet->cache, dev->cfg.re_addr, &dev->have);
+
+            report_dev(fleet, dev);
+            if(dev->failed)
+                failed++;
+            remaining--;
+        }
+
+        if(remaining == 0)
+            break;
+
+        //sleep until the nearest deadline at most, a readback just finished has its batch to send right away
+        struct pollfd pfd = {cari_fd(c), POLLIN, 0};
+        if(poll(&pfd, 1, cari_timeout(c)) < 0 && errno != EINTR)
+        {
+            dbg_print(TERM_RED, "Poll error: %s\n", strerror(errno));
+            break;
+        }
+    }
+
+    cari_free(c);
+
+    dbg_print(0, "Fleet: %d device(s), ", fleet->n);
+    if(failed)
+        dbg_print(TERM_YELLOW, "%d failed", failed);
+    else
+        dbg_print(TERM_GREEN, "all OK");
+    if(fleet->converge)
+        dbg_print(0, ", %d setting(s) changed, %d already in place", changed, same);
+    dbg_print(0, ", %.2f ms total\n", now_ms()-t0);
+
+    return failed;
+}
+
+void fleet_free(struct fleet_t* fleet)
+{
+    free(fleet->dev);
+    fleet->dev = NULL;
+    fleet->n = fleet->cap = 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * fleet.h
+ *
+ *  Concurrent control of many devices from a single process
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <getopt.h>
+
+#include "ctrl.h"
+#include "cari.h"
+#include "devcache.h"
+
+//device phases
+#define FLEET_APPLY     0
+#define FLEET_READBACK  1       //reading the settings back before converging
+
+struct fleet_dev_t
+{
+    struct re_config_t cfg;
+    struct cari_dev_t* cd;
+    struct pending_t batch[MAX_BATCH];
+    uint64_t ids[MAX_BATCH];    //request ID of each batch entry, 0 - not submitted
+    uint8_t n;                  //requests in the batch
+    uint8_t replies;            //replies received so far
+    uint8_t failed;
+    uint8_t attempt;            //attempts the slowest request took, 0 - first one
+    char ident[64];
+    double t_start;             //ms
+    struct re_config_t have;    //last known settings
+    uint8_t phase;
+    uint8_t same;               //settings already in place, not sent
+};
+
+struct fleet_t
+{
+    struct fleet_dev_t* dev;
+    int n;
+    int cap;
+    struct devcache_t* cache;   //known device states, NULL - none
+    uint8_t converge;           //bit 0 - only send what differs, bit 1 - read the state back first
+};
+
+int fleet_add(struct fleet_t* fleet, const struct re_config_t* cfg);
+int fleet_load(struct fleet_t* fleet, const char* path, const struct re_config_t* defaults, const struct option* opts);
+int fleet_run(struct fleet_t* fleet, void* zmq_ctx, uint8_t dev_reset, uint8_t get_ident);
+void fleet_free(struct fleet_t* fleet);
@@ -0,0 +1,129 @@
+/*
+ * fuzz_codec.c
+ *
+ *  CARI decoder fuzz target
+ *
+ *  Built with clang it is a libFuzzer target, with CARI_FUZZ_RANDOM defined
+ *  it runs standalone on randomly mutated frames (for use without clang).
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cari_codec.h"
+#include "interface_cmds.h"
+
+static const uint8_t cids[] =
+{
+    #define X(id, name, req_min, req_max, rep_kind, rep_min, rep_max) id,
+    CARI_CMD_TABLE(X)
+    #undef X
+};
+
+static volatile uint32_t sink;
+
+//every successfully decoded frame has to stay inside the input
+static void check(const struct cari_frame_t* f, const uint8_t* data, size_t size)
+{
+    uint32_t acc = 0;
+
+    if(f->payload < data || f->payload + f->payload_len > data + size || f->len != size
+        || f->payload_len + CARI_HDR_LEN != f->len)
+        abort();
+
+    for(uint16_t i=0; i<f->payload_len; i++)
+        acc += f->payload[i];
+    sink = acc;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    struct cari_frame_t f;
+    uint8_t buf[64];
+
+    if(cari_decode(data, size, &f) == CARI_DEC_OK)
+        check(&f, data, size);
+
+    if(cari_decode_request(data, size, &f) == CARI_DEC_OK)
+        check(&f, data, size);
+
+    for(size_t i=0; i<sizeof(cids); i++)
+    {
+        if(cari_decode_reply(cids[i], data, size, &f) == CARI_DEC_OK)
+        {
+            const struct cari_cmd_info_t* info = cari_cmd_info(cids[i]);
+            check(&f, data, size);
+            if(f.cid != cids[i] || (info->rep_kind == CARI_REP_STATUS && f.payload_len != 1))
+                abort();
+            if(cari_reply_ambiguous(&f) && (info->rep_kind != CARI_REP_BYTE || f.payload_len != 1))
+                abort();
+
+            struct cari_caps_t caps;
+            if(cari_dec_caps(&f, &caps) == CARI_DEC_OK && f.payload_len < CARI_CAPS_LEN)
+                abort();
+
+            struct cari_spvn_info_t vars[8];
+            int n = cari_dec_spvn_list(&f, vars, 8);
+            for(int k=0; k<n; k++)
+                if(strlen(vars[k].name) >= CARI_SPVN_NAME_LEN)
+                    abort();
+        }
+    }
+
+    //supervision samples, with every id typed by the first payload byte
+    if(cari_decode(data, size, &f) == CARI_DEC_OK && f.payload_len > 0)
+    {
+        struct cari_spvn_iter_t it;
+        uint8_t types[256];
+        uint8_t id;
+        float val;
+
+        memset(types, f.payload[0] % (SPVN_F32+2), sizeof(types));
+        f.cid = CMD_DEV_START_SPVN_STREAM;
+        if(cari_spvn_begin(&f, &it) == CARI_DEC_OK)
+        {
+            while(cari_spvn_next(&it, types, &id, &val) > 0)
+                if(it.p > data + size)
+                    abort();
+        }
+    }
+
+    //re-encoding the input as a payload must round trip
+    size_t len = cari_encode(buf, sizeof(buf), size ? data[0] : 0, data, size);
+    if(len != 0 && (cari_decode(buf, len, &f) != CARI_DEC_OK || f.payload_len != size || memcmp(f.payload, data, size) != 0))
+        abort();
+
+    return 0;
+}
+
+#ifdef CARI_FUZZ_RANDOM
+int main(int argc, char* argv[])
+{
+    uint64_t iters = (argc > 1) ? strtoull(argv[1], NULL, 0) : 10000000ULL;
+    uint8_t frame[80];
+
+    srand(1);
+    for(uint64_t i=0; i<iters; i++)
+    {
+        //mostly well-formed headers, so the payload checks get exercised
+        size_t size = rand() % sizeof(frame);
+        for(size_t j=0; j<size; j++)
+            frame[j] = rand();
+        if(size >= CARI_HDR_LEN && (rand() & 3))
+        {
+            frame[0] = cids[rand() % sizeof(cids)];
+            cari_put_u16(&frame[1], size);
+        }
+
+        uint8_t* data = malloc(size ? size : 1); //exact size, for ASan
+        memcpy(data, frame, size);
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+    }
+
+    printf("%lu inputs OK\n", (unsigned long)iters);
+    return 0;
+}
+#endif
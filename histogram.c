@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "histogram.h"
+
+void hist_init(struct hist_t* h)
+{
+    memset(h, 0, sizeof(struct hist_t));
+    h->min = UINT64_MAX;
+}
+
+//bucket index of a value
+uint32_t hist_bucket(uint64_t v)
+{
+    if(v < (2ULL << HIST_SUB_BITS))
+        return v;
+
+    uint32_t e = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return ((e+1) << HIST_SUB_BITS) + (uint32_t)(v >> e) - (1U << HIST_SUB_BITS);
+}
+
+//largest value falling into a bucket
+uint64_t hist_bucket_top(uint32_t b)
+{
+    if(b < (2U << HIST_SUB_BITS))
+        return b;
+
+    uint32_t e = (b >> HIST_SUB_BITS) - 1;
+    uint64_t m = (b & ((1U << HIST_SUB_BITS)-1)) + (1U << HIST_SUB_BITS);
+    return ((m+1) << e) - 1;
+}
+
+void hist_add(struct hist_t* h, uint64_t v)
+{
+    h->counts[hist_bucket(v)]++;
+    h->n++;
+    h->sum += v;
+    if(v < h->min)
+        h->min = v;
+    if(v > h->max)
+        h->max = v;
+}
+
+void hist_merge(struct hist_t* dst, const struct hist_t* src)
+{
+    for(uint32_t i=0; i<HIST_BUCKETS; i++)
+        dst->counts[i] += src->counts[i];
+    dst->n += src->n;
+    dst->sum += src->sum;
+    if(src->min < dst->min)
+        dst->min = src->min;
+    if(src->max > dst->max)
+        dst->max = src->max;
+}
+
+//value below which the q fraction of samples lies (bucket upper bound, clamped to max)
+uint64_t hist_quantile(const struct hist_t* h, double q)
+{
+    uint64_t rank;
+    uint64_t acc = 0;
+
+    if(h->n == 0)
+        return 0;
+
+    rank = q * h->n;
+    if(rank >= h->n)
+        rank = h->n-1;
+
+    for(uint32_t i=0; i<HIST_BUCKETS; i++)
+    {
+        acc += h->counts[i];
+        if(acc > rank)
+        {
+            uint64_t top = hist_bucket_top(i);
+            return (top > h->max) ? h->max : top;
+        }
+    }
+
+    return h->max;
+}
+
+double hist_mean(const struct hist_t* h)
+{
+    return h->n ? h->sum/h->n : 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * histogram.h
+ *
+ *  Log-bucketed latency histogram
+ *
+ *  Values below 2^(HIST_SUB_BITS+1) are counted exactly, above that every
+ *  power of two is split into 2^HIST_SUB_BITS buckets, i.e. about 3% resolution.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS   5
+#define HIST_BUCKETS    ((65-HIST_SUB_BITS) << HIST_SUB_BITS)
+
+struct hist_t
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t n;
+    uint64_t min, max;
+    double sum;
+};
+
+void hist_init(struct hist_t* h);
+void hist_add(struct hist_t* h, uint64_t v);
+void hist_merge(struct hist_t* dst, const struct hist_t* src);
+uint64_t hist_quantile(const struct hist_t* h, double q);
+double hist_mean(const struct hist_t* h);
+uint32_t hist_bucket(uint64_t v);
+uint64_t hist_bucket_top(uint32_t b);
@@ -0,0 +1,463 @@
+/*
+ * hop.c
+ *
+ *  Scheduled retuning from a hop table
+ *
+ *  Every SUB_SET_PARAM frame of the table is encoded up front. A dedicated
+ *  thread owns the socket, sleeps until each hop is due with an absolute
+ *  clock_nanosleep() deadline and sends its frames. Between hops it waits for
+ *  replies with zmq_poll(), and in the last stretch before a deadline (where
+ *  the millisecond poll timeout is too coarse) in short sleep slices.
+ *  Like in the benchmark, every request carries its sequence number in an
+ *  envelope frame that the device echoes back, so replies match exactly.
+ *
+ *  Issue jitter is how late a hop went out, the issue cost how long sending
+ *  its frames took, the settle time runs from the deadline to its last reply.
+ */
+
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "interface_cmds.h"
+#include "cari_codec.h"
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "ctrl.h"
+#include "histogram.h"
+#include "hop.h"
+#include "log.h"
+#include "cari.h"
+#include "metrics.h"
+
+#define TAG_LEN         8           //[seq u64]
+#define HOP_WINDOW      4096        //requests tracked, a slot is reused HOP_WINDOW requests later
+#define HOP_POLL_MARGIN 2000000ULL  //ns before a deadline where zmq_poll() is no longer used
+#define HOP_SLICE       50000ULL    //ns, reply timestamp resolution in the last stretch
+
+struct hop_req_t
+{
+    uint64_t seq;
+    uint64_t hop;               //hop sequence number
+    uint64_t t_sent;            //ns
+    uint8_t busy;
+};
+
+struct hop_state_t
+{
+    uint64_t seq;
+    uint64_t t_due;             //ns
+    uint8_t left;               //replies still missing
+};
+
+struct hop_ctx_t
+{
+    const struct hop_table_t* table;
+    const struct hop_opts_t* opts;
+    struct link_t* link;
+    struct hop_req_t* reqs;
+    struct hop_state_t* hops;
+    struct hist_t* jitter;
+    struct hist_t* cost;
+    struct hist_t* rtt;
+    struct hist_t* settle;
+    uint64_t sent, recvd, lost, errors, hops_done;
+    uint64_t t0, t_end;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000ULL + t.tv_nsec;
+}
+
+static void sleep_until(uint64_t t)
+{
+    struct timespec ts = {t / 1000000000ULL, t % 1000000000ULL};
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+//load a hop table, one hop per line:
+//  T_MS RX_FREQ [TX_FREQ [PPM]]
+//"-" leaves a value as it is, PPM sets both corrections
+//a line with the time alone ends the cycle, otherwise it is one mean hop interval after the last hop
+int hop_load(struct hop_table_t* table, const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    char line[256];
+    int line_num = 0;
+    uint32_t cap = 0;
+
+    memset(table, 0, sizeof(*table));
+
+    if(fp == NULL)
+    {
+        dbg_print(TERM_RED, "Can not open hop table %s\n", path);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), fp) != NULL)
+    {
+        line_num++;
+
+        char* hash = strchr(line, '#'); //strip comments
+        if(hash != NULL)
+            *hash = 0;
+
+        char* tok = strtok(line, " \t\r\n");
+        if(tok == NULL)
+            continue;
+
+        char* end;
+        double t_ms = strtod(tok, &end);
+        uint64_t t = t_ms*1e6;
+
+        if(*end || t_ms < 0 || (table->n > 0 && t < table->hops[table->n-1].t) || table->cycle)
+        {
+            dbg_print(TERM_RED, "%s:%d: bad hop time\n", path, line_num);
+            goto fail;
+        }
+
+        //reuse the command line checks, one column per option
+        static const char cols[] = {'f', 'F', 'c'};
+        struct re_config_t cfg;
+        uint8_t ncols = 0;
+
+        config_init(&cfg);
+        while((tok = strtok(NULL, " \t\r\n")) != NULL)
+        {
+            if(ncols == sizeof(cols) || (strcmp(tok, "-") != 0 && config_parse_opt(&cfg, cols[ncols], tok, 0) != 0))
+            {
+                dbg_print(TERM_RED, "%s:%d: bad value \"%s\"\n", path, line_num, tok);
+                goto fail;
+            }
+            ncols++;
+        }
+
+        if(ncols == 0)
+        {
+            table->cycle = t;
+            continue;
+        }
+
+        if(table->n == cap)
+        {
+            cap = cap ? cap*2 : 64;
+            struct hop_t* hops = realloc(table->hops, cap*sizeof(struct hop_t));
+            if(hops == NULL)
+                goto fail;
+            table->hops = hops;
+        }
+
+        struct hop_t* h = &table->hops[table->n++];
+        h->t = t;
+        h->nframes = 0;
+
+        #define FRAME h->frames[h->nframes], sizeof(h->frames[0])
+        #define ADD(flen) do { h->len[h->nframes] = (flen); h->nframes++; } while(0)
+
+        if(cfg.rx_freq > 0)
+            ADD(cari_enc_param_u64(FRAME, PARAM_RX_FREQ, cfg.rx_freq));
+        if(cfg.tx_freq > 0)
+            ADD(cari_enc_param_u64(FRAME, PARAM_TX_FREQ, cfg.tx_freq));
+        if(cfg.rx_freq_corr > -1000.0f)
+        {
+            ADD(cari_enc_param_f32(FRAME, PARAM_RX_FREQ_CORR, cfg.rx_freq_corr));
+            ADD(cari_enc_param_f32(FRAME, PARAM_TX_FREQ_CORR, cfg.rx_freq_corr));
+        }
+
+        #undef ADD
+        #undef FRAME
+    }
+
+    fclose(fp);
+
+    if(table->n == 0)
+    {
+        dbg_print(TERM_RED, "%s: no hops\n", path);
+        hop_free(table);
+        return -1;
+    }
+
+    if(table->cycle == 0)
+    {
+        uint64_t last = table->hops[table->n-1].t;
+        uint64_t mean = (table->n > 1) ? (last - table->hops[0].t)/(table->n-1) : 1000000000ULL;
+        table->cycle = last + (mean > 0 ? mean : 1000000ULL); //hops all at one instant still take a ms
+    }
+
+    return table->n;
+
+fail:
+    fclose(fp);
+    hop_free(table);
+    return -1;
+}
+
+void hop_free(struct hop_table_t* table)
+{
+    free(table->hops);
+    memset(table, 0, sizeof(*table));
+}
+
+static int hop_send(struct link_t* link, uint64_t seq, const uint8_t* frame, uint16_t len)
+{
+    uint8_t tag[TAG_LEN];
+
+    cari_put_u64(tag, seq);
+    return link_send_tagged(link, tag, sizeof(tag), frame, len);
+}
+
+static void finish_req(struct hop_ctx_t* c, struct hop_req_t* r, uint64_t now, int err)
+{
+    struct hop_state_t* h = &c->hops[r->hop % HOP_WINDOW];
+
+    r->busy = 0;
+    metrics_req(c->link->mdev, CMD_SUB_SET_PARAM, err, 1, (now - r->t_sent)/1e6);
+    if(err == CARI_NO_REPLY)
+        c->lost++;
+    else
+    {
+        c->recvd++;
+        if(err == CARI_MALFORMED)
+        {
+            c->errors++;
+            LOG(TERM_YELLOW, "Hop %lu: malformed reply\n", r->hop);
+        }
+        else if(err != ERR_OK)
+        {
+            c->errors++;
+            LOG(TERM_YELLOW, "Hop %lu: ERR %d\n", r->hop, err);
+        }
+        hist_add(c->rtt, now - r->t_sent);
+    }
+
+    if(h->seq == r->hop && h->left > 0 && --h->left == 0 && err != CARI_NO_REPLY)
+        hist_add(c->settle, now - h->t_due);
+}
+
+//take every reply waiting on the socket
+static void drain(struct hop_ctx_t* c)
+{
+    zmq_msg_t msg;
+    uint8_t tag[TAG_LEN];
+    int tagged;
+
+    while((tagged = link_recv_tagged(c->link, &msg, tag, sizeof(tag))) >= 0)
+    {
+        uint64_t now = now_ns();
+        int64_t seq = tagged ? (int64_t)cari_get_u64(tag) : -1;
+
+        struct hop_req_t* r = (seq >= 0) ? &c->reqs[seq % HOP_WINDOW] : NULL;
+        struct cari_frame_t f;
+
+        if(r != NULL && r->busy && r->seq == (uint64_t)seq)
+        {
+            if(cari_decode_reply_msg(CMD_SUB_SET_PARAM, &msg, &f) == CARI_DEC_OK)
+                finish_req(c, r, now, f.err);
+            else
+                finish_req(c, r, now, CARI_MALFORMED);
+        }
+        zmq_msg_close(&msg);
+    }
+}
+
+//wait for replies until t
+static void wait_until(struct hop_ctx_t* c, uint64_t t)
+{
+    zmq_pollitem_t item = {c->link->sock, 0, ZMQ_POLLIN, 0};
+    uint64_t now;
+
+    while(running && (now = now_ns()) + HOP_POLL_MARGIN < t)
+    {
+        if(zmq_poll(&item, 1, (t - HOP_POLL_MARGIN - now)/1000000) > 0)
+            drain(c);
+    }
+
+    while(running && (now = now_ns()) + HOP_SLICE < t)
+    {
+        sleep_until(now + HOP_SLICE);
+        drain(c);
+    }
+
+    if(running)
+        sleep_until(t);
+}
+
+static void* sender(void* arg)
+{
+    struct hop_ctx_t* c = arg;
+    const struct hop_table_t* table = c->table;
+    uint64_t total = (uint64_t)table->n * c->opts->repeat;
+    uint64_t seq = 0;
+
+    c->t0 = now_ns() + 10000000ULL; //leave some room for the first hop
+
+    for(uint64_t k=0; k<total && running; k++)
+    {
+        const struct hop_t* hop = &table->hops[k % table->n];
+        uint64_t due = c->t0 + (k / table->n)*table->cycle + hop->t;
+        struct hop_state_t* h = &c->hops[k % HOP_WINDOW];
+
+        wait_until(c, due);
+
+        uint64_t t_issue = now_ns();
+        hist_add(c->jitter, t_issue - due);
+
+        h->seq = k;
+        h->t_due = due;
+        h->left = 0;
+
+        for(uint8_t i=0; i<hop->nframes; i++)
+        {
+            struct hop_req_t* r = &c->reqs[seq % HOP_WINDOW];
+
+            if(r->busy) //a full window behind, written off
+                finish_req(c, r, 0, CARI_NO_REPLY);
+
+            if(hop_send(c->link, seq, hop->frames[i], hop->len[i]) < 0)
+            {
+                c->lost++;
+                continue;
+            }
+
+            r->seq = seq++;
+            r->hop = k;
+            r->t_sent = now_ns();
+            r->busy = 1;
+            h->left++;
+            c->sent++;
+        }
+
+        hist_add(c->cost, now_ns() - t_issue);
+        c->hops_done++;
+        drain(c);
+    }
+
+    //collect the last replies
+    c->t_end = now_ns();
+    wait_until(c, c->t_end + c->link->timeout*1000000ULL);
+    drain(c);
+
+    for(uint32_t i=0; i<HOP_WINDOW; i++)
+    {
+        if(c->reqs[i].busy)
+            finish_req(c, &c->reqs[i], 0, CARI_NO_REPLY);
+    }
+
+    return NULL;
+}
+
+static void print_hist(const char* name, const struct hist_t* h)
+{
+    if(h->n == 0)
+        return;
+
+    dbg_print(0, "%-18s min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  mean %.1f\n", name,
+        h->min/1e3, hist_quantile(h, 0.5)/1e3, hist_quantile(h, 0.9)/1e3, hist_quantile(h, 0.99)/1e3,
+        hist_quantile(h, 0.999)/1e3, h->max/1e3, hist_mean(h)/1e3);
+}
+
+int hop_run(void* zmq_ctx, const char* addr, const struct hop_opts_t* opts)
+{
+    struct hop_table_t table;
+    struct link_t link = {0};
+    struct hop_ctx_t c = {.opts = opts, .link = &link};
+    pthread_t thread;
+    pthread_attr_t attr;
+    struct sched_param sp = {.sched_priority = sched_get_priority_min(SCHED_FIFO)};
+    int ret = 1;
+
+    if(hop_load(&table, opts->path) < 0)
+        return 1;
+    c.table = &table;
+
+    c.reqs = calloc(HOP_WINDOW, sizeof(struct hop_req_t));
+    c.hops = calloc(HOP_WINDOW, sizeof(struct hop_state_t));
+    c.jitter = malloc(sizeof(struct hist_t));
+    c.cost = malloc(sizeof(struct hist_t));
+    c.rtt = malloc(sizeof(struct hist_t));
+    c.settle = malloc(sizeof(struct hist_t));
+    if(c.reqs == NULL || c.hops == NULL || c.jitter == NULL || c.cost == NULL || c.rtt == NULL || c.settle == NULL)
+        goto out;
+
+    hist_init(c.jitter);
+    hist_init(c.cost);
+    hist_init(c.rtt);
+    hist_init(c.settle);
+
+    link_direct_only("Hop");
+    if(link_open(&link, zmq_ctx, addr) != 0)
+    {
+        dbg_print(TERM_RED, "Can not connect to %s\n", addr);
+        goto out;
+    }
+
+    dbg_print(0, "Hopping %s: %u hop(s) every %.3f ms", link.endpoint, table.n, table.cycle/1e6);
+    if(opts->repeat > 1)
+        dbg_print(0, ", %u times", opts->repeat);
+    dbg_print(0, "\n");
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    //real-time priority where allowed, plain scheduling otherwise
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &sp);
+    if(pthread_create(&thread, &attr, sender, &c) != 0)
+    {
+        dbg_print(TERM_YELLOW, "No real-time priority, hop timing may suffer\n");
+        if(pthread_create(&thread, NULL, sender, &c) != 0)
+        {
+            pthread_attr_destroy(&attr);
+            link_close(&link);
+            goto out;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    pthread_join(thread, NULL);
+
+    double elapsed = (c.t_end - c.t0)/1e9;
+    dbg_print(0, "Hops %lu in %.3f s (%.1f/s), frames sent %lu, received %lu, ", c.hops_done, elapsed,
+        elapsed > 0 ? c.hops_done/elapsed : 0, c.sent, c.recvd);
+    dbg_print(c.lost ? TERM_YELLOW : TERM_GREEN, "lost %lu", c.lost);
+    if(c.errors)
+        dbg_print(TERM_YELLOW, ", %lu error repl(ies)", c.errors);
+    dbg_print(0, "\n[us]\n");
+    print_hist("Issue jitter", c.jitter);
+    print_hist("Issue cost", c.cost);
+    print_hist("Reply latency", c.rtt);
+    print_hist("Hop settle", c.settle);
+
+    link_close(&link);
+    ret = (c.lost || c.errors);
+
+out:
+    hop_free(&table);
+    free(c.reqs);
+    free(c.hops);
+    free(c.jitter);
+    free(c.cost);
+    free(c.rtt);
+    free(c.settle);
+    return ret;
+}
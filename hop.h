@@ -0,0 +1,37 @@
+/*
+ * hop.h
+ *
+ *  Scheduled retuning from a hop table
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define HOP_MAX_FRAMES  4       //RX, TX, RX and TX correction
+
+//a single retune, frames are encoded when the table is loaded
+struct hop_t
+{
+    uint64_t t;                 //ns from the start of the cycle
+    uint8_t nframes;
+    uint8_t len[HOP_MAX_FRAMES];
+    uint8_t frames[HOP_MAX_FRAMES][16];
+};
+
+struct hop_table_t
+{
+    struct hop_t* hops;
+    uint32_t n;
+    uint64_t cycle;             //ns, table period when repeated
+};
+
+struct hop_opts_t
+{
+    const char* path;
+    uint32_t repeat;            //times the table is played
+};
+
+int hop_load(struct hop_table_t* table, const char* path);
+void hop_free(struct hop_table_t* table);
+int hop_run(void* zmq_ctx, const char* addr, const struct hop_opts_t* opts);
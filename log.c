@@ -0,0 +1,695 @@
+/*
+ * log.c
+ *
+ *  Asynchronous logging through per-thread binary rings
+ *
+ *  A producer only takes the clock, copies the arguments into a fixed size
+ *  slot of its own ring and publishes it, nothing is formatted and no lock
+ *  is taken. The logger thread polls all rings, formats the records and
+ *  writes them out through stdio, flushing whenever the rings run dry.
+ *  Lines are assembled per thread, so fragments logged one dbg_print() at a
+ *  time still make one JSON object.
+ *
+ *  The binary log starts with LOG_MAGIC, followed by records:
+ *    'E' id(u32) color(u8) len(u16) format         - a call site, before its first use
+ *    'R' t(u64) id(u32) color(u8) thread(u8) dev(u32) nargs(u8) len(u8) body[LOG_TEXT]
+ *  id 0 is preformatted text, all numbers little endian. The body is the
+ *  text or the string flags, arguments and string storage of the record.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "term.h" //colored terminal font
+#include "spsc_ring.h"
+#include "log.h"
+
+#define LOG_MAGIC   "CARILOG1"
+#define LOG_LINE    1024        //longest JSON message, longer lines are split
+
+struct log_rec_t
+{
+    uint64_t t;                 //ns, CLOCK_REALTIME
+    struct log_site_t* site;    //NULL - text
+    const char* color;          //of the text
+    uint32_t dev;
+    uint8_t nargs;
+    uint8_t len;                //text bytes or string storage used
+    union
+    {
+        struct
+        {
+            uint8_t str[LOG_MAX_ARGS + 2];  //argument is an offset into s
+            uint64_t v[LOG_MAX_ARGS];
+            char s[LOG_STR];
+        } a;
+        char text[LOG_TEXT];
+    };
+};
+
+_Static_assert(sizeof(((struct log_rec_t*)0)->a) == LOG_TEXT, "record body size");
+
+//one per producing thread, the line is only touched by the consumer
+struct log_thread_t
+{
+    struct spsc_ring_t ring;
+    atomic_uint_fast64_t dropped;
+    uint8_t index;
+    char line[LOG_LINE];
+    size_t line_len;
+    uint64_t line_t;
+    uint32_t line_dev, line_event;
+    uint8_t line_level;
+};
+
+static struct log_thread_t* threads[LOG_MAX_THREADS];
+static atomic_int nthreads;
+static pthread_mutex_t reg_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local struct log_thread_t* self;
+
+static atomic_int running;
+static pthread_t worker;
+static enum log_fmt_t format;
+static FILE* out;
+static uint32_t nsites;
+
+static const char* colors[] = {NULL, TERM_GREEN, TERM_RED, TERM_YELLOW, TERM_DEFAULT};
+
+static uint8_t color_code(const char* color)
+{
+    for(uint8_t i=1; i<sizeof(colors)/sizeof(colors[0]); i++)
+        if(color != NULL && strcmp(color, colors[i]) == 0)
+            return i;
+    return 0;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+//this thread's ring, registered on first use, NULL if there are too many threads
+static struct log_thread_t* attach(void)
+{
+    pthread_mutex_lock(&reg_lock);
+
+    int n = atomic_load_explicit(&nthreads, memory_order_relaxed);
+    if(n < LOG_MAX_THREADS)
+    {
+        struct log_thread_t* t = calloc(1, sizeof(struct log_thread_t));
+        if(t != NULL && spsc_init(&t->ring, LOG_RING, sizeof(struct log_rec_t)) == 0)
+        {
+            t->index = n;
+            threads[n] = t;
+            atomic_store_explicit(&nthreads, n+1, memory_order_release);
+            self = t;
+        }
+        else
+            free(t);
+    }
+
+    pthread_mutex_unlock(&reg_lock);
+    return self;
+}
+
+//printf one argument with the conversion spec, typed after the conversion
+static int format_arg(char* buf, size_t size, const char* spec, char conv, const char* len, const struct log_rec_t* r, uint8_t i)
+{
+    uint64_t v = r->a.v[i];
+    uint8_t wide = (len[0] == 'l' || len[0] == 'z' || len[0] == 'j' || len[0] == 't');
+
+    switch(conv)
+    {
+        case 'd': case 'i':
+            return wide ? snprintf(buf, size, spec, (long long)v) : snprintf(buf, size, spec, (int)v);
+
+        case 'u': case 'o': case 'x': case 'X': case 'c':
+            return wide ? snprintf(buf, size, spec, (unsigned long long)v) : snprintf(buf, size, spec, (unsigned)v);
+
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        {
+            union { uint64_t u; double d; } x = {.u = v};
+            return snprintf(buf, size, spec, x.d);
+        }
+
+        case 's':
+            if(r->a.str[i])
+                return snprintf(buf, size, spec, v < LOG_STR ? &r->a.s[v] : "");
+            return snprintf(buf, size, spec, "(?)"); //not captured as a string
+
+        case 'p':
+            return snprintf(buf, size, spec, (void*)(uintptr_t)v);
+    }
+
+    return snprintf(buf, size, "%s", spec);
+}
+
+//apply the call site's format to the captured arguments, returns the length
+static size_t format_event(char* buf, size_t size, const struct log_rec_t* r, const char* fmt)
+{
+    size_t pos = 0;
+    uint8_t arg = 0;
+
+    while(*fmt && pos+1 < size)
+    {
+        if(*fmt != '%')
+        {
+            buf[pos++] = *fmt++;
+            continue;
+        }
+        if(fmt[1] == '%')
+        {
+            buf[pos++] = '%';
+            fmt += 2;
+            continue;
+        }
+
+        //%[flags][width][.precision][length]conversion, `*` is not supported
+        char spec[32];
+        char lenmod[3] = {0};
+        size_t k = 0;
+
+        spec[k++] = *fmt++;
+        while(*fmt && strchr("-+ #0123456789.", *fmt) && k < sizeof(spec)-4)
+            spec[k++] = *fmt++;
+        for(uint8_t l=0; *fmt && strchr("hlLqjzt", *fmt) && l < 2; l++)
+        {
+            lenmod[l] = *fmt;
+            spec[k++] = *fmt++;
+        }
+        if(*fmt == 0)
+            break;
+        char conv = *fmt++;
+        spec[k++] = conv;
+        spec[k] = 0;
+
+        int n = (arg < r->nargs) ? format_arg(&buf[pos], size-pos, spec, conv, lenmod, r, arg) : snprintf(&buf[pos], size-pos, "%s", spec);
+        arg++;
+        if(n > 0)
+            pos += ((size_t)n < size-pos) ? (size_t)n : size-pos-1;
+    }
+
+    buf[pos] = 0;
+    return pos;
+}
+
+static void json_escape(FILE* fp, const char* s, size_t len)
+{
+    for(size_t i=0; i<len; i++)
+    {
+        unsigned char c = s[i];
+
+        if(c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if(c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+}
+
+static void json_line(FILE* fp, struct log_thread_t* t)
+{
+    static const char* levels[] = {"info", "warn", "error"};
+
+    fprintf(fp, "{\"t\":%lu.%06lu,\"level\":\"%s\"", t->line_t/1000000000, (t->line_t/1000) % 1000000, levels[t->line_level]);
+    if(t->line_dev != LOG_NO_DEV)
+        fprintf(fp, ",\"dev\":%u", t->line_dev);
+    if(t->line_event)
+        fprintf(fp, ",\"event\":%u", t->line_event);
+    fprintf(fp, ",\"msg\":\"");
+    json_escape(fp, t->line, t->line_len);
+    fprintf(fp, "\"}\n");
+
+    t->line_len = 0;
+}
+
+//collect text into the thread's line, one JSON object per line
+static void json_text(FILE* fp, struct log_thread_t* t, const struct log_rec_t* r, const char* text, size_t len)
+{
+    uint8_t code = color_code(r->color);
+    uint8_t level = (code == 2) ? 2 : (code == 3) ? 1 : 0;   //red - error, yellow - warning
+
+    for(size_t i=0; i<len; i++)
+    {
+        if(t->line_len == 0)
+        {
+            t->line_t = r->t;
+            t->line_dev = r->dev;
+            t->line_event = r->site ? r->site->id : 0;
+            t->line_level = 0;
+        }
+        if(level > t->line_level)
+            t->line_level = level;
+        if(r->dev != LOG_NO_DEV)
+            t->line_dev = r->dev;
+
+        if(text[i] == '\n')
+        {
+            json_line(fp, t);
+            continue;
+        }
+        t->line[t->line_len++] = text[i];
+        if(t->line_len == sizeof(t->line))
+            json_line(fp, t);
+    }
+}
+
+static void put_le(uint8_t* p, uint64_t v, uint8_t n)
+{
+    for(uint8_t i=0; i<n; i++)
+        p[i] = v >> (8*i);
+}
+
+static uint64_t get_le(const uint8_t* p, uint8_t n)
+{
+    uint64_t v = 0;
+    for(uint8_t i=0; i<n; i++)
+        v |= (uint64_t)p[i] << (8*i);
+    return v;
+}
+
+static void write_bin(FILE* fp, struct log_thread_t* t, const struct log_rec_t* r)
+{
+    uint8_t hdr[21];
+
+    hdr[0] = 'R';
+    put_le(&hdr[1], r->t, 8);
+    put_le(&hdr[9], r->site ? r->site->id : 0, 4);
+    hdr[13] = r->site ? 0 : color_code(r->color);
+    hdr[14] = t->index;
+    put_le(&hdr[15], r->dev, 4);
+    hdr[19] = r->nargs;
+    hdr[20] = r->len;
+    fwrite(hdr, 1, sizeof(hdr), fp);
+
+    if(r->site == NULL)
+    {
+        fwrite(r->text, 1, sizeof(r->text), fp);
+        return;
+    }
+
+    uint8_t body[LOG_TEXT];
+    memcpy(body, r->a.str, sizeof(r->a.str));
+    for(uint8_t i=0; i<LOG_MAX_ARGS; i++)
+        put_le(&body[sizeof(r->a.str) + 8*i], r->a.v[i], 8);
+    memcpy(&body[sizeof(r->a.str) + 8*LOG_MAX_ARGS], r->a.s, LOG_STR);
+    fwrite(body, 1, sizeof(body), fp);
+}
+
+//write one record in the output format, t is the producing thread
+static void emit(FILE* fp, enum log_fmt_t fmt, struct log_thread_t* t, const struct log_rec_t* r)
+{
+    char buf[512];
+    const char* text = r->text;
+    const char* color = r->color;
+    size_t len = r->len;
+
+    if(r->site != NULL && r->site->id == 0)
+    {
+        r->site->id = ++nsites;
+        if(fmt == LOG_BIN)
+        {
+            uint8_t hdr[8];
+            size_t flen = strlen(r->site->fmt);
+
+            hdr[0] = 'E';
+            put_le(&hdr[1], r->site->id, 4);
+            hdr[5] = color_code(r->site->color);
+            put_le(&hdr[6], flen, 2);
+            fwrite(hdr, 1, sizeof(hdr), fp);
+            fwrite(r->site->fmt, 1, flen, fp);
+        }
+    }
+
+    if(fmt == LOG_BIN)
+    {
+        write_bin(fp, t, r);
+        return;
+    }
+
+    if(r->site != NULL)
+    {
+        len = format_event(buf, sizeof(buf), r, r->site->fmt);
+        text = buf;
+        color = r->site->color;
+    }
+
+    if(fmt == LOG_JSON)
+    {
+        json_text(fp, t, r, text, len);
+        return;
+    }
+
+    if(color != NULL)
+        fputs(color, fp);
+    fwrite(text, 1, len, fp);
+    if(color != NULL)
+        fputs(TERM_DEFAULT, fp);
+}
+
+//format everything waiting in the rings, returns the number of records
+static uint64_t drain(void)
+{
+    int n = atomic_load_explicit(&nthreads, memory_order_acquire);
+    uint64_t done = 0;
+
+    for(int i=0; i<n; i++)
+    {
+        struct log_thread_t* t = threads[i];
+        struct log_rec_t* r;
+
+        while((r = spsc_peek(&t->ring)) != NULL)
+        {
+            emit(out, format, t, r);
+            spsc_release(&t->ring);
+            done++;
+        }
+    }
+
+    return done;
+}
+
+static void* log_thread(void* arg)
+{
+    const struct timespec idle = {0, 500000};
+    (void)arg;
+
+    while(1)
+    {
+        if(drain() > 0)
+            continue;
+
+        fflush(out);
+        if(!atomic_load_explicit(&running, memory_order_acquire))
+            break;
+        nanosleep(&idle, NULL);
+    }
+
+    drain();
+    fflush(out);
+    return NULL;
+}
+
+int log_start(enum log_fmt_t fmt, const char* path)
+{
+    if(atomic_load(&running))
+        return 0;
+
+    out = stdout;
+    if(path != NULL && (out = fopen(path, "wb")) == NULL)
+    {
+        out = stdout;
+        return -1;
+    }
+    if(fmt == LOG_BIN)
+        fwrite(LOG_MAGIC, 1, strlen(LOG_MAGIC), out);
+
+    format = fmt;
+    atomic_store(&running, 1);
+    if(pthread_create(&worker, NULL, log_thread, NULL) != 0)
+    {
+        atomic_store(&running, 0);
+        if(out != stdout)
+            fclose(out);
+        out = stdout;
+        return -1;
+    }
+
+    return 0;
+}
+
+void log_stop(void)
+{
+    if(!atomic_load(&running))
+        return;
+
+    atomic_store(&running, 0);
+    pthread_join(worker, NULL);
+
+    //a JSON line without its newline yet
+    int n = atomic_load(&nthreads);
+    for(int i=0; i<n; i++)
+    {
+        if(format == LOG_JSON && threads[i]->line_len > 0)
+            json_line(out, threads[i]);
+    }
+
+    if(out != stdout)
+        fclose(out);
+    else
+        fflush(out);
+    out = stdout;
+
+    uint64_t lost = log_dropped();
+    if(lost > 0)
+        fprintf(stderr, "%lu log record(s) dropped\n", lost);
+}
+
+void log_flush(void)
+{
+    if(!atomic_load(&running))
+    {
+        fflush(stdout);
+        return;
+    }
+
+    int n = atomic_load_explicit(&nthreads, memory_order_acquire);
+    for(int i=0; i<n; i++)
+    {
+        while(spsc_count(&threads[i]->ring) > 0)
+            sched_yield();
+    }
+    fflush(out);
+}
+
+uint64_t log_dropped(void)
+{
+    int n = atomic_load(&nthreads);
+    uint64_t lost = 0;
+
+    for(int i=0; i<n; i++)
+        lost += atomic_load_explicit(&threads[i]->dropped, memory_order_relaxed);
+    return lost;
+}
+
+//no logger thread, or no ring for this thread: write it out here
+static void emit_now(const struct log_rec_t* r)
+{
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    struct log_thread_t t = {.index = 0xFF};
+
+    pthread_mutex_lock(&lock);
+    if(atomic_load(&running) && format != LOG_TERM)
+    {
+        //JSON and binary output belong to the logger thread
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    emit(stdout, LOG_TERM, &t, r);
+    pthread_mutex_unlock(&lock);
+}
+
+void log_event(struct log_site_t* site, uint32_t dev, uint8_t nargs, const struct log_arg_t* args)
+{
+    struct log_thread_t* t = self;
+    struct log_rec_t local;
+    struct log_rec_t* r = &local;
+    uint8_t async = atomic_load_explicit(&running, memory_order_relaxed) && (t != NULL || (t = attach()) != NULL);
+
+    if(async && (r = spsc_reserve(&t->ring)) == NULL)
+    {
+        atomic_fetch_add_explicit(&t->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    if(nargs > LOG_MAX_ARGS)
+        nargs = LOG_MAX_ARGS;
+
+    r->t = now_ns();
+    r->site = site;
+    r->color = site->color;
+    r->dev = dev;
+    r->nargs = nargs;
+    r->len = 0;
+
+    for(uint8_t i=0; i<nargs; i++)
+    {
+        r->a.str[i] = args[i].str;
+        r->a.v[i] = args[i].v;
+        if(args[i].str)
+        {
+            //copied in, the caller's string may be gone by the time it is printed
+            const char* s = (const char*)(uintptr_t)args[i].v;
+            size_t room = LOG_STR - r->len;
+            size_t n = (s != NULL && room > 0) ? strnlen(s, room-1) : 0;
+
+            r->a.v[i] = r->len;
+            if(room > 0)
+            {
+                memcpy(&r->a.s[r->len], s, n);
+                r->a.s[r->len + n] = 0;
+                r->len += n+1;
+            }
+            else
+                r->a.v[i] = LOG_STR;
+        }
+    }
+
+    if(async)
+        spsc_commit(&t->ring);
+    else
+        emit_now(r);
+}
+
+void log_text(const char* color, uint32_t dev, const char* text, size_t len)
+{
+    struct log_thread_t* t = self;
+    uint8_t async = atomic_load_explicit(&running, memory_order_relaxed) && (t != NULL || (t = attach()) != NULL);
+    uint64_t now = now_ns();
+
+    while(len > 0)
+    {
+        struct log_rec_t local;
+        struct log_rec_t* r = &local;
+
+        //status output is not dropped, wait for the logger to make room
+        while(async && (r = spsc_reserve(&t->ring)) == NULL)
+            sched_yield();
+
+        size_t n = (len < LOG_TEXT) ? len : LOG_TEXT;
+        r->t = now;
+        r->site = NULL;
+        r->color = color;
+        r->dev = dev;
+        r->nargs = 0;
+        r->len = n;
+        memcpy(r->text, text, n);
+        text += n;
+        len -= n;
+
+        if(async)
+            spsc_commit(&t->ring);
+        else
+            emit_now(r);
+    }
+}
+
+int log_replay(const char* path, enum log_fmt_t fmt)
+{
+    FILE* fp = fopen(path, "rb");
+    char magic[8];
+    struct log_site_t* sites = NULL;
+    uint32_t nsite = 0;
+    struct log_thread_t* lines[256] = {0};
+    int ret = 0;
+
+    if(fp == NULL)
+        return -1;
+    if(fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, LOG_MAGIC, sizeof(magic)) != 0)
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    int type;
+    while((type = fgetc(fp)) != EOF)
+    {
+        if(type == 'E')
+        {
+            uint8_t hdr[7];
+            if(fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr))
+                break;
+
+            uint32_t id = get_le(hdr, 4);
+            uint16_t flen = get_le(&hdr[5], 2);
+            char* f = malloc(flen+1);
+            if(id == 0 || id > 1000000 || f == NULL || fread(f, 1, flen, fp) != flen)
+            {
+                free(f);
+                ret = -1;
+                break;
+            }
+            f[flen] = 0;
+
+            if(id > nsite)
+            {
+                struct log_site_t* s = realloc(sites, (id+1)*sizeof(struct log_site_t));
+                if(s == NULL)
+                {
+                    free(f);
+                    ret = -1;
+                    break;
+                }
+                uint32_t from = (sites != NULL) ? nsite+1 : 0; //slot 0 too on the first growth
+                memset(&s[from], 0, (id+1-from)*sizeof(struct log_site_t));
+                sites = s;
+                nsite = id;
+            }
+            free((char*)sites[id].fmt);
+            sites[id].fmt = f;
+            sites[id].color = hdr[4] < sizeof(colors)/sizeof(colors[0]) ? colors[hdr[4]] : NULL;
+            sites[id].id = id;
+            continue;
+        }
+
+        uint8_t hdr[20], body[LOG_TEXT];
+        if(type != 'R' || fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr) || fread(body, 1, sizeof(body), fp) != sizeof(body))
+        {
+            ret = (type == 'R') ? 0 : -1; //a cut off last record is fine
+            break;
+        }
+
+        struct log_rec_t r = {0};
+        uint32_t id = get_le(&hdr[8], 4);
+        r.t = get_le(hdr, 8);
+        r.color = hdr[12] < sizeof(colors)/sizeof(colors[0]) ? colors[hdr[12]] : NULL;
+        r.dev = get_le(&hdr[14], 4);
+        r.nargs = hdr[18] <= LOG_MAX_ARGS ? hdr[18] : LOG_MAX_ARGS;
+        r.len = hdr[19] <= LOG_TEXT ? hdr[19] : LOG_TEXT;
+        if(id > 0)
+        {
+            if(id > nsite || sites[id].fmt == NULL)
+                continue;
+            r.site = &sites[id];
+            memcpy(r.a.str, body, sizeof(r.a.str));
+            for(uint8_t i=0; i<LOG_MAX_ARGS; i++)
+                r.a.v[i] = get_le(&body[sizeof(r.a.str) + 8*i], 8);
+            memcpy(r.a.s, &body[sizeof(r.a.str) + 8*LOG_MAX_ARGS], LOG_STR);
+            r.a.s[LOG_STR-1] = 0;
+        }
+        else
+            memcpy(r.text, body, sizeof(r.text));
+
+        uint8_t th = hdr[13];
+        if(lines[th] == NULL && (lines[th] = calloc(1, sizeof(struct log_thread_t))) == NULL)
+        {
+            ret = -1;
+            break;
+        }
+        emit(stdout, fmt, lines[th], &r);
+    }
+
+    for(int i=0; i<256; i++)
+    {
+        if(lines[i] != NULL && fmt == LOG_JSON && lines[i]->line_len > 0)
+            json_line(stdout, lines[i]);
+        free(lines[i]);
+    }
+    for(uint32_t i=0; i<=nsite && sites != NULL; i++)
+        free((char*)sites[i].fmt);
+    free(sites);
+    fclose(fp);
+    fflush(stdout);
+
+    return ret;
+}
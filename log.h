@@ -0,0 +1,95 @@
+/*
+ * log.h
+ *
+ *  Asynchronous logging through per-thread binary rings
+ *
+ *  Every thread logs into its own lock-free ring, registered on its first
+ *  record. A record is the timestamp, an optional device id and either the
+ *  arguments of a call site (LOG(), the format is applied later) or text
+ *  already formatted (dbg_print()). A background thread drains the rings and
+ *  writes the records to the terminal with their colors, as JSON lines or
+ *  into a binary file, which `log_replay()` turns back into either.
+ *
+ *  Before log_start() and after log_stop() records are written right away
+ *  by the calling thread, in the terminal format.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LOG_RING        4096    //records per thread
+#define LOG_MAX_ARGS    6
+#define LOG_STR         40      //bytes for the string arguments of a record, longer ones are cut
+#define LOG_TEXT        96      //text bytes per record, longer text takes several
+#define LOG_MAX_THREADS 64
+#define LOG_NO_DEV      0xFFFFFFFFu     //also what METRICS_NO_DEV converts to
+
+enum log_fmt_t
+{
+    LOG_TERM,
+    LOG_JSON,
+    LOG_BIN
+};
+
+//a LOG() call site, id is assigned by the logger thread on first use
+struct log_site_t
+{
+    const char* color;
+    const char* fmt;
+    uint32_t id;
+};
+
+//an argument as captured, its type is taken from the format when printing
+struct log_arg_t
+{
+    uint64_t v;
+    uint8_t str;                //v is a const char*, copied into the record
+};
+
+static inline struct log_arg_t log_arg_i(uint64_t v) { return (struct log_arg_t){v, 0}; }
+static inline struct log_arg_t log_arg_f(double v) { union { double d; uint64_t u; } x = {.d = v}; return (struct log_arg_t){x.u, 0}; }
+static inline struct log_arg_t log_arg_p(const void* v) { return (struct log_arg_t){(uintptr_t)v, 0}; }
+static inline struct log_arg_t log_arg_s(const char* v) { return (struct log_arg_t){(uintptr_t)v, 1}; }
+
+#define LOG_ARG(x) _Generic((x), float: log_arg_f, double: log_arg_f, char*: log_arg_s, const char*: log_arg_s, \
+    void*: log_arg_p, const void*: log_arg_p, default: log_arg_i)(x)
+
+#define LOG_NARGS(...)  LOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+#define LOG_CAT(a, b)   LOG_CAT_(a, b)
+#define LOG_CAT_(a, b)  a##b
+#define LOG_MAP_0()
+#define LOG_MAP_1(a)        LOG_ARG(a),
+#define LOG_MAP_2(a, ...)   LOG_ARG(a), LOG_MAP_1(__VA_ARGS__)
+#define LOG_MAP_3(a, ...)   LOG_ARG(a), LOG_MAP_2(__VA_ARGS__)
+#define LOG_MAP_4(a, ...)   LOG_ARG(a), LOG_MAP_3(__VA_ARGS__)
+#define LOG_MAP_5(a, ...)   LOG_ARG(a), LOG_MAP_4(__VA_ARGS__)
+#define LOG_MAP_6(a, ...)   LOG_ARG(a), LOG_MAP_5(__VA_ARGS__)
+
+//hot path logging: up to LOG_MAX_ARGS integer, floating point or string arguments
+//and a constant format, formatted by the logger thread, dropped if the ring is full
+#define LOG_DEV(dev, color, fmt, ...) do { \
+    static struct log_site_t log_site_ = {color, fmt, 0}; \
+    log_event(&log_site_, dev, LOG_NARGS(__VA_ARGS__), \
+        (const struct log_arg_t[]){LOG_CAT(LOG_MAP_, LOG_NARGS(__VA_ARGS__))(__VA_ARGS__) {0, 0}}); \
+} while(0)
+
+#define LOG(color, fmt, ...)    LOG_DEV(LOG_NO_DEV, color, fmt, ##__VA_ARGS__)
+
+//path is the binary log for LOG_BIN, NULL - stdout for the others
+int log_start(enum log_fmt_t fmt, const char* path);
+//drain everything logged so far and stop the logger thread
+void log_stop(void);
+//returns once everything logged before the call is written
+void log_flush(void);
+//records lost to full rings
+uint64_t log_dropped(void);
+
+void log_event(struct log_site_t* site, uint32_t dev, uint8_t nargs, const struct log_arg_t* args);
+//already formatted text, waits for room in the ring instead of dropping it
+void log_text(const char* color, uint32_t dev, const char* text, size_t len);
+
+//write a binary log as fmt (LOG_TERM or LOG_JSON) to stdout
+int log_replay(const char* path, enum log_fmt_t fmt);
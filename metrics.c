@@ -0,0 +1,539 @@
+/*
+ * metrics.c
+ *
+ *  Control plane and stream instrumentation
+ *
+ *  Counters live in static tables, by command ID and by stream, and in a
+ *  table of per-device blocks allocated when a device is first registered
+ *  and never freed, so the exporter can read any of them at any time without
+ *  coordinating with the threads updating them. Latency histograms have
+ *  fixed buckets, each bucket is a counter of its own; the cumulative counts
+ *  Prometheus expects are summed up when formatting. Series with nothing
+ *  counted are left out.
+ *
+ *  The HTTP endpoint and the snapshot writer each run in a thread of their
+ *  own. The endpoint answers one connection at a time with the whole text,
+ *  whatever the request.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "cari_codec.h"
+#include "cari.h"
+#include "log.h"
+#include "metrics.h"
+
+#define METRICS_BUCKETS     16      //the last one is +Inf
+#define METRICS_RESULTS     10      //CARI_CANCELLED..ERR_RANGE, then anything else
+#define METRICS_REQ_LEN     2048    //longest HTTP request read
+
+typedef atomic_uint_fast64_t counter_t;
+
+struct metrics_hist_t
+{
+    counter_t count[METRICS_BUCKETS];
+    counter_t sum_us;
+};
+
+struct metrics_cmd_t
+{
+    counter_t results[METRICS_RESULTS];
+    counter_t resends;
+    struct metrics_hist_t rtt;
+};
+
+struct metrics_dev_t
+{
+    char addr[128];
+    counter_t results[METRICS_RESULTS];
+    counter_t resends;
+    struct metrics_hist_t rtt;
+    counter_t last_reply;       //ms, CLOCK_REALTIME
+};
+
+struct metrics_stream_ctr_t
+{
+    counter_t frames;
+    counter_t bytes;
+    counter_t dropped;
+};
+
+//upper bucket bounds in ms
+static const double bounds[METRICS_BUCKETS-1] = {0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000};
+
+#define X(id, name) #id,
+static const char* results[METRICS_RESULTS] = {"CARI_CANCELLED", "CARI_NO_REPLY", "CARI_MALFORMED", CARI_ERR_TABLE(X) "OTHER"};
+#undef X
+_Static_assert(CARI_CANCELLED == -3 && ERR_RANGE == METRICS_RESULTS-5, "result table");
+
+static const char* streams[METRICS_STREAMS] = {"bb_rx", "bb_tx", "spvn"};
+
+static struct metrics_cmd_t cmds[256];
+static struct metrics_stream_ctr_t stream_ctr[METRICS_STREAMS];
+static struct metrics_dev_t* devs[METRICS_MAX_DEVS];
+static atomic_int ndevs;
+static pthread_mutex_t reg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_int running;
+static int serve_fd = -1;
+static pthread_t serve_thread, snap_thread;
+static uint8_t serving, snapshotting;
+static char snap_path[256];
+static int snap_interval;
+
+static inline void count(counter_t* c, uint64_t n)
+{
+    atomic_fetch_add_explicit(c, n, memory_order_relaxed);
+}
+
+static inline uint64_t get(counter_t* c)
+{
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+static inline void lat_add(struct metrics_hist_t* h, double ms)
+{
+    uint8_t b = 0;
+
+    while(b < METRICS_BUCKETS-1 && ms > bounds[b])
+        b++;
+    count(&h->count[b], 1);
+    count(&h->sum_us, ms > 0 ? (uint64_t)(ms*1e3) : 0);
+}
+
+int metrics_dev(const char* addr)
+{
+    int n = atomic_load_explicit(&ndevs, memory_order_acquire);
+
+    for(int i=0; i<n; i++)
+        if(strcmp(devs[i]->addr, addr) == 0)
+            return i;
+
+    pthread_mutex_lock(&reg_lock);
+
+    //someone else may have added it in the meantime
+    int ret = METRICS_NO_DEV;
+    n = atomic_load_explicit(&ndevs, memory_order_relaxed);
+    for(int i=0; i<n && ret == METRICS_NO_DEV; i++)
+        if(strcmp(devs[i]->addr, addr) == 0)
+            ret = i;
+
+    if(ret == METRICS_NO_DEV && n < METRICS_MAX_DEVS && (devs[n] = calloc(1, sizeof(struct metrics_dev_t))) != NULL)
+    {
+        snprintf(devs[n]->addr, sizeof(devs[n]->addr), "%s", addr);
+        atomic_store_explicit(&ndevs, n+1, memory_order_release);
+        ret = n;
+    }
+
+    pthread_mutex_unlock(&reg_lock);
+    return ret;
+}
+
+void metrics_req(int dev, uint8_t cid, int err, uint8_t attempts, double rtt)
+{
+    uint8_t res = (err >= CARI_CANCELLED && err <= ERR_RANGE) ? err - CARI_CANCELLED : METRICS_RESULTS-1;
+    uint8_t replied = (err != CARI_NO_REPLY && err != CARI_CANCELLED);
+    struct metrics_cmd_t* c = &cmds[cid];
+
+    count(&c->results[res], 1);
+    if(attempts > 1)
+        count(&c->resends, attempts-1);
+    if(replied)
+        lat_add(&c->rtt, rtt);
+
+    if(dev < 0 || dev >= atomic_load_explicit(&ndevs, memory_order_relaxed))
+        return;
+
+    struct metrics_dev_t* d = devs[dev];
+    count(&d->results[res], 1);
+    if(attempts > 1)
+        count(&d->resends, attempts-1);
+    if(replied)
+    {
+        struct timespec ts;
+
+        lat_add(&d->rtt, rtt);
+        clock_gettime(CLOCK_REALTIME, &ts);
+        atomic_store_explicit(&d->last_reply, ts.tv_sec*1000ull + ts.tv_nsec/1000000, memory_order_relaxed);
+    }
+}
+
+void metrics_stream(enum metrics_stream_t s, uint64_t frames, uint64_t bytes)
+{
+    count(&stream_ctr[s].frames, frames);
+    count(&stream_ctr[s].bytes, bytes);
+}
+
+void metrics_stream_drop(enum metrics_stream_t s, uint64_t frames)
+{
+    count(&stream_ctr[s].dropped, frames);
+}
+
+//label value, quotes and backslashes escaped
+static void put_label(FILE* fp, const char* s)
+{
+    for(; *s; s++)
+    {
+        if(*s == '"' || *s == '\\')
+            fputc('\\', fp);
+        fputc(*s == '\n' ? ' ' : *s, fp);
+    }
+}
+
+static void put_family(FILE* fp, const char* name, const char* type, const char* help)
+{
+    fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+//one histogram's series, label is `name="value"` without the braces
+static void put_hist(FILE* fp, const char* name, const char* label, const char* value, struct metrics_hist_t* h)
+{
+    uint64_t cum = 0;
+
+    for(uint8_t b=0; b<METRICS_BUCKETS; b++)
+    {
+        cum += get(&h->count[b]);
+        fprintf(fp, "%s_bucket{%s=\"", name, label);
+        put_label(fp, value);
+        if(b < METRICS_BUCKETS-1)
+            fprintf(fp, "\",le=\"%g\"} %lu\n", bounds[b]/1e3, cum);
+        else
+            fprintf(fp, "\",le=\"+Inf\"} %lu\n", cum);
+    }
+    fprintf(fp, "%s_sum{%s=\"", name, label);
+    put_label(fp, value);
+    fprintf(fp, "\"} %.6f\n%s_count{%s=\"", get(&h->sum_us)/1e6, name, label);
+    put_label(fp, value);
+    fprintf(fp, "\"} %lu\n", cum);
+}
+
+static uint64_t hist_total(struct metrics_hist_t* h)
+{
+    uint64_t n = 0;
+
+    for(uint8_t b=0; b<METRICS_BUCKETS; b++)
+        n += get(&h->count[b]);
+    return n;
+}
+
+static uint64_t results_total(counter_t* r)
+{
+    uint64_t n = 0;
+
+    for(uint8_t i=0; i<METRICS_RESULTS; i++)
+        n += get(&r[i]);
+    return n;
+}
+
+char* metrics_format(size_t* len)
+{
+    char* buf = NULL;
+    size_t size = 0;
+    FILE* fp = open_memstream(&buf, &size);
+    int n = atomic_load_explicit(&ndevs, memory_order_acquire);
+
+    if(fp == NULL)
+        return NULL;
+
+    put_family(fp, "cari_requests_total", "counter", "Finished requests by command and result");
+    for(int cid=0; cid<256; cid++)
+    {
+        for(uint8_t i=0; i<METRICS_RESULTS; i++)
+        {
+            uint64_t v = get(&cmds[cid].results[i]);
+            if(v > 0)
+                fprintf(fp, "cari_requests_total{cmd=\"%s\",result=\"%s\"} %lu\n", cari_cmd_name(cid), results[i], v);
+        }
+    }
+
+    put_family(fp, "cari_request_resends_total", "counter", "Requests sent again after a missed deadline, by command");
+    for(int cid=0; cid<256; cid++)
+    {
+        if(results_total(cmds[cid].results) > 0)
+            fprintf(fp, "cari_request_resends_total{cmd=\"%s\"} %lu\n", cari_cmd_name(cid), get(&cmds[cid].resends));
+    }
+
+    put_family(fp, "cari_request_duration_seconds", "histogram", "Round trip time of the answered requests, by command");
+    for(int cid=0; cid<256; cid++)
+    {
+        if(hist_total(&cmds[cid].rtt) > 0)
+            put_hist(fp, "cari_request_duration_seconds", "cmd", cari_cmd_name(cid), &cmds[cid].rtt);
+    }
+
+    put_family(fp, "cari_device_requests_total", "counter", "Finished requests by device and result");
+    for(int i=0; i<n; i++)
+    {
+        for(uint8_t k=0; k<METRICS_RESULTS; k++)
+        {
+            uint64_t v = get(&devs[i]->results[k]);
+            if(v == 0)
+                continue;
+            fprintf(fp, "cari_device_requests_total{dev=\"");
+            put_label(fp, devs[i]->addr);
+            fprintf(fp, "\",result=\"%s\"} %lu\n", results[k], v);
+        }
+    }
+
+    put_family(fp, "cari_device_request_resends_total", "counter", "Requests sent again after a missed deadline, by device");
+    for(int i=0; i<n; i++)
+    {
+        if(results_total(devs[i]->results) == 0)
+            continue;
+        fprintf(fp, "cari_device_request_resends_total{dev=\"");
+        put_label(fp, devs[i]->addr);
+        fprintf(fp, "\"} %lu\n", get(&devs[i]->resends));
+    }
+
+    put_family(fp, "cari_device_request_duration_seconds", "histogram", "Round trip time of the answered requests, by device");
+    for(int i=0; i<n; i++)
+    {
+        if(hist_total(&devs[i]->rtt) > 0)
+            put_hist(fp, "cari_device_request_duration_seconds", "dev", devs[i]->addr, &devs[i]->rtt);
+    }
+
+    put_family(fp, "cari_device_last_reply_timestamp_seconds", "gauge", "Time of the last reply from the device");
+    for(int i=0; i<n; i++)
+    {
+        uint64_t t = get(&devs[i]->last_reply);
+        if(t == 0)
+            continue;
+        fprintf(fp, "cari_device_last_reply_timestamp_seconds{dev=\"");
+        put_label(fp, devs[i]->addr);
+        fprintf(fp, "\"} %.3f\n", t/1e3);
+    }
+
+    put_family(fp, "cari_stream_frames_total", "counter", "Stream messages received or published");
+    for(int s=0; s<METRICS_STREAMS; s++)
+        fprintf(fp, "cari_stream_frames_total{stream=\"%s\"} %lu\n", streams[s], get(&stream_ctr[s].frames));
+    put_family(fp, "cari_stream_bytes_total", "counter", "Stream bytes received or published");
+    for(int s=0; s<METRICS_STREAMS; s++)
+        fprintf(fp, "cari_stream_bytes_total{stream=\"%s\"} %lu\n", streams[s], get(&stream_ctr[s].bytes));
+    put_family(fp, "cari_stream_dropped_total", "counter", "Stream messages lost by a consumer or not decoded");
+    for(int s=0; s<METRICS_STREAMS; s++)
+        fprintf(fp, "cari_stream_dropped_total{stream=\"%s\"} %lu\n", streams[s], get(&stream_ctr[s].dropped));
+
+    put_family(fp, "cari_log_dropped_total", "counter", "Log records lost to full rings");
+    fprintf(fp, "cari_log_dropped_total %lu\n", log_dropped());
+
+    if(fclose(fp) != 0)
+    {
+        free(buf);
+        return NULL;
+    }
+    if(len != NULL)
+        *len = size;
+    return buf;
+}
+
+static int write_all(int fd, const char* p, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+//read the request up to the blank line, the request itself does not matter
+static void answer(int fd)
+{
+    char req[METRICS_REQ_LEN+1];
+    size_t got = 0;
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    while(got < METRICS_REQ_LEN && poll(&pfd, 1, 1000) > 0)
+    {
+        ssize_t n = read(fd, req+got, METRICS_REQ_LEN-got);
+        if(n <= 0)
+            return;
+        got += n;
+        req[got] = 0;
+        if(strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL)
+            break;
+    }
+
+    size_t len;
+    char* body = metrics_format(&len);
+    char hdr[160];
+
+    if(body == NULL)
+    {
+        const char* err = "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+        write_all(fd, err, strlen(err));
+        return;
+    }
+
+    int hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %zu\r\nConnection: close\r\n\r\n", len);
+    if(write_all(fd, hdr, hlen) == 0 && strncmp(req, "HEAD ", 5) != 0)
+        write_all(fd, body, len);
+    free(body);
+}
+
+static void* serve_loop(void* arg)
+{
+    struct pollfd pfd = {serve_fd, POLLIN, 0};
+    (void)arg;
+
+    while(atomic_load(&running))
+    {
+        if(poll(&pfd, 1, 200) <= 0)
+            continue;
+
+        int fd = accept(serve_fd, NULL, NULL);
+        if(fd < 0)
+            continue;
+        answer(fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+int metrics_serve(const char* addr)
+{
+    char ip[64] = "127.0.0.1";
+    const char* port = addr;
+    const char* colon = strrchr(addr, ':');
+    struct sockaddr_in sa = {.sin_family = AF_INET};
+    int one = 1;
+
+    if(serving)
+        return -1;
+
+    if(colon != NULL)
+    {
+        if((size_t)(colon - addr) >= sizeof(ip))
+            return -1;
+        memcpy(ip, addr, colon - addr);
+        ip[colon - addr] = 0;
+        port = colon+1;
+    }
+
+    char* end;
+    unsigned long p = strtoul(port, &end, 10);
+    if(*port == 0 || *end != 0 || p == 0 || p > 65535 || inet_pton(AF_INET, ip, &sa.sin_addr) != 1)
+        return -1;
+    sa.sin_port = htons(p);
+
+    serve_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(serve_fd < 0)
+        return -1;
+    setsockopt(serve_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(bind(serve_fd, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(serve_fd, 16) != 0)
+    {
+        close(serve_fd);
+        serve_fd = -1;
+        return -1;
+    }
+
+    atomic_store(&running, 1);
+    if(pthread_create(&serve_thread, NULL, serve_loop, NULL) != 0)
+    {
+        close(serve_fd);
+        serve_fd = -1;
+        return -1;
+    }
+    serving = 1;
+
+    return 0;
+}
+
+static int write_snapshot(void)
+{
+    char tmp[sizeof(snap_path)+8];
+    size_t len;
+    char* body = metrics_format(&len);
+
+    if(body == NULL)
+        return -1;
+
+    //readers never see a half written file
+    snprintf(tmp, sizeof(tmp), "%s.tmp", snap_path);
+    FILE* fp = fopen(tmp, "w");
+    int ret = -1;
+    if(fp != NULL)
+    {
+        ret = (fwrite(body, 1, len, fp) == len) ? 0 : -1;
+        if(fclose(fp) != 0)
+            ret = -1;
+        if(ret == 0)
+            ret = rename(tmp, snap_path);
+        else
+            unlink(tmp);
+    }
+
+    free(body);
+    return ret;
+}
+
+static void* snap_loop(void* arg)
+{
+    const struct timespec step = {0, 100000000};
+    (void)arg;
+
+    while(atomic_load(&running))
+    {
+        for(int i=0; i<snap_interval*10 && atomic_load(&running); i++)
+            nanosleep(&step, NULL);
+        write_snapshot();
+    }
+
+    return NULL;
+}
+
+int metrics_snapshot(const char* path, int interval)
+{
+    if(snapshotting || interval < 1 || strlen(path) >= sizeof(snap_path))
+        return -1;
+
+    snprintf(snap_path, sizeof(snap_path), "%s", path);
+    snap_interval = interval;
+
+    //the file is there from the start, and a path that can not be written fails right away
+    if(write_snapshot() != 0)
+        return -1;
+
+    atomic_store(&running, 1);
+    if(pthread_create(&snap_thread, NULL, snap_loop, NULL) != 0)
+        return -1;
+    snapshotting = 1;
+
+    return 0;
+}
+
+void metrics_stop(void)
+{
+    atomic_store(&running, 0);
+
+    if(serving)
+    {
+        pthread_join(serve_thread, NULL);
+        close(serve_fd);
+        serve_fd = -1;
+        serving = 0;
+    }
+    if(snapshotting)
+    {
+        pthread_join(snap_thread, NULL);
+        snapshotting = 0;
+    }
+}
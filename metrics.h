@@ -0,0 +1,48 @@
+/*
+ * metrics.h
+ *
+ *  Control plane and stream instrumentation
+ *
+ *  Every finished request is counted by command and result (cari_err_t or
+ *  one of the CARI_* errors) and by device, with its round trip time in a
+ *  latency histogram; baseband and supervision streams count frames, bytes
+ *  and drops. All counters are updated with relaxed atomics from whichever
+ *  thread does the work, nothing is locked on the hot path. The lot is
+ *  exported in the Prometheus text format, over HTTP on a loopback socket
+ *  and/or as a snapshot file rewritten periodically.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define METRICS_MAX_DEVS    4096    //devices with series of their own, the ones after are only counted by command
+#define METRICS_NO_DEV      -1
+#define METRICS_INTERVAL    10      //default snapshot period in s
+
+enum metrics_stream_t
+{
+    METRICS_BB_RX,              //baseband received, drops are messages a consumer had no room for
+    METRICS_BB_TX,              //baseband published
+    METRICS_SPVN,               //supervision samples, drops are malformed frames
+    METRICS_STREAMS
+};
+
+//series index of the device at addr, registered on first use, METRICS_NO_DEV if the table is full
+int metrics_dev(const char* addr);
+
+//a finished request: err is cari_err_t or a CARI_* error, rtt in ms (ignored without a reply)
+//attempts above 1 count as resends
+void metrics_req(int dev, uint8_t cid, int err, uint8_t attempts, double rtt);
+void metrics_stream(enum metrics_stream_t s, uint64_t frames, uint64_t bytes);
+void metrics_stream_drop(enum metrics_stream_t s, uint64_t frames);
+
+//Prometheus text exposition of everything counted so far, malloc'ed, NULL if out of memory
+char* metrics_format(size_t* len);
+
+//HTTP on addr ("[IP:]PORT", the IP defaults to 127.0.0.1), every path gets the metrics
+int metrics_serve(const char* addr);
+//rewrite path (through a temporary file and a rename) every interval s, and once more on metrics_stop()
+int metrics_snapshot(const char* path, int interval);
+void metrics_stop(void);
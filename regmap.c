@@ -0,0 +1,532 @@
+/*
+ * regmap.c
+ *
+ *  Bulk register dump, load and diff
+ *
+ *  DEV_GET_REG replies do not name the register, so every request carries its
+ *  index in an envelope frame, as in the benchmark, and up to a window of them
+ *  are kept in flight. A full map then costs about one round trip per window
+ *  and a lost request only has itself resent. Dumps are a small header
+ *  followed by [reg][value] pairs of the registers that could be read, mapped
+ *  into memory for reading and writing. A device answers a DEV_GET_REG it
+ *  can not serve with a lone error code, the same single byte a value is
+ *  sent as, so registers reading as a non-zero error code are left out.
+ */
+
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "interface_cmds.h"
+#include "cari_codec.h"
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "ctrl.h"
+#include "cari.h"
+#include "regmap.h"
+
+#define REGMAP_MAGIC    0x4D474552u //"REGM"
+#define REGMAP_VERSION  1
+#define TAG_LEN         8           //[index u64]
+#define REG_AMBIGUOUS   (CARI_CANCELLED-1) //the value is an error code as well, below the CARI_* errors
+
+struct regmap_hdr_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;                 //[reg][value] pairs that follow
+    uint32_t reserved;
+    int64_t t;
+    char ident[64];
+};
+
+struct reg_req_t
+{
+    uint8_t frame[16];
+    uint8_t len;
+    uint8_t reg;
+    uint8_t sent;
+    uint8_t done;
+    int8_t err;
+    uint8_t val;                //what an ambiguous reply read
+};
+
+int regmap_save(const char* path, const struct regmap_t* m)
+{
+    uint32_t count = 0;
+
+    for(int i=0; i<REGMAP_SIZE; i++)
+        count += regmap_has(m, i);
+
+    size_t size = sizeof(struct regmap_hdr_t) + 2*count;
+    int fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if(fd < 0)
+        return -1;
+
+    if(ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    uint8_t* map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+
+    struct regmap_hdr_t* h = (struct regmap_hdr_t*)map;
+    uint8_t* p = map + sizeof(*h);
+
+    h->magic = REGMAP_MAGIC;
+    h->version = REGMAP_VERSION;
+    h->count = count;
+    h->reserved = 0;
+    h->t = m->t;
+    memcpy(h->ident, m->ident, sizeof(h->ident));
+
+    for(int i=0; i<REGMAP_SIZE; i++)
+    {
+        if(regmap_has(m, i))
+        {
+            *p++ = i;
+            *p++ = m->val[i];
+        }
+    }
+
+    munmap(map, size);
+    return 0;
+}
+
+int regmap_load(const char* path, struct regmap_t* m)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    int ret = -1;
+
+    memset(m, 0, sizeof(*m));
+
+    if(fd < 0)
+        return -1;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct regmap_hdr_t))
+    {
+        close(fd);
+        return -1;
+    }
+
+    uint8_t* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+
+    const struct regmap_hdr_t* h = (const struct regmap_hdr_t*)map;
+    const uint8_t* p = map + sizeof(*h);
+
+    if(h->magic == REGMAP_MAGIC && h->version == REGMAP_VERSION && (size_t)st.st_size == sizeof(*h) + 2*(size_t)h->count)
+    {
+        for(uint32_t i=0; i<h->count; i++, p+=2)
+            regmap_set(m, p[0], p[1]);
+        memcpy(m->ident, h->ident, sizeof(m->ident));
+        m->ident[sizeof(m->ident)-1] = 0;
+        m->t = h->t;
+        ret = 0;
+    }
+
+    munmap(map, st.st_size);
+    return ret;
+}
+
+static void print_source(const char* name, const struct regmap_t* m)
+{
+    char date[32] = "now";
+    time_t t = m->t;
+
+    if(t != 0)
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    dbg_print(0, "%s: \"%s\", %s\n", name, m->ident, date);
+}
+
+//list every register that is different or only in one of the maps, returns their number
+int regmap_diff(const struct regmap_t* a, const struct regmap_t* b, const char* name_a, const char* name_b)
+{
+    int differ = 0, same = 0;
+
+    dbg_print(0, "--- ");
+    print_source(name_a, a);
+    dbg_print(0, "+++ ");
+    print_source(name_b, b);
+
+    for(int i=0; i<REGMAP_SIZE; i++)
+    {
+        int in_a = regmap_has(a, i), in_b = regmap_has(b, i);
+
+        if(!in_a && !in_b)
+            continue;
+
+        if(in_a && in_b && a->val[i] == b->val[i])
+        {
+            same++;
+            continue;
+        }
+
+        differ++;
+        dbg_print(0, "  0x%02X: ", i);
+        if(in_a)
+            dbg_print(TERM_RED, "0x%02X", a->val[i]);
+        else
+            dbg_print(TERM_RED, "  --");
+        dbg_print(0, " -> ");
+        if(in_b)
+            dbg_print(TERM_GREEN, "0x%02X\n", b->val[i]);
+        else
+            dbg_print(TERM_GREEN, "  --\n");
+    }
+
+    dbg_print(differ ? TERM_YELLOW : TERM_GREEN, "%d register(s) differ", differ);
+    dbg_print(0, ", %d identical\n", same);
+
+    return differ;
+}
+
+static void print_map(const struct regmap_t* m)
+{
+    dbg_print(0, "     ");
+    for(int i=0; i<16; i++)
+        dbg_print(0, " %X ", i);
+
+    for(int i=0; i<REGMAP_SIZE; i++)
+    {
+        if(i%16 == 0)
+            dbg_print(0, "\n0x%02X ", i);
+        if(regmap_has(m, i))
+            dbg_print(0, " %02X", m->val[i]);
+        else
+            dbg_print(0, " --");
+    }
+    dbg_print(0, "\n");
+}
+
+static int reg_send(struct link_t* link, uint64_t idx, const struct reg_req_t* r)
+{
+    uint8_t tag[TAG_LEN];
+
+    cari_put_u64(tag, idx);
+    return link_send_tagged(link, tag, sizeof(tag), r->frame, r->len);
+}
+
+static void take_reply(struct reg_req_t* r, zmq_msg_t* msg, struct regmap_t* m)
+{
+    struct cari_frame_t f;
+
+    r->done = 1;
+    if(cari_decode_reply_msg(r->frame[0], msg, &f) != CARI_DEC_OK)
+    {
+        r->err = CARI_MALFORMED;
+        return;
+    }
+
+    r->err = f.err;
+    if(cari_reply_ambiguous(&f))
+    {
+        r->err = REG_AMBIGUOUS;
+        r->val = f.payload[0];
+    }
+    if(r->err != ERR_OK || m == NULL)
+        return;
+
+    if(f.cid == CMD_DEV_GET_REG && f.payload_len >= 1)
+        regmap_set(m, r->reg, f.payload[0]);
+    else if(f.cid == CMD_DEV_GET_IDENT)
+        snprintf(m->ident, sizeof(m->ident), "%.*s", (int)strnlen((const char*)f.payload, f.payload_len), f.payload);
+}
+
+//take every reply waiting on the socket, returns the number of requests completed
+static uint32_t drain(struct link_t* link, struct reg_req_t* reqs, uint32_t n, struct regmap_t* m)
+{
+    zmq_msg_t msg;
+    uint8_t tag[TAG_LEN];
+    uint32_t done = 0;
+    int tagged;
+
+    while((tagged = link_recv_tagged(link, &msg, tag, sizeof(tag))) >= 0)
+    {
+        uint64_t idx = tagged ? cari_get_u64(tag) : UINT64_MAX;
+
+        if(idx < n && reqs[idx].sent && !reqs[idx].done)
+        {
+            done++;
+            take_reply(&reqs[idx], &msg, m);
+        }
+        zmq_msg_close(&msg);
+    }
+
+    return done;
+}
+
+//run all requests with up to window of them in flight, returns the number lost
+static uint32_t xfer(struct link_t* link, struct reg_req_t* reqs, uint32_t n, uint32_t window, struct regmap_t* m)
+{
+    uint32_t next = 0, done = 0, inflight = 0;
+    uint8_t attempt = 0;
+    double deadline = now_ms() + link_attempt_timeout(link, 0);
+
+    while(done < n)
+    {
+        while(inflight < window && next < n)
+        {
+            reqs[next].sent = 1;
+            reg_send(link, next, &reqs[next]);
+            next++;
+            inflight++;
+        }
+
+        zmq_pollitem_t item = {link->sock, 0, ZMQ_POLLIN, 0};
+        double now = now_ms();
+
+        if(now < deadline)
+            zmq_poll(&item, 1, (long)(deadline - now) + 1);
+
+        uint32_t got = drain(link, reqs, n, m);
+        done += got;
+        inflight -= got;
+        now = now_ms();
+
+        if(got > 0)
+        {
+            attempt = 0;
+            deadline = now + link_attempt_timeout(link, 0);
+        }
+        else if(now >= deadline)
+        {
+            if(attempt < link->retries && link_reopen(link) == 0)
+            {
+                //the old connection is gone with its replies, resend what is in flight
+                attempt++;
+                deadline = now + link_attempt_timeout(link, attempt);
+                for(uint32_t i=0; i<next; i++)
+                    if(!reqs[i].done)
+                        reg_send(link, i, &reqs[i]);
+                continue;
+            }
+
+            //give up on the rest
+            uint32_t lost = 0;
+            for(uint32_t i=0; i<n; i++)
+            {
+                if(!reqs[i].done)
+                {
+                    reqs[i].done = 1;
+                    reqs[i].err = CARI_NO_REPLY;
+                    lost++;
+                }
+            }
+            return lost;
+        }
+    }
+
+    return 0;
+}
+
+static const char* err_str(int8_t err)
+{
+    if(err == CARI_NO_REPLY)
+        return "no response";
+    if(err == REG_AMBIGUOUS)
+        return "reads as an error code, not recorded";
+    if(err < 0)
+        return "malformed response";
+    return cari_err_name(err);
+}
+
+//read the registers in [first, last] along with the ident, returns the number not read, -1 if the device is not there
+static int dump(struct link_t* link, const struct regmap_opts_t* opts, const uint8_t* only, struct regmap_t* m, uint8_t verbose)
+{
+    struct reg_req_t reqs[1 + REGMAP_SIZE] = {0};
+    uint32_t n = 0, failed = 0;
+
+    memset(m, 0, sizeof(*m));
+    m->t = time(NULL);
+
+    reqs[n].len = cari_encode(reqs[n].frame, sizeof(reqs[n].frame), CMD_DEV_GET_IDENT, NULL, 0);
+    n++;
+    for(int i=opts->first; i<=opts->last; i++)
+    {
+        if(only != NULL && !((only[i/8] >> (i%8)) & 1))
+            continue;
+        reqs[n].reg = i;
+        reqs[n].len = cari_enc_u8(reqs[n].frame, sizeof(reqs[n].frame), CMD_DEV_GET_REG, i);
+        n++;
+    }
+
+    double t0 = now_ms();
+    uint32_t lost = xfer(link, reqs, n, opts->window, m);
+    double elapsed = now_ms() - t0;
+
+    lost -= (reqs[0].err == CARI_NO_REPLY); //the ident is not a register
+
+    for(uint32_t i=1; i<n; i++)
+    {
+        if(reqs[i].err != ERR_OK)
+        {
+            failed++;
+            if(verbose && reqs[i].err != CARI_NO_REPLY)
+            {
+                if(reqs[i].err == REG_AMBIGUOUS)
+                    dbg_print(TERM_YELLOW, "Register 0x%02X: 0x%02X (%s) %s\n", reqs[i].reg, reqs[i].val,
+                        cari_err_name(reqs[i].val), err_str(reqs[i].err));
+                else
+                    dbg_print(TERM_YELLOW, "Register 0x%02X: %s\n", reqs[i].reg, err_str(reqs[i].err));
+            }
+        }
+    }
+
+    if(verbose)
+    {
+        dbg_print(0, "Read %u of %u register(s) in %.3f ms, window %u", n-1-failed, n-1, elapsed, opts->window);
+        if(lost)
+            dbg_print(TERM_RED, ", %u without a response", lost);
+        dbg_print(0, "\n");
+    }
+
+    return (reqs[0].err == CARI_NO_REPLY) ? -1 : (int)failed;
+}
+
+static int load(struct link_t* link, const struct regmap_opts_t* opts)
+{
+    struct regmap_t want, have;
+    struct reg_req_t reqs[REGMAP_SIZE] = {0};
+    uint32_t n = 0, failed = 0, same = 0;
+
+    if(regmap_load(opts->load, &want) != 0)
+    {
+        dbg_print(TERM_RED, "Can not read the register dump %s\n", opts->load);
+        return 1;
+    }
+
+    //writing register 0 resets the device
+    if(regmap_has(&want, 0) && opts->first == 0)
+        dbg_print(TERM_YELLOW, "Register 0 resets the device, skipped\n");
+    want.present[0] &= ~1;
+
+    if(opts->converge)
+    {
+        if(dump(link, opts, want.present, &have, 0) != 0)
+        {
+            dbg_print(TERM_YELLOW, "Not every register could be read back, writing all of them\n");
+            memset(have.present, 0, sizeof(have.present));
+        }
+    }
+    else
+        memset(&have, 0, sizeof(have));
+
+    for(int i=opts->first; i<=opts->last; i++)
+    {
+        if(!regmap_has(&want, i))
+            continue;
+        if(regmap_has(&have, i) && have.val[i] == want.val[i])
+        {
+            same++;
+            continue;
+        }
+        reqs[n].reg = i;
+        reqs[n].len = cari_enc_set_reg(reqs[n].frame, sizeof(reqs[n].frame), i, want.val[i]);
+        n++;
+    }
+
+    double t0 = now_ms();
+    uint32_t lost = xfer(link, reqs, n, opts->window, NULL);
+    double elapsed = now_ms() - t0;
+
+    for(uint32_t i=0; i<n; i++)
+    {
+        if(reqs[i].err != ERR_OK)
+        {
+            failed++;
+            if(reqs[i].err != CARI_NO_REPLY)
+                dbg_print(TERM_YELLOW, "Register 0x%02X: %s\n", reqs[i].reg, err_str(reqs[i].err));
+        }
+    }
+
+    dbg_print(0, "Wrote %u of %u register(s) in %.3f ms, window %u", n-failed, n, elapsed, opts->window);
+    if(opts->converge)
+        dbg_print(0, ", %u unchanged", same);
+    if(lost)
+        dbg_print(TERM_RED, ", %u without a response", lost);
+    dbg_print(0, "\n");
+
+    return failed ? 1 : 0;
+}
+
+int regmap_run(void* zmq_ctx, const char* addr, const struct regmap_opts_t* opts)
+{
+    struct link_t link = {0};
+    struct regmap_t a, b;
+    int ret = 0;
+
+    //dumps compared to each other need no device
+    if(opts->diff[0] != NULL && (opts->diff[1] != NULL || addr == NULL))
+    {
+        if(regmap_load(opts->diff[0], &a) != 0 || (opts->diff[1] != NULL && regmap_load(opts->diff[1], &b) != 0))
+        {
+            dbg_print(TERM_RED, "Can not read the register dumps\n");
+            return 1;
+        }
+
+        if(opts->diff[1] == NULL)
+        {
+            print_source(opts->diff[0], &a);
+            print_map(&a);
+            return 0;
+        }
+
+        return regmap_diff(&a, &b, opts->diff[0], opts->diff[1]) ? 1 : 0;
+    }
+
+    link_direct_only("Register");
+    if(link_open(&link, zmq_ctx, addr) != 0)
+    {
+        dbg_print(TERM_RED, "Can not connect to %s\n", addr);
+        return 1;
+    }
+
+    if(opts->load != NULL)
+        ret |= load(&link, opts);
+
+    if(opts->dump != NULL || opts->diff[0] != NULL)
+    {
+        int failed = dump(&link, opts, NULL, &b, 1);
+
+        if(failed < 0)
+        {
+            link_close(&link);
+            return 1;
+        }
+        ret |= (failed != 0);
+
+        if(opts->dump != NULL && regmap_save(opts->dump, &b) != 0)
+        {
+            dbg_print(TERM_RED, "Can not write the register dump %s\n", opts->dump);
+            ret = 1;
+        }
+
+        if(opts->diff[0] != NULL)
+        {
+            if(regmap_load(opts->diff[0], &a) != 0)
+            {
+                dbg_print(TERM_RED, "Can not read the register dump %s\n", opts->diff[0]);
+                ret = 1;
+            }
+            else if(regmap_diff(&a, &b, opts->diff[0], addr))
+                ret = 1;
+        }
+    }
+
+    link_close(&link);
+    return ret;
+}
@@ -0,0 +1,39 @@
+/*
+ * regmap.h
+ *
+ *  Bulk register dump, load and diff
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define REGMAP_SIZE     256     //DEV_GET_REG/DEV_SET_REG address space
+#define REGMAP_WINDOW   32      //default requests in flight
+
+//a device register map, only the registers flagged in `present` are known
+struct regmap_t
+{
+    char ident[64];
+    int64_t t;                  //unix time of the dump
+    uint8_t present[REGMAP_SIZE/8];
+    uint8_t val[REGMAP_SIZE];
+};
+
+struct regmap_opts_t
+{
+    const char* dump;           //file to dump the device into
+    const char* load;           //file to write to the device
+    const char* diff[2];        //dumps to compare, the device stands in for the second one if missing
+    uint8_t first, last;        //register range
+    uint32_t window;
+    uint8_t converge;           //read the device first, only write what differs
+};
+
+static inline int regmap_has(const struct regmap_t* m, uint8_t reg) { return (m->present[reg/8] >> (reg%8)) & 1; }
+static inline void regmap_set(struct regmap_t* m, uint8_t reg, uint8_t val) { m->present[reg/8] |= 1 << (reg%8); m->val[reg] = val; }
+
+int regmap_save(const char* path, const struct regmap_t* m);
+int regmap_load(const char* path, struct regmap_t* m);
+int regmap_diff(const struct regmap_t* a, const struct regmap_t* b, const char* name_a, const char* name_b);
+int regmap_run(void* zmq_ctx, const char* addr, const struct regmap_opts_t* opts);
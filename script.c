@@ -0,0 +1,575 @@
+/*
+ * script.c
+ *
+ *  Streaming batch mode
+ *
+ *  Operations are read from a file or stdin, one line each, using the long
+ *  option names:
+ *    [dest=ADDR] [setting=value ...] [ping] [ident] [reset] [get=SETTING]
+ *    [getreg=REG] [setreg=REG:VAL]
+ *  `dest` stays in effect for the following lines. Settings go out first, in
+ *  the same order as on the command line, then the queries in line order.
+ *  Every device gets one connection for the whole run, all of them driven by
+ *  one libcari context. Lines for different devices run in parallel, lines
+ *  for the same device are pipelined up to SCRIPT_DEPTH requests; reading
+ *  stops while the target device is that far behind. Each line yields a JSON
+ *  object on stdout once all of its replies are in, in line order per device,
+ *  all other output goes to stderr.
+ */
+
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "interface_cmds.h"
+#include "cari_codec.h"
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "ctrl.h"
+#include "cari.h"
+#include "script.h"
+
+#define SCRIPT_BUF      65536   //input buffer, also the longest line
+
+struct script_req_t
+{
+    struct pending_t p;
+    uint32_t line;
+    uint8_t last;               //last request of its line
+    double t_line;              //ms, when the line was read
+    char value[80];             //decoded reply data, JSON
+};
+
+struct script_dev_t
+{
+    char addr[128];
+    struct cari_dev_t* cd;      //NULL - connection failed
+    struct script_req_t q[SCRIPT_DEPTH];
+    uint32_t head, tail;        //oldest unfinished line, next free slot
+};
+
+//a parsed line waiting for room in its device queue
+struct script_line_t
+{
+    uint32_t num;
+    char addr[128];
+    struct pending_t req[MAX_BATCH];
+    uint8_t n;
+    double t;
+};
+
+struct script_t
+{
+    struct script_dev_t** dev;
+    int ndev, cap;
+    int last;                   //device of the previous line
+    FILE* out;
+    struct cari_t* c;
+    uint64_t lines, reqs, failed_lines;
+};
+
+static const struct
+{
+    const char* name;           //long option name
+    uint8_t param;
+} params[] =
+{
+    {"rfreq", PARAM_RX_FREQ},
+    {"tfreq", PARAM_TX_FREQ},
+    {"rcorr", PARAM_RX_FREQ_CORR},
+    {"tcorr", PARAM_TX_FREQ_CORR},
+    {"afc",   PARAM_AFC},
+    {"power", PARAM_TX_PWR}
+};
+
+static void json_str(FILE* fp, const char* s, size_t len)
+{
+    fputc('"', fp);
+    for(size_t i=0; i<len && s[i]; i++)
+    {
+        unsigned char c = s[i];
+
+        if(c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if(c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+static struct script_dev_t* get_dev(struct script_t* s, const char* addr)
+{
+    if(s->last >= 0 && strcmp(s->dev[s->last]->addr, addr) == 0)
+        return s->dev[s->last];
+
+    for(int i=0; i<s->ndev; i++)
+    {
+        if(strcmp(s->dev[i]->addr, addr) == 0)
+        {
+            s->last = i;
+            return s->dev[i];
+        }
+    }
+
+    if(s->ndev == s->cap)
+    {
+        int cap = s->cap ? s->cap*2 : 16;
+        struct script_dev_t** dev = realloc(s->dev, cap*sizeof(struct script_dev_t*));
+        if(dev == NULL)
+            return NULL;
+        s->dev = dev;
+        s->cap = cap;
+    }
+
+    struct script_dev_t* d = calloc(1, sizeof(struct script_dev_t));
+    if(d == NULL)
+        return NULL;
+
+    snprintf(d->addr, sizeof(d->addr), "%s", addr);
+    d->cd = cari_dev_open(s->c, addr);
+
+    s->last = s->ndev;
+    s->dev[s->ndev++] = d;
+    return d;
+}
+
+//parse a line into requests, returns 0 if there is something to send, 1 if not, -1 on errors
+static int parse_line(char* text, struct script_line_t* l, char* dest, const struct option* opts, char* err, size_t err_size)
+{
+    struct re_config_t cfg;
+    struct pending_t* q = l->req;       //queries are collected at the end of the batch
+    uint8_t nq = 0;
+    char* tok;
+
+    config_init(&cfg);
+    l->n = 0;
+
+    #define QUERY (&q[MAX_BATCH-1-nq])
+    #define REQ QUERY->req, sizeof(QUERY->req)
+
+    for(tok = strtok(text, " \t\r\n"); tok != NULL; tok = strtok(NULL, " \t\r\n"))
+    {
+        char* val = strchr(tok, '=');
+        if(val != NULL)
+            *val++ = 0;
+
+        if(nq == MAX_BATCH)
+        {
+            snprintf(err, err_size, "too many requests");
+            return -1;
+        }
+
+        if(strcmp(tok, "dest") == 0 && val != NULL)
+        {
+            struct re_config_t d;
+            if(config_parse_opt(&d, 'd', val, 0) != 0)
+            {
+                snprintf(err, err_size, "bad address \"%s\"", val);
+                return -1;
+            }
+            strcpy(dest, d.re_addr);
+        }
+        else if(strcmp(tok, "ping") == 0 && val == NULL)
+            nq += batch_add(QUERY, cari_encode(REQ, CMD_PING, NULL, 0), "ping");
+        else if(strcmp(tok, "ident") == 0 && val == NULL)
+            nq += batch_add(QUERY, cari_encode(REQ, CMD_DEV_GET_IDENT, NULL, 0), "ident");
+        else if(strcmp(tok, "reset") == 0 && val == NULL)
+            nq += batch_add(QUERY, cari_enc_set_reg(REQ, 0, 0), "reset");
+        else if(strcmp(tok, "get") == 0 && val != NULL)
+        {
+            size_t i;
+            for(i=0; i<sizeof(params)/sizeof(params[0]); i++)
+                if(strcmp(params[i].name, val) == 0)
+                    break;
+            if(i == sizeof(params)/sizeof(params[0]))
+            {
+                snprintf(err, err_size, "unknown setting \"%s\"", val);
+                return -1;
+            }
+            nq += batch_add(QUERY, cari_enc_u8(REQ, CMD_SUB_GET_PARAM, params[i].param), "get %s", val);
+        }
+        else if(strcmp(tok, "getreg") == 0 && val != NULL)
+        {
+            char* end;
+            unsigned long reg = strtoul(val, &end, 0);
+            if(*end || reg > 0xFF)
+            {
+                snprintf(err, err_size, "bad register \"%s\"", val);
+                return -1;
+            }
+            nq += batch_add(QUERY, cari_enc_u8(REQ, CMD_DEV_GET_REG, reg), "getreg %lu", reg);
+        }
+        else if(strcmp(tok, "setreg") == 0 && val != NULL)
+        {
+            char* end;
+            unsigned long reg = strtoul(val, &end, 0), v = 0;
+            if(*end == ':')
+                v = strtoul(end+1, &end, 0);
+            if(*end || reg > 0xFF || v > 0xFF || strchr(val, ':') == NULL)
+            {
+                snprintf(err, err_size, "bad register write \"%s\"", val);
+                return -1;
+            }
+            nq += batch_add(QUERY, cari_enc_set_reg(REQ, reg, v), "setreg %lu:%lu", reg, v);
+        }
+        else
+        {
+            const struct option* o = opts;
+
+            if(val != NULL)
+                for(; o->name != NULL; o++)
+                    if(strcmp(o->name, tok) == 0 && o->has_arg != no_argument)
+                        break;
+
+            if(val == NULL || o->name == NULL || o->val == 'd')
+            {
+                snprintf(err, err_size, "unknown operation \"%s\"", tok);
+                return -1;
+            }
+
+            int ret = config_parse_opt(&cfg, o->val, val, 0);
+            if(ret < 0)
+            {
+                snprintf(err, err_size, "invalid %s \"%s\"", tok, val);
+                return -1;
+            }
+            if(ret > 0)
+            {
+                snprintf(err, err_size, "%s is not a device setting", tok);
+                return -1;
+            }
+        }
+    }
+
+    #undef REQ
+    #undef QUERY
+
+    //settings first, then the queries in line order
+    l->n = config_to_batch(&cfg, l->req);
+    if(l->n + nq > MAX_BATCH)
+    {
+        snprintf(err, err_size, "too many requests");
+        return -1;
+    }
+    for(uint8_t i=0; i<nq; i++)
+        l->req[l->n++] = q[MAX_BATCH-1-i];
+
+    if(l->n > 0 && dest[0] == 0)
+    {
+        snprintf(err, err_size, "no device, set one with dest=ADDR");
+        return -1;
+    }
+
+    strcpy(l->addr, dest);
+    return l->n ? 0 : 1;
+}
+
+static void print_value(struct script_req_t* r, const struct cari_result_t* f)
+{
+    r->value[0] = 0;
+
+    if(r->p.err != ERR_OK || f->payload_len < 1)
+        return;
+
+    switch(f->cid)
+    {
+        case CMD_DEV_GET_IDENT:
+        {
+            //escaped later, keep it short enough
+            size_t len = strnlen((const char*)f->payload, f->payload_len);
+            if(len > sizeof(r->value)-1)
+                len = sizeof(r->value)-1;
+            memcpy(r->value, f->payload, len);
+            r->value[len] = 0;
+            break;
+        }
+
+        case CMD_DEV_GET_REG:
+            snprintf(r->value, sizeof(r->value), "%u", f->payload[0]);
+            break;
+
+        case CMD_SUB_GET_PARAM:
+        {
+            struct re_config_t c;
+            config_init(&c);
+            config_note_param(&c, f->payload, f->payload_len);
+
+            switch(f->payload[0])
+            {
+                case PARAM_RX_FREQ:      snprintf(r->value, sizeof(r->value), "%lu", c.rx_freq); break;
+                case PARAM_TX_FREQ:      snprintf(r->value, sizeof(r->value), "%lu", c.tx_freq); break;
+                case PARAM_RX_FREQ_CORR: snprintf(r->value, sizeof(r->value), "%g", c.rx_freq_corr); break;
+                case PARAM_TX_FREQ_CORR: snprintf(r->value, sizeof(r->value), "%g", c.tx_freq_corr); break;
+                case PARAM_AFC:          snprintf(r->value, sizeof(r->value), "%d", c.afc); break;
+                case PARAM_TX_PWR:       snprintf(r->value, sizeof(r->value), "%g", c.tx_pwr); break;
+            }
+            break;
+        }
+    }
+}
+
+//one JSON object per line
+static void report_line(struct script_t* s, struct script_dev_t* d, uint32_t first, uint32_t last)
+{
+    struct script_req_t* r0 = &d->q[first % SCRIPT_DEPTH];
+    uint8_t ok = 1;
+
+    for(uint32_t i=first; i<=last; i++)
+        ok &= (d->q[i % SCRIPT_DEPTH].p.err == ERR_OK);
+
+    fprintf(s->out, "{\"line\":%u,\"dev\":", r0->line);
+    json_str(s->out, d->addr, sizeof(d->addr));
+    fprintf(s->out, ",\"ok\":%s,\"ms\":%.3f,\"results\":[", ok ? "true" : "false", now_ms() - r0->t_line);
+
+    for(uint32_t i=first; i<=last; i++)
+    {
+        struct script_req_t* r = &d->q[i % SCRIPT_DEPTH];
+
+        fprintf(s->out, "%s{\"req\":", i > first ? "," : "");
+        json_str(s->out, r->p.desc, sizeof(r->p.desc));
+        fprintf(s->out, ",\"status\":");
+        if(r->p.err >= 0)
+            json_str(s->out, cari_err_name(r->p.err), 32);
+        else
+            json_str(s->out, r->p.err == CARI_NO_REPLY ? "no response" : "malformed", 32);
+        if(r->value[0])
+        {
+            fprintf(s->out, ",\"value\":");
+            json_str(s->out, r->value, sizeof(r->value));
+        }
+        fprintf(s->out, "}");
+    }
+    fprintf(s->out, "]}\n");
+
+    s->lines++;
+    s->failed_lines += !ok;
+}
+
+//report and drop every finished line at the head of the queue
+static void retire(struct script_t* s, struct script_dev_t* d)
+{
+    while(d->head != d->tail)
+    {
+        uint32_t end = d->head;
+
+        while(!d->q[end % SCRIPT_DEPTH].last)
+            end++;
+        for(uint32_t i=d->head; i<=end; i++)
+            if(!d->q[i % SCRIPT_DEPTH].p.done)
+                return;
+
+        report_line(s, d, d->head, end);
+        d->head = end + 1;
+    }
+}
+
+static void on_done(const struct cari_result_t* res)
+{
+    struct script_req_t* r = res->arg;
+
+    r->p.done = 1;
+    r->p.err = res->err;
+    r->p.rtt = res->rtt;
+    r->p.attempts = res->attempts;
+    print_value(r, res);
+}
+
+static int enqueue(struct script_t* s, struct script_line_t* l)
+{
+    struct script_dev_t* d = get_dev(s, l->addr);
+
+    if(d == NULL || SCRIPT_DEPTH - (d->tail - d->head) < l->n)
+        return -1;
+
+    for(uint8_t i=0; i<l->n; i++)
+    {
+        struct script_req_t* r = &d->q[d->tail++ % SCRIPT_DEPTH];
+
+        r->p = l->req[i];
+        r->line = l->num;
+        r->last = (i == l->n-1);
+        r->t_line = l->t;
+        r->value[0] = 0;
+
+        if(d->cd == NULL || cari_submit(d->cd, r->p.req, r->p.len, on_done, r) == 0)
+        {
+            r->p.done = 1;
+            r->p.err = CARI_NO_REPLY;
+        }
+    }
+
+    s->reqs += l->n;
+    retire(s, d);
+    return 0;
+}
+
+int script_run(void* zmq_ctx, const char* path, const char* dest, const struct option* opts)
+{
+    struct script_t s = {.last = -1};
+    struct script_line_t line;
+    char target[128] = {0};
+    char* buf = malloc(SCRIPT_BUF);
+    size_t fill = 0;
+    uint32_t num = 0;
+    uint8_t eof = 0, stalled = 0;
+    uint8_t skip = 0;           //dropping the rest of an overlong line
+    int timeout, retries;
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+
+    if(fd < 0 || buf == NULL)
+    {
+        dbg_print(TERM_RED, "Can not open script %s\n", path);
+        free(buf);
+        return 1;
+    }
+
+    s.c = cari_new(zmq_ctx);
+    if(s.c == NULL || (link_get_via() != NULL && cari_set_via(s.c, link_get_via()) != 0))
+    {
+        dbg_print(TERM_RED, "Can not set up the control channel\n");
+        cari_free(s.c);
+        free(buf);
+        return 1;
+    }
+    link_get_timeout(&timeout, &retries);
+    cari_set_timeout(s.c, timeout, retries);
+    cari_set_window(s.c, SCRIPT_DEPTH);
+    if(dest != NULL)
+        snprintf(target, sizeof(target), "%s", dest);
+
+    //stdout carries the results only, everything else goes to stderr
+    s.out = ctrl_take_stdout();
+    if(s.out == NULL)
+    {
+        cari_free(s.c);
+        free(buf);
+        if(fd != STDIN_FILENO)
+            close(fd);
+        return 1;
+    }
+
+    double t0 = now_ms();
+
+    while(!eof || stalled || s.ndev > 0)
+    {
+        //feed complete lines until a device queue is full
+        while(!stalled)
+        {
+            char* nl = memchr(buf, '\n', fill);
+            char err[96];
+
+            if(skip)
+            {
+                size_t len = nl ? (size_t)(nl - buf) + 1 : fill;
+                memmove(buf, buf + len, fill - len);
+                fill -= len;
+                skip = (nl == NULL);
+                if(skip)
+                    break;
+                continue;
+            }
+
+            if(nl == NULL && !(eof && fill > 0))
+            {
+                if(fill == SCRIPT_BUF) //overlong line, skip it up to its end
+                {
+                    fprintf(s.out, "{\"line\":%u,\"ok\":false,\"error\":\"line too long\"}\n", ++num);
+                    s.lines++;
+                    s.failed_lines++;
+                    fill = 0;
+                    skip = 1;
+                }
+                break;
+            }
+
+            size_t len = nl ? (size_t)(nl - buf) + 1 : fill;
+            char text[SCRIPT_BUF+1];
+            memcpy(text, buf, len);
+            text[len] = 0;
+            memmove(buf, buf + len, fill - len);
+            fill -= len;
+            num++;
+
+            char* hash = strchr(text, '#'); //strip comments
+            if(hash != NULL)
+                *hash = 0;
+
+            line.num = num;
+            line.t = now_ms();
+            int ret = parse_line(text, &line, target, opts, err, sizeof(err));
+            if(ret < 0)
+            {
+                fprintf(s.out, "{\"line\":%u,\"ok\":false,\"error\":", num);
+                json_str(s.out, err, sizeof(err));
+                fprintf(s.out, "}\n");
+                s.lines++;
+                s.failed_lines++;
+            }
+            else if(ret == 0 && enqueue(&s, &line) != 0)
+                stalled = 1;
+        }
+
+        //send what was queued, collect the replies, report finished lines
+        cari_process(s.c);
+
+        int busy = 0;
+        for(int i=0; i<s.ndev; i++)
+        {
+            struct script_dev_t* d = s.dev[i];
+            if(d->head == d->tail)
+                continue;
+            retire(&s, d);
+            busy += (d->head != d->tail);
+        }
+        fflush(s.out);
+
+        if(stalled && enqueue(&s, &line) == 0)
+        {
+            stalled = 0;
+            continue;
+        }
+        if(eof && !stalled && busy == 0)
+            break;
+
+        //wait for the input and the devices, or the nearest deadline
+        zmq_pollitem_t items[2] = {{NULL, cari_fd(s.c), ZMQ_POLLIN, 0}, {NULL, fd, ZMQ_POLLIN, 0}};
+        uint8_t reading = (!eof && !stalled);
+
+        if(zmq_poll(items, 1 + reading, cari_timeout(s.c)) < 0 && zmq_errno() != EINTR)
+            break;
+
+        //a pipe at its end only reports the hangup
+        if(reading && (items[1].revents & (ZMQ_POLLIN|ZMQ_POLLERR)))
+        {
+            ssize_t n = read(fd, buf + fill, SCRIPT_BUF - fill);
+            if(n <= 0)
+                eof = 1;
+            else
+                fill += n;
+        }
+    }
+
+    double elapsed = (now_ms() - t0)/1e3;
+    fflush(s.out);
+    dbg_print(0, "Script: %lu line(s), %lu request(s) to %d device(s) in %.3f s (%.0f req/s), %lu failed\n",
+        s.lines, s.reqs, s.ndev, elapsed, elapsed > 0 ? s.reqs/elapsed : 0, s.failed_lines);
+
+    cari_free(s.c);
+    for(int i=0; i<s.ndev; i++)
+        free(s.dev[i]);
+    free(s.dev);
+    free(buf);
+    if(fd != STDIN_FILENO)
+        close(fd);
+    fclose(s.out);
+
+    return s.failed_lines ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+/*
+ * script.h
+ *
+ *  Streaming batch mode
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <getopt.h>
+
+#include "ctrl.h"
+
+#define SCRIPT_DEPTH    64      //requests in flight per device
+
+int script_run(void* zmq_ctx, const char* path, const char* dest, const struct option* opts);
@@ -0,0 +1,193 @@
+/*
+ * spectrum.c
+ *
+ *  Averaged power spectrum of the RX baseband
+ *
+ *  Samples are converted to complex float (without DC removal, a carrier on
+ *  the center frequency has to stay visible) and collected into blocks of the
+ *  FFT size, overlapping by half. Every block is weighted with a 4-term
+ *  Blackman-Harris window, which keeps the leakage of a strong carrier far
+ *  below the noise floor, transformed and its power added up per bin. A
+ *  report turns the average into the channel power around the center, the
+ *  noise floor (the median bin, robust against carriers) and the strongest
+ *  bin, refined by parabolic interpolation, as an offset from the center.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "dsp.h"
+#include "fft.h"
+#include "spectrum.h"
+
+#define DB(x)   (10.0*log10((x) > 1e-30 ? (x) : 1e-30))
+
+int spectrum_init(struct spectrum_t* s, const struct spectrum_opts_t* opts, int kernel)
+{
+    uint32_t n = opts->fft;
+
+    memset(s, 0, sizeof(struct spectrum_t));
+    s->opts = opts;
+
+    if(fft_init(&s->plan, n, kernel) != 0)
+        return -1;
+    s->kernel = s->plan.kernel;
+
+    s->win = malloc(n*sizeof(float));
+    s->block = malloc(2*n*sizeof(float));
+    s->x = malloc(2*n*sizeof(float));
+    s->acc = calloc(n, sizeof(float));
+    s->sorted = malloc(n*sizeof(float));
+    if(s->win == NULL || s->block == NULL || s->x == NULL || s->acc == NULL || s->sorted == NULL)
+    {
+        spectrum_free(s);
+        return -1;
+    }
+
+    for(uint32_t i=0; i<n; i++)
+    {
+        double a = 2*M_PI*i/n;
+        s->win[i] = 0.35875 - 0.48829*cos(a) + 0.14128*cos(2*a) - 0.01168*cos(3*a);
+        s->wsum += s->win[i];
+        s->wsum2 += s->win[i]*s->win[i];
+    }
+
+    return 0;
+}
+
+void spectrum_free(struct spectrum_t* s)
+{
+    fft_free(&s->plan);
+    free(s->win);
+    free(s->block);
+    free(s->x);
+    free(s->acc);
+    free(s->sorted);
+    s->win = s->block = s->x = s->acc = s->sorted = NULL;
+}
+
+static void process_block(struct spectrum_t* s)
+{
+    uint32_t n = s->plan.n;
+
+    for(uint32_t i=0; i<n; i++)
+    {
+        s->x[2*i] = s->block[2*i] * s->win[i];
+        s->x[2*i+1] = s->block[2*i+1] * s->win[i];
+    }
+
+    const float* y = fft_run(&s->plan, s->x);
+
+    for(uint32_t i=0; i<n; i++)
+        s->acc[i] += y[2*i]*y[2*i] + y[2*i+1]*y[2*i+1];
+    s->frames++;
+}
+
+void spectrum_feed(struct spectrum_t* s, const int16_t* in, size_t n)
+{
+    dsp_convert_fn convert = dsp_convert_kernel(s->kernel);
+    const float dc[2] = {0, 0};
+    uint32_t size = s->plan.n;
+    float sum[2];
+
+    while(n > 0)
+    {
+        size_t k = (n < size - s->fill) ? n : size - s->fill;
+
+        convert(in, &s->block[2*s->fill], k, 1.0f/32768.0f, dc, sum);
+        s->fill += k;
+        in += 2*k;
+        n -= k;
+
+        if(s->fill == size)
+        {
+            process_block(s);
+
+            //half of the block is the start of the next one
+            memcpy(s->block, &s->block[size], size*sizeof(float));
+            s->fill = size/2;
+        }
+    }
+}
+
+static int cmp_float(const void* a, const void* b)
+{
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+void spectrum_report(struct spectrum_t* s, double secs)
+{
+    const struct spectrum_opts_t* o = s->opts;
+    uint32_t n = s->plan.n;
+
+    dbg_print(0, "%.1f s: ", secs);
+    if(s->frames == 0)
+    {
+        dbg_print(TERM_YELLOW, "no baseband\n");
+        return;
+    }
+
+    //power per bin relative to a full scale complex sine
+    double norm = 1.0 / ((double)s->frames * n * s->wsum2);
+    double total = 0, chan = 0;
+    uint32_t nchan = 0, peak = 0;
+
+    for(uint32_t i=0; i<n; i++)
+    {
+        int32_t k = (i < n/2) ? (int32_t)i : (int32_t)i - (int32_t)n;
+        double p = s->acc[i] * norm;
+
+        s->sorted[i] = p;
+        total += p;
+        if(o->rate <= 0 || fabs(k*o->rate/n) <= o->chan_bw/2)
+        {
+            chan += p;
+            nchan++;
+        }
+        if(s->acc[i] > s->acc[peak])
+            peak = i;
+    }
+
+    qsort(s->sorted, n, sizeof(float), cmp_float);
+    double floor = s->sorted[n/2];
+
+    //parabola through the peak and its neighbours, on the dB scale
+    double l = DB(s->acc[(peak+n-1)%n]), c = DB(s->acc[peak]), r = DB(s->acc[(peak+1)%n]);
+    double den = l - 2*c + r;
+    double delta = (den < 0) ? 0.5*(l - r)/den : 0;
+    double bin = peak + delta;
+    if(bin >= n/2.0)
+        bin -= n;
+
+    //a sine centered on a bin shows up with the window gain instead of its noise bandwidth
+    double tone = s->acc[peak] / ((double)s->frames * s->wsum * s->wsum);
+
+    if(o->rate > 0)
+        dbg_print(0, "channel %.1f dBFS/%.1f kHz", DB(chan), o->chan_bw/1e3);
+    else
+        dbg_print(0, "total %.1f dBFS", DB(total));
+    dbg_print(0, ", C/N %.1f dB, floor %.1f dBFS/%s", DB(chan) - DB(floor*nchan),
+        o->rate > 0 ? DB(floor*n/o->rate) : DB(floor), o->rate > 0 ? "Hz" : "bin");
+
+    dbg_print(0, ", peak %.1f dBFS at ", DB(tone));
+    if(o->rate > 0)
+    {
+        double hz = bin*o->rate/n;
+        dbg_print(TERM_GREEN, "%+.1f Hz", hz);
+        if(o->freq > 0)
+            dbg_print(TERM_GREEN, " (%+.3f ppm)", hz/o->freq*1e6);
+    }
+    else
+        dbg_print(TERM_GREEN, "%+.5f fs", bin/n);
+    dbg_print(0, ", %lu FFT(s)\n", s->frames);
+
+    memset(s->acc, 0, n*sizeof(float));
+    s->frames = 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * spectrum.h
+ *
+ *  Averaged power spectrum of the RX baseband
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fft.h"
+
+#define SPECTRUM_FFT        4096    //default FFT size
+#define SPECTRUM_CHAN_BW    12500.0 //default channel bandwidth in Hz
+
+struct spectrum_opts_t
+{
+    double interval;            //s between reports, 0 - off
+    uint32_t fft;               //FFT size
+    double chan_bw;             //Hz, power is integrated over this band around the center
+    double rate;                //S/s, 0 - unknown, offsets are given as a fraction of it
+    uint64_t freq;              //center frequency in Hz, 0 - unknown, no ppm
+};
+
+struct spectrum_t
+{
+    const struct spectrum_opts_t* opts;
+    struct fft_plan_t plan;
+    int kernel;
+    float* win;                 //window, n
+    float wsum, wsum2;          //sum of the window and of its squares
+    float* block;               //last n samples, interleaved complex
+    uint32_t fill;              //complex samples in block
+    float* x;                   //windowed FFT input
+    float* acc;                 //summed power per bin
+    uint64_t frames;            //FFTs in acc
+    float* sorted;              //scratch for the noise floor
+};
+
+int spectrum_init(struct spectrum_t* s, const struct spectrum_opts_t* opts, int kernel);
+void spectrum_free(struct spectrum_t* s);
+
+//n complex int16 samples
+void spectrum_feed(struct spectrum_t* s, const int16_t* in, size_t n);
+
+//print the averaged measurements and start averaging again
+void spectrum_report(struct spectrum_t* s, double secs);
@@ -0,0 +1,112 @@
+/*
+ * spsc_ring.h
+ *
+ *  Lock-free single producer, single consumer ring of fixed size slots
+ *
+ *  The producer fills the slot returned by spsc_reserve() in place and
+ *  publishes it with spsc_commit(), the consumer reads spsc_peek() and hands
+ *  the slot back with spsc_release(). Both sides keep a cached copy of the
+ *  other side's index, so the shared cache lines are only touched when the
+ *  ring looks full (or empty).
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#define SPSC_CACHE_LINE 64
+
+struct spsc_ring_t
+{
+    _Alignas(SPSC_CACHE_LINE) atomic_uint_fast32_t head;   //next slot to fill, written by the producer
+    uint32_t tail_cache;                                    //producer's view of tail
+
+    _Alignas(SPSC_CACHE_LINE) atomic_uint_fast32_t tail;   //next slot to drain, written by the consumer
+    uint32_t head_cache;                                    //consumer's view of head
+
+    _Alignas(SPSC_CACHE_LINE) uint32_t mask;
+    size_t slot_size;
+    uint8_t* slots;
+};
+
+//size is rounded up to a power of two, returns 0 on success
+static inline int spsc_init(struct spsc_ring_t* r, uint32_t size, size_t slot_size)
+{
+    uint32_t n = 1;
+    while(n < size)
+        n <<= 1;
+
+    slot_size = (slot_size + SPSC_CACHE_LINE-1) & ~(size_t)(SPSC_CACHE_LINE-1);
+    if(posix_memalign((void**)&r->slots, SPSC_CACHE_LINE, (size_t)n*slot_size) != 0)
+        return -1;
+
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->tail_cache = 0;
+    r->head_cache = 0;
+    r->mask = n-1;
+    r->slot_size = slot_size;
+
+    return 0;
+}
+
+static inline void spsc_free(struct spsc_ring_t* r)
+{
+    free(r->slots);
+    r->slots = NULL;
+}
+
+static inline uint32_t spsc_capacity(const struct spsc_ring_t* r)
+{
+    return r->mask+1;
+}
+
+//producer: free slot to fill or NULL if the ring is full
+static inline void* spsc_reserve(struct spsc_ring_t* r)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if(head - r->tail_cache > r->mask)
+    {
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if(head - r->tail_cache > r->mask)
+            return NULL;
+    }
+
+    return &r->slots[(head & r->mask)*r->slot_size];
+}
+
+//producer: publish the reserved slot
+static inline void spsc_commit(struct spsc_ring_t* r)
+{
+    atomic_store_explicit(&r->head, atomic_load_explicit(&r->head, memory_order_relaxed) + 1, memory_order_release);
+}
+
+//filled slots, exact from either side, approximate from anywhere else
+static inline uint32_t spsc_count(struct spsc_ring_t* r)
+{
+    return atomic_load_explicit(&r->head, memory_order_acquire) - atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+//consumer: oldest filled slot or NULL if the ring is empty
+static inline void* spsc_peek(struct spsc_ring_t* r)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    if(tail == r->head_cache)
+    {
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        if(tail == r->head_cache)
+            return NULL;
+    }
+
+    return &r->slots[(tail & r->mask)*r->slot_size];
+}
+
+//consumer: hand the peeked slot back to the producer
+static inline void spsc_release(struct spsc_ring_t* r)
+{
+    atomic_store_explicit(&r->tail, atomic_load_explicit(&r->tail, memory_order_relaxed) + 1, memory_order_release);
+}
@@ -0,0 +1,388 @@
+/*
+ * spvn.c
+ *
+ *  Supervision telemetry consumer
+ *
+ *  Every device is asked for its variable list once, then the stream is
+ *  started and the samples pushed on the control connection are decoded into
+ *  fixed per-variable rings. Min/max/mean cover the summary interval, the
+ *  percentiles the last SPVN_WINDOW samples. Nothing is allocated per sample.
+ */
+
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <signal.h>
+
+#include "interface_cmds.h"
+#include "cari_codec.h"
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "ctrl.h"
+#include "fleet.h"
+#include "spvn.h"
+#include "metrics.h"
+
+enum spvn_state_t
+{
+    SPVN_LIST,                  //waiting for the variable list
+    SPVN_START,                 //waiting for the stream start confirmation
+    SPVN_STREAM,
+    SPVN_FAILED
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+//k-th smallest element, reorders a
+static float select_kth(float* a, uint32_t n, uint32_t k)
+{
+    uint32_t lo = 0, hi = n-1;
+
+    while(lo < hi)
+    {
+        float pivot = a[(lo+hi)/2];
+        uint32_t i = lo, j = hi;
+
+        while(i <= j)
+        {
+            while(a[i] < pivot)
+                i++;
+            while(a[j] > pivot)
+                j--;
+            if(i <= j)
+            {
+                float t = a[i];
+                a[i] = a[j];
+                a[j] = t;
+                i++;
+                if(j == 0)
+                    break;
+                j--;
+            }
+        }
+
+        if(k <= j)
+            hi = j;
+        else if(k >= i)
+            lo = i;
+        else
+            break;
+    }
+
+    return a[k];
+}
+
+static int send_request(struct spvn_dev_t* dev, uint8_t cid, const uint8_t* pld, uint16_t len)
+{
+    uint8_t frame[8];
+    size_t flen = cari_encode(frame, sizeof(frame), cid, pld, len);
+
+    return link_send(&dev->link, frame, flen);
+}
+
+static void request_state(struct spvn_dev_t* dev)
+{
+    uint8_t on = 1;
+
+    dev->deadline = now_ms() + link_attempt_timeout(&dev->link, dev->attempt);
+    if(dev->state == SPVN_LIST)
+        send_request(dev, CMD_DEV_GET_SPVN_LIST, NULL, 0);
+    else
+        send_request(dev, CMD_DEV_START_SPVN_STREAM, &on, 1);
+}
+
+static void fail(struct spvn_dev_t* dev, const char* fmt, const char* detail)
+{
+    dbg_print(0, "%s ", dev->addr);
+    dbg_print(TERM_RED, fmt, detail);
+    dbg_print(0, "\n");
+    dev->state = SPVN_FAILED;
+}
+
+static void on_list(struct spvn_dev_t* dev, const struct cari_frame_t* f)
+{
+    struct cari_spvn_info_t info[SPVN_MAX_VARS];
+    int n = cari_dec_spvn_list(f, info, SPVN_MAX_VARS);
+
+    if(n <= 0)
+    {
+        fail(dev, "%s", n ? "malformed supervision list" : "no supervision variables");
+        return;
+    }
+
+    dev->vars = calloc(n, sizeof(struct spvn_var_t));
+    if(dev->vars == NULL)
+    {
+        fail(dev, "%s", "out of memory");
+        return;
+    }
+
+    for(int i=0; i<n; i++)
+    {
+        dev->vars[i].info = info[i];
+        dev->types[info[i].id] = info[i].type;
+        dev->index[info[i].id] = i;
+    }
+    dev->nvars = n;
+
+    dev->state = SPVN_START;
+    dev->attempt = 0;
+    request_state(dev);
+}
+
+static void on_samples(struct spvn_dev_t* dev, const struct cari_frame_t* f)
+{
+    struct cari_spvn_iter_t it;
+    uint8_t id;
+    float val;
+    int ret;
+
+    if(dev->nvars == 0 || cari_spvn_begin(f, &it) != CARI_DEC_OK)
+    {
+        dev->bad++;
+        metrics_stream_drop(METRICS_SPVN, 1);
+        return;
+    }
+
+    while((ret = cari_spvn_next(&it, dev->types, &id, &val)) > 0)
+    {
+        struct spvn_var_t* v = &dev->vars[dev->index[id]];
+
+        v->ring[v->total++ % SPVN_WINDOW] = val;
+        v->last = val;
+        if(v->n == 0 || val < v->min)
+            v->min = val;
+        if(v->n == 0 || val > v->max)
+            v->max = val;
+        v->sum += val;
+        v->n++;
+    }
+
+    if(ret < 0)
+    {
+        dev->bad++;
+        metrics_stream_drop(METRICS_SPVN, 1);
+    }
+    dev->frames++;
+    metrics_stream(METRICS_SPVN, 1, f->len);
+}
+
+static void on_frame(struct spvn_dev_t* dev, const uint8_t* buf, size_t len)
+{
+    struct cari_frame_t f;
+
+    if(cari_decode(buf, len, &f) != CARI_DEC_OK)
+    {
+        dev->bad++;
+        return;
+    }
+
+    //stream frames are never a single byte, the start status is
+    if(f.cid == CMD_DEV_START_SPVN_STREAM && f.payload_len > 1)
+    {
+        on_samples(dev, &f);
+        return;
+    }
+
+    if(dev->state == SPVN_LIST && cari_decode_reply(CMD_DEV_GET_SPVN_LIST, buf, len, &f) == CARI_DEC_OK)
+    {
+        if(f.err != ERR_OK)
+            fail(dev, "supervision list: %s", cari_err_name(f.err));
+        else
+            on_list(dev, &f);
+        return;
+    }
+
+    if(dev->state == SPVN_START && cari_decode_reply(CMD_DEV_START_SPVN_STREAM, buf, len, &f) == CARI_DEC_OK)
+    {
+        if(f.err != ERR_OK)
+        {
+            fail(dev, "supervision stream start: %s", cari_err_name(f.err));
+            return;
+        }
+
+        dev->state = SPVN_STREAM;
+        dbg_print(0, "%s ", dev->addr);
+        dbg_print(TERM_GREEN, "streaming");
+        dbg_print(0, " %u variable(s):", dev->nvars);
+        for(uint8_t i=0; i<dev->nvars; i++)
+            dbg_print(0, " %s", dev->vars[i].info.name);
+        dbg_print(0, "\n");
+        return;
+    }
+
+    dev->bad++;
+}
+
+static void print_summary(struct spvn_dev_t* devs, int n, double t, double interval)
+{
+    static float scratch[SPVN_WINDOW];
+
+    dbg_print(0, "--- %.1f s\n", t);
+    for(int i=0; i<n; i++)
+    {
+        struct spvn_dev_t* dev = &devs[i];
+
+        if(dev->state != SPVN_STREAM)
+            continue;
+
+        for(uint8_t k=0; k<dev->nvars; k++)
+        {
+            struct spvn_var_t* v = &dev->vars[k];
+            uint32_t w = (v->total < SPVN_WINDOW) ? v->total : SPVN_WINDOW;
+
+            dbg_print(0, "%s %-16s ", dev->addr, v->info.name);
+            if(v->n == 0)
+            {
+                dbg_print(TERM_YELLOW, "no samples\n");
+                continue;
+            }
+
+            memcpy(scratch, v->ring, w*sizeof(float));
+            float p50 = select_kth(scratch, w, w/2);
+            float p99 = select_kth(scratch, w, (uint32_t)(w*0.99));
+
+            dbg_print(0, "last %.3f  min %.3f  mean %.3f  max %.3f  p50 %.3f  p99 %.3f  (%lu, %.1f/s)\n",
+                v->last, v->min, v->sum/v->n, v->max, p50, p99, v->n, v->n/interval);
+
+            v->n = 0;
+            v->sum = 0;
+        }
+
+        if(dev->bad)
+        {
+            dbg_print(TERM_YELLOW, "%s %lu malformed frame(s)\n", dev->addr, dev->bad);
+            dev->bad = 0;
+        }
+    }
+}
+
+int spvn_run(struct fleet_t* fleet, void* zmq_ctx, const struct spvn_opts_t* opts)
+{
+    struct spvn_dev_t* devs = calloc(fleet->n, sizeof(struct spvn_dev_t));
+    zmq_pollitem_t* items = calloc(fleet->n, sizeof(zmq_pollitem_t));
+    int failed = 0;
+
+    if(devs == NULL || items == NULL)
+    {
+        free(devs);
+        free(items);
+        return fleet->n;
+    }
+
+    zmq_ctx_set(zmq_ctx, ZMQ_MAX_SOCKETS, fleet->n + 64);
+
+    for(int i=0; i<fleet->n; i++)
+    {
+        struct spvn_dev_t* dev = &devs[i];
+
+        dev->addr = fleet->dev[i].cfg.re_addr;
+        memset(dev->types, CARI_SPVN_NONE, sizeof(dev->types));
+
+        if(link_open(&dev->link, zmq_ctx, dev->addr) != 0)
+        {
+            fail(dev, "connection failed: %s", zmq_strerror(zmq_errno()));
+            items[i].fd = -1;
+            continue;
+        }
+
+        items[i].socket = dev->link.sock;
+        items[i].events = ZMQ_POLLIN;
+        request_state(dev);
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    double t0 = now_ms();
+    double t_last = t0;
+
+    while(running)
+    {
+        double now = now_ms();
+
+        if(opts->duration > 0 && now - t0 >= opts->duration*1e3)
+            break;
+
+        if(now - t_last >= opts->interval*1e3)
+        {
+            print_summary(devs, fleet->n, (now-t0)/1e3, (now-t_last)/1e3);
+            t_last = now;
+        }
+
+        //list and start requests are retried over a fresh connection
+        for(int i=0; i<fleet->n; i++)
+        {
+            struct spvn_dev_t* dev = &devs[i];
+
+            if(dev->state > SPVN_START || now < dev->deadline)
+                continue;
+
+            if(dev->attempt >= dev->link.retries)
+            {
+                fail(dev, "%s", "no reply, giving up");
+                link_close(&dev->link);
+                items[i].socket = NULL;
+                items[i].fd = -1;
+                continue;
+            }
+
+            dev->attempt++;
+            link_reopen(&dev->link);
+            items[i].socket = dev->link.sock;
+            items[i].fd = -1;
+            if(dev->link.sock != NULL)
+                request_state(dev);
+            else
+                dev->deadline = now + link_attempt_timeout(&dev->link, dev->attempt);
+        }
+
+        if(zmq_poll(items, fleet->n, 100) <= 0)
+            continue;
+
+        for(int i=0; i<fleet->n; i++)
+        {
+            zmq_msg_t msg;
+
+            if(!(items[i].revents & ZMQ_POLLIN))
+                continue;
+
+            while(link_recv_msg(&devs[i].link, &msg, ZMQ_DONTWAIT) >= 0)
+            {
+                on_frame(&devs[i], zmq_msg_data(&msg), zmq_msg_size(&msg));
+                zmq_msg_close(&msg);
+            }
+        }
+    }
+
+    double now = now_ms();
+    if(now - t_last > 1)
+        print_summary(devs, fleet->n, (now-t0)/1e3, (now-t_last)/1e3);
+
+    //stop the streams, best effort
+    for(int i=0; i<fleet->n; i++)
+    {
+        uint8_t off = 0;
+
+        if(devs[i].state == SPVN_FAILED)
+            failed++;
+        else if(devs[i].state == SPVN_STREAM)
+            send_request(&devs[i], CMD_DEV_START_SPVN_STREAM, &off, 1);
+
+        link_close(&devs[i].link);
+        free(devs[i].vars);
+    }
+
+    free(devs);
+    free(items);
+    return failed;
+}
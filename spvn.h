@@ -0,0 +1,50 @@
+/*
+ * spvn.h
+ *
+ *  Supervision telemetry consumer
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "cari_codec.h"
+#include "ctrl.h"
+#include "fleet.h"
+
+#define SPVN_WINDOW     512     //latest samples kept per variable, for the percentiles
+#define SPVN_MAX_VARS   32
+
+struct spvn_var_t
+{
+    struct cari_spvn_info_t info;
+    float ring[SPVN_WINDOW];
+    uint64_t total;             //samples ever received, the ring index is total % SPVN_WINDOW
+    float last;
+    //current summary interval
+    uint64_t n;
+    float min, max;
+    double sum;
+};
+
+struct spvn_dev_t
+{
+    const char* addr;
+    struct link_t link;
+    uint8_t state;              //spvn_state_t
+    uint8_t attempt;
+    double deadline;            //ms, for the list and start requests
+    uint8_t types[256];         //variable id -> type, CARI_SPVN_NONE if not on the list
+    uint8_t index[256];         //variable id -> vars[] index
+    struct spvn_var_t* vars;
+    uint8_t nvars;
+    uint64_t frames, bad;
+};
+
+struct spvn_opts_t
+{
+    double interval;            //s between summaries
+    double duration;            //s, 0 - until interrupted
+};
+
+int spvn_run(struct fleet_t* fleet, void* zmq_ctx, const struct spvn_opts_t* opts);
@@ -0,0 +1,469 @@
+/*
+ * watch.c
+ *
+ *  Heartbeat watchdog restoring the configuration of rebooted devices
+ *
+ *  Every device gets a PING beat per interval, one in flight at a time, with
+ *  a reply deadline following its measured round trip time (as the TCP
+ *  retransmission timeout, srtt + 4*rttvar), so a lost beat is noticed within
+ *  milliseconds instead of after the interval. After a miss the beats come
+ *  WATCH_FAST times as often until the device answers again or has missed
+ *  the configured number in a row and is declared down. A down device keeps
+ *  being probed, backing off from the fast rate to the interval. The first
+ *  reply after an outage (and the first one at all) triggers the whole
+ *  configuration, SUB_CONN included, in one pipelined burst; the device is up
+ *  once all of it is acknowledged.
+ *
+ *  Every transition is written to stdout as a JSON line with its timing, the
+ *  detection time (last reply to being declared down) and the restore time
+ *  (first reply to the configuration acknowledged) are summarized on exit.
+ */
+
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+
+#include "interface_cmds.h"
+#include "cari_codec.h"
+#include "term.h" //colored terminal font
+#include "dbg.h"
+#include "log.h"
+#include "ctrl.h"
+#include "cari.h"
+#include "fleet.h"
+#include "histogram.h"
+#include "watch.h"
+
+enum watch_state_t
+{
+    WATCH_UNKNOWN,              //not answered yet
+    WATCH_UP,
+    WATCH_DOWN,
+    WATCH_RESTORE               //configuration sent, waiting for the acknowledgements
+};
+
+struct watch_t
+{
+    const struct watch_opts_t* opts;
+    struct fleet_t* fleet;
+    struct watch_dev_t* devs;
+    int timeout, retries;       //first beat deadline, configuration retries
+    double t0;
+    FILE* out;                  //events, the original stdout
+    uint8_t ping[8];
+    uint16_t ping_len;
+    struct hist_t detect, restore, outage, rtt; //us
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+//device of the log records, the address goes as text, it can be longer than LOG_STR
+static uint32_t log_dev(const struct watch_dev_t* dev)
+{
+    return (dev->cd != NULL) ? (uint32_t)cari_dev_mdev(dev->cd) : LOG_NO_DEV;
+}
+
+static void on_beat(const struct cari_result_t* r);
+static void on_restore(const struct cari_result_t* r);
+static void restore_done(struct watch_dev_t* dev, double now);
+
+//beat reply deadline from the round trip times seen so far
+static int beat_timeout(const struct watch_dev_t* dev)
+{
+    const struct watch_t* w = dev->w;
+    double rto = (dev->srtt < 0) ? w->timeout : dev->srtt + 4*dev->rttvar + 1;
+
+    if(rto > w->opts->interval/2)
+        rto = w->opts->interval/2;
+    return (rto < WATCH_MIN_RTO) ? WATCH_MIN_RTO : (int)rto;
+}
+
+static void send_beat(struct watch_dev_t* dev, double now)
+{
+    cari_dev_set_timeout(dev->cd, beat_timeout(dev), 0);
+    if(cari_submit(dev->cd, dev->w->ping, dev->w->ping_len, on_beat, dev) == 0)
+    {
+        dev->next_beat = now + dev->w->opts->interval;
+        return;
+    }
+
+    dev->beat_out = 1;
+    dev->t_beat = now;
+    dev->beats++;
+}
+
+//one JSON line per transition, on stdout
+static void event(struct watch_dev_t* dev, double now, const char* name, const char* fmt, ...)
+{
+    FILE* out = dev->w->out;
+    va_list ap;
+
+    fprintf(out, "{\"t\":%.3f,\"dev\":\"%s\",\"event\":\"%s\"", (now - dev->w->t0)/1e3, dev->cfg->re_addr, name);
+    if(fmt != NULL)
+    {
+        va_start(ap, fmt);
+        vfprintf(out, fmt, ap);
+        va_end(ap);
+    }
+    fprintf(out, "}\n");
+    fflush(out);
+}
+
+static void go_down(struct watch_dev_t* dev, double now)
+{
+    struct watch_t* w = dev->w;
+    double detect = now - dev->t_ok;
+
+    dev->state = WATCH_DOWN;
+    dev->t_down = now;
+    dev->outages++;
+    hist_add(&w->detect, detect*1e3);
+
+    dbg_print_dev(log_dev(dev), 0, "%s ", dev->cfg->re_addr);
+    LOG_DEV(log_dev(dev), TERM_RED, "down");
+    LOG_DEV(log_dev(dev), 0, ", %d beat(s) missed, detected %.0f ms after the last reply", dev->missed, detect);
+    dbg_print_dev(log_dev(dev), 0, "\n");
+    event(dev, now, "down", ",\"missed\":%d,\"detect_ms\":%.1f", dev->missed, detect);
+}
+
+static void go_up(struct watch_dev_t* dev, double now)
+{
+    struct watch_t* w = dev->w;
+    uint8_t first = (dev->state == WATCH_RESTORE && dev->t_down == 0);
+    double restore = now - dev->t_back;
+
+    dev->state = WATCH_UP;
+    dev->missed = 0;
+    dev->t_ok = now;
+    dev->next_beat = now + w->opts->interval;
+
+    dbg_print_dev(log_dev(dev), 0, "%s ", dev->cfg->re_addr);
+    if(dev->failed)
+        LOG_DEV(log_dev(dev), TERM_YELLOW, "up");
+    else
+        LOG_DEV(log_dev(dev), TERM_GREEN, "up");
+    if(!first)
+    {
+        hist_add(&w->restore, restore*1e3);
+        hist_add(&w->outage, (now - dev->t_down)*1e3);
+        LOG_DEV(log_dev(dev), 0, " after %.0f ms,", now - dev->t_down);
+    }
+    LOG_DEV(log_dev(dev), 0, " %d setting(s) applied in %.0f ms", dev->n - dev->failed, restore);
+    if(dev->failed)
+        LOG_DEV(log_dev(dev), TERM_YELLOW, ", %d refused", dev->failed);
+    dbg_print_dev(log_dev(dev), 0, "\n");
+
+    for(uint8_t i=0; i<dev->n; i++)
+    {
+        struct pending_t* p = &dev->batch[i];
+        if(p->done && p->err != ERR_OK)
+            dbg_print_dev(log_dev(dev), TERM_YELLOW, "  %s - ERR %d (%s)\n", p->desc, p->err, p->err > 0 ? cari_err_name(p->err) : "malformed");
+    }
+
+    if(first)
+        event(dev, now, "up", ",\"settings\":%d,\"failed\":%d,\"restore_ms\":%.1f", dev->n, dev->failed, restore);
+    else
+        event(dev, now, "up", ",\"settings\":%d,\"failed\":%d,\"restore_ms\":%.1f,\"outage_ms\":%.1f",
+            dev->n, dev->failed, restore, now - dev->t_down);
+
+    //what the device has now, for converging later
+    if(w->fleet->cache != NULL && dev->n > 0)
+    {
+        struct re_config_t have;
+        config_init(&have);
+        for(uint8_t i=0; i<dev->n; i++)
+            config_note_request(&have, &dev->batch[i]);
+        devcache_set_state(w->fleet->cache, dev->cfg->re_addr, &have);
+    }
+}
+
+//the device answers again, send it the whole configuration at once
+static void restore(struct watch_dev_t* dev, double now)
+{
+    struct watch_t* w = dev->w;
+
+    dev->state = WATCH_RESTORE;
+    dev->t_back = now;
+    dev->replies = dev->failed = dev->lost = 0;
+    dev->n = config_to_batch(dev->cfg, dev->batch);
+    if(dev->n == 0)
+    {
+        go_up(dev, now);
+        return;
+    }
+
+    //the beat that just came back has measured the round trip
+    cari_dev_set_timeout(dev->cd, beat_timeout(dev), w->retries);
+    for(uint8_t i=0; i<dev->n; i++)
+    {
+        dev->ids[i] = cari_submit(dev->cd, dev->batch[i].req, dev->batch[i].len, on_restore, dev);
+        if(dev->ids[i] == 0) //never sent, as good as unanswered
+        {
+            dev->lost++;
+            dev->replies++;
+        }
+    }
+
+    //nothing went out, no callback is coming to finish it
+    if(dev->replies == dev->n)
+        restore_done(dev, now);
+}
+
+static void on_beat(const struct cari_result_t* r)
+{
+    struct watch_dev_t* dev = r->arg;
+    struct watch_t* w = dev->w;
+    const struct watch_opts_t* o = w->opts;
+    double now = now_ms();
+
+    if(r->err == CARI_CANCELLED)
+        return;
+    dev->beat_out = 0;
+
+    if(r->err == CARI_NO_REPLY)
+    {
+        double fast = (double)o->interval / WATCH_FAST;
+
+        if(dev->missed < 255)
+            dev->missed++;
+        dev->missed_total++;
+
+        if(dev->state == WATCH_UP && dev->missed >= o->missed)
+            go_down(dev, now);
+
+        //suspect devices are probed fast, down ones back off to the interval
+        if(dev->state == WATCH_UP)
+            dev->next_beat = dev->t_beat + fast;
+        else
+        {
+            int k = dev->missed - o->missed;
+            double t = fast * (1 << (k < 0 ? 0 : k > 6 ? 6 : k));
+            dev->next_beat = dev->t_beat + (t < o->interval ? t : o->interval);
+        }
+        return;
+    }
+
+    //any reply, even a malformed one, means the device is alive
+    if(dev->srtt < 0)
+    {
+        dev->srtt = r->rtt;
+        dev->rttvar = r->rtt/2;
+    }
+    else
+    {
+        double d = dev->srtt - r->rtt;
+        dev->rttvar = 0.75*dev->rttvar + 0.25*(d < 0 ? -d : d);
+        dev->srtt = 0.875*dev->srtt + 0.125*r->rtt;
+    }
+    hist_add(&w->rtt, r->rtt*1e3);
+
+    if(dev->state != WATCH_UP)
+    {
+        restore(dev, now);
+        return;
+    }
+
+    dev->missed = 0;
+    dev->t_ok = now;
+    dev->next_beat = dev->t_beat + o->interval;
+}
+
+static void on_restore(const struct cari_result_t* r)
+{
+    struct watch_dev_t* dev = r->arg;
+    double now = now_ms();
+
+    if(r->err == CARI_CANCELLED)
+        return;
+
+    uint8_t i = 0;
+    while(i < dev->n && dev->ids[i] != r->id)
+        i++;
+    if(i == dev->n) //from an earlier restore
+        return;
+
+    struct pending_t* p = &dev->batch[i];
+    p->attempts = r->attempts;
+    if(r->err == CARI_NO_REPLY)
+        dev->lost++;
+    else
+    {
+        p->done = 1;
+        p->rtt = r->rtt;
+        p->err = (r->err >= 0) ? r->err : -1;
+        dev->failed += (p->err != ERR_OK);
+    }
+
+    if(++dev->replies < dev->n)
+        return;
+
+    restore_done(dev, now);
+}
+
+//every setting of the restore is answered or written off
+static void restore_done(struct watch_dev_t* dev, double now)
+{
+    if(dev->lost == 0)
+    {
+        go_up(dev, now);
+        return;
+    }
+
+    //gone again before the configuration got through, probe it as before
+    dbg_print_dev(log_dev(dev), 0, "%s ", dev->cfg->re_addr);
+    LOG_DEV(log_dev(dev), TERM_YELLOW, "restore failed");
+    LOG_DEV(log_dev(dev), 0, ", %d of %d setting(s) unanswered", dev->lost, dev->n);
+    dbg_print_dev(log_dev(dev), 0, "\n");
+    dev->state = (dev->t_down > 0) ? WATCH_DOWN : WATCH_UNKNOWN;
+    dev->missed = dev->w->opts->missed;
+    dev->next_beat = now;
+}
+
+static void print_hist(const char* name, const struct hist_t* h)
+{
+    if(h->n == 0)
+        return;
+
+    dbg_print(0, "%-18s min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f  mean %.1f ms\n", name,
+        h->min/1e3, hist_quantile(h, 0.5)/1e3, hist_quantile(h, 0.9)/1e3, hist_quantile(h, 0.99)/1e3,
+        h->max/1e3, hist_mean(h)/1e3);
+}
+
+//returns the number of devices not up at the end
+int watch_run(struct fleet_t* fleet, void* zmq_ctx, const struct watch_opts_t* opts)
+{
+    struct watch_t w = {.opts = opts, .fleet = fleet};
+    int down = 0;
+
+    link_get_timeout(&w.timeout, &w.retries);
+    w.ping_len = cari_encode(w.ping, sizeof(w.ping), CMD_PING, NULL, 0);
+    hist_init(&w.detect);
+    hist_init(&w.restore);
+    hist_init(&w.outage);
+    hist_init(&w.rtt);
+
+    struct cari_t* c = cari_new(zmq_ctx);
+    w.devs = calloc(fleet->n, sizeof(struct watch_dev_t));
+    if(c == NULL || w.devs == NULL)
+    {
+        cari_free(c);
+        free(w.devs);
+        return fleet->n;
+    }
+    if(link_get_via() != NULL && cari_set_via(c, link_get_via()) != 0)
+    {
+        dbg_print(TERM_RED, "Can not connect to %s\n", link_get_via());
+        cari_free(c);
+        free(w.devs);
+        return fleet->n;
+    }
+    cari_set_window(c, MAX_BATCH);
+
+    //stdout carries the events only, everything else goes to stderr
+    w.out = ctrl_take_stdout();
+    if(w.out == NULL)
+    {
+        cari_free(c);
+        free(w.devs);
+        return fleet->n;
+    }
+
+    w.t0 = now_ms();
+    for(int i=0; i<fleet->n; i++)
+    {
+        struct watch_dev_t* dev = &w.devs[i];
+
+        dev->cfg = &fleet->dev[i].cfg;
+        dev->w = &w;
+        dev->srtt = -1;
+        //spread the beats over the interval
+        dev->next_beat = w.t0 + (double)opts->interval*i/fleet->n;
+        dev->cd = cari_dev_open(c, dev->cfg->re_addr);
+        if(dev->cd == NULL)
+        {
+            dbg_print(TERM_RED, "%s connection failed: %s\n", dev->cfg->re_addr, zmq_strerror(zmq_errno()));
+            dev->next_beat = -1;
+        }
+    }
+
+    dbg_print(0, "Watching %d device(s), a beat every %d ms, down after %d missed\n", fleet->n, opts->interval, opts->missed);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    while(running)
+    {
+        cari_process(c);
+
+        double now = now_ms();
+        if(opts->duration > 0 && now - w.t0 >= opts->duration*1e3)
+            break;
+
+        double next = now + opts->interval;
+        for(int i=0; i<fleet->n; i++)
+        {
+            struct watch_dev_t* dev = &w.devs[i];
+
+            if(dev->next_beat < 0 || dev->beat_out || dev->state == WATCH_RESTORE)
+                continue;
+            if(dev->next_beat <= now)
+                send_beat(dev, now);
+            else if(dev->next_beat < next)
+                next = dev->next_beat;
+        }
+
+        long wait = (long)(next - now) + 1;
+        long t = cari_timeout(c);
+        if(t >= 0 && t < wait)
+            wait = t;
+
+        struct pollfd pfd = {cari_fd(c), POLLIN, 0};
+        if(poll(&pfd, 1, wait) < 0 && errno != EINTR)
+        {
+            dbg_print(TERM_RED, "Poll error: %s\n", strerror(errno));
+            break;
+        }
+    }
+
+    uint64_t beats = 0, missed = 0, outages = 0;
+    for(int i=0; i<fleet->n; i++)
+    {
+        struct watch_dev_t* dev = &w.devs[i];
+
+        beats += dev->beats;
+        missed += dev->missed_total;
+        outages += dev->outages;
+        if(dev->state != WATCH_UP)
+        {
+            dbg_print_dev(log_dev(dev), 0, "%s ", dev->cfg->re_addr);
+            dbg_print_dev(log_dev(dev), TERM_YELLOW, "%s\n", dev->state == WATCH_UNKNOWN ? "never answered" : "down");
+            down++;
+        }
+    }
+
+    dbg_print(0, "Watch: %d device(s), %d not up, %lu outage(s), %lu beat(s), %lu missed, %.1f s\n",
+        fleet->n, down, outages, beats, missed, (now_ms() - w.t0)/1e3);
+    print_hist("Beat RTT", &w.rtt);
+    print_hist("Detection", &w.detect);
+    print_hist("Restore", &w.restore);
+    print_hist("Outage", &w.outage);
+
+    fclose(w.out);
+    cari_free(c);
+    free(w.devs);
+
+    return down;
+}
@@ -0,0 +1,46 @@
+/*
+ * watch.h
+ *
+ *  Heartbeat watchdog restoring the configuration of rebooted devices
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "ctrl.h"
+#include "cari.h"
+#include "fleet.h"
+
+#define WATCH_MISSED    3       //default missed beats before a device is down
+#define WATCH_MIN_RTO   20      //ms, lowest heartbeat reply deadline
+#define WATCH_FAST      8       //beats per interval while a device is suspect
+
+struct watch_opts_t
+{
+    int interval;               //ms between beats of a healthy device
+    int missed;                 //consecutive missed beats that make a device down
+    double duration;            //s, 0 - until interrupted
+};
+
+struct watch_dev_t
+{
+    const struct re_config_t* cfg;
+    struct watch_t* w;
+    struct cari_dev_t* cd;
+    uint8_t state;              //watch_state_t
+    uint8_t missed;             //consecutive beats without a reply
+    uint8_t beat_out;           //a beat is in flight
+    double next_beat;           //ms
+    double t_beat;              //last beat sent
+    double srtt, rttvar;        //ms, smoothed beat round trip, srtt < 0 - no sample yet
+    double t_ok;                //last reply
+    double t_down;              //declared down
+    double t_back;              //first reply after the outage
+    struct pending_t batch[MAX_BATCH];
+    uint64_t ids[MAX_BATCH];    //request ID of each batch entry, 0 - not submitted
+    uint8_t n, replies, failed, lost;
+    uint64_t beats, missed_total, outages;
+};
+
+int watch_run(struct fleet_t* fleet, void* zmq_ctx, const struct watch_opts_t* opts);